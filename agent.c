@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "ber.h"
+#include "snmp.h"
+#include "agent.h"
+
+/** How often workers check if they should stop, in microseconds */
+#define SNMP_AGENT_POLL_US 100000
+/** Space left after every received datagram, see snmp_decode_msg */
+#define SNMP_AGENT_MSG_SLACK 8
+
+struct snmp_agent_worker {
+    struct snmp_agent *agent;
+    pthread_t thread;
+    int fd;
+    uint64_t requests;
+    uint32_t src[SNMP_AGENT_BATCH]; /**< datagram index of each decoded msg */
+    struct mmsghdr rx_hdrs[SNMP_AGENT_BATCH];
+    struct mmsghdr tx_hdrs[SNMP_AGENT_BATCH];
+    struct iovec rx_iovs[SNMP_AGENT_BATCH];
+    struct iovec tx_iovs[SNMP_AGENT_BATCH];
+    struct sockaddr_in addrs[SNMP_AGENT_BATCH];
+    struct snmp_msg_batch msgs[SNMP_AGENT_BATCH];
+    /* one more than allowed, so that too big requests can be detected */
+    struct snmp_varbind varbinds[SNMP_AGENT_BATCH][SNMP_AGENT_MAX_VARBINDS + 1];
+    struct snmp_varbind resp_varbinds[SNMP_AGENT_MAX_BULK_VARBINDS];
+    uint8_t rx_bufs[SNMP_AGENT_BATCH][SNMP_AGENT_MSG_SIZE];
+    uint8_t tx_bufs[SNMP_AGENT_BATCH][SNMP_AGENT_MSG_SIZE];
+};
+
+struct snmp_agent {
+    struct snmp_agent_config config;
+    uint32_t community_len;
+    uint16_t port;
+    int stop;
+    uint32_t worker_num;
+    struct snmp_agent_worker *workers;
+};
+
+static int
+snmp_oid_cmp(const uint32_t *a, uint32_t a_len, const uint32_t *b, uint32_t b_len)
+{
+    uint32_t i, len = a_len < b_len ? a_len : b_len;
+
+    for (i = 0; i < len; ++i) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+/**
+ * Find MIB entry with given OID, or with the first OID following it
+ * if *next* is set.
+ */
+static const struct snmp_mib_entry *
+snmp_agent_find(const struct snmp_agent_config *config, const uint32_t *oid, uint32_t oid_len, int next)
+{
+    const struct snmp_mib_entry *entry;
+    uint32_t lo = 0, hi = config->mib_len, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        entry = &config->mib[mid];
+        cmp = snmp_oid_cmp(entry->oid, entry->oid_len, oid, oid_len);
+        if (cmp < 0 || (next && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == config->mib_len) {
+        return NULL;
+    }
+
+    entry = &config->mib[lo];
+    if (!next && snmp_oid_cmp(entry->oid, entry->oid_len, oid, oid_len) != 0) {
+        return NULL;
+    }
+
+    return entry;
+}
+
+/** Fill *resp* with the next MIB entry after *oid*, or endOfMibView */
+static void
+snmp_agent_next(const struct snmp_agent_config *config, const uint32_t *oid,
+                struct snmp_varbind *resp)
+{
+    const struct snmp_mib_entry *entry;
+    uint32_t oid_len = 0;
+
+    while (oid[oid_len] != SNMP_MSG_OID_END) {
+        ++oid_len;
+    }
+
+    memcpy(resp->oid, oid, (oid_len + 1) * sizeof(uint32_t));
+    resp->value_type = SNMP_DATA_T_END_OF_MIB_VIEW;
+
+    entry = snmp_agent_find(config, oid, oid_len, 1);
+    if (entry == NULL) {
+        return;
+    }
+
+    memcpy(resp->oid, entry->oid, entry->oid_len * sizeof(uint32_t));
+    resp->oid[entry->oid_len] = SNMP_MSG_OID_END;
+    if (entry->get(entry, resp) != 0) {
+        resp->value_type = SNMP_DATA_T_NO_SUCH_INSTANCE;
+    }
+}
+
+/**
+ * Walk the MIB for GetBulk request as described in RFC 3416 4.2.3.
+ * Non-repeaters get a single successor, the rest of varbinds get up to
+ * max-repetitions rows, each following the previous row. The walk stops
+ * early when all repeaters have reached the end of MIB or *resp* is full.
+ * @return number of varbinds put into *resp*
+ */
+static uint32_t
+snmp_agent_bulk(const struct snmp_agent_config *config, const struct snmp_msg_header *header,
+                const struct snmp_varbind *req, uint32_t req_num, struct snmp_varbind *resp)
+{
+    uint32_t non_repeaters, repeaters, rep, i, resp_num = 0;
+    const uint32_t *prev;
+    int all_ended;
+
+    non_repeaters = header->non_repeaters < req_num ? header->non_repeaters : req_num;
+    repeaters = req_num - non_repeaters;
+
+    for (i = 0; i < non_repeaters; ++i) {
+        snmp_agent_next(config, req[i].oid, &resp[resp_num++]);
+    }
+
+    for (rep = 0; rep < header->max_repetitions && repeaters > 0; ++rep) {
+        if (resp_num + repeaters > SNMP_AGENT_MAX_BULK_VARBINDS) {
+            break;
+        }
+
+        all_ended = 1;
+        for (i = 0; i < repeaters; ++i) {
+            if (rep == 0) {
+                prev = req[non_repeaters + i].oid;
+            } else {
+                prev = resp[resp_num - repeaters].oid;
+            }
+
+            snmp_agent_next(config, prev, &resp[resp_num]);
+            if (resp[resp_num].value_type != SNMP_DATA_T_END_OF_MIB_VIEW) {
+                all_ended = 0;
+            }
+            ++resp_num;
+        }
+
+        if (all_ended) {
+            break;
+        }
+    }
+
+    return resp_num;
+}
+
+/**
+ * Process a single decoded request and encode the response.
+ * @return pointer to the first byte of the response or NULL if
+ * the request should be dropped.
+ */
+static uint8_t *
+snmp_agent_respond(struct snmp_agent *agent, struct snmp_msg_batch *msg,
+                   struct snmp_varbind *resp, uint8_t *out_end)
+{
+    const struct snmp_agent_config *config = &agent->config;
+    const struct snmp_mib_entry *entry;
+    struct snmp_msg_header header = msg->header;
+    struct snmp_varbind *req, *varbinds = resp;
+    uint32_t i, oid_len, varbind_num = msg->varbind_num;
+
+    if (msg->status != 0 || msg->header.community_len != agent->community_len ||
+        memcmp(msg->header.community, config->community, agent->community_len) != 0) {
+        return NULL;
+    }
+
+    if (msg->header.pdu_type != SNMP_DATA_T_PDU_GET_REQUEST &&
+        msg->header.pdu_type != SNMP_DATA_T_PDU_GET_NEXT_REQUEST &&
+        msg->header.pdu_type != SNMP_DATA_T_PDU_SET_REQUEST &&
+        msg->header.pdu_type != SNMP_DATA_T_PDU_GET_BULK_REQUEST) {
+        return NULL;
+    }
+
+    /* GetBulk doesn't exist in SNMPv1 (snmp_ver 0), only in v2c (snmp_ver 1) */
+    if (msg->header.pdu_type == SNMP_DATA_T_PDU_GET_BULK_REQUEST && msg->header.snmp_ver != 1) {
+        return NULL;
+    }
+
+    /* all varbinds are decoded already, so the strings can be
+     * NUL-terminated in place, just like snmp_decode_msg does */
+    for (i = 0; i < varbind_num; ++i) {
+        req = &msg->varbinds[i];
+        if (req->value_type == SNMP_DATA_T_OCTET_STRING) {
+            ((char *)(uintptr_t)req->value.s)[req->value_len] = 0;
+        }
+    }
+
+    header.community = config->community;
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.error_status = SNMP_AGENT_ERR_NO_ERROR;
+    header.error_index = 0;
+
+    if (varbind_num > SNMP_AGENT_MAX_VARBINDS) {
+        header.error_status = SNMP_AGENT_ERR_TOO_BIG;
+        varbind_num = 0;
+    } else if (msg->header.pdu_type == SNMP_DATA_T_PDU_GET_BULK_REQUEST) {
+        header.non_repeaters = 0;
+        header.max_repetitions = 0;
+        varbind_num = snmp_agent_bulk(config, &msg->header, msg->varbinds, varbind_num, resp);
+        return snmp_encode_msg_fit(out_end, SNMP_AGENT_MSG_SIZE, &header, varbind_num, resp,
+                                   &varbind_num);
+    }
+
+    for (i = 0; i < varbind_num && header.error_status == SNMP_AGENT_ERR_NO_ERROR; ++i) {
+        req = &msg->varbinds[i];
+        oid_len = 0;
+        while (req->oid[oid_len] != SNMP_MSG_OID_END) {
+            ++oid_len;
+        }
+
+        resp[i] = *req;
+        entry = snmp_agent_find(config, req->oid, oid_len,
+                                msg->header.pdu_type == SNMP_DATA_T_PDU_GET_NEXT_REQUEST);
+        if (entry == NULL) {
+            header.error_status = SNMP_AGENT_ERR_NO_SUCH_NAME;
+        } else if (msg->header.pdu_type == SNMP_DATA_T_PDU_SET_REQUEST) {
+            if (entry->set == NULL) {
+                header.error_status = SNMP_AGENT_ERR_READ_ONLY;
+            } else if (entry->set(entry, req) != 0) {
+                header.error_status = SNMP_AGENT_ERR_BAD_VALUE;
+            }
+        } else {
+            memcpy(resp[i].oid, entry->oid, entry->oid_len * sizeof(uint32_t));
+            resp[i].oid[entry->oid_len] = SNMP_MSG_OID_END;
+            if (entry->get(entry, &resp[i]) != 0) {
+                header.error_status = SNMP_AGENT_ERR_NO_SUCH_NAME;
+            }
+        }
+
+        if (header.error_status != SNMP_AGENT_ERR_NO_ERROR) {
+            header.error_index = i + 1;
+        }
+    }
+
+    /* failed requests are sent back unchanged */
+    if (header.error_status != SNMP_AGENT_ERR_NO_ERROR) {
+        varbinds = msg->varbinds;
+    }
+
+    if (snmp_sizeof_msg(&header, varbind_num, varbinds) > SNMP_AGENT_MSG_SIZE) {
+        header.error_status = SNMP_AGENT_ERR_TOO_BIG;
+        header.error_index = 0;
+        varbind_num = 0;
+    }
+
+    return snmp_encode_msg(out_end, &header, varbind_num, varbinds);
+}
+
+static void
+snmp_agent_process(struct snmp_agent_worker *w, uint32_t rx_num)
+{
+    struct snmp_msg_batch *msg;
+    struct msghdr *hdr;
+    uint8_t *out, *out_end;
+    uint32_t i, msg_num = 0, tx_num = 0;
+    int sent;
+
+    for (i = 0; i < rx_num; ++i) {
+        if (w->rx_hdrs[i].msg_len < 2) {
+            continue;
+        }
+
+        msg = &w->msgs[msg_num];
+        msg->buf = w->rx_bufs[i];
+        /* the decoder needs 5 bytes of slack, which are always available */
+        msg->buf_len = w->rx_hdrs[i].msg_len + 5;
+        msg->varbind_num = SNMP_AGENT_MAX_VARBINDS + 1;
+        msg->varbinds = w->varbinds[msg_num];
+        w->src[msg_num++] = i;
+    }
+
+    snmp_decode_msg_batch(w->msgs, msg_num);
+
+    for (i = 0; i < msg_num; ++i) {
+        out_end = w->tx_bufs[tx_num] + SNMP_AGENT_MSG_SIZE - 1;
+        out = snmp_agent_respond(w->agent, &w->msgs[i], w->resp_varbinds, out_end);
+        if (out == NULL) {
+            continue;
+        }
+
+        w->tx_iovs[tx_num].iov_base = out;
+        w->tx_iovs[tx_num].iov_len = (size_t)(out_end - out + 1);
+        hdr = &w->tx_hdrs[tx_num].msg_hdr;
+        hdr->msg_name = &w->addrs[w->src[i]];
+        hdr->msg_namelen = w->rx_hdrs[w->src[i]].msg_hdr.msg_namelen;
+        ++tx_num;
+    }
+
+    if (tx_num > 0) {
+        sent = sendmmsg(w->fd, w->tx_hdrs, tx_num, 0);
+        if (sent > 0) {
+            __atomic_fetch_add(&w->requests, (uint64_t)sent, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void *
+snmp_agent_worker_run(void *arg)
+{
+    struct snmp_agent_worker *w = arg;
+    uint32_t i;
+    int rx_num;
+
+    while (!__atomic_load_n(&w->agent->stop, __ATOMIC_RELAXED)) {
+        for (i = 0; i < SNMP_AGENT_BATCH; ++i) {
+            w->rx_hdrs[i].msg_hdr.msg_namelen = sizeof(w->addrs[i]);
+        }
+
+        /* wait for the first datagram, then take whatever is queued */
+        rx_num = recvmmsg(w->fd, w->rx_hdrs, SNMP_AGENT_BATCH, MSG_WAITFORONE, NULL);
+        if (rx_num > 0) {
+            snmp_agent_process(w, (uint32_t)rx_num);
+        }
+    }
+
+    return NULL;
+}
+
+static int
+snmp_agent_socket(struct snmp_agent *agent)
+{
+    struct sockaddr_in addr = { 0 };
+    struct timeval timeout = { 0, SNMP_AGENT_POLL_US };
+    socklen_t addr_len = sizeof(addr);
+    int fd, one = 1, rcvbuf = 4 * 1024 * 1024;
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(agent->port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (agent->config.addr != NULL && inet_pton(AF_INET, agent->config.addr, &addr.sin_addr) != 1) {
+        return -1;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* best effort, pollers may send thousands of requests at once */
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    /* the rest of workers will bind to the same port */
+    agent->port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void
+snmp_agent_worker_init(struct snmp_agent *agent, struct snmp_agent_worker *w)
+{
+    uint32_t i;
+
+    w->agent = agent;
+    for (i = 0; i < SNMP_AGENT_BATCH; ++i) {
+        w->rx_iovs[i].iov_base = w->rx_bufs[i];
+        w->rx_iovs[i].iov_len = SNMP_AGENT_MSG_SIZE - SNMP_AGENT_MSG_SLACK;
+        w->rx_hdrs[i].msg_hdr.msg_iov = &w->rx_iovs[i];
+        w->rx_hdrs[i].msg_hdr.msg_iovlen = 1;
+        w->rx_hdrs[i].msg_hdr.msg_name = &w->addrs[i];
+        w->tx_hdrs[i].msg_hdr.msg_iov = &w->tx_iovs[i];
+        w->tx_hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+/** Stop first *thread_num* workers and release everything */
+static void
+snmp_agent_free(struct snmp_agent *agent, uint32_t thread_num)
+{
+    uint32_t i;
+
+    __atomic_store_n(&agent->stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < thread_num; ++i) {
+        pthread_join(agent->workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < agent->worker_num; ++i) {
+        if (agent->workers[i].fd >= 0) {
+            close(agent->workers[i].fd);
+        }
+    }
+
+    free(agent->workers);
+    free(agent);
+}
+
+struct snmp_agent *
+snmp_agent_start(const struct snmp_agent_config *config)
+{
+    struct snmp_agent *agent;
+    struct snmp_agent_worker *w;
+    cpu_set_t cpus;
+    long cpu_num;
+    uint32_t i;
+
+    agent = calloc(1, sizeof(*agent));
+    if (agent == NULL) {
+        return NULL;
+    }
+
+    cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_num < 1) {
+        cpu_num = 1;
+    }
+
+    agent->config = *config;
+    agent->community_len = (uint32_t)strlen(config->community);
+    agent->port = config->port;
+    agent->worker_num = config->worker_num ? config->worker_num : (uint32_t)cpu_num;
+    agent->workers = calloc(agent->worker_num, sizeof(*agent->workers));
+    if (agent->workers == NULL) {
+        free(agent);
+        return NULL;
+    }
+
+    for (i = 0; i < agent->worker_num; ++i) {
+        agent->workers[i].fd = -1;
+    }
+
+    for (i = 0; i < agent->worker_num; ++i) {
+        w = &agent->workers[i];
+        snmp_agent_worker_init(agent, w);
+        w->fd = snmp_agent_socket(agent);
+        if (w->fd < 0) {
+            snmp_agent_free(agent, 0);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < agent->worker_num; ++i) {
+        w = &agent->workers[i];
+        if (pthread_create(&w->thread, NULL, snmp_agent_worker_run, w) != 0) {
+            snmp_agent_free(agent, i);
+            return NULL;
+        }
+
+        /* best effort, the agent works without pinning as well */
+        CPU_ZERO(&cpus);
+        CPU_SET(i % (uint32_t)cpu_num, &cpus);
+        (void)pthread_setaffinity_np(w->thread, sizeof(cpus), &cpus);
+    }
+
+    return agent;
+}
+
+void
+snmp_agent_stop(struct snmp_agent *agent)
+{
+    snmp_agent_free(agent, agent->worker_num);
+}
+
+uint16_t
+snmp_agent_port(const struct snmp_agent *agent)
+{
+    return agent->port;
+}
+
+uint64_t
+snmp_agent_requests(const struct snmp_agent *agent)
+{
+    uint64_t requests = 0;
+    uint32_t i;
+
+    for (i = 0; i < agent->worker_num; ++i) {
+        requests += __atomic_load_n(&agent->workers[i].requests, __ATOMIC_RELAXED);
+    }
+
+    return requests;
+}
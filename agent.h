@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#ifndef BER_SNMP_AGENT_H
+#define BER_SNMP_AGENT_H
+
+#include <stdint.h>
+#include "snmp.h"
+
+/** Max number of varbinds in a single request */
+#define SNMP_AGENT_MAX_VARBINDS 16
+/** Max number of varbinds in a single GetBulk response */
+#define SNMP_AGENT_MAX_BULK_VARBINDS 64
+/** Max number of datagrams received or sent with a single syscall */
+#define SNMP_AGENT_BATCH 32
+/** Size of a single datagram buffer */
+#define SNMP_AGENT_MSG_SIZE 2048
+
+/** SNMPv1 error-status values used by the agent */
+enum snmp_agent_error {
+    SNMP_AGENT_ERR_NO_ERROR = 0,
+    SNMP_AGENT_ERR_TOO_BIG = 1,
+    SNMP_AGENT_ERR_NO_SUCH_NAME = 2,
+    SNMP_AGENT_ERR_BAD_VALUE = 3,
+    SNMP_AGENT_ERR_READ_ONLY = 4,
+};
+
+struct snmp_mib_entry;
+
+/**
+ * Fill the value of given MIB entry.
+ * May be called concurrently from all agent workers.
+ * @param entry MIB entry being read
+ * @param varbind varbind to put *value_type* and *value* into. OCTET_STRING
+ * value has to be NUL-terminated and stay valid until the response is sent.
+ * @return 0 on success or non-zero to fail the request with
+ * SNMP_AGENT_ERR_NO_SUCH_NAME
+ */
+typedef int (*snmp_mib_get_cb)(const struct snmp_mib_entry *entry, struct snmp_varbind *varbind);
+
+/**
+ * Change the value of given MIB entry.
+ * May be called concurrently from all agent workers.
+ * @param entry MIB entry being written
+ * @param varbind varbind with the new value. OCTET_STRING value is
+ * NUL-terminated, but valid only during this call.
+ * @return 0 on success or non-zero to fail the request with
+ * SNMP_AGENT_ERR_BAD_VALUE
+ */
+typedef int (*snmp_mib_set_cb)(const struct snmp_mib_entry *entry, const struct snmp_varbind *varbind);
+
+/** Single scalar object served by the agent */
+struct snmp_mib_entry {
+    const uint32_t *oid;
+    uint32_t oid_len; /**< number of arcs, less than SNMP_MSG_OID_LEN */
+    snmp_mib_get_cb get;
+    snmp_mib_set_cb set; /**< NULL for read-only objects */
+    void *ctx;
+};
+
+/** Agent settings, see snmp_agent_start */
+struct snmp_agent_config {
+    const char *addr; /**< IPv4 address to bind to, NULL for any */
+    uint16_t port; /**< UDP port, 0 to pick any free one */
+    uint32_t worker_num; /**< 0 for one worker per online core */
+    const char *community;
+    /** entries sorted by OID in lexicographic order */
+    const struct snmp_mib_entry *mib;
+    uint32_t mib_len;
+};
+
+struct snmp_agent;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Start a multi-threaded UDP SNMP agent.
+ * Every worker thread owns a separate SO_REUSEPORT socket bound to the same
+ * port, so the kernel spreads requests across the workers. Datagrams are
+ * received and sent in batches of SNMP_AGENT_BATCH with recvmmsg() and
+ * sendmmsg(), and decoded with snmp_decode_msg_batch. All buffers are
+ * allocated upfront, nothing is allocated while serving requests.
+ * GET, GETNEXT and SET requests are answered with SNMPv1 error semantics.
+ * GETBULK requests are answered with as many rows as fit in a single
+ * datagram, with endOfMibView past the last MIB entry. Requests with
+ * a different community are dropped.
+ * @param config agent settings. *config->mib* has to stay valid until
+ * the agent is stopped.
+ * @return agent handle or NULL if sockets or threads couldn't be created.
+ */
+struct snmp_agent *snmp_agent_start(const struct snmp_agent_config *config);
+
+/**
+ * Stop all workers and release the agent.
+ * @param agent agent started with snmp_agent_start
+ */
+void snmp_agent_stop(struct snmp_agent *agent);
+
+/**
+ * Get the UDP port the agent is bound to.
+ * @param agent agent started with snmp_agent_start
+ * @return port in host byte order
+ */
+uint16_t snmp_agent_port(const struct snmp_agent *agent);
+
+/**
+ * Get the number of requests answered so far by all workers.
+ * @param agent agent started with snmp_agent_start
+ * @return number of sent responses
+ */
+uint64_t snmp_agent_requests(const struct snmp_agent *agent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //BER_SNMP_AGENT_H
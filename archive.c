@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+#define BER_ARCHIVE_MAGIC_LEN 8
+
+/** Index file entry */
+struct ber_archive_entry {
+    uint64_t time;
+    uint64_t offset;
+    uint64_t len;
+};
+
+/** File mapping, followed by zeroed slack and room to grow in place */
+struct ber_archive_map {
+    uint8_t *addr;
+    size_t len; /**< size of the whole reserved range */
+    uint64_t file_len; /**< number of bytes mapped from the file */
+};
+
+struct ber_archive {
+    int data_fd;
+    int idx_fd;
+    int flags;
+    struct ber_archive_map data;
+    struct ber_archive_map idx; /**< index file mapping, including the magic */
+    struct ber_archive_map *old_data; /**< outgrown data mappings, kept until close */
+    uint32_t old_data_num;
+    const struct ber_archive_entry *entries;
+    uint64_t data_size; /**< size of the data file visible through the mapping */
+    uint64_t mapped_num; /**< number of entries visible through the mapping */
+    uint64_t num; /**< number of entries, including the ones appended since mapping */
+    uint64_t data_len; /**< end of the last record */
+    uint64_t last_time;
+};
+
+/**
+ * Map the first *len* bytes of the file followed by at least
+ * BER_ARCHIVE_SLACK zeroed bytes. The slack is an anonymous mapping,
+ * so it can be safely read even if the file ends on a page boundary.
+ * If the file still fits in the range reserved by *m*, it's mapped again
+ * at the same address, so pointers into the old mapping stay valid.
+ * Otherwise a new range twice as big as needed is reserved and put into
+ * *new_m*, leaving *m* intact.
+ * @return 0 on success or -1 if the file couldn't be mapped
+ */
+static int
+ber_archive_map(int fd, uint64_t len, const struct ber_archive_map *m,
+                struct ber_archive_map *new_m)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size, file_end, old_file_end;
+    void *map;
+
+    if (m->addr != NULL && len + BER_ARCHIVE_SLACK <= m->len) {
+        *new_m = *m;
+        if (len > 0 &&
+            mmap(m->addr, len, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            return -1;
+        }
+
+        /* the file got truncated, don't leave the pages past its end mapped */
+        file_end = (len + page - 1) / page * page;
+        old_file_end = (m->file_len + page - 1) / page * page;
+        if (old_file_end > file_end &&
+            mmap(m->addr + file_end, old_file_end - file_end, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+            return -1;
+        }
+
+        new_m->file_len = len;
+        return 0;
+    }
+
+    size = (len * 2 + BER_ARCHIVE_SLACK + page - 1) / page * page;
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    if (len > 0 && mmap(map, len, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(map, size);
+        return -1;
+    }
+
+    new_m->addr = map;
+    new_m->len = size;
+    new_m->file_len = len;
+    return 0;
+}
+
+static void
+ber_archive_unmap(struct ber_archive *ar)
+{
+    uint32_t i;
+
+    if (ar->data.addr != NULL) {
+        munmap(ar->data.addr, ar->data.len);
+    }
+
+    if (ar->idx.addr != NULL) {
+        munmap(ar->idx.addr, ar->idx.len);
+    }
+
+    for (i = 0; i < ar->old_data_num; ++i) {
+        munmap(ar->old_data[i].addr, ar->old_data[i].len);
+    }
+
+    free(ar->old_data);
+}
+
+/** Check if the entry describes a record inside the mapped data file */
+static int
+ber_archive_entry_valid(const struct ber_archive_entry *entry, uint64_t data_size)
+{
+    return entry->len > 0 && entry->len <= UINT32_MAX && entry->offset <= data_size &&
+           entry->len <= data_size - entry->offset;
+}
+
+int
+ber_archive_refresh(struct ber_archive *ar)
+{
+    const struct ber_archive_entry *entries;
+    struct ber_archive_map data, idx, *old_data;
+    struct stat data_st, idx_st;
+    uint64_t num;
+
+    if (fstat(ar->data_fd, &data_st) != 0 || fstat(ar->idx_fd, &idx_st) != 0 ||
+        idx_st.st_size < BER_ARCHIVE_MAGIC_LEN) {
+        return -1;
+    }
+
+    if (ber_archive_map(ar->data_fd, (uint64_t)data_st.st_size, &ar->data, &data) != 0) {
+        return -1;
+    }
+
+    /* records returned so far may still be in use, so an outgrown mapping is kept */
+    if (data.addr != ar->data.addr && ar->data.addr != NULL) {
+        old_data = realloc(ar->old_data, (ar->old_data_num + 1) * sizeof(*old_data));
+        if (old_data == NULL) {
+            munmap(data.addr, data.len);
+            return -1;
+        }
+        ar->old_data = old_data;
+    }
+
+    idx = ar->idx;
+    if (ber_archive_map(ar->idx_fd, (uint64_t)idx_st.st_size, &ar->idx, &idx) != 0 ||
+        memcmp(idx.addr, BER_ARCHIVE_MAGIC, BER_ARCHIVE_MAGIC_LEN) != 0) {
+        /* keep the previous mapping and state */
+        if (idx.addr != ar->idx.addr) {
+            munmap(idx.addr, idx.len);
+        }
+        if (data.addr != ar->data.addr) {
+            munmap(data.addr, data.len);
+        }
+        return -1;
+    }
+
+    /* skip a torn entry or entries of records not fully written yet */
+    entries = (const struct ber_archive_entry *)(void *)(idx.addr + BER_ARCHIVE_MAGIC_LEN);
+    num = ((uint64_t)idx_st.st_size - BER_ARCHIVE_MAGIC_LEN) / sizeof(*entries);
+    while (num > 0 && !ber_archive_entry_valid(&entries[num - 1], (uint64_t)data_st.st_size)) {
+        --num;
+    }
+
+    if (data.addr != ar->data.addr && ar->data.addr != NULL) {
+        ar->old_data[ar->old_data_num++] = ar->data;
+    }
+    if (idx.addr != ar->idx.addr && ar->idx.addr != NULL) {
+        munmap(ar->idx.addr, ar->idx.len);
+    }
+
+    ar->data = data;
+    ar->data_size = (uint64_t)data_st.st_size;
+    ar->idx = idx;
+    ar->entries = entries;
+    ar->mapped_num = ar->num = num;
+    ar->data_len = num > 0 ? entries[num - 1].offset + entries[num - 1].len : 0;
+    ar->last_time = num > 0 ? entries[num - 1].time : 0;
+
+    return 0;
+}
+
+struct ber_archive *
+ber_archive_open(const char *path, int flags)
+{
+    struct ber_archive *ar;
+    struct stat data_st;
+    char *idx_path;
+    int oflags = (flags & BER_ARCHIVE_WRITE) ? O_RDWR | O_CREAT : O_RDONLY;
+
+    ar = calloc(1, sizeof(*ar));
+    idx_path = malloc(strlen(path) + sizeof(".idx"));
+    if (ar == NULL || idx_path == NULL) {
+        free(ar);
+        free(idx_path);
+        return NULL;
+    }
+
+    sprintf(idx_path, "%s.idx", path);
+    ar->flags = flags;
+    ar->idx_fd = -1;
+    ar->data_fd = open(path, oflags | O_CLOEXEC, 0644);
+    if (ar->data_fd < 0 || fstat(ar->data_fd, &data_st) != 0) {
+        free(idx_path);
+        ber_archive_close(ar);
+        return NULL;
+    }
+
+    /* never create an index for existing records, they would be truncated */
+    if (data_st.st_size > 0) {
+        oflags &= ~O_CREAT;
+    }
+
+    ar->idx_fd = open(idx_path, oflags | O_CLOEXEC, 0644);
+    free(idx_path);
+    if (ar->idx_fd < 0) {
+        ber_archive_close(ar);
+        return NULL;
+    }
+
+    /* new archive */
+    if ((flags & BER_ARCHIVE_WRITE) && data_st.st_size == 0 &&
+        lseek(ar->idx_fd, 0, SEEK_END) == 0 &&
+        pwrite(ar->idx_fd, BER_ARCHIVE_MAGIC, BER_ARCHIVE_MAGIC_LEN, 0) != BER_ARCHIVE_MAGIC_LEN) {
+        ber_archive_close(ar);
+        return NULL;
+    }
+
+    if (ber_archive_refresh(ar) != 0) {
+        ber_archive_close(ar);
+        return NULL;
+    }
+
+    /* drop whatever was left by an interrupted append */
+    if ((flags & BER_ARCHIVE_WRITE) &&
+        (ftruncate(ar->data_fd, (off_t)ar->data_len) != 0 ||
+         ftruncate(ar->idx_fd, (off_t)(BER_ARCHIVE_MAGIC_LEN +
+                                       ar->num * sizeof(struct ber_archive_entry))) != 0)) {
+        ber_archive_close(ar);
+        return NULL;
+    }
+
+    return ar;
+}
+
+void
+ber_archive_close(struct ber_archive *ar)
+{
+    ber_archive_unmap(ar);
+
+    if (ar->data_fd >= 0) {
+        close(ar->data_fd);
+    }
+
+    if (ar->idx_fd >= 0) {
+        close(ar->idx_fd);
+    }
+
+    free(ar);
+}
+
+int
+ber_archive_append(struct ber_archive *ar, uint64_t time, const uint8_t *rec, uint32_t len)
+{
+    struct ber_archive_entry entry;
+
+    if (!(ar->flags & BER_ARCHIVE_WRITE) || len == 0 || (ar->num > 0 && time < ar->last_time)) {
+        return -1;
+    }
+
+    if (pwrite(ar->data_fd, rec, len, (off_t)ar->data_len) != (ssize_t)len) {
+        return -1;
+    }
+
+    entry.time = time;
+    entry.offset = ar->data_len;
+    entry.len = len;
+    if (pwrite(ar->idx_fd, &entry, sizeof(entry),
+               (off_t)(BER_ARCHIVE_MAGIC_LEN + ar->num * sizeof(entry))) != sizeof(entry)) {
+        return -1;
+    }
+
+    ar->data_len += len;
+    ar->last_time = time;
+    ++ar->num;
+
+    return 0;
+}
+
+uint64_t
+ber_archive_count(const struct ber_archive *ar)
+{
+    return ar->num;
+}
+
+/** Make records appended through this handle visible */
+static int
+ber_archive_sync_map(struct ber_archive *ar)
+{
+    if (ar->mapped_num == ar->num) {
+        return 0;
+    }
+
+    return ber_archive_refresh(ar);
+}
+
+const uint8_t *
+ber_archive_get(struct ber_archive *ar, uint64_t n, uint32_t *len, uint64_t *time)
+{
+    const struct ber_archive_entry *entry;
+
+    if (n >= ar->num || (n >= ar->mapped_num && ber_archive_sync_map(ar) != 0)) {
+        return NULL;
+    }
+
+    /* the index may be corrupted anywhere, not just at the end */
+    entry = &ar->entries[n];
+    if (!ber_archive_entry_valid(entry, ar->data_size)) {
+        return NULL;
+    }
+
+    *len = (uint32_t)entry->len;
+    if (time != NULL) {
+        *time = entry->time;
+    }
+
+    return ar->data.addr + entry->offset;
+}
+
+uint64_t
+ber_archive_seek_time(struct ber_archive *ar, uint64_t time)
+{
+    uint64_t lo = 0, hi, mid;
+
+    if (ber_archive_sync_map(ar) != 0) {
+        return ar->num;
+    }
+
+    hi = ar->mapped_num;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ar->entries[mid].time < time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
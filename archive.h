@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#ifndef BER_ARCHIVE_H
+#define BER_ARCHIVE_H
+
+#include <stdint.h>
+
+/**
+ * Append-only log of BER records, e.g. received traps or poll results.
+ *
+ * Records are stored back to back in the data file, exactly as given,
+ * so the file can still be read sequentially by any BER decoder. Every
+ * record has an entry in the sidecar index file, named like the data
+ * file with ".idx" appended. The index starts with the 8-byte
+ * BER_ARCHIVE_MAGIC, followed by fixed-size entries of three native
+ * endian uint64_t: record timestamp, offset in the data file and length.
+ * Records are looked up by number in O(1) and by timestamp in O(log n),
+ * without reading the data file at all.
+ *
+ * Both files are read through mmap, so records are decoded in place.
+ * There are always at least BER_ARCHIVE_SLACK readable bytes after any
+ * record, as required by snmp_decode_msg_slice and the other decoders
+ * with relaxed bound checks. The mapping is read-only, so destructive
+ * decoders like snmp_decode_msg can't be used.
+ *
+ * Data is written before its index entry, so records torn by a crash
+ * are never visible and are truncated when the archive is opened for
+ * writing again. Nothing is fsync'ed. An archive handle is not
+ * thread-safe.
+ */
+
+#define BER_ARCHIVE_MAGIC "BERIDX01"
+/** Min number of zeroed bytes readable after every record */
+#define BER_ARCHIVE_SLACK 4096
+
+/** Open flags */
+#define BER_ARCHIVE_WRITE 0x1 /**< allow appending, create files if missing */
+
+struct ber_archive;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Open an archive.
+ * @param path path of the data file
+ * @param flags 0 or BER_ARCHIVE_WRITE
+ * @return archive handle or NULL if files couldn't be opened or mapped,
+ * or the index is not a valid archive index. A non-empty data file
+ * without an index is not a valid archive either, the index is never
+ * created for it.
+ */
+struct ber_archive *ber_archive_open(const char *path, int flags);
+
+/**
+ * Close the archive. All pointers returned by ber_archive_get
+ * become invalid.
+ * @param ar archive opened with ber_archive_open
+ */
+void ber_archive_close(struct ber_archive *ar);
+
+/**
+ * Append a record.
+ * @param ar archive opened with BER_ARCHIVE_WRITE
+ * @param time record timestamp in any unit. It can't be lower than
+ * the timestamp of the previous record.
+ * @param rec encoded BER record
+ * @param len size of *rec*, greater than 0
+ * @return 0 on success or -1 if the archive is read-only, *time* is
+ * out of order or the record couldn't be written
+ */
+int ber_archive_append(struct ber_archive *ar, uint64_t time, const uint8_t *rec, uint32_t len);
+
+/**
+ * Get the number of records.
+ * @param ar archive opened with ber_archive_open
+ * @return number of records
+ */
+uint64_t ber_archive_count(const struct ber_archive *ar);
+
+/**
+ * Get a record. This doesn't copy anything, the record is returned straight
+ * from the mapped data file and stays valid until the archive is closed.
+ * Mapping the archive again after appends or in ber_archive_refresh
+ * doesn't invalidate records returned before.
+ * @param ar archive opened with ber_archive_open
+ * @param n record number, starting from 0
+ * @param len pointer to put the record size into
+ * @param time pointer to put the record timestamp into, can be NULL
+ * @return pointer to the record or NULL if there's no such record,
+ * its index entry points outside the data file or the archive couldn't
+ * be mapped again after appends
+ */
+const uint8_t *ber_archive_get(struct ber_archive *ar, uint64_t n, uint32_t *len, uint64_t *time);
+
+/**
+ * Find the first record with timestamp not lower than *time*.
+ * @param ar archive opened with ber_archive_open
+ * @param time timestamp to look for
+ * @return record number or ber_archive_count() if all records are older
+ */
+uint64_t ber_archive_seek_time(struct ber_archive *ar, uint64_t time);
+
+/**
+ * Map the archive again, to see records appended through other handles
+ * or by other processes.
+ * @param ar archive opened with ber_archive_open
+ * @return 0 on success or -1 if the files couldn't be mapped. The
+ * previous mapping stays in use then.
+ */
+int ber_archive_refresh(struct ber_archive *ar);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //BER_ARCHIVE_H
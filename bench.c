@@ -0,0 +1,1142 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/perf_event.h>
+#include "ber.h"
+#include "snmp.h"
+#include "snmp_counter.h"
+#include "parallel.h"
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+/** Number of distinct inputs each benchmark cycles through */
+#define BENCH_NUM 1024
+#define BENCH_MASK (BENCH_NUM - 1)
+/** Min duration of a single measurement */
+#define BENCH_MIN_NS 20000000ULL
+/** Number of measurements, the best one is reported */
+#define BENCH_REPS 5
+#define BENCH_MAX 64
+#define BENCH_VARBINDS 5
+/** Number of responses in a concatenated stream */
+#define BENCH_STREAM_MSGS 4096
+/** Size of the string value of a single-varbind message, e.g. a config blob */
+#define BENCH_BLOB_LEN 4096
+
+struct bench {
+    const char *name;
+    /** prepare input data, set *bytes* to the number of bytes processed per op */
+    void (*setup)(struct bench *b);
+    /** run *iters* ops, return anything depending on the results */
+    uint64_t (*run)(uint64_t iters);
+    double bytes;
+};
+
+struct bench_result {
+    char name[64];
+    double ns;
+    double insn; /**< negative if not available */
+    double bytes;
+};
+
+static volatile uint64_t g_sink;
+static int g_perf_fd = -1;
+
+static uint32_t g_nums[BENCH_NUM];
+static uint64_t g_nums64[BENCH_NUM];
+static uint8_t g_buf[BENCH_NUM * 16];
+static uint8_t *g_buf_end = g_buf + sizeof(g_buf) - 1;
+/** encoded input of decoding benchmarks, see bench_encode_nums */
+static uint8_t *g_enc;
+static uint32_t g_enc_len;
+static uint8_t g_scratch[BENCH_NUM * 16];
+static const char *g_str = "GigabitEthernet0/1";
+
+static struct snmp_msg_header g_get_header;
+static struct snmp_varbind g_get_varbinds[BENCH_VARBINDS];
+static struct snmp_msg_header g_resp_header;
+static struct snmp_varbind g_resp_varbinds[BENCH_VARBINDS];
+static struct snmp_varbind g_dec_varbinds[BENCH_VARBINDS];
+static struct snmp_counter_response g_gen_resp;
+static char g_blob[BENCH_BLOB_LEN + 1];
+static struct snmp_varbind g_blob_varbind;
+static uint8_t *g_stream;
+static uint64_t g_stream_len;
+static uint32_t g_threads;
+static uint8_t g_msg[2][512];
+static uint32_t g_msg_len[2];
+static uint8_t *g_msg_out[2];
+
+static uint64_t
+bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/** xorshift, so that every run gets the same input */
+static uint32_t
+bench_rand(void)
+{
+    static uint32_t state = 2463534242U;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/** Random number with random bit width, most of them small */
+static uint32_t
+bench_rand_num(void)
+{
+    static const uint32_t bits[] = { 4, 7, 8, 12, 14, 16, 24, 32 };
+
+    return bench_rand() >> (32 - bits[bench_rand() % 8]);
+}
+
+static void
+bench_perf_init(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    g_perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void
+bench_perf_start(void)
+{
+    if (g_perf_fd >= 0) {
+        ioctl(g_perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(g_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/** @return number of instructions since bench_perf_start or -1 */
+static int64_t
+bench_perf_stop(void)
+{
+    uint64_t count;
+
+    if (g_perf_fd < 0) {
+        return -1;
+    }
+
+    ioctl(g_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(g_perf_fd, &count, sizeof(count)) != sizeof(count)) {
+        return -1;
+    }
+
+    return (int64_t)count;
+}
+
+/**
+ * Encode all g_nums with *encode* so that they can be decoded front-to-back
+ * from g_enc. Set b->bytes to the average encoded size.
+ */
+static void
+bench_encode_nums(struct bench *b, uint8_t *(*encode)(uint8_t *, uint32_t))
+{
+    uint8_t *out = g_buf_end;
+    int i;
+
+    for (i = BENCH_NUM - 1; i >= 0; --i) {
+        out = encode(out, g_nums[i]);
+    }
+
+    g_enc = out + 1;
+    g_enc_len = (uint32_t)(g_buf_end - out);
+    b->bytes = (double)g_enc_len / BENCH_NUM;
+}
+
+static uint8_t *
+bench_encode_uint64(uint8_t *out, uint32_t idx)
+{
+    return ber_encode_uint64(out, g_nums64[idx & BENCH_MASK], 0x46);
+}
+
+static void
+setup_vlint(struct bench *b)
+{
+    bench_encode_nums(b, ber_encode_vlint);
+}
+
+static void
+setup_vlint_batch(struct bench *b)
+{
+    bench_encode_nums(b, ber_encode_vlint);
+    b->bytes = g_enc_len;
+}
+
+static void
+setup_int(struct bench *b)
+{
+    bench_encode_nums(b, ber_encode_int);
+}
+
+static void
+setup_length(struct bench *b)
+{
+    bench_encode_nums(b, ber_encode_length);
+}
+
+static void
+setup_uint64(struct bench *b)
+{
+    uint8_t *out = g_buf_end;
+    int i;
+
+    for (i = BENCH_NUM - 1; i >= 0; --i) {
+        out = bench_encode_uint64(out, (uint32_t)i);
+    }
+
+    g_enc = out + 1;
+    g_enc_len = (uint32_t)(g_buf_end - out);
+    b->bytes = (double)g_enc_len / BENCH_NUM;
+}
+
+static void
+setup_string(struct bench *b)
+{
+    g_enc = ber_encode_string(g_buf_end, g_str) + 1;
+    b->bytes = (uint32_t)(g_buf_end - g_enc + 1);
+}
+
+static void
+setup_null(struct bench *b)
+{
+    g_enc = ber_encode_null(g_buf_end) + 1;
+    b->bytes = 2;
+}
+
+static void
+setup_fmt(struct bench *b)
+{
+    g_enc = ber_fprintf(g_buf_end, "%u%u%u%n", 123456, 103, 42);
+    b->bytes = (uint32_t)(g_buf_end - g_enc + 1);
+}
+
+#define BENCH_ENCODE_LOOP(encode)                   \
+    uint8_t *out = g_buf_end;                       \
+    uint64_t i, sum = 0;                            \
+                                                    \
+    for (i = 0; i < iters; ++i) {                   \
+        out = encode;                               \
+        if ((i & BENCH_MASK) == BENCH_MASK) {       \
+            sum += out[1];                          \
+            out = g_buf_end;                        \
+        }                                           \
+    }                                               \
+                                                    \
+    return sum + (uint64_t)(g_buf_end - out)
+
+#define BENCH_DECODE_LOOP(decode)                   \
+    uint8_t *buf = g_enc;                           \
+    uint64_t i, sum = 0;                            \
+    uint32_t num;                                   \
+                                                    \
+    for (i = 0; i < iters; ++i) {                   \
+        buf = decode;                               \
+        sum += num;                                 \
+        if ((i & BENCH_MASK) == BENCH_MASK) {       \
+            buf = g_enc;                            \
+        }                                           \
+    }                                               \
+                                                    \
+    return sum
+
+static uint64_t
+run_encode_vlint(uint64_t iters)
+{
+    BENCH_ENCODE_LOOP(ber_encode_vlint(out, g_nums[i & BENCH_MASK]));
+}
+
+static uint64_t
+run_decode_vlint(uint64_t iters)
+{
+    BENCH_DECODE_LOOP(ber_decode_vlint(buf, &num));
+}
+
+static uint64_t
+run_decode_vlint_batch(uint64_t iters)
+{
+    static uint32_t nums[BENCH_NUM];
+    uint64_t i, sum = 0;
+    uint32_t nums_len;
+
+    for (i = 0; i < iters; ++i) {
+        nums_len = BENCH_NUM;
+        ber_decode_vlint_batch(g_enc, g_enc_len, nums, &nums_len);
+        sum += nums[i & BENCH_MASK];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_encode_int(uint64_t iters)
+{
+    BENCH_ENCODE_LOOP(ber_encode_int(out, g_nums[i & BENCH_MASK]));
+}
+
+static uint64_t
+run_decode_int(uint64_t iters)
+{
+    BENCH_DECODE_LOOP(ber_decode_int(buf, &num));
+}
+
+static uint64_t
+run_encode_uint64(uint64_t iters)
+{
+    BENCH_ENCODE_LOOP(bench_encode_uint64(out, (uint32_t)i));
+}
+
+static uint64_t
+run_decode_uint64(uint64_t iters)
+{
+    uint8_t *buf = g_enc;
+    uint64_t i, num, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        buf = ber_decode_uint64(buf, &num);
+        sum += num;
+        if ((i & BENCH_MASK) == BENCH_MASK) {
+            buf = g_enc;
+        }
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_encode_length(uint64_t iters)
+{
+    BENCH_ENCODE_LOOP(ber_encode_length(out, g_nums[i & BENCH_MASK]));
+}
+
+static uint64_t
+run_decode_length(uint64_t iters)
+{
+    BENCH_DECODE_LOOP(ber_decode_length(buf, &num));
+}
+
+static uint64_t
+run_decode_header(uint64_t iters)
+{
+    const uint8_t *buf = g_enc;
+    uint64_t i, sum = 0;
+    uint32_t len;
+
+    for (i = 0; i < iters; ++i) {
+        buf = ber_decode_header(buf, (uint32_t)(g_enc + g_enc_len - buf), BER_DATA_T_INTEGER, &len);
+        buf += len;
+        sum += len;
+        if ((i & BENCH_MASK) == BENCH_MASK) {
+            buf = g_enc;
+        }
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_encode_string(uint64_t iters)
+{
+    BENCH_ENCODE_LOOP(ber_encode_string_len(out, g_str, 18));
+}
+
+static uint64_t
+run_decode_string(uint64_t iters)
+{
+    const char *str;
+    uint64_t i, sum = 0;
+    uint32_t len;
+
+    for (i = 0; i < iters; ++i) {
+        sum += ber_decode_string_len_buffer(g_enc, &str, &len) != NULL;
+        sum += len;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_decode_string_arena(uint64_t iters)
+{
+    static uint8_t arena_buf[4096];
+    struct ber_arena arena;
+    char *str;
+    uint64_t i, sum = 0;
+
+    ber_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    for (i = 0; i < iters; ++i) {
+        if (ber_decode_string_arena(g_enc, &arena, &str, 64) == NULL) {
+            ber_arena_reset(&arena);
+            continue;
+        }
+        sum += (uint8_t)str[0];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_encode_null(uint64_t iters)
+{
+    BENCH_ENCODE_LOOP(ber_encode_null(out));
+}
+
+static uint64_t
+run_decode_null(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        sum += ber_decode_null(g_enc) != NULL;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_sizeof_int(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        sum += ber_sizeof_int(g_nums[i & BENCH_MASK]);
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_fprintf(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        sum += ber_fprintf(g_buf_end, "%u%u%u%n", (uint32_t)i, 103, 42)[2];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_encode_macro(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        sum += BER_ENCODE(g_buf_end, BER_U((uint32_t)i), BER_U(103), BER_U(42), BER_N())[2];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_sscanf(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+    uint32_t a, b, c;
+
+    for (i = 0; i < iters; ++i) {
+        ber_sscanf(g_enc, "%u%u%u%n", &a, &b, &c);
+        sum += a + c;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_decode_macro(uint64_t iters)
+{
+    uint8_t *buf;
+    uint64_t i, sum = 0;
+    uint32_t a, b, c;
+
+    for (i = 0; i < iters; ++i) {
+        buf = g_enc;
+        sum += BER_DECODE(buf, BER_U(&a), BER_U(&b), BER_U(&c), BER_N()) != NULL;
+        sum += a + c;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snscanf(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+    uint32_t a, b, c;
+
+    for (i = 0; i < iters; ++i) {
+        ber_snscanf(g_enc, 16, "%u%u%u%n", &a, &b, &c);
+        sum += a + c;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_writer_int(uint64_t iters)
+{
+    struct ber_writer w;
+    uint64_t i, sum = 0;
+
+    ber_writer_init(&w, g_scratch, sizeof(g_scratch), NULL, NULL);
+    for (i = 0; i < iters; ++i) {
+        ber_writer_int(&w, g_nums[i & BENCH_MASK]);
+        if ((i & BENCH_MASK) == BENCH_MASK) {
+            sum += w.len;
+            w.len = 0;
+        }
+    }
+
+    return sum;
+}
+
+static void
+bench_fill_varbind(struct snmp_varbind *varbind, const uint32_t *oid, uint32_t oid_len,
+                   enum snmp_data_type value_type)
+{
+    memcpy(varbind->oid, oid, oid_len * sizeof(*oid));
+    varbind->oid[oid_len] = SNMP_MSG_OID_END;
+    varbind->value_type = value_type;
+}
+
+static void
+setup_snmp(struct bench *b)
+{
+    static const uint32_t sys_descr[] = { 1, 3, 6, 1, 2, 1, 1, 1, 0 };
+    static const uint32_t sys_uptime[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+    static const uint32_t if_in_octets[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, 10001 };
+    static const uint32_t if_hc_in_octets[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 10001 };
+    static const uint32_t if_oper_status[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 8, 10001 };
+    static const uint32_t *oids[] = { sys_descr, sys_uptime, if_in_octets, if_hc_in_octets,
+                                      if_oper_status };
+    static const uint32_t oid_lens[] = { 9, 9, 11, 12, 11 };
+    static const enum snmp_data_type types[] = { SNMP_DATA_T_OCTET_STRING, SNMP_DATA_T_TIMETICKS,
+                                                 SNMP_DATA_T_COUNTER32, SNMP_DATA_T_COUNTER64,
+                                                 SNMP_DATA_T_INTEGER };
+    uint32_t i;
+
+    if (g_msg_len[0] != 0) {
+        b->bytes = strstr(b->name, "/get") ? g_msg_len[0] : g_msg_len[1];
+        return;
+    }
+
+    g_get_header.snmp_ver = 1;
+    g_get_header.community = "public";
+    g_get_header.pdu_type = SNMP_DATA_T_PDU_GET_REQUEST;
+    g_get_header.request_id = 1234567;
+    g_resp_header = g_get_header;
+    g_resp_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+
+    for (i = 0; i < BENCH_VARBINDS; ++i) {
+        bench_fill_varbind(&g_get_varbinds[i], oids[i], oid_lens[i], SNMP_DATA_T_NULL);
+        bench_fill_varbind(&g_resp_varbinds[i], oids[i], oid_lens[i], types[i]);
+    }
+    g_resp_varbinds[0].value.s = "Linux router 5.10.0 #1 SMP x86_64";
+    g_resp_varbinds[1].value.i = 123456789;
+    g_resp_varbinds[2].value.i = 3000000000U;
+    g_resp_varbinds[3].value.i64 = 0x123456789ABULL;
+    g_resp_varbinds[4].value.i = 1;
+
+    g_gen_resp.version = 1;
+    g_gen_resp.community = "public";
+    g_gen_resp.community_len = 6;
+    g_gen_resp.pdu.request_id = 1234567;
+    memcpy(g_gen_resp.pdu.varbinds.varbind.name, if_in_octets, sizeof(if_in_octets));
+    g_gen_resp.pdu.varbinds.varbind.name_len = 11;
+    g_gen_resp.pdu.varbinds.varbind.value = 300000000;
+
+    /* decoders need 5 bytes of slack after the message */
+    for (i = 0; i < 2; ++i) {
+        g_msg_out[i] = snmp_encode_msg(g_msg[i] + sizeof(g_msg[i]) - 6,
+                                       i == 0 ? &g_get_header : &g_resp_header, BENCH_VARBINDS,
+                                       i == 0 ? g_get_varbinds : g_resp_varbinds);
+        g_msg_len[i] = (uint32_t)(g_msg[i] + sizeof(g_msg[i]) - 6 - g_msg_out[i] + 1);
+    }
+
+    b->bytes = strstr(b->name, "/get") ? g_msg_len[0] : g_msg_len[1];
+}
+
+static void
+setup_snmp_gen(struct bench *b)
+{
+    uint8_t *out;
+
+    setup_snmp(b);
+    out = snmp_counter_response_encode(g_buf_end, &g_gen_resp);
+    g_enc = out + 1;
+    g_enc_len = (uint32_t)(g_buf_end - out);
+    b->bytes = g_enc_len;
+}
+
+static void
+setup_snmp_blob(struct bench *b)
+{
+    static const uint32_t oid[] = { 1, 3, 6, 1, 4, 1, 9, 9, 96, 1, 1, 1, 1, 14, 1 };
+
+    setup_snmp(b);
+    memset(g_blob, 'x', BENCH_BLOB_LEN);
+    bench_fill_varbind(&g_blob_varbind, oid, 15, SNMP_DATA_T_OCTET_STRING);
+    g_blob_varbind.value.s = g_blob;
+    b->bytes = snmp_sizeof_msg(&g_resp_header, 1, &g_blob_varbind);
+}
+
+static uint64_t
+bench_snmp_encode(uint64_t iters, struct snmp_msg_header *header, struct snmp_varbind *varbinds)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        header->request_id = (uint32_t)i;
+        sum += snmp_encode_msg(g_buf_end, header, BENCH_VARBINDS, varbinds)[1];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_encode_get(uint64_t iters)
+{
+    return bench_snmp_encode(iters, &g_get_header, g_get_varbinds);
+}
+
+static uint64_t
+run_snmp_encode_resp(uint64_t iters)
+{
+    return bench_snmp_encode(iters, &g_resp_header, g_resp_varbinds);
+}
+
+static uint64_t
+run_snmp_encode_blob(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        g_resp_header.request_id = (uint32_t)i;
+        sum += snmp_encode_msg(g_buf_end, &g_resp_header, 1, &g_blob_varbind)[1];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_encode_iov_blob(uint64_t iters)
+{
+    struct iovec iov[3];
+    uint64_t i, sum = 0;
+    uint32_t iov_num;
+
+    for (i = 0; i < iters; ++i) {
+        g_resp_header.request_id = (uint32_t)i;
+        iov_num = 3;
+        sum += snmp_encode_msg_iov(g_buf_end, &g_resp_header, 1, &g_blob_varbind, iov,
+                                   &iov_num)[1];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_sizeof_resp(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        g_resp_header.request_id = (uint32_t)i;
+        sum += snmp_sizeof_msg(&g_resp_header, BENCH_VARBINDS, g_resp_varbinds);
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_write_resp(uint64_t iters)
+{
+    struct ber_writer w;
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        ber_writer_init(&w, g_scratch, sizeof(g_scratch), NULL, NULL);
+        g_resp_header.request_id = (uint32_t)i;
+        snmp_write_msg(&w, &g_resp_header, BENCH_VARBINDS, g_resp_varbinds);
+        sum += w.len;
+    }
+
+    return sum;
+}
+
+/** snmp_decode_msg modifies the message, so it's decoded from a fresh copy each time */
+static uint64_t
+bench_snmp_decode(uint64_t iters, uint32_t msg)
+{
+    struct snmp_msg_header header;
+    uint64_t i, sum = 0;
+    uint32_t varbind_num;
+
+    for (i = 0; i < iters; ++i) {
+        memcpy(g_scratch, g_msg_out[msg], g_msg_len[msg] + 5);
+        varbind_num = BENCH_VARBINDS;
+        snmp_decode_msg(g_scratch, g_msg_len[msg] + 5, &header, &varbind_num, g_dec_varbinds);
+        sum += header.request_id + varbind_num;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_decode_get(uint64_t iters)
+{
+    return bench_snmp_decode(iters, 0);
+}
+
+static uint64_t
+run_snmp_decode_resp(uint64_t iters)
+{
+    return bench_snmp_decode(iters, 1);
+}
+
+static uint64_t
+bench_snmp_decode_slice(uint64_t iters, uint32_t msg)
+{
+    struct snmp_msg_header header;
+    uint64_t i, sum = 0;
+    uint32_t varbind_num;
+
+    for (i = 0; i < iters; ++i) {
+        varbind_num = BENCH_VARBINDS;
+        snmp_decode_msg_slice(g_msg_out[msg], g_msg_len[msg] + 5, &header, &varbind_num,
+                              g_dec_varbinds);
+        sum += header.request_id + varbind_num;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_decode_slice_get(uint64_t iters)
+{
+    return bench_snmp_decode_slice(iters, 0);
+}
+
+static uint64_t
+run_snmp_decode_slice_resp(uint64_t iters)
+{
+    return bench_snmp_decode_slice(iters, 1);
+}
+
+static uint64_t
+run_snmp_validate_resp(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+    uint32_t varbind_num;
+
+    for (i = 0; i < iters; ++i) {
+        sum += snmp_validate_msg(g_msg_out[1], g_msg_len[1], &varbind_num) != NULL;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_unchecked_resp(uint64_t iters)
+{
+    struct snmp_msg_header header;
+    uint64_t i, sum = 0;
+    uint32_t varbind_num;
+
+    for (i = 0; i < iters; ++i) {
+        varbind_num = BENCH_VARBINDS;
+        snmp_decode_msg_unchecked(g_msg_out[1], &header, &varbind_num, g_dec_varbinds);
+        sum += header.request_id + varbind_num;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_snmp_tape_resp(uint64_t iters)
+{
+    struct ber_tape_entry tape[32];
+    uint64_t i, sum = 0;
+    uint32_t tape_len;
+
+    for (i = 0; i < iters; ++i) {
+        tape_len = 32;
+        ber_tape_index(g_msg_out[1], g_msg_len[1], tape, &tape_len);
+        sum += tape_len;
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_stream_resp(uint64_t iters)
+{
+    struct ber_stream s;
+    struct ber_stream_token tok;
+    uint64_t i, sum = 0;
+    uint32_t pos, consumed;
+
+    for (i = 0; i < iters; ++i) {
+        ber_stream_init(&s);
+        for (pos = 0; pos < g_msg_len[1]; pos += consumed) {
+            if (ber_stream_feed(&s, g_msg_out[1] + pos, g_msg_len[1] - pos, &consumed, &tok) !=
+                BER_STREAM_TOKEN) {
+                break;
+            }
+            sum += tok.len;
+        }
+    }
+
+    return sum;
+}
+
+static void
+setup_snmp_stream(struct bench *b)
+{
+    uint32_t i;
+
+    setup_snmp(b);
+    if (g_stream == NULL) {
+        /* 5 bytes of slack after the last message */
+        g_stream = calloc(1, (size_t)BENCH_STREAM_MSGS * g_msg_len[1] + 5);
+        if (g_stream == NULL) {
+            exit(1);
+        }
+
+        for (i = 0; i < BENCH_STREAM_MSGS; ++i) {
+            memcpy(g_stream + g_stream_len, g_msg_out[1], g_msg_len[1]);
+            g_stream_len += g_msg_len[1];
+        }
+
+        g_threads = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    b->bytes = (double)g_stream_len;
+}
+
+static uint64_t
+run_stream_decode_slice(uint64_t iters)
+{
+    struct snmp_msg_header header;
+    const uint8_t *buf;
+    uint64_t i, sum = 0;
+    uint32_t varbind_num;
+
+    for (i = 0; i < iters; ++i) {
+        for (buf = g_stream; buf < g_stream + g_stream_len; buf += g_msg_len[1]) {
+            varbind_num = BENCH_VARBINDS;
+            snmp_decode_msg_slice(buf, g_msg_len[1] + 5, &header, &varbind_num, g_dec_varbinds);
+            sum += header.request_id + varbind_num;
+        }
+    }
+
+    return sum;
+}
+
+static void
+bench_parallel_msg_cb(void *ctx, void *chunk_ctx, uint64_t msg_idx,
+                      const struct snmp_msg_header *header, uint32_t varbind_num,
+                      const struct snmp_varbind *varbinds)
+{
+    *(uint64_t *)chunk_ctx += header != NULL ? header->request_id + varbind_num : 0;
+}
+
+static void
+bench_parallel_chunk_cb(void *ctx, void *chunk_ctx, uint64_t first_msg, uint64_t msg_num)
+{
+    *(uint64_t *)ctx += *(uint64_t *)chunk_ctx;
+}
+
+static uint64_t
+run_stream_decode_parallel(uint64_t iters)
+{
+    struct snmp_parallel_config config = { 0 };
+    uint64_t i, sum = 0, msg_num;
+
+    config.thread_num = g_threads;
+    config.chunk_ctx_size = sizeof(uint64_t);
+    config.msg_cb = bench_parallel_msg_cb;
+    config.chunk_cb = bench_parallel_chunk_cb;
+    config.ctx = &sum;
+    for (i = 0; i < iters; ++i) {
+        snmp_decode_parallel(g_stream, g_stream_len, &config, &msg_num);
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_gen_encode(uint64_t iters)
+{
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        g_gen_resp.pdu.request_id = (uint32_t)i;
+        sum += snmp_counter_response_encode(g_buf_end, &g_gen_resp)[1];
+    }
+
+    return sum;
+}
+
+static uint64_t
+run_gen_decode(uint64_t iters)
+{
+    struct snmp_counter_response resp;
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < iters; ++i) {
+        snmp_counter_response_decode(g_enc, g_enc_len, &resp);
+        sum += resp.pdu.varbinds.varbind.value;
+    }
+
+    return sum;
+}
+
+static struct bench g_benches[] = {
+    { "ber_encode_vlint", setup_vlint, run_encode_vlint, 0 },
+    { "ber_decode_vlint", setup_vlint, run_decode_vlint, 0 },
+    { "ber_decode_vlint_batch/1024", setup_vlint_batch, run_decode_vlint_batch, 0 },
+    { "ber_encode_int", setup_int, run_encode_int, 0 },
+    { "ber_decode_int", setup_int, run_decode_int, 0 },
+    { "ber_decode_header", setup_int, run_decode_header, 0 },
+    { "ber_sizeof_int", setup_int, run_sizeof_int, 0 },
+    { "ber_writer_int", setup_int, run_writer_int, 0 },
+    { "ber_encode_uint64", setup_uint64, run_encode_uint64, 0 },
+    { "ber_decode_uint64", setup_uint64, run_decode_uint64, 0 },
+    { "ber_encode_length", setup_length, run_encode_length, 0 },
+    { "ber_decode_length", setup_length, run_decode_length, 0 },
+    { "ber_encode_string_len", setup_string, run_encode_string, 0 },
+    { "ber_decode_string_len_buffer", setup_string, run_decode_string, 0 },
+    { "ber_decode_string_arena", setup_string, run_decode_string_arena, 0 },
+    { "ber_encode_null", setup_null, run_encode_null, 0 },
+    { "ber_decode_null", setup_null, run_decode_null, 0 },
+    { "ber_fprintf", setup_fmt, run_fprintf, 0 },
+    { "BER_ENCODE", setup_fmt, run_encode_macro, 0 },
+    { "ber_sscanf", setup_fmt, run_sscanf, 0 },
+    { "BER_DECODE", setup_fmt, run_decode_macro, 0 },
+    { "ber_snscanf", setup_fmt, run_snscanf, 0 },
+    { "snmp_encode_msg/get", setup_snmp, run_snmp_encode_get, 0 },
+    { "snmp_encode_msg/response", setup_snmp, run_snmp_encode_resp, 0 },
+    { "snmp_encode_msg/blob", setup_snmp_blob, run_snmp_encode_blob, 0 },
+    { "snmp_encode_msg_iov/blob", setup_snmp_blob, run_snmp_encode_iov_blob, 0 },
+    { "snmp_sizeof_msg/response", setup_snmp, run_snmp_sizeof_resp, 0 },
+    { "snmp_write_msg/response", setup_snmp, run_snmp_write_resp, 0 },
+    { "snmp_decode_msg/get", setup_snmp, run_snmp_decode_get, 0 },
+    { "snmp_decode_msg/response", setup_snmp, run_snmp_decode_resp, 0 },
+    { "snmp_decode_msg_slice/get", setup_snmp, run_snmp_decode_slice_get, 0 },
+    { "snmp_decode_msg_slice/response", setup_snmp, run_snmp_decode_slice_resp, 0 },
+    { "snmp_validate_msg/response", setup_snmp, run_snmp_validate_resp, 0 },
+    { "snmp_decode_msg_unchecked/response", setup_snmp, run_snmp_unchecked_resp, 0 },
+    { "snmp_decode_msg_slice/stream", setup_snmp_stream, run_stream_decode_slice, 0 },
+    { "snmp_decode_parallel/stream", setup_snmp_stream, run_stream_decode_parallel, 0 },
+    { "ber_tape_index/response", setup_snmp, run_snmp_tape_resp, 0 },
+    { "ber_stream_feed/response", setup_snmp, run_stream_resp, 0 },
+    { "snmp_counter_response_encode", setup_snmp_gen, run_gen_encode, 0 },
+    { "snmp_counter_response_decode", setup_snmp_gen, run_gen_decode, 0 },
+};
+
+/** Run single benchmark long enough to get stable results */
+static void
+bench_run(struct bench *b, struct bench_result *res)
+{
+    uint64_t iters = 1024, start, elapsed;
+    int64_t insn;
+    double ns;
+    int i;
+
+    b->setup(b);
+
+    /* warm up and calibrate */
+    for (;;) {
+        start = bench_now_ns();
+        g_sink += b->run(iters);
+        elapsed = bench_now_ns() - start;
+        if (elapsed >= BENCH_MIN_NS) {
+            break;
+        }
+        iters = elapsed < BENCH_MIN_NS / 16 ? iters * 16 : iters * 2;
+    }
+
+    snprintf(res->name, sizeof(res->name), "%s", b->name);
+    res->bytes = b->bytes;
+    res->ns = 1e30;
+    res->insn = -1;
+    for (i = 0; i < BENCH_REPS; ++i) {
+        bench_perf_start();
+        start = bench_now_ns();
+        g_sink += b->run(iters);
+        elapsed = bench_now_ns() - start;
+        insn = bench_perf_stop();
+
+        ns = (double)elapsed / (double)iters;
+        if (ns < res->ns) {
+            res->ns = ns;
+        }
+        if (insn >= 0 && (res->insn < 0 || (double)insn / (double)iters < res->insn)) {
+            res->insn = (double)insn / (double)iters;
+        }
+    }
+}
+
+/** Load results of a previous run written with -o */
+static uint32_t
+bench_load(const char *path, struct bench_result *results, uint32_t max)
+{
+    FILE *f = fopen(path, "r");
+    char line[256], version[64];
+    struct bench_result *res;
+    uint32_t num = 0;
+
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    while (num < max && fgets(line, sizeof(line), f) != NULL) {
+        res = &results[num];
+        if (sscanf(line, "%63[^,],%63[^,],%lf,%lf,%*f,%lf", version, res->name, &res->ns,
+                   &res->bytes, &res->insn) == 5) {
+            ++num;
+        }
+    }
+
+    fclose(f);
+    return num;
+}
+
+static const struct bench_result *
+bench_find(const struct bench_result *results, uint32_t num, const char *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < num; ++i) {
+        if (strcmp(results[i].name, name) == 0) {
+            return &results[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-o results.csv] [-b baseline.csv] [-f filter]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench_result results[BENCH_MAX], baseline[BENCH_MAX];
+    const struct bench_result *base;
+    const char *out_path = NULL, *base_path = NULL, *filter = NULL;
+    uint32_t i, num = 0, base_num = 0;
+    FILE *out = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:b:f:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'b':
+                base_path = optarg;
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (base_path != NULL) {
+        base_num = bench_load(base_path, baseline, BENCH_MAX);
+    }
+
+    for (i = 0; i < BENCH_NUM; ++i) {
+        g_nums[i] = bench_rand_num();
+        g_nums64[i] = (uint64_t)bench_rand_num() << (bench_rand() % 32) | bench_rand_num();
+    }
+
+    bench_perf_init();
+    printf("# ber-bench %s, instructions/op %s\n", BENCH_VERSION,
+           g_perf_fd >= 0 ? "from perf_event_open" : "not available");
+    printf("%-36s %10s %12s %10s%s\n", "name", "ns/op", "MB/s", "insn/op",
+           base_num > 0 ? "     change" : "");
+
+    for (i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]) && num < BENCH_MAX; ++i) {
+        struct bench_result *res = &results[num];
+
+        if (filter != NULL && strstr(g_benches[i].name, filter) == NULL) {
+            continue;
+        }
+
+        bench_run(&g_benches[i], res);
+        ++num;
+
+        printf("%-36s %10.2f %12.1f ", res->name, res->ns, res->bytes / res->ns * 1e3);
+        if (res->insn >= 0) {
+            printf("%10.1f", res->insn);
+        } else {
+            printf("%10s", "-");
+        }
+
+        base = bench_find(baseline, base_num, res->name);
+        if (base != NULL) {
+            printf(" %+9.1f%%", (res->ns / base->ns - 1) * 100);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (out_path != NULL) {
+        out = fopen(out_path, "w");
+        if (out == NULL) {
+            perror(out_path);
+            return 1;
+        }
+
+        fprintf(out, "version,name,ns_per_op,bytes_per_op,bytes_per_s,instructions_per_op\n");
+        for (i = 0; i < num; ++i) {
+            fprintf(out, "%s,%s,%.3f,%.2f,%.0f,%.1f\n", BENCH_VERSION, results[i].name,
+                    results[i].ns, results[i].bytes, results[i].bytes / results[i].ns * 1e9,
+                    results[i].insn);
+        }
+
+        fclose(out);
+    }
+
+    return (int)(g_sink & 0);
+}
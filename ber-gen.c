@@ -0,0 +1,982 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+/*
+ * BER codec generator.
+ * Reads a subset of ASN.1 and emits C encode and decode functions built on
+ * ber.c primitives. Supported types are SEQUENCE, INTEGER, OCTET STRING,
+ * NULL and OBJECT IDENTIFIER, with optional [n] IMPLICIT or
+ * [APPLICATION n] IMPLICIT tags. INTEGER value ranges (lo..hi) and
+ * OCTET STRING sizes (SIZE(lo..hi)) are checked by generated code. When they
+ * make encoded size of an object constant, it's encoded and decoded at fixed
+ * offsets, with a single bounds check for the whole object.
+ *
+ * Usage: ber-gen <schema.asn1> <output>
+ * Writes <output>.c and <output>.h, the basename of <output> is used as
+ * prefix of all generated identifiers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include "ber.h"
+
+#define GEN_NAME_LEN 64
+#define GEN_MAX_CHILDREN 32
+#define GEN_MAX_TYPES 32
+#define GEN_PATH_LEN 512
+/** max number of arcs in generated OID fields */
+#define GEN_OID_LEN 32
+
+enum gen_kind {
+    GEN_SEQUENCE,
+    GEN_INTEGER,
+    GEN_OCTET_STRING,
+    GEN_NULL,
+    GEN_OID,
+};
+
+struct gen_node {
+    enum gen_kind kind;
+    char name[GEN_NAME_LEN]; /**< C name of the field or type */
+    uint8_t tag;
+    int has_range;
+    uint32_t lo, hi; /**< INTEGER values or OCTET STRING sizes */
+    uint32_t size; /**< encoded size if constant, 0 otherwise */
+    uint32_t content_len; /**< SEQUENCE content size if constant */
+    uint32_t child_num;
+    struct gen_node *children[GEN_MAX_CHILDREN];
+};
+
+struct gen {
+    const char *path;
+    const char *src;
+    const char *pos;
+    uint32_t line;
+    char tok[GEN_NAME_LEN];
+    char prefix[GEN_NAME_LEN];
+    int has_oid;
+    uint32_t type_num;
+    struct gen_node *types[GEN_MAX_TYPES];
+    FILE *out;
+};
+
+static void __attribute__((format(printf, 2, 3), noreturn))
+gen_error(struct gen *g, const char *fmt, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "%s:%u: error: ", g->path, g->line);
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static void __attribute__((format(printf, 3, 4)))
+gen_emit(struct gen *g, uint32_t indent, const char *fmt, ...)
+{
+    va_list args;
+
+    fprintf(g->out, "%*s", (int)(indent * 4), "");
+    va_start(args, fmt);
+    vfprintf(g->out, fmt, args);
+    va_end(args);
+}
+
+/** Read the next token into g->tok, empty at the end of input */
+static void
+gen_next(struct gen *g)
+{
+    const char *start;
+    size_t len;
+
+    for (;;) {
+        while (isspace((unsigned char)*g->pos)) {
+            g->line += *g->pos++ == '\n';
+        }
+
+        if (g->pos[0] != '-' || g->pos[1] != '-') {
+            break;
+        }
+
+        while (*g->pos && *g->pos != '\n') {
+            ++g->pos;
+        }
+    }
+
+    start = g->pos;
+    if (isalnum((unsigned char)*g->pos)) {
+        while (isalnum((unsigned char)*g->pos) ||
+               (*g->pos == '-' && isalnum((unsigned char)g->pos[1]))) {
+            ++g->pos;
+        }
+    } else if (strncmp(g->pos, "::=", 3) == 0) {
+        g->pos += 3;
+    } else if (strncmp(g->pos, "..", 2) == 0) {
+        g->pos += 2;
+    } else if (*g->pos) {
+        ++g->pos;
+    }
+
+    len = (size_t)(g->pos - start);
+    if (len >= GEN_NAME_LEN) {
+        gen_error(g, "token too long");
+    }
+
+    memcpy(g->tok, start, len);
+    g->tok[len] = 0;
+}
+
+static int
+gen_accept(struct gen *g, const char *tok)
+{
+    if (strcmp(g->tok, tok) != 0) {
+        return 0;
+    }
+
+    gen_next(g);
+    return 1;
+}
+
+static void
+gen_expect(struct gen *g, const char *tok)
+{
+    if (!gen_accept(g, tok)) {
+        gen_error(g, "expected '%s', got '%s'", tok, g->tok);
+    }
+}
+
+static uint32_t
+gen_number(struct gen *g)
+{
+    char *end;
+    unsigned long num;
+
+    num = strtoul(g->tok, &end, 10);
+    if (g->tok[0] == 0 || *end != 0 || num > UINT32_MAX) {
+        gen_error(g, "expected a number, got '%s'", g->tok);
+    }
+
+    gen_next(g);
+    return (uint32_t)num;
+}
+
+/** Convert ASN.1 camelCase or hyphenated name to C snake_case */
+static void
+gen_c_name(struct gen *g, char *out, const char *name)
+{
+    uint32_t len = 0;
+    const char *c;
+
+    for (c = name; *c; ++c) {
+        if (len + 2 >= GEN_NAME_LEN) {
+            gen_error(g, "name too long: %s", name);
+        }
+
+        if (*c == '-') {
+            out[len++] = '_';
+        } else if (isupper((unsigned char)*c)) {
+            if (c != name && islower((unsigned char)c[-1])) {
+                out[len++] = '_';
+            }
+            out[len++] = (char)tolower((unsigned char)*c);
+        } else {
+            out[len++] = *c;
+        }
+    }
+
+    out[len] = 0;
+}
+
+static void
+gen_upper(char *out, const char *name)
+{
+    while (*name) {
+        *out++ = (char)toupper((unsigned char)*name++);
+    }
+    *out = 0;
+}
+
+/** Compute the constant encoded size of *node*, if it has one */
+static void
+gen_node_size(struct gen_node *node)
+{
+    uint32_t i, len = 0;
+
+    node->size = 0;
+    switch (node->kind) {
+        case GEN_INTEGER:
+            if (node->has_range && ber_sizeof_int(node->lo) == ber_sizeof_int(node->hi)) {
+                node->size = ber_sizeof_int(node->hi);
+            }
+            break;
+        case GEN_OCTET_STRING:
+            if (node->has_range && node->lo == node->hi) {
+                node->size = ber_sizeof_string_len(node->lo);
+            }
+            break;
+        case GEN_NULL:
+            node->size = 2;
+            break;
+        case GEN_SEQUENCE:
+            for (i = 0; i < node->child_num; ++i) {
+                if (node->children[i]->size == 0) {
+                    return;
+                }
+                len += node->children[i]->size;
+            }
+            node->content_len = len;
+            node->size = 1 + ber_sizeof_length(len) + len;
+            break;
+        case GEN_OID:
+        default:
+            break;
+    }
+}
+
+static struct gen_node *gen_parse_type(struct gen *g, const char *name);
+
+static void
+gen_parse_sequence(struct gen *g, struct gen_node *node)
+{
+    char name[GEN_NAME_LEN];
+    uint32_t i, value_num = 0;
+
+    gen_expect(g, "{");
+    do {
+        if (node->child_num == GEN_MAX_CHILDREN) {
+            gen_error(g, "too many SEQUENCE fields");
+        }
+
+        if (!islower((unsigned char)g->tok[0])) {
+            gen_error(g, "expected a field name, got '%s'", g->tok);
+        }
+
+        gen_c_name(g, name, g->tok);
+        for (i = 0; i < node->child_num; ++i) {
+            if (strcmp(node->children[i]->name, name) == 0) {
+                gen_error(g, "duplicate field '%s'", name);
+            }
+        }
+
+        gen_next(g);
+        node->children[node->child_num] = gen_parse_type(g, name);
+        value_num += node->children[node->child_num]->kind != GEN_NULL;
+        ++node->child_num;
+    } while (gen_accept(g, ","));
+    gen_expect(g, "}");
+
+    if (value_num == 0) {
+        gen_error(g, "SEQUENCE '%s' has no fields with values", node->name);
+    }
+}
+
+static void
+gen_parse_range(struct gen *g, struct gen_node *node)
+{
+    node->has_range = 1;
+    node->lo = gen_number(g);
+    node->hi = node->lo;
+    if (gen_accept(g, "..")) {
+        node->hi = gen_number(g);
+    }
+
+    if (node->lo > node->hi) {
+        gen_error(g, "empty range %u..%u", node->lo, node->hi);
+    }
+}
+
+static struct gen_node *
+gen_parse_type(struct gen *g, const char *name)
+{
+    struct gen_node *node = calloc(1, sizeof(*node));
+    int tag_class = -1;
+    uint32_t tag_num = 0;
+
+    if (node == NULL) {
+        gen_error(g, "out of memory");
+    }
+    snprintf(node->name, sizeof(node->name), "%s", name);
+
+    if (gen_accept(g, "[")) {
+        tag_class = gen_accept(g, "APPLICATION") ? 0x40 : 0x80;
+        tag_num = gen_number(g);
+        if (tag_num > 30) {
+            gen_error(g, "multi-byte tags are not supported");
+        }
+        gen_expect(g, "]");
+        gen_expect(g, "IMPLICIT");
+    }
+
+    if (gen_accept(g, "SEQUENCE")) {
+        node->kind = GEN_SEQUENCE;
+        node->tag = 0x30;
+        gen_parse_sequence(g, node);
+    } else if (gen_accept(g, "INTEGER")) {
+        node->kind = GEN_INTEGER;
+        node->tag = BER_DATA_T_INTEGER;
+        if (gen_accept(g, "(")) {
+            gen_parse_range(g, node);
+            gen_expect(g, ")");
+        }
+    } else if (gen_accept(g, "OCTET")) {
+        gen_expect(g, "STRING");
+        node->kind = GEN_OCTET_STRING;
+        node->tag = BER_DATA_T_OCTET_STRING;
+        if (gen_accept(g, "(")) {
+            gen_expect(g, "SIZE");
+            gen_expect(g, "(");
+            gen_parse_range(g, node);
+            gen_expect(g, ")");
+            gen_expect(g, ")");
+        }
+    } else if (gen_accept(g, "NULL")) {
+        node->kind = GEN_NULL;
+        node->tag = BER_DATA_T_NULL;
+    } else if (gen_accept(g, "OBJECT")) {
+        gen_expect(g, "IDENTIFIER");
+        node->kind = GEN_OID;
+        node->tag = 0x06;
+        g->has_oid = 1;
+    } else {
+        gen_error(g, "unsupported type '%s'", g->tok);
+    }
+
+    if (tag_class != -1) {
+        node->tag = (uint8_t)(tag_class | (node->tag & 0x20) | tag_num);
+    }
+
+    gen_node_size(node);
+    return node;
+}
+
+static void
+gen_parse(struct gen *g)
+{
+    char name[GEN_NAME_LEN];
+    int module = 0;
+
+    gen_next(g);
+    while (g->tok[0] != 0) {
+        if (module && gen_accept(g, "END")) {
+            break;
+        }
+
+        if (!isupper((unsigned char)g->tok[0])) {
+            gen_error(g, "expected a type name, got '%s'", g->tok);
+        }
+
+        gen_c_name(g, name, g->tok);
+        gen_next(g);
+        if (!module && g->type_num == 0 && gen_accept(g, "DEFINITIONS")) {
+            /* skip module header, e.g. "DEFINITIONS IMPLICIT TAGS ::= BEGIN" */
+            while (!gen_accept(g, "BEGIN")) {
+                if (g->tok[0] == 0) {
+                    gen_error(g, "expected 'BEGIN'");
+                }
+                gen_next(g);
+            }
+            module = 1;
+            continue;
+        }
+
+        if (g->type_num == GEN_MAX_TYPES) {
+            gen_error(g, "too many types");
+        }
+
+        gen_expect(g, "::=");
+        g->types[g->type_num] = gen_parse_type(g, name);
+        if (g->types[g->type_num]->kind != GEN_SEQUENCE) {
+            gen_error(g, "top-level type '%s' has to be a SEQUENCE", name);
+        }
+        ++g->type_num;
+    }
+
+    if (g->type_num == 0) {
+        gen_error(g, "no types defined");
+    }
+}
+
+static void
+gen_header_fields(struct gen *g, const struct gen_node *node, uint32_t indent)
+{
+    const struct gen_node *child;
+    char upper[GEN_NAME_LEN];
+    uint32_t i;
+
+    for (i = 0; i < node->child_num; ++i) {
+        child = node->children[i];
+        switch (child->kind) {
+            case GEN_SEQUENCE:
+                gen_emit(g, indent, "struct {\n");
+                gen_header_fields(g, child, indent + 1);
+                gen_emit(g, indent, "} %s;\n", child->name);
+                break;
+            case GEN_INTEGER:
+                gen_emit(g, indent, "uint32_t %s;\n", child->name);
+                break;
+            case GEN_OCTET_STRING:
+                gen_emit(g, indent, "const char *%s;\n", child->name);
+                gen_emit(g, indent, "uint32_t %s_len;\n", child->name);
+                break;
+            case GEN_OID:
+                gen_upper(upper, g->prefix);
+                gen_emit(g, indent, "uint32_t %s[%s_OID_LEN];\n", child->name, upper);
+                gen_emit(g, indent, "uint32_t %s_len; /**< number of arcs */\n", child->name);
+                break;
+            case GEN_NULL:
+            default:
+                break;
+        }
+    }
+}
+
+static void
+gen_header(struct gen *g, const char *schema)
+{
+    const struct gen_node *type;
+    char upper[GEN_NAME_LEN];
+    uint32_t i;
+
+    gen_upper(upper, g->prefix);
+    gen_emit(g, 0, "/* Generated by ber-gen from %s, do not edit. */\n\n", schema);
+    gen_emit(g, 0, "#ifndef BER_GEN_%s_H\n#define BER_GEN_%s_H\n\n", upper, upper);
+    gen_emit(g, 0, "#include <stdint.h>\n\n");
+    if (g->has_oid) {
+        gen_emit(g, 0, "/** Max number of arcs in OBJECT IDENTIFIER fields */\n");
+        gen_emit(g, 0, "#define %s_OID_LEN %u\n\n", upper, GEN_OID_LEN);
+    }
+
+    for (i = 0; i < g->type_num; ++i) {
+        type = g->types[i];
+        gen_emit(g, 0, "struct %s_%s {\n", g->prefix, type->name);
+        gen_header_fields(g, type, 1);
+        gen_emit(g, 0, "};\n\n");
+    }
+
+    gen_emit(g, 0, "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
+    for (i = 0; i < g->type_num; ++i) {
+        type = g->types[i];
+        gen_emit(g, 0, "/**\n"
+                       " * Encode struct %s_%s.\n"
+                       " * Note that this function does not check against output buffer overflow.\n",
+                 g->prefix, type->name);
+        if (type->size != 0) {
+            gen_emit(g, 0, " * It will write exactly %u bytes.\n", type->size);
+        }
+        gen_emit(g, 0, " * @param out pointer to the **end** of the output buffer.\n"
+                       " * The first encoded byte will be put in buf, next one in (buf - 1), etc.\n"
+                       " * @param msg message to encode\n"
+                       " * @return pointer to the next empty byte in the given buffer or NULL\n"
+                       " * if a field doesn't match its schema constraints.\n"
+                       " */\n");
+        gen_emit(g, 0, "uint8_t *%s_%s_encode(uint8_t *out, const struct %s_%s *msg);\n\n",
+                 g->prefix, type->name, g->prefix, type->name);
+
+        gen_emit(g, 0, "/**\n"
+                       " * Decode struct %s_%s.\n"
+                       " * This never reads past *buf* + *buf_len* and never writes to *buf*.\n"
+                       " * Strings are not NUL-terminated, they point into *buf*.\n"
+                       " * @param buf pointer to the **beginning** of the input buffer.\n"
+                       " * @param buf_len size of the input buffer\n"
+                       " * @param msg message to decode into\n"
+                       " * @return pointer to the next not processed byte in the given buffer or\n"
+                       " * NULL if the message is invalid or doesn't match the schema.\n"
+                       " */\n",
+                 g->prefix, type->name);
+        gen_emit(g, 0, "const uint8_t *%s_%s_decode(const uint8_t *buf, uint32_t buf_len,\n"
+                       "%*sstruct %s_%s *msg);\n\n",
+                 g->prefix, type->name, (int)(strlen(g->prefix) + strlen(type->name) + 24), "",
+                 g->prefix, type->name);
+    }
+    gen_emit(g, 0, "#ifdef __cplusplus\n}\n#endif\n\n#endif //BER_GEN_%s_H\n", upper);
+}
+
+/** Append field *name* to C expression *path*, which may end with -> */
+static void
+gen_path(struct gen *g, char *out, const char *path, const char *name)
+{
+    const char *sep = path[strlen(path) - 1] == '>' ? "" : ".";
+
+    if (snprintf(out, GEN_PATH_LEN, "%s%s%s", path, sep, name) >= GEN_PATH_LEN) {
+        gen_error(g, "field path too long: %s.%s", path, name);
+    }
+}
+
+/** Emit range check of *value*, skipping always true comparisons */
+static void
+gen_range_check(struct gen *g, const struct gen_node *node, const char *value, uint32_t indent)
+{
+    if (!node->has_range || (node->lo == 0 && node->hi == UINT32_MAX)) {
+        return;
+    }
+
+    if (node->lo == node->hi) {
+        gen_emit(g, indent, "if (%s != %uu) {\n", value, node->lo);
+    } else if (node->lo == 0) {
+        gen_emit(g, indent, "if (%s > %uu) {\n", value, node->hi);
+    } else if (node->hi == UINT32_MAX) {
+        gen_emit(g, indent, "if (%s < %uu) {\n", value, node->lo);
+    } else {
+        gen_emit(g, indent, "if (%s < %uu || %s > %uu) {\n", value, node->lo, value, node->hi);
+    }
+    gen_emit(g, indent + 1, "return NULL;\n");
+    gen_emit(g, indent, "}\n");
+}
+
+/** Emit constant type and length bytes, in reverse order */
+static void
+gen_encode_header(struct gen *g, uint8_t tag, uint32_t len, uint32_t indent)
+{
+    uint8_t hdr[6];
+    uint8_t *hdr_end = hdr + sizeof(hdr) - 1;
+    uint8_t *out = ber_encode_length(hdr_end, len);
+
+    while (hdr_end > out) {
+        gen_emit(g, indent, "*out-- = 0x%02x;\n", *hdr_end--);
+    }
+    gen_emit(g, indent, "*out-- = 0x%02x;\n", tag);
+}
+
+static void
+gen_encode_node(struct gen *g, const struct gen_node *node, const char *path, uint32_t depth,
+                uint32_t indent)
+{
+    char field[GEN_PATH_LEN], len_field[GEN_PATH_LEN + 8];
+    uint32_t i;
+
+    gen_path(g, field, path, node->name);
+    snprintf(len_field, sizeof(len_field), "%s_len", field);
+
+    switch (node->kind) {
+        case GEN_SEQUENCE:
+            if (node->size == 0) {
+                gen_emit(g, indent, "seq_end[%u] = out;\n", depth);
+            }
+            for (i = node->child_num; i > 0; --i) {
+                gen_encode_node(g, node->children[i - 1], field, depth + 1, indent);
+            }
+            if (node->size != 0) {
+                gen_encode_header(g, node->tag, node->content_len, indent);
+            } else {
+                gen_emit(g, indent, "out = ber_encode_length(out, (uint32_t)(seq_end[%u] - out));\n", depth);
+                gen_emit(g, indent, "*out-- = 0x%02x;\n", node->tag);
+            }
+            break;
+        case GEN_INTEGER:
+            gen_range_check(g, node, field, indent);
+            if (node->size != 0) {
+                for (i = 0; i < node->size - 2; ++i) {
+                    if (i == 0) {
+                        gen_emit(g, indent, "*out-- = (uint8_t)%s;\n", field);
+                    } else {
+                        gen_emit(g, indent, "*out-- = (uint8_t)(%s >> %u);\n", field, i * 8);
+                    }
+                }
+                gen_encode_header(g, node->tag, node->size - 2, indent);
+            } else {
+                gen_emit(g, indent, "out = ber_encode_int(out, %s);\n", field);
+                if (node->tag != BER_DATA_T_INTEGER) {
+                    gen_emit(g, indent, "out[1] = 0x%02x;\n", node->tag);
+                }
+            }
+            break;
+        case GEN_OCTET_STRING:
+            gen_range_check(g, node, len_field, indent);
+            if (node->size != 0) {
+                gen_emit(g, indent, "out -= %u;\n", node->lo);
+                gen_emit(g, indent, "memcpy(out + 1, %s, %u);\n", field, node->lo);
+                gen_encode_header(g, node->tag, node->lo, indent);
+            } else {
+                gen_emit(g, indent, "out = ber_encode_string_len(out, %s, %s);\n", field, len_field);
+                if (node->tag != BER_DATA_T_OCTET_STRING) {
+                    gen_emit(g, indent, "out[1] = 0x%02x;\n", node->tag);
+                }
+            }
+            break;
+        case GEN_NULL:
+            gen_encode_header(g, node->tag, 0, indent);
+            break;
+        case GEN_OID:
+            gen_emit(g, indent, "out = %s_encode_oid(out, %s, %s, 0x%02x);\n", g->prefix, field,
+                     len_field, node->tag);
+            gen_emit(g, indent, "if (out == NULL) {\n");
+            gen_emit(g, indent + 1, "return NULL;\n");
+            gen_emit(g, indent, "}\n");
+            break;
+        default:
+            break;
+    }
+}
+
+/** Emit checks of constant type and length bytes at *off* */
+static void
+gen_decode_fixed_header(struct gen *g, uint8_t tag, uint32_t len, uint32_t off, uint32_t indent)
+{
+    uint8_t hdr[6];
+    uint8_t *hdr_end = hdr + sizeof(hdr) - 1;
+    uint8_t *hdr_start = ber_encode_length(hdr_end, len);
+    uint32_t i, hdr_len = (uint32_t)(hdr_end - hdr_start);
+
+    *hdr_start = tag;
+    gen_emit(g, indent, "if (p[%u] != 0x%02x", off, tag);
+    for (i = 1; i <= hdr_len; ++i) {
+        fprintf(g->out, " || p[%u] != 0x%02x", off + i, hdr_start[i]);
+    }
+    fprintf(g->out, ") {\n");
+    gen_emit(g, indent + 1, "return NULL;\n");
+    gen_emit(g, indent, "}\n");
+}
+
+/** Emit decoding of an object of constant size at offset *off* from p */
+static void
+gen_decode_fixed(struct gen *g, const struct gen_node *node, const char *path, uint32_t off,
+                 uint32_t indent)
+{
+    char field[GEN_PATH_LEN], len_field[GEN_PATH_LEN + 8];
+    uint32_t i, len, hdr_len;
+
+    gen_path(g, field, path, node->name);
+    snprintf(len_field, sizeof(len_field), "%s_len", field);
+
+    switch (node->kind) {
+        case GEN_SEQUENCE:
+            gen_decode_fixed_header(g, node->tag, node->content_len, off, indent);
+            off += node->size - node->content_len;
+            for (i = 0; i < node->child_num; ++i) {
+                gen_decode_fixed(g, node->children[i], field, off, indent);
+                off += node->children[i]->size;
+            }
+            break;
+        case GEN_INTEGER:
+            len = node->size - 2;
+            gen_decode_fixed_header(g, node->tag, len, off, indent);
+            gen_emit(g, indent, "%s = ", field);
+            for (i = 0; i < len; ++i) {
+                if (i > 0) {
+                    fprintf(g->out, " | ");
+                }
+                if (i == len - 1) {
+                    fprintf(g->out, "p[%u]", off + 2 + i);
+                } else {
+                    fprintf(g->out, "(uint32_t)p[%u] << %u", off + 2 + i, (len - 1 - i) * 8);
+                }
+            }
+            fprintf(g->out, ";\n");
+            gen_range_check(g, node, field, indent);
+            break;
+        case GEN_OCTET_STRING:
+            hdr_len = node->size - node->lo;
+            gen_decode_fixed_header(g, node->tag, node->lo, off, indent);
+            gen_emit(g, indent, "%s = (const char *)p + %u;\n", field, off + hdr_len);
+            gen_emit(g, indent, "%s = %u;\n", len_field, node->lo);
+            break;
+        case GEN_NULL:
+            gen_decode_fixed_header(g, node->tag, 0, off, indent);
+            break;
+        case GEN_OID:
+        default:
+            break;
+    }
+}
+
+static void
+gen_decode_header(struct gen *g, uint8_t tag, const char *end, uint32_t indent)
+{
+    gen_emit(g, indent, "p = ber_decode_header(p, (uint32_t)(%s - p), 0x%02x, &len);\n", end, tag);
+    gen_emit(g, indent, "if (p == NULL) {\n");
+    gen_emit(g, indent + 1, "return NULL;\n");
+    gen_emit(g, indent, "}\n");
+}
+
+static void
+gen_decode_node(struct gen *g, const struct gen_node *node, const char *path, const char *end,
+                uint32_t depth, uint32_t indent)
+{
+    char field[GEN_PATH_LEN], len_field[GEN_PATH_LEN + 8], seq_end[32];
+    uint32_t i;
+
+    gen_path(g, field, path, node->name);
+    snprintf(len_field, sizeof(len_field), "%s_len", field);
+
+    if (node->size != 0) {
+        gen_emit(g, indent, "if (%s - p < %u) {\n", end, node->size);
+        gen_emit(g, indent + 1, "return NULL;\n");
+        gen_emit(g, indent, "}\n");
+        gen_decode_fixed(g, node, path, 0, indent);
+        gen_emit(g, indent, "p += %u;\n", node->size);
+        return;
+    }
+
+    gen_decode_header(g, node->tag, end, indent);
+    switch (node->kind) {
+        case GEN_SEQUENCE:
+            snprintf(seq_end, sizeof(seq_end), "seq_end[%u]", depth);
+            gen_emit(g, indent, "%s = p + len;\n", seq_end);
+            for (i = 0; i < node->child_num; ++i) {
+                gen_decode_node(g, node->children[i], field, seq_end, depth + 1, indent);
+            }
+            gen_emit(g, indent, "if (p != %s) {\n", seq_end);
+            gen_emit(g, indent + 1, "return NULL;\n");
+            gen_emit(g, indent, "}\n");
+            break;
+        case GEN_INTEGER:
+            gen_emit(g, indent, "if (len == 0 || len > 4) {\n");
+            gen_emit(g, indent + 1, "return NULL;\n");
+            gen_emit(g, indent, "}\n");
+            gen_emit(g, indent, "%s = 0;\n", field);
+            gen_emit(g, indent, "while (len--) {\n");
+            gen_emit(g, indent + 1, "%s = %s << 8 | *p++;\n", field, field);
+            gen_emit(g, indent, "}\n");
+            gen_range_check(g, node, field, indent);
+            break;
+        case GEN_OCTET_STRING:
+            gen_emit(g, indent, "%s = (const char *)p;\n", field);
+            gen_emit(g, indent, "%s = len;\n", len_field);
+            gen_range_check(g, node, len_field, indent);
+            gen_emit(g, indent, "p += len;\n");
+            break;
+        case GEN_OID:
+            gen_emit(g, indent, "p = %s_decode_oid(p, len, %s, &%s);\n", g->prefix, field, len_field);
+            gen_emit(g, indent, "if (p == NULL) {\n");
+            gen_emit(g, indent + 1, "return NULL;\n");
+            gen_emit(g, indent, "}\n");
+            break;
+        case GEN_NULL:
+        default:
+            break;
+    }
+}
+
+static uint32_t
+gen_max_depth(const struct gen_node *node)
+{
+    uint32_t i, depth, max = 0;
+
+    for (i = 0; i < node->child_num; ++i) {
+        depth = gen_max_depth(node->children[i]);
+        max = depth > max ? depth : max;
+    }
+
+    return max + (node->kind == GEN_SEQUENCE);
+}
+
+static void
+gen_oid_helpers(struct gen *g)
+{
+    char upper[GEN_NAME_LEN];
+
+    gen_upper(upper, g->prefix);
+    gen_emit(g, 0, "static uint8_t *\n"
+                   "%s_encode_oid(uint8_t *out, const uint32_t *oid, uint32_t oid_len, uint8_t tag)\n"
+                   "{\n"
+                   "    uint8_t *out_end = out;\n"
+                   "    uint32_t i;\n"
+                   "\n"
+                   "    if (oid_len < 2 || oid_len > %s_OID_LEN) {\n"
+                   "        return NULL;\n"
+                   "    }\n"
+                   "\n"
+                   "    for (i = oid_len - 1; i > 1; --i) {\n"
+                   "        out = ber_encode_vlint(out, oid[i]);\n"
+                   "    }\n"
+                   "\n"
+                   "    out = ber_encode_vlint(out, oid[0] * 40 + oid[1]);\n"
+                   "    out = ber_encode_length(out, (uint32_t)(out_end - out));\n"
+                   "    *out-- = tag;\n"
+                   "\n"
+                   "    return out;\n"
+                   "}\n\n",
+             g->prefix, upper);
+    gen_emit(g, 0, "static const uint8_t *\n"
+                   "%s_decode_oid(const uint8_t *buf, uint32_t len, uint32_t *oid, uint32_t *oid_len)\n"
+                   "{\n"
+                   "    uint32_t arcs_len = %s_OID_LEN - 2;\n"
+                   "\n"
+                   "    if (len == 0) {\n"
+                   "        return NULL;\n"
+                   "    }\n"
+                   "\n"
+                   "    oid[0] = *buf / 40;\n"
+                   "    oid[1] = *buf %% 40;\n"
+                   "    if (ber_decode_vlint_batch((uint8_t *)(uintptr_t)(buf + 1), len - 1, oid + 2,\n"
+                   "                               &arcs_len) == NULL) {\n"
+                   "        return NULL;\n"
+                   "    }\n"
+                   "\n"
+                   "    *oid_len = arcs_len + 2;\n"
+                   "    return buf + len;\n"
+                   "}\n\n",
+             g->prefix, upper);
+}
+
+static void
+gen_source(struct gen *g, const char *schema, const char *header)
+{
+    const struct gen_node *type;
+    uint32_t i, j, depth, off;
+
+    gen_emit(g, 0, "/* Generated by ber-gen from %s, do not edit. */\n\n", schema);
+    gen_emit(g, 0, "#include <stdint.h>\n#include <string.h>\n#include \"ber.h\"\n#include \"%s\"\n\n", header);
+    if (g->has_oid) {
+        gen_oid_helpers(g);
+    }
+
+    for (i = 0; i < g->type_num; ++i) {
+        type = g->types[i];
+        depth = gen_max_depth(type);
+
+        gen_emit(g, 0, "uint8_t *\n%s_%s_encode(uint8_t *out, const struct %s_%s *msg)\n{\n",
+                 g->prefix, type->name, g->prefix, type->name);
+        if (type->size == 0) {
+            gen_emit(g, 1, "uint8_t *seq_end[%u];\n\n", depth);
+            gen_emit(g, 1, "seq_end[0] = out;\n");
+        }
+        for (j = type->child_num; j > 0; --j) {
+            gen_encode_node(g, type->children[j - 1], "msg->", 1, 1);
+        }
+        if (type->size != 0) {
+            gen_encode_header(g, type->tag, type->content_len, 1);
+        } else {
+            gen_emit(g, 1, "out = ber_encode_length(out, (uint32_t)(seq_end[0] - out));\n");
+            gen_emit(g, 1, "*out-- = 0x%02x;\n", type->tag);
+        }
+        gen_emit(g, 0, "\n    return out;\n}\n\n");
+
+        gen_emit(g, 0, "const uint8_t *\n%s_%s_decode(const uint8_t *buf, uint32_t buf_len,\n"
+                       "%*sstruct %s_%s *msg)\n{\n",
+                 g->prefix, type->name, (int)(strlen(g->prefix) + strlen(type->name) + 9), "",
+                 g->prefix, type->name);
+        if (type->size != 0) {
+            /* the whole message at fixed offsets */
+            gen_emit(g, 1, "const uint8_t *p = buf;\n\n");
+            gen_emit(g, 1, "if (buf_len < %u) {\n", type->size);
+            gen_emit(g, 2, "return NULL;\n");
+            gen_emit(g, 1, "}\n");
+            gen_decode_fixed_header(g, type->tag, type->content_len, 0, 1);
+            off = type->size - type->content_len;
+            for (j = 0; j < type->child_num; ++j) {
+                gen_decode_fixed(g, type->children[j], "msg->", off, 1);
+                off += type->children[j]->size;
+            }
+            gen_emit(g, 0, "\n    return p + %u;\n}\n\n", type->size);
+            continue;
+        }
+
+        gen_emit(g, 1, "const uint8_t *p = buf;\n");
+        gen_emit(g, 1, "const uint8_t *seq_end[%u];\n", depth);
+        gen_emit(g, 1, "uint32_t len;\n\n");
+        gen_decode_header(g, type->tag, "buf + buf_len", 1);
+        gen_emit(g, 1, "seq_end[0] = p + len;\n");
+        for (j = 0; j < type->child_num; ++j) {
+            gen_decode_node(g, type->children[j], "msg->", "seq_end[0]", 1, 1);
+        }
+        gen_emit(g, 1, "if (p != seq_end[0]) {\n");
+        gen_emit(g, 2, "return NULL;\n");
+        gen_emit(g, 1, "}\n");
+        gen_emit(g, 0, "\n    return p;\n}\n\n");
+    }
+}
+
+static char *
+gen_read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf;
+    long size;
+
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+        fseek(f, 0, SEEK_SET) != 0) {
+        perror(path);
+        exit(1);
+    }
+
+    buf = malloc((size_t)size + 1);
+    if (buf == NULL || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        perror(path);
+        exit(1);
+    }
+
+    buf[size] = 0;
+    fclose(f);
+    return buf;
+}
+
+static void
+gen_write(struct gen *g, const char *path, const char *schema, const char *header)
+{
+    g->out = fopen(path, "w");
+    if (g->out == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    if (header == NULL) {
+        gen_header(g, schema);
+    } else {
+        gen_source(g, schema, header);
+    }
+
+    if (fclose(g->out) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static void
+gen_free_node(struct gen_node *node)
+{
+    uint32_t i;
+
+    for (i = 0; i < node->child_num; ++i) {
+        gen_free_node(node->children[i]);
+    }
+    free(node);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct gen g = { 0 };
+    char c_path[GEN_PATH_LEN], h_path[GEN_PATH_LEN];
+    const char *schema, *base;
+    uint32_t i;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <schema.asn1> <output>\n", argv[0]);
+        return 1;
+    }
+
+    base = strrchr(argv[2], '/');
+    base = base != NULL ? base + 1 : argv[2];
+    schema = strrchr(argv[1], '/');
+    schema = schema != NULL ? schema + 1 : argv[1];
+    if (snprintf(g.prefix, sizeof(g.prefix), "%s", base) >= (int)sizeof(g.prefix) ||
+        snprintf(c_path, sizeof(c_path), "%s.c", argv[2]) >= (int)sizeof(c_path) ||
+        snprintf(h_path, sizeof(h_path), "%s.h", argv[2]) >= (int)sizeof(h_path)) {
+        fprintf(stderr, "output path too long\n");
+        return 1;
+    }
+
+    g.path = argv[1];
+    g.src = gen_read_file(argv[1]);
+    g.pos = g.src;
+    g.line = 1;
+    gen_parse(&g);
+
+    gen_write(&g, h_path, schema, NULL);
+    gen_write(&g, c_path, schema, strrchr(h_path, '/') ? strrchr(h_path, '/') + 1 : h_path);
+
+    for (i = 0; i < g.type_num; ++i) {
+        gen_free_node(g.types[i]);
+    }
+    free((char *)(uintptr_t)g.src);
+    return 0;
+}
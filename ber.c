@@ -10,10 +10,20 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include "ber.h"
+#include "ber_stats.h"
+
+#if !defined(BER_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define BER_VLINT_SIMD_WIDTH 32
+#elif !defined(BER_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define BER_VLINT_SIMD_WIDTH 16
+#endif
 
 uint8_t *
 ber_encode_vlint(uint8_t *out, uint32_t num)
 {
+    BER_STATS_CALL(ENCODE_VLINT);
     *out-- = (uint8_t)(num & 0x7F);
     num >>= 7;
 
@@ -30,14 +40,19 @@ ber_decode_vlint(uint8_t *buf, uint32_t *num)
 {
     int i;
 
-    *num = (uint32_t)(*buf & 0x7F);
-    for (i = 0; i < 4; ++i) {
-        if ((*buf++ & 0x80) == 0) {
-            return buf;
+    BER_STATS_CALL(DECODE_VLINT);
+    *num = 0;
+    for (i = 0; i < 5; ++i) {
+        /* 5th byte may only add the lowest 4 of 32 bits */
+        if (i == 4 && *num >> 25) {
+            return NULL;
         }
-
         *num <<= 7;
         *num |= (*buf & 0x7F);
+
+        if ((*buf++ & 0x80) == 0) {
+            return buf;
+        }
     }
 
     /* if 5th byte is not the last one,
@@ -45,12 +60,121 @@ ber_decode_vlint(uint8_t *buf, uint32_t *num)
     return NULL;
 }
 
+#ifdef BER_VLINT_SIMD_WIDTH
+/* bit i is set if byte i has its continuation bit set */
+static uint32_t
+ber_vlint_cont_mask(const uint8_t *buf)
+{
+#if BER_VLINT_SIMD_WIDTH == 32
+    return (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)buf));
+#else
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)buf));
+#endif
+}
+
+/* zero-extend BER_VLINT_SIMD_WIDTH single-byte vlints into nums */
+static void
+ber_vlint_widen(const uint8_t *buf, uint32_t *nums)
+{
+#if BER_VLINT_SIMD_WIDTH == 32
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadl_epi64((const __m128i *)(buf + i * 8));
+        _mm256_storeu_si256((__m256i *)(nums + i * 8), _mm256_cvtepu8_epi32(v));
+    }
+#else
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_loadu_si128((const __m128i *)buf);
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+    _mm_storeu_si128((__m128i *)nums, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)(nums + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)(nums + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i *)(nums + 12), _mm_unpackhi_epi16(hi, zero));
+#endif
+}
+#endif
+
+uint8_t *
+ber_decode_vlint_batch(uint8_t *buf, uint32_t len, uint32_t *nums, uint32_t *nums_len)
+{
+    uint8_t *buf_end = buf + len;
+    uint32_t *nums_start = nums;
+    uint32_t *nums_end = nums + *nums_len;
+    uint32_t num = 0, num_bytes = 0;
+#ifdef BER_VLINT_SIMD_WIDTH
+    uint32_t cont, run;
+#endif
+
+    BER_STATS_CALL(DECODE_VLINT_BATCH);
+#ifdef BER_VLINT_SIMD_WIDTH
+    while (buf_end - buf >= BER_VLINT_SIMD_WIDTH) {
+        cont = ber_vlint_cont_mask(buf);
+        if (num_bytes == 0 && nums_end - nums >= BER_VLINT_SIMD_WIDTH) {
+            /* every byte before the first continuation bit is a whole vlint */
+            run = cont ? (uint32_t)__builtin_ctz(cont) : BER_VLINT_SIMD_WIDTH;
+            ber_vlint_widen(buf, nums);
+            buf += run;
+            nums += run;
+            if (run == BER_VLINT_SIMD_WIDTH) {
+                continue;
+            }
+        }
+
+        /* multi-byte vlint, finish it the scalar way */
+        do {
+            if (++num_bytes > 5 || (num_bytes == 5 && num >> 25)) {
+                return NULL;
+            }
+            num = (num << 7) | (*buf & 0x7F);
+        } while ((*buf++ & 0x80) && buf < buf_end);
+
+        if ((*(buf - 1) & 0x80) == 0) {
+            if (nums == nums_end) {
+                return NULL;
+            }
+            *nums++ = num;
+            num = 0;
+            num_bytes = 0;
+        }
+    }
+#endif
+
+    while (buf < buf_end) {
+        /* 5th byte may only add the lowest 4 of 32 bits */
+        if (++num_bytes > 5 || (num_bytes == 5 && num >> 25)) {
+            return NULL;
+        }
+        num = (num << 7) | (*buf & 0x7F);
+
+        if ((*buf++ & 0x80) == 0) {
+            if (nums == nums_end) {
+                return NULL;
+            }
+            *nums++ = num;
+            num = 0;
+            num_bytes = 0;
+        }
+    }
+
+    if (num_bytes != 0) {
+        return NULL; /* last vlint is not terminated */
+    }
+
+    *nums_len = (uint32_t)(nums - nums_start);
+
+    return buf;
+}
+
 uint8_t *
 ber_encode_int(uint8_t *out, uint32_t num)
 {
     uint8_t *out_end = out;
     uint8_t len;
 
+    BER_STATS_CALL(ENCODE_INT);
     do {
         *out-- = (uint8_t)(num & 0xFF);
         num >>= 8;
@@ -68,6 +192,7 @@ ber_decode_int(uint8_t *buf, uint32_t *num)
 {
     uint8_t i, len;
 
+    BER_STATS_CALL(DECODE_INT);
     buf++; /* ignore ber type, assume it's integer */
     len = *buf++;
     if (len > 4) {
@@ -83,11 +208,58 @@ ber_decode_int(uint8_t *buf, uint32_t *num)
     return buf;
 }
 
+/** Number of bytes needed for unsigned *num* as a non-negative BER integer */
+static inline uint32_t
+ber_uint64_len(uint64_t num)
+{
+    /* one more bit for the sign, so the top bit can be encoded as 0x00 */
+    return (uint32_t)(64 - __builtin_clzll(num | 1)) / 8 + 1;
+}
+
+uint8_t *
+ber_encode_uint64(uint8_t *out, uint64_t num, uint8_t type)
+{
+    uint32_t i, len = ber_uint64_len(num);
+
+    BER_STATS_CALL(ENCODE_UINT64);
+    /* the 9th byte, if any, is the sign byte - already shifted out to 0 */
+    for (i = 0; i < len; ++i) {
+        *out-- = (uint8_t)num;
+        num >>= 8;
+    }
+
+    *out-- = (uint8_t)len;
+    *out-- = type;
+
+    return out;
+}
+
+uint8_t *
+ber_decode_uint64(uint8_t *buf, uint64_t *num)
+{
+    uint8_t i, len;
+
+    BER_STATS_CALL(DECODE_UINT64);
+    buf++; /* ignore ber type */
+    len = *buf++;
+    if (len == 0 || len > 9 || (len == 9 && *buf != 0)) {
+        return NULL; /* won't fit in uint64_t */
+    }
+
+    *num = 0;
+    for (i = 0; i < len; ++i) {
+        *num = *num << 8 | *buf++;
+    }
+
+    return buf;
+}
+
 uint8_t *
 ber_encode_length(uint8_t *out, uint32_t length)
 {
     uint8_t *out_end = out;
 
+    BER_STATS_CALL(ENCODE_LENGTH);
     if (length < 0x80) {
         *out-- = (uint8_t)length;
         return out;
@@ -109,11 +281,14 @@ ber_decode_length(uint8_t *buf, uint32_t *length)
 {
     uint8_t i, length_bytes;
 
+    BER_STATS_CALL(DECODE_LENGTH);
     if ((*buf & 0x80) == 0) {
         *length = (uint32_t)*buf++;
         return buf;
     }
 
+    BER_STATS_ADD(long_lengths, 1);
+
     length_bytes = (uint8_t)(*buf++ & 0x7F);
     if (length_bytes > 4) {
         return NULL; /* won't fit in uint32_t */
@@ -131,12 +306,9 @@ ber_decode_length(uint8_t *buf, uint32_t *length)
 uint8_t *
 ber_encode_string_len(uint8_t *out, const char *str, uint32_t str_len)
 {
-    uint32_t i;
-
-    str += str_len - 1;
-    for (i = 0; i < str_len; ++i) {
-        *out-- = (uint8_t)*str--;
-    }
+    BER_STATS_CALL(ENCODE_STRING);
+    out -= str_len;
+    memcpy(out + 1, str, str_len);
 
     out = ber_encode_length(out, str_len);
     *out-- = BER_DATA_T_OCTET_STRING;
@@ -155,6 +327,7 @@ ber_encode_string(uint8_t *out, const char *str)
 uint8_t *
 ber_decode_string_len_buffer(uint8_t *buf, const char **str, uint32_t *str_len)
 {
+    BER_STATS_CALL(DECODE_STRING);
     buf++; /* ignore ber type, assume it's string */
     buf = ber_decode_length(buf, str_len);
     if (buf == NULL) {
@@ -204,6 +377,28 @@ ber_decode_string_alloc(uint8_t *buf, char **str, uint32_t maxlen)
     return buf + str_len;
 }
 
+uint8_t *
+ber_decode_string_arena(uint8_t *buf, struct ber_arena *arena, char **str, uint32_t maxlen)
+{
+    uint32_t str_len;
+
+    buf++; /* ignore ber type, assume it's string */
+    buf = ber_decode_length(buf, &str_len);
+    if (buf == NULL || str_len > maxlen) {
+        return NULL;
+    }
+
+    *str = ber_arena_alloc(arena, str_len + 1); /* +1 for NUL */
+    if (*str == NULL) {
+        return NULL;
+    }
+
+    memcpy(*str, buf, str_len);
+    (*str)[str_len] = 0;
+
+    return buf + str_len;
+}
+
 uint8_t *
 ber_encode_null(uint8_t *out)
 {
@@ -219,6 +414,531 @@ ber_decode_null(uint8_t *buf)
     return buf + 2;
 }
 
+uint32_t
+ber_sizeof_vlint(uint32_t num)
+{
+    uint32_t size = 1;
+
+    while (num >>= 7) {
+        ++size;
+    }
+
+    return size;
+}
+
+uint32_t
+ber_sizeof_int(uint32_t num)
+{
+    /* type, length and at least one byte */
+    return 2 + 1 + (uint32_t)(31 - __builtin_clz(num | 1)) / 8;
+}
+
+uint32_t
+ber_sizeof_uint64(uint64_t num)
+{
+    return 2 + ber_uint64_len(num);
+}
+
+uint32_t
+ber_sizeof_length(uint32_t length)
+{
+    uint32_t size = 1;
+
+    if (length < 0x80) {
+        return size;
+    }
+
+    while (length) {
+        ++size;
+        length >>= 8;
+    }
+
+    return size;
+}
+
+uint32_t
+ber_sizeof_string_len(uint32_t str_len)
+{
+    return 1 + ber_sizeof_length(str_len) + str_len;
+}
+
+/* reserved for every open constructed type: 0x84 and 4 bytes of length */
+#define BER_WRITER_LEN_RESERVED 5
+/* open[] mark of a constructed type opened with ber_writer_begin_len */
+#define BER_WRITER_LEN_KNOWN UINT32_MAX
+
+void
+ber_writer_init(struct ber_writer *w, uint8_t *buf, uint32_t size,
+                ber_writer_flush_cb flush, void *ctx)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->depth = 0;
+    w->flushed = 0;
+    w->flush = flush;
+    w->ctx = ctx;
+}
+
+int
+ber_writer_flush(struct ber_writer *w)
+{
+    uint32_t done = w->len;
+    uint32_t i;
+
+    if (w->flush == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < w->depth; ++i) {
+        if (w->open[i] != BER_WRITER_LEN_KNOWN) {
+            done = w->open[i];
+            break;
+        }
+    }
+
+    if (done == 0) {
+        return 0;
+    }
+
+    if (w->flush(w->ctx, w->buf, done) != 0) {
+        return -1;
+    }
+
+    memmove(w->buf, w->buf + done, w->len - done);
+    w->len -= done;
+    w->flushed += done;
+    for (i = 0; i < w->depth; ++i) {
+        if (w->open[i] != BER_WRITER_LEN_KNOWN) {
+            w->open[i] -= done;
+        }
+    }
+
+    return 0;
+}
+
+/* return pointer to *len* free bytes, flushing if necessary */
+static uint8_t *
+ber_writer_reserve(struct ber_writer *w, uint32_t len)
+{
+    uint8_t *out;
+
+    if (len > w->size - w->len) {
+        if (ber_writer_flush(w) != 0 || len > w->size - w->len) {
+            return NULL;
+        }
+    }
+
+    out = w->buf + w->len;
+    w->len += len;
+
+    return out;
+}
+
+int
+ber_writer_begin(struct ber_writer *w, uint8_t type)
+{
+    uint8_t *out;
+
+    if (w->depth == BER_WRITER_MAX_DEPTH) {
+        return -1;
+    }
+
+    out = ber_writer_reserve(w, 1 + BER_WRITER_LEN_RESERVED);
+    if (out == NULL) {
+        return -1;
+    }
+
+    *out = type;
+    w->open[w->depth++] = w->len - BER_WRITER_LEN_RESERVED;
+
+    return 0;
+}
+
+int
+ber_writer_begin_len(struct ber_writer *w, uint8_t type, uint32_t len)
+{
+    uint8_t len_buf[BER_WRITER_LEN_RESERVED];
+    uint8_t *len_end = len_buf + sizeof(len_buf) - 1;
+    uint8_t *len_out, *out;
+    uint32_t len_size;
+
+    if (w->depth == BER_WRITER_MAX_DEPTH) {
+        return -1;
+    }
+
+    len_out = ber_encode_length(len_end, len);
+    len_size = (uint32_t)(len_end - len_out);
+
+    out = ber_writer_reserve(w, 1 + len_size);
+    if (out == NULL) {
+        return -1;
+    }
+
+    *out = type;
+    memcpy(out + 1, len_out + 1, len_size);
+    w->open[w->depth] = BER_WRITER_LEN_KNOWN;
+    w->end[w->depth++] = w->flushed + w->len + len;
+
+    return 0;
+}
+
+int
+ber_writer_end(struct ber_writer *w)
+{
+    uint8_t len_buf[BER_WRITER_LEN_RESERVED];
+    uint8_t *len_end = len_buf + sizeof(len_buf) - 1;
+    uint8_t *len_out, *slot;
+    uint32_t content_len, len_size;
+
+    if (w->depth == 0) {
+        return -1;
+    }
+
+    if (w->open[w->depth - 1] == BER_WRITER_LEN_KNOWN) {
+        if (w->flushed + w->len != w->end[w->depth - 1]) {
+            return -1;
+        }
+        --w->depth;
+        return 0;
+    }
+
+    slot = w->buf + w->open[--w->depth];
+    content_len = w->len - w->open[w->depth] - BER_WRITER_LEN_RESERVED;
+    len_out = ber_encode_length(len_end, content_len);
+    len_size = (uint32_t)(len_end - len_out);
+
+    /* shrink the reserved space to the actual length size */
+    memmove(slot + len_size, slot + BER_WRITER_LEN_RESERVED, content_len);
+    memcpy(slot, len_out + 1, len_size);
+    w->len -= BER_WRITER_LEN_RESERVED - len_size;
+
+    return 0;
+}
+
+int
+ber_writer_int(struct ber_writer *w, uint32_t num)
+{
+    uint32_t size = ber_sizeof_int(num);
+    uint8_t *out = ber_writer_reserve(w, size);
+
+    if (out == NULL) {
+        return -1;
+    }
+
+    ber_encode_int(out + size - 1, num);
+
+    return 0;
+}
+
+int
+ber_writer_uint64(struct ber_writer *w, uint64_t num, uint8_t type)
+{
+    uint32_t size = ber_sizeof_uint64(num);
+    uint8_t *out = ber_writer_reserve(w, size);
+
+    if (out == NULL) {
+        return -1;
+    }
+
+    ber_encode_uint64(out + size - 1, num, type);
+
+    return 0;
+}
+
+int
+ber_writer_vlint(struct ber_writer *w, uint32_t num)
+{
+    uint32_t size = ber_sizeof_vlint(num);
+    uint8_t *out = ber_writer_reserve(w, size);
+
+    if (out == NULL) {
+        return -1;
+    }
+
+    ber_encode_vlint(out + size - 1, num);
+
+    return 0;
+}
+
+int
+ber_writer_string_len(struct ber_writer *w, const char *str, uint32_t str_len)
+{
+    uint32_t size = ber_sizeof_length(str_len);
+    uint8_t *out = ber_writer_reserve(w, 1 + size);
+
+    if (out == NULL) {
+        return -1;
+    }
+
+    ber_encode_length(out + size, str_len);
+    *out = BER_DATA_T_OCTET_STRING;
+
+    return ber_writer_raw(w, (const uint8_t *)str, str_len);
+}
+
+int
+ber_writer_null(struct ber_writer *w)
+{
+    uint8_t *out = ber_writer_reserve(w, 2);
+
+    if (out == NULL) {
+        return -1;
+    }
+
+    ber_encode_null(out + 1);
+
+    return 0;
+}
+
+int
+ber_writer_raw(struct ber_writer *w, const uint8_t *data, uint32_t len)
+{
+    uint32_t chunk;
+
+    /* big chunks can be streamed through the flush callback */
+    while (len > w->size - w->len) {
+        chunk = w->size - w->len;
+        memcpy(w->buf + w->len, data, chunk);
+        w->len += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (ber_writer_flush(w) != 0 || w->len == w->size) {
+            return -1;
+        }
+    }
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+
+    return 0;
+}
+
+enum ber_stream_state {
+    BER_STREAM_S_TAG = 0,
+    BER_STREAM_S_LEN,
+    BER_STREAM_S_LEN_BYTES,
+    BER_STREAM_S_VALUE,
+    BER_STREAM_S_ERROR,
+};
+
+void
+ber_stream_init(struct ber_stream *s)
+{
+    s->state = BER_STREAM_S_TAG;
+    s->pos = 0;
+    s->depth = 0;
+}
+
+/** Validate just decoded TLV header against the enclosing types */
+static int
+ber_stream_header(struct ber_stream *s)
+{
+    uint32_t parent_end = s->depth > 0 ? s->end[s->depth - 1] : UINT32_MAX;
+
+    /* the header itself may already run past the enclosing type */
+    if (s->pos > parent_end || s->len > parent_end - s->pos) {
+        return -1;
+    }
+
+    if (s->type & 0x20) {
+        if (s->depth == BER_STREAM_MAX_DEPTH) {
+            return -1;
+        }
+        s->end[s->depth++] = s->pos + s->len;
+    }
+
+    s->value_used = 0;
+    return 0;
+}
+
+static int
+ber_stream_emit(struct ber_stream *s, struct ber_stream_token *tok,
+                uint32_t depth, const uint8_t *value)
+{
+    tok->type = s->type;
+    tok->constructed = (uint8_t)((s->type & 0x20) != 0);
+    tok->depth = depth;
+    tok->len = s->len;
+    tok->value = tok->constructed ? NULL : value;
+    tok->value_off = 0;
+    tok->value_len = tok->constructed ? 0 : s->len;
+    s->state = BER_STREAM_S_TAG;
+
+    /* close all types that end with this token */
+    while (s->depth > 0 && s->end[s->depth - 1] == s->pos) {
+        --s->depth;
+    }
+
+    if (s->depth == 0) {
+        s->pos = 0;
+    }
+
+    return BER_STREAM_TOKEN;
+}
+
+/** Report the next piece of a value too long to be buffered */
+static int
+ber_stream_emit_piece(struct ber_stream *s, struct ber_stream_token *tok,
+                      const uint8_t *value, uint32_t value_len)
+{
+    uint32_t value_off = s->value_used;
+
+    s->value_used += value_len;
+    s->pos += value_len;
+    if (s->value_used == s->len) {
+        ber_stream_emit(s, tok, s->depth, value);
+    } else {
+        tok->type = s->type;
+        tok->constructed = 0;
+        tok->depth = s->depth;
+        tok->len = s->len;
+        tok->value = value;
+    }
+
+    tok->value_off = value_off;
+    tok->value_len = value_len;
+    return BER_STREAM_TOKEN;
+}
+
+int
+ber_stream_feed(struct ber_stream *s, const uint8_t *data, uint32_t len,
+                uint32_t *consumed, struct ber_stream_token *tok)
+{
+    const uint8_t *buf = data;
+    const uint8_t *buf_end = data + len;
+    uint32_t chunk, depth;
+
+    if (s->state == BER_STREAM_S_ERROR) {
+        *consumed = 0;
+        return BER_STREAM_ERROR;
+    }
+
+    while (buf < buf_end) {
+        switch (s->state) {
+            case BER_STREAM_S_TAG:
+                s->type = *buf++;
+                ++s->pos;
+                if ((s->type & 0x1F) == 0x1F) {
+                    goto error; /* multi-byte tags are not supported */
+                }
+                s->state = BER_STREAM_S_LEN;
+                continue;
+            case BER_STREAM_S_LEN:
+                ++s->pos;
+                if ((*buf & 0x80) == 0) {
+                    s->len = *buf++;
+                    break;
+                }
+
+                s->len_bytes = (uint8_t)(*buf++ & 0x7F);
+                if (s->len_bytes == 0 || s->len_bytes > 4) {
+                    goto error; /* indefinite or won't fit in uint32_t */
+                }
+                s->len = 0;
+                s->state = BER_STREAM_S_LEN_BYTES;
+                continue;
+            case BER_STREAM_S_LEN_BYTES:
+                s->len = (s->len << 8) | *buf++;
+                ++s->pos;
+                if (--s->len_bytes > 0) {
+                    continue;
+                }
+                break;
+            case BER_STREAM_S_VALUE:
+                chunk = s->len - s->value_used;
+                if (chunk > (uint32_t)(buf_end - buf)) {
+                    chunk = (uint32_t)(buf_end - buf);
+                }
+
+                if (s->len > BER_STREAM_VALUE_MAX) {
+                    buf += chunk;
+                    *consumed = (uint32_t)(buf - data);
+                    return ber_stream_emit_piece(s, tok, buf - chunk, chunk);
+                }
+
+                memcpy(s->value + s->value_used, buf, chunk);
+                s->value_used += chunk;
+                s->pos += chunk;
+                buf += chunk;
+                if (s->value_used < s->len) {
+                    continue;
+                }
+
+                *consumed = (uint32_t)(buf - data);
+                return ber_stream_emit(s, tok, s->depth, s->value);
+            default:
+                goto error;
+        }
+
+        /* the whole header has been decoded */
+        depth = s->depth;
+        if (ber_stream_header(s) != 0) {
+            goto error;
+        }
+
+        if (s->type & 0x20) {
+            *consumed = (uint32_t)(buf - data);
+            return ber_stream_emit(s, tok, depth, NULL);
+        }
+
+        if (s->len <= (uint32_t)(buf_end - buf)) {
+            /* the value is already in memory, don't copy it */
+            buf += s->len;
+            s->pos += s->len;
+            *consumed = (uint32_t)(buf - data);
+            return ber_stream_emit(s, tok, depth, buf - s->len);
+        }
+
+        s->state = BER_STREAM_S_VALUE;
+    }
+
+    *consumed = len;
+    return BER_STREAM_NEED_MORE;
+
+error:
+    s->state = BER_STREAM_S_ERROR;
+    *consumed = (uint32_t)(buf - data);
+    return BER_STREAM_ERROR;
+}
+
+int
+ber_stream_token_int(const struct ber_stream_token *tok, uint32_t *num)
+{
+    uint32_t i;
+
+    if (tok->constructed || tok->len == 0 || tok->len > 4) {
+        return -1;
+    }
+
+    *num = tok->value[0];
+    for (i = 1; i < tok->len; ++i) {
+        *num <<= 8;
+        *num |= tok->value[i];
+    }
+
+    return 0;
+}
+
+int
+ber_stream_token_uint64(const struct ber_stream_token *tok, uint64_t *num)
+{
+    uint32_t i;
+
+    if (tok->constructed || tok->len == 0 || tok->len > 9 ||
+        (tok->len == 9 && tok->value[0] != 0)) {
+        return -1;
+    }
+
+    *num = 0;
+    for (i = 0; i < tok->len; ++i) {
+        *num = *num << 8 | tok->value[i];
+    }
+
+    return 0;
+}
+
 struct ber_data {
     char type;
     union {
@@ -280,15 +1000,15 @@ ber_fprintf(uint8_t *out, char *fmt, ...)
     return out + 1;
 }
 
-uint8_t *
-ber_sscanf(uint8_t *buf, char *fmt, ...)
+/** Strings are allocated from *arena*, or with malloc() if it's NULL */
+static uint8_t *
+ber_vsscanf(uint8_t *buf, struct ber_arena *arena, char *fmt, va_list args)
 {
-    va_list args;
     const char *str;
+    char **astr;
     uint32_t str_len;
 
-    va_start(args, fmt);
-    while (*fmt) {
+    while (*fmt && buf != NULL) {
         if (*fmt != '%') {
             return NULL;
         }
@@ -303,8 +1023,16 @@ ber_sscanf(uint8_t *buf, char *fmt, ...)
                     return NULL;
                 }
 
+                astr = va_arg(args, char **);
+                if (arena != NULL) {
+                    buf = ber_decode_string_arena(buf, arena, astr, UINT32_MAX);
+                    break;
+                }
+
                 buf = ber_decode_string_len_buffer(buf, &str, &str_len);
-                *va_arg(args, char **) = strndup(str, str_len);
+                if (buf != NULL) {
+                    *astr = strndup(str, str_len);
+                }
                 break;
             case 'n':
                 buf = ber_decode_null(buf);
@@ -315,7 +1043,324 @@ ber_sscanf(uint8_t *buf, char *fmt, ...)
 
         ++fmt;
     }
+
+    return buf;
+}
+
+uint8_t *
+ber_sscanf(uint8_t *buf, char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    buf = ber_vsscanf(buf, NULL, fmt, args);
+    va_end(args);
+
+    return buf;
+}
+
+uint8_t *
+ber_sscanf_arena(uint8_t *buf, struct ber_arena *arena, char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    buf = ber_vsscanf(buf, arena, fmt, args);
+    va_end(args);
+
+    return buf;
+}
+
+static const uint8_t *
+ber_decode_any_header(const uint8_t *buf, uint32_t buf_len, uint8_t *type, uint32_t *length)
+{
+    const uint8_t *end = buf + buf_len;
+    uint32_t i, length_bytes;
+
+    /* multi-byte tags are not supported */
+    if (buf_len < 2 || (*buf & 0x1F) == 0x1F) {
+        return NULL;
+    }
+
+    *type = *buf++;
+    *length = *buf++;
+    if (*length & 0x80) {
+        length_bytes = *length & 0x7F;
+        if (length_bytes == 0 || length_bytes > 4 || (uint32_t)(end - buf) < length_bytes) {
+            return NULL;
+        }
+
+        *length = 0;
+        for (i = 0; i < length_bytes; ++i) {
+            *length = *length << 8 | *buf++;
+        }
+    }
+
+    if ((uint32_t)(end - buf) < *length) {
+        return NULL;
+    }
+
+    return buf;
+}
+
+const uint8_t *
+ber_decode_header(const uint8_t *buf, uint32_t buf_len, uint8_t type, uint32_t *length)
+{
+    uint8_t decoded_type;
+
+    BER_STATS_CALL(DECODE_HEADER);
+    if (buf_len < 1 || *buf != type) {
+        return NULL;
+    }
+
+    return ber_decode_any_header(buf, buf_len, &decoded_type, length);
+}
+
+int
+ber_tape_index(const uint8_t *buf, uint32_t buf_len, struct ber_tape_entry *tape, uint32_t *tape_len)
+{
+    uint32_t open[BER_TAPE_MAX_DEPTH]; /* tape indexes of open constructed objects */
+    uint32_t end[BER_TAPE_MAX_DEPTH + 1];
+    uint32_t depth = 0, num = 0, pos = 0, len;
+    const uint8_t *value;
+    struct ber_tape_entry *entry;
+    uint8_t type;
+
+    end[0] = buf_len;
+    for (;;) {
+        while (depth > 0 && pos == end[depth]) {
+            --depth;
+            tape[open[depth]].span = num - open[depth];
+        }
+
+        if (pos == buf_len) {
+            break;
+        }
+
+        if (num == *tape_len) {
+            return -1;
+        }
+
+        value = ber_decode_any_header(buf + pos, end[depth] - pos, &type, &len);
+        if (value == NULL) {
+            return -1;
+        }
+
+        entry = &tape[num++];
+        entry->type = type;
+        entry->depth = (uint8_t)depth;
+        entry->hdr_off = pos;
+        entry->value_off = (uint32_t)(value - buf);
+        entry->len = len;
+        entry->span = 1;
+
+        pos = entry->value_off;
+        if (type & 0x20) {
+            if (depth == BER_TAPE_MAX_DEPTH) {
+                return -1;
+            }
+            open[depth++] = num - 1;
+            end[depth] = pos + len;
+        } else {
+            pos += len;
+        }
+    }
+
+    *tape_len = num;
+    return 0;
+}
+
+const struct ber_tape_entry *
+ber_tape_child(const struct ber_tape_entry *entry, uint32_t n)
+{
+    const struct ber_tape_entry *child = entry + 1;
+    const struct ber_tape_entry *end = entry + entry->span;
+
+    while (child < end && n > 0) {
+        child += child->span;
+        --n;
+    }
+
+    return child < end ? child : NULL;
+}
+
+const struct ber_tape_entry *
+ber_tape_path(const struct ber_tape_entry *tape, uint32_t tape_len, const uint32_t *path,
+              uint32_t path_len)
+{
+    const struct ber_tape_entry *entry = tape;
+    const struct ber_tape_entry *end = tape + tape_len;
+    uint32_t i, n;
+
+    if (path_len == 0) {
+        return NULL;
+    }
+
+    for (n = path[0]; entry < end && n > 0; --n) {
+        entry += entry->span;
+    }
+
+    if (entry >= end) {
+        return NULL;
+    }
+
+    for (i = 1; i < path_len && entry != NULL; ++i) {
+        entry = ber_tape_child(entry, path[i]);
+    }
+
+    return entry;
+}
+
+const uint8_t *
+ber_snscanf(const uint8_t *buf, uint32_t buf_len, const char *fmt, ...)
+{
+    const uint8_t *end = buf + buf_len;
+    va_list args;
+    uint32_t *num;
+    uint32_t len, i;
+
+    va_start(args, fmt);
+    while (*fmt && buf != NULL) {
+        if (*fmt++ != '%') {
+            buf = NULL;
+            break;
+        }
+
+        switch (*fmt++) {
+            case 'u':
+                buf = ber_decode_header(buf, (uint32_t)(end - buf), BER_DATA_T_INTEGER, &len);
+                if (buf == NULL || len == 0 || len > 4) {
+                    buf = NULL;
+                    break;
+                }
+
+                num = va_arg(args, uint32_t *);
+                *num = 0;
+                for (i = 0; i < len; ++i) {
+                    *num = *num << 8 | *buf++;
+                }
+                break;
+            case '.':
+                if (*fmt++ != '*' || *fmt++ != 's') {
+                    buf = NULL;
+                    break;
+                }
+
+                buf = ber_decode_header(buf, (uint32_t)(end - buf), BER_DATA_T_OCTET_STRING, &len);
+                if (buf == NULL) {
+                    break;
+                }
+
+                *va_arg(args, uint32_t *) = len;
+                *va_arg(args, const char **) = (const char *)buf;
+                buf += len;
+                break;
+            case 'a':
+            case 'm':
+                if (*fmt++ != 's') {
+                    buf = NULL;
+                    break;
+                }
+
+                buf = ber_decode_header(buf, (uint32_t)(end - buf), BER_DATA_T_OCTET_STRING, &len);
+                if (buf == NULL) {
+                    break;
+                }
+
+                *va_arg(args, char **) = strndup((const char *)buf, len);
+                buf += len;
+                break;
+            case 'n':
+                buf = ber_decode_header(buf, (uint32_t)(end - buf), BER_DATA_T_NULL, &len);
+                if (buf != NULL && len != 0) {
+                    buf = NULL;
+                }
+                break;
+            default:
+                buf = NULL;
+                break;
+        }
+    }
     va_end(args);
 
     return buf;
 }
+
+void
+ber_arena_init(struct ber_arena *arena, void *buf, uint32_t size)
+{
+    arena->buf = buf;
+    arena->size = size;
+    arena->used = 0;
+}
+
+void *
+ber_arena_alloc(struct ber_arena *arena, uint32_t size)
+{
+    uint32_t start = (arena->used + 3) & ~(uint32_t)3;
+
+    if (start > arena->size || size > arena->size - start) {
+        return NULL;
+    }
+
+    arena->used = start + size;
+
+    return arena->buf + start;
+}
+
+void
+ber_arena_reset(struct ber_arena *arena)
+{
+    arena->used = 0;
+}
+
+#ifdef BER_STATS
+__thread struct ber_stats ber_stats_tls;
+#endif
+
+void
+ber_stats_get(struct ber_stats *stats)
+{
+#ifdef BER_STATS
+    *stats = ber_stats_tls;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void
+ber_stats_reset(void)
+{
+#ifdef BER_STATS
+    memset(&ber_stats_tls, 0, sizeof(ber_stats_tls));
+#endif
+}
+
+const char *
+ber_stats_fn_name(enum ber_stats_fn fn)
+{
+    static const char *names[BER_STATS_FN_MAX] = {
+        [BER_STATS_FN_ENCODE_VLINT] = "ber_encode_vlint",
+        [BER_STATS_FN_DECODE_VLINT] = "ber_decode_vlint",
+        [BER_STATS_FN_DECODE_VLINT_BATCH] = "ber_decode_vlint_batch",
+        [BER_STATS_FN_ENCODE_INT] = "ber_encode_int",
+        [BER_STATS_FN_DECODE_INT] = "ber_decode_int",
+        [BER_STATS_FN_ENCODE_UINT64] = "ber_encode_uint64",
+        [BER_STATS_FN_DECODE_UINT64] = "ber_decode_uint64",
+        [BER_STATS_FN_ENCODE_LENGTH] = "ber_encode_length",
+        [BER_STATS_FN_DECODE_LENGTH] = "ber_decode_length",
+        [BER_STATS_FN_ENCODE_STRING] = "ber_encode_string_len",
+        [BER_STATS_FN_DECODE_STRING] = "ber_decode_string_len_buffer",
+        [BER_STATS_FN_DECODE_HEADER] = "ber_decode_header",
+        [BER_STATS_FN_SNMP_ENCODE_MSG] = "snmp_encode_msg",
+        [BER_STATS_FN_SNMP_DECODE_MSG] = "snmp_decode_msg",
+        [BER_STATS_FN_SNMP_VALIDATE_MSG] = "snmp_validate_msg",
+        [BER_STATS_FN_SNMP_DECODE_MSG_UNCHECKED] = "snmp_decode_msg_unchecked",
+    };
+
+    if ((unsigned)fn >= BER_STATS_FN_MAX) {
+        return NULL;
+    }
+
+    return names[fn];
+}
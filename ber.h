@@ -16,10 +16,174 @@ enum ber_data_type {
     BER_DATA_T_NULL = 0x05,
 };
 
+/** Bump allocator for decoded data, see ber_arena_init */
+struct ber_arena {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t used;
+};
+
+/** Max number of nested constructed types open in struct ber_writer */
+#define BER_WRITER_MAX_DEPTH 8
+
+/**
+ * Callback consuming data produced by struct ber_writer.
+ * @param ctx user context given to ber_writer_init
+ * @param data encoded data
+ * @param len length of *data*
+ * @return 0 on success or non-zero to fail the write
+ */
+typedef int (*ber_writer_flush_cb)(void *ctx, const uint8_t *data, uint32_t len);
+
+/** Front-to-back encoder, see ber_writer_init */
+struct ber_writer {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t len;
+    uint32_t depth;
+    uint32_t open[BER_WRITER_MAX_DEPTH]; /**< offsets of reserved lengths */
+    uint64_t end[BER_WRITER_MAX_DEPTH]; /**< stream offsets where types of known length end */
+    uint64_t flushed; /**< number of bytes already passed to *flush* */
+    ber_writer_flush_cb flush;
+    void *ctx;
+};
+
+/** Max number of nested constructed types tracked by struct ber_stream */
+#define BER_STREAM_MAX_DEPTH 8
+/**
+ * Max length of a primitive value that struct ber_stream buffers when it's
+ * split between chunks. Longer values are reported in pieces instead.
+ */
+#define BER_STREAM_VALUE_MAX 256
+
+/** Return codes of ber_stream_feed */
+enum ber_stream_status {
+    BER_STREAM_ERROR = -1,
+    BER_STREAM_NEED_MORE = 0,
+    BER_STREAM_TOKEN = 1,
+};
+
+/** Single TLV reported by ber_stream_feed */
+struct ber_stream_token {
+    uint8_t type;
+    uint8_t constructed; /**< set for SEQUENCE-like types, which have no value */
+    uint32_t depth; /**< number of enclosing constructed types */
+    uint32_t len;
+    /**
+     * value of primitive type. Points either into the data given to
+     * ber_stream_feed or into the stream itself, so it's valid only until
+     * the next ber_stream_feed call or until the input data changes.
+     */
+    const uint8_t *value;
+    /**
+     * offset and size of the part of the value pointed to by *value*.
+     * Unless a value longer than BER_STREAM_VALUE_MAX is split between
+     * chunks, it's the whole value: *value_off* is 0 and *value_len* is
+     * equal to *len*. Otherwise the same token is reported for every
+     * piece of the value as it arrives.
+     */
+    uint32_t value_off;
+    uint32_t value_len;
+};
+
+/** Resumable decoder, see ber_stream_init */
+struct ber_stream {
+    uint8_t state;
+    uint8_t type;
+    uint8_t len_bytes;
+    uint32_t len;
+    uint32_t value_used;
+    uint32_t pos; /**< offset within the current top-level record */
+    uint32_t depth;
+    uint32_t end[BER_STREAM_MAX_DEPTH]; /**< end offsets of open types */
+    uint8_t value[BER_STREAM_VALUE_MAX];
+};
+
+/** Max number of nested constructed types indexed by ber_tape_index */
+#define BER_TAPE_MAX_DEPTH 16
+
+/** Single TLV indexed by ber_tape_index */
+struct ber_tape_entry {
+    uint8_t type;
+    uint8_t depth; /**< number of enclosing constructed types */
+    uint32_t hdr_off; /**< offset of the type byte */
+    uint32_t value_off; /**< offset of the value */
+    uint32_t len; /**< length of the value */
+    uint32_t span; /**< number of entries in this subtree, including itself */
+};
+
+/** Functions whose calls are counted in struct ber_stats */
+enum ber_stats_fn {
+    BER_STATS_FN_ENCODE_VLINT,
+    BER_STATS_FN_DECODE_VLINT,
+    BER_STATS_FN_DECODE_VLINT_BATCH,
+    BER_STATS_FN_ENCODE_INT,
+    BER_STATS_FN_DECODE_INT,
+    BER_STATS_FN_ENCODE_UINT64,
+    BER_STATS_FN_DECODE_UINT64,
+    BER_STATS_FN_ENCODE_LENGTH,
+    BER_STATS_FN_DECODE_LENGTH,
+    BER_STATS_FN_ENCODE_STRING,
+    BER_STATS_FN_DECODE_STRING,
+    BER_STATS_FN_DECODE_HEADER,
+    BER_STATS_FN_SNMP_ENCODE_MSG,
+    BER_STATS_FN_SNMP_DECODE_MSG,
+    BER_STATS_FN_SNMP_VALIDATE_MSG,
+    BER_STATS_FN_SNMP_DECODE_MSG_UNCHECKED,
+    BER_STATS_FN_MAX,
+};
+
+/** Reasons of failed SNMP message decoding counted in struct ber_stats */
+enum ber_stats_err {
+    BER_STATS_ERR_LENGTH, /**< length too long or not matching the enclosing object */
+    BER_STATS_ERR_INT, /**< integer too big */
+    BER_STATS_ERR_OID, /**< OID with too many arcs or an invalid arc */
+    BER_STATS_ERR_PDU, /**< unsupported PDU type */
+    BER_STATS_ERR_VALUE, /**< unsupported value type or value out of range */
+    BER_STATS_ERR_MAX,
+};
+
+/**
+ * Instrumentation counters of the calling thread, see ber_stats_get.
+ * They're collected only if the library is compiled with BER_STATS
+ * defined. Otherwise all instrumentation compiles to nothing.
+ */
+struct ber_stats {
+    uint64_t bytes_encoded; /**< size of SNMP messages encoded */
+    uint64_t bytes_decoded; /**< size of SNMP messages decoded successfully */
+    uint64_t long_lengths; /**< long-form lengths decoded */
+    uint64_t calls[BER_STATS_FN_MAX];
+    uint64_t errors[BER_STATS_ERR_MAX]; /**< failed SNMP message decoding */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Initialize arena over user-provided memory.
+ * The arena doesn't allocate nor free anything by itself.
+ * @param arena arena to be initialized
+ * @param buf memory to allocate from. It should be aligned to at least 4 bytes.
+ * @param size size of *buf*
+ */
+void ber_arena_init(struct ber_arena *arena, void *buf, uint32_t size);
+
+/**
+ * Allocate memory from the arena.
+ * @param arena arena to allocate from
+ * @param size number of bytes to allocate
+ * @return pointer to allocated memory aligned to 4 bytes or NULL in case
+ * the arena is full.
+ */
+void *ber_arena_alloc(struct ber_arena *arena, uint32_t size);
+
+/**
+ * Release all memory allocated from the arena at once.
+ * @param arena arena to be reset
+ */
+void ber_arena_reset(struct ber_arena *arena);
+
 /**
  * Encode variable-length unsigned 32-bit integer.
  * Note that this function does not check against output buffer overflow.
@@ -46,6 +210,28 @@ uint8_t *ber_encode_vlint(uint8_t *out, uint32_t num);
  */
 uint8_t *ber_decode_vlint(uint8_t *buf, uint32_t *num);
 
+/**
+ * Decode a run of variable-length unsigned 32-bit integers, e.g. arcs
+ * of an encoded OID.
+ * Each decoded integer is equal to the one ber_decode_vlint would return.
+ * Unlike ber_decode_vlint, this function never reads past *buf* + *len*.
+ * On x86 the continuation bits are gathered 16 (SSE2) or 32 (AVX2) bytes
+ * at a time, and runs of single-byte integers are widened in bulk.
+ * Define BER_NO_SIMD to always use the scalar implementation.
+ * @param buf pointer to the **beginning** of the input buffer.
+ * @param len number of bytes to decode. The last byte has to terminate
+ * a vlint.
+ * @param nums array to be filled with decoded integers. In case this
+ * function returns NULL, the content of nums is undefined.
+ * @param nums_len pointer to max size of *nums* array. Underlying value will
+ * be replaced with the actual number of decoded integers. In case this
+ * function returns NULL, the content of this param is undefined.
+ * @return pointer to the next not processed byte in the given buffer
+ * (always *buf* + *len*) or NULL in case any vlint consists of more than
+ * 5 bytes, the last vlint is not terminated or *nums* array is too small.
+ */
+uint8_t *ber_decode_vlint_batch(uint8_t *buf, uint32_t len, uint32_t *nums, uint32_t *nums_len);
+
 /**
  * Encode integer in BER.
  * Note that this function is does not check against output buffer overflow.
@@ -73,6 +259,35 @@ uint8_t *ber_encode_int(uint8_t *out, uint32_t num);
  */
 uint8_t *ber_decode_int(uint8_t *buf, uint32_t *num);
 
+/**
+ * Encode unsigned 64-bit integer in BER with given type.
+ * Unlike ber_encode_int, numbers with the top bit set get a leading 0x00
+ * byte, so they are not decoded as negative. This is how SNMP application
+ * types like Counter64 are encoded. The length is computed with a single
+ * count-leading-zeros instruction.
+ * Note that this function is does not check against output buffer overflow.
+ * It will write at most 11 bytes.
+ * @param out pointer to the **end** of the output buffer.
+ * The first encoded byte will be put in buf, next one in (buf - 1), etc.
+ * @param num number to encode
+ * @param type BER type to encode, e.g. BER_DATA_T_INTEGER
+ * @return pointer to the next empty byte in the given buffer.
+ * Will always be smaller than given buf param.
+ */
+uint8_t *ber_encode_uint64(uint8_t *out, uint64_t num, uint8_t type);
+
+/**
+ * Decode unsigned 64-bit BER integer of any type.
+ * Note that this function does not check against input buffer overflow.
+ * It will read at most 11 bytes.
+ * @param buf pointer to the **beginning** of the input buffer.
+ * @param num pointer to put decoded number into. In case this function
+ * returns NULL, the content of num is undefined.
+ * @return pointer to the next not processed byte in the given buffer or
+ * NULL in case if integer is empty or doesn't fit in uint64_t.
+ */
+uint8_t *ber_decode_uint64(uint8_t *buf, uint64_t *num);
+
 /**
  * Encode BER length.
  * For use with user-defined types.
@@ -198,6 +413,69 @@ uint8_t *ber_decode_string_buffer(uint8_t *buf, const char **str, uint32_t maxle
  */
 uint8_t *ber_decode_string_alloc(uint8_t *buf, char **str, uint32_t maxlen);
 
+/**
+ * Decode BER octet string into memory allocated from the arena.
+ * This works the same way as ber_decode_string_alloc, but the string
+ * doesn't have to be freed. It's released together with the rest of
+ * the arena by ber_arena_reset.
+ * @see ber_decode_string_alloc for the description of params
+ * @param arena arena to allocate the string from
+ * @return pointer to the next not processed byte in the given buffer or
+ * NULL in case decoded string length is invalid or the arena is full.
+ */
+uint8_t *ber_decode_string_arena(uint8_t *buf, struct ber_arena *arena, char **str, uint32_t maxlen);
+
+/**
+ * Decode type and length of BER object, checking that it fits in the buffer.
+ * Unlike other decoding functions, this never reads past *buf* + *buf_len*.
+ * @param buf pointer to the **beginning** of the input buffer.
+ * @param buf_len size of the input buffer
+ * @param type expected BER type
+ * @param length pointer to put decoded length into
+ * @return pointer to the value of decoded object or NULL if it has
+ * a different type, invalid length or doesn't fit in the buffer.
+ */
+const uint8_t *ber_decode_header(const uint8_t *buf, uint32_t buf_len, uint8_t type, uint32_t *length);
+
+/**
+ * Index all objects in BER buffer with a single pass.
+ * Each object, either primitive or constructed, gets an entry on the tape
+ * in the order of appearance. Children of a constructed object directly
+ * follow its own entry, so any subtree can be skipped without parsing it
+ * by moving *span* entries forward.
+ * This never reads past *buf* + *buf_len*.
+ * @param buf pointer to the **beginning** of the input buffer.
+ * @param buf_len size of the input buffer. It has to contain a number
+ * of complete top-level objects.
+ * @param tape array to be filled with indexed objects. In case this
+ * function returns -1, the content of tape is undefined.
+ * @param tape_len pointer to max size of *tape* array. Underlying value will
+ * be replaced with the actual number of indexed objects.
+ * @return 0 on success, -1 if the buffer contains a malformed or truncated
+ * object, objects nested deeper than BER_TAPE_MAX_DEPTH or *tape* is too small.
+ */
+int ber_tape_index(const uint8_t *buf, uint32_t buf_len, struct ber_tape_entry *tape, uint32_t *tape_len);
+
+/**
+ * Get n-th child of a constructed object indexed by ber_tape_index.
+ * @param entry tape entry of the constructed object
+ * @param n index of the child, starting from 0
+ * @return tape entry of the child or NULL if there is no such child.
+ */
+const struct ber_tape_entry *ber_tape_child(const struct ber_tape_entry *entry, uint32_t n);
+
+/**
+ * Find an object by its path on the tape filled by ber_tape_index.
+ * @param tape indexed tape
+ * @param tape_len number of entries on the tape
+ * @param path child indexes at subsequent depths, starting with the index
+ * of the top-level object
+ * @param path_len number of elements in *path*
+ * @return tape entry of the object or NULL if there is no such object.
+ */
+const struct ber_tape_entry *ber_tape_path(const struct ber_tape_entry *tape, uint32_t tape_len,
+                                           const uint32_t *path, uint32_t path_len);
+
 /**
  * Encode NULL in BER.
  * Note that this function is does not check against output buffer overflow.
@@ -218,6 +496,212 @@ uint8_t *ber_encode_null(uint8_t *out);
  */
 uint8_t *ber_decode_null(uint8_t *buf);
 
+/**
+ * Get the exact number of bytes ber_encode_vlint would write.
+ * @param num number to be encoded
+ * @return size of encoded vlint
+ */
+uint32_t ber_sizeof_vlint(uint32_t num);
+
+/**
+ * Get the exact number of bytes ber_encode_int would write.
+ * @param num number to be encoded
+ * @return size of encoded integer
+ */
+uint32_t ber_sizeof_int(uint32_t num);
+
+/**
+ * Get the exact number of bytes ber_encode_uint64 would write.
+ * @param num number to be encoded
+ * @return size of encoded integer
+ */
+uint32_t ber_sizeof_uint64(uint64_t num);
+
+/**
+ * Get the exact number of bytes ber_encode_length would write.
+ * @param length length to be encoded
+ * @return size of encoded length
+ */
+uint32_t ber_sizeof_length(uint32_t length);
+
+/**
+ * Get the exact number of bytes ber_encode_string_len would write.
+ * @param str_len length of the string to be encoded
+ * @return size of encoded octet string
+ */
+uint32_t ber_sizeof_string_len(uint32_t str_len);
+
+/**
+ * Initialize front-to-back encoder.
+ * Unlike ber_encode_* functions, the writer encodes data in natural order
+ * and checks against output buffer overflow. Constructed types are opened
+ * with ber_writer_begin, which reserves space for their length, and closed
+ * with ber_writer_end, which patches it. The output is byte for byte
+ * the same as produced by ber_encode_* functions.
+ * All data in front of the first constructed type opened with
+ * ber_writer_begin can be flushed with ber_writer_flush, so that long
+ * streams of records can be produced in a small buffer. Such type can't
+ * be flushed until it's closed, as its length isn't known until
+ * ber_writer_end. Constructed types opened with ber_writer_begin_len have
+ * their length written up front instead, so their content can be flushed
+ * as it's produced.
+ * @param w writer to be initialized
+ * @param buf output buffer
+ * @param size size of *buf*, at least the size of the biggest constructed
+ * type opened with ber_writer_begin plus its 5 bytes of reserved length
+ * @param flush callback to be called with completed data, can be NULL.
+ * If set, the writer will flush automatically when *buf* becomes full.
+ * @param ctx user context passed to *flush*
+ */
+void ber_writer_init(struct ber_writer *w, uint8_t *buf, uint32_t size,
+                     ber_writer_flush_cb flush, void *ctx);
+
+/**
+ * Open constructed type (e.g. SEQUENCE) of unknown length.
+ * @param w writer
+ * @param type BER type of the constructed object
+ * @return 0 on success or -1 if the buffer is full or more than
+ * BER_WRITER_MAX_DEPTH types are open.
+ */
+int ber_writer_begin(struct ber_writer *w, uint8_t type);
+
+/**
+ * Open constructed type (e.g. SEQUENCE) of known length.
+ * The header is written immediately, so the content doesn't have to fit
+ * in the buffer at once and can be flushed while it's written.
+ * @param w writer
+ * @param type BER type of the constructed object
+ * @param len exact length of the content, e.g. computed with snmp_sizeof_*
+ * @return 0 on success or -1 if the buffer is full or more than
+ * BER_WRITER_MAX_DEPTH types are open.
+ */
+int ber_writer_begin_len(struct ber_writer *w, uint8_t type, uint32_t len);
+
+/**
+ * Close the most recently opened constructed type and patch its length.
+ * @param w writer
+ * @return 0 on success or -1 if there is no open constructed type or
+ * the content written doesn't match the length given to ber_writer_begin_len.
+ */
+int ber_writer_end(struct ber_writer *w);
+
+/**
+ * Write integer in BER.
+ * @see ber_encode_int
+ * @param w writer
+ * @param num number to encode
+ * @return 0 on success or -1 if the buffer is full
+ */
+int ber_writer_int(struct ber_writer *w, uint32_t num);
+
+/**
+ * Write variable-length unsigned 32-bit integer.
+ * @see ber_encode_vlint
+ * @param w writer
+ * @param num number to encode
+ * @return 0 on success or -1 if the buffer is full
+ */
+int ber_writer_vlint(struct ber_writer *w, uint32_t num);
+
+/**
+ * Write unsigned 64-bit integer with given type.
+ * @see ber_encode_uint64
+ * @param w writer
+ * @param num number to encode
+ * @param type BER type to encode
+ * @return 0 on success or -1 if the buffer is full
+ */
+int ber_writer_uint64(struct ber_writer *w, uint64_t num, uint8_t type);
+
+/**
+ * Write octet string in BER.
+ * @see ber_encode_string_len
+ * @param w writer
+ * @param str string to encode
+ * @param str_len length of given string
+ * @return 0 on success or -1 if the buffer is full
+ */
+int ber_writer_string_len(struct ber_writer *w, const char *str, uint32_t str_len);
+
+/**
+ * Write NULL in BER.
+ * @param w writer
+ * @return 0 on success or -1 if the buffer is full
+ */
+int ber_writer_null(struct ber_writer *w);
+
+/**
+ * Write already encoded data.
+ * @param w writer
+ * @param data data to be copied
+ * @param len length of *data*
+ * @return 0 on success or -1 if the buffer is full
+ */
+int ber_writer_raw(struct ber_writer *w, const uint8_t *data, uint32_t len);
+
+/**
+ * Pass all completed data to the flush callback.
+ * Constructed types opened with ber_writer_begin, with their headers and
+ * all their content, stay in the buffer, so such type growing past the
+ * buffer size makes writes fail even with a flush callback.
+ * @param w writer
+ * @return 0 on success or -1 if there's no flush callback or it failed
+ */
+int ber_writer_flush(struct ber_writer *w);
+
+/**
+ * Initialize resumable decoder.
+ * Unlike ber_decode_* functions, the stream doesn't need the whole object
+ * in memory. It accepts input in chunks of arbitrary size, e.g. straight
+ * from read() buffers, and reports every decoded TLV as a token. Constructed
+ * types are reported when their header is decoded, then their content
+ * follows. Primitive values are buffered only when split between chunks,
+ * and values too long to be buffered are reported in pieces.
+ * Top-level objects may follow each other, so a stream of records can
+ * be decoded as well.
+ * @param s stream to be initialized
+ */
+void ber_stream_init(struct ber_stream *s);
+
+/**
+ * Feed the decoder with the next chunk of input.
+ * The function stops after the first decoded token, so it should be called
+ * repeatedly with the rest of the chunk until it returns
+ * BER_STREAM_NEED_MORE.
+ * @param s stream initialized with ber_stream_init
+ * @param data input chunk
+ * @param len length of *data*
+ * @param consumed pointer to put the number of processed bytes into.
+ * On BER_STREAM_NEED_MORE it's always equal to *len*.
+ * @param tok token to be filled on BER_STREAM_TOKEN
+ * @return BER_STREAM_TOKEN if a token was decoded, BER_STREAM_NEED_MORE
+ * if all data was consumed without completing a token, or BER_STREAM_ERROR
+ * if the input is malformed, uses unsupported features (multi-byte tags,
+ * indefinite length) or nests deeper than BER_STREAM_MAX_DEPTH. Once an
+ * error occurs, the stream has to be initialized again.
+ */
+int ber_stream_feed(struct ber_stream *s, const uint8_t *data, uint32_t len,
+                    uint32_t *consumed, struct ber_stream_token *tok);
+
+/**
+ * Decode value of an integer token.
+ * @param tok token returned by ber_stream_feed
+ * @param num pointer to put decoded number into
+ * @return 0 on success or -1 if the token is not a whole primitive
+ * fitting in uint32_t.
+ */
+int ber_stream_token_int(const struct ber_stream_token *tok, uint32_t *num);
+
+/**
+ * Decode value of an unsigned 64-bit integer token of any type.
+ * @see ber_decode_uint64
+ * @param tok token returned by ber_stream_feed
+ * @param num pointer to put decoded number into
+ * @return 0 on success or -1 if the token is not a whole primitive
+ * fitting in uint64_t.
+ */
+int ber_stream_token_uint64(const struct ber_stream_token *tok, uint64_t *num);
+
 /**
  * Encode data in BER using fprintf-like syntax.
  * Note that this function does not check against output buffer overflow.
@@ -248,8 +732,138 @@ uint8_t *ber_fprintf(uint8_t *out, char *fmt, ...);
  */
 uint8_t *ber_sscanf(uint8_t *buf, char *fmt, ...);
 
+/**
+ * Decode BER data using sscanf-like syntax, allocating strings from arena.
+ * This works the same way as ber_sscanf, but %ms and %as strings are
+ * allocated with ber_decode_string_arena, so none of them has to be freed.
+ * @see ber_sscanf for the description of params
+ * @param arena arena to allocate strings from
+ * @return pointer to the first byte of encoded sequence in given buffer or NULL
+ * if fmt parsing error occured or the arena is full.
+ */
+uint8_t *ber_sscanf_arena(uint8_t *buf, struct ber_arena *arena, char *fmt, ...);
+
+/**
+ * Decode BER data using sscanf-like syntax, never reading past the buffer.
+ * This is meant for untrusted input like received datagrams. Unlike
+ * ber_sscanf, it checks BER type of each decoded object and never writes
+ * to the input buffer.
+ * @param buf pointer to the **beginning** of the input buffer.
+ * @param buf_len size of the input buffer
+ * @param fmt c printf-like format string. It supports only format specifiers.
+ * Any detected non format specifier will cause to return with NULL.
+ * Currently supported:
+ *  * %u - integer
+ *  * %n - null
+ *  * %.*s - string slice, given as (uint32_t *len, const char **str). The
+ *  string is not copied nor NUL-terminated, it points into *buf*.
+ *  * %ms or %as - dynamically allocated string
+ * @param ... c printf-like parameters specified in fmt field
+ * @return pointer to the next not processed byte in the given buffer or NULL
+ * if fmt parsing error occured, an object has unexpected type or doesn't
+ * fit in the buffer.
+ */
+const uint8_t *ber_snscanf(const uint8_t *buf, uint32_t buf_len, const char *fmt, ...);
+
+/**
+ * Copy instrumentation counters of the calling thread.
+ * Without BER_STATS defined all counters are always 0.
+ * @param stats structure to be filled
+ */
+void ber_stats_get(struct ber_stats *stats);
+
+/**
+ * Zero instrumentation counters of the calling thread.
+ */
+void ber_stats_reset(void);
+
+/**
+ * Get the name of a function counted in struct ber_stats.
+ * @param fn function
+ * @return name of the function or NULL if *fn* is invalid
+ */
+const char *ber_stats_fn_name(enum ber_stats_fn fn);
+
 #ifdef __cplusplus
 }
 #endif
 
+/**
+ * Compile-time counterparts of ber_fprintf and ber_sscanf.
+ * The format is given as a list of items instead of a string, so that
+ * it's expanded into straight-line calls of ber_encode_* and ber_decode_*
+ * functions. There's no format parsing, argument copying or va_list left
+ * at runtime. Up to 8 items are supported:
+ *  * BER_U(num) - integer, like %u
+ *  * BER_S(str) - string, like %s when encoding and %ms when decoding
+ *  * BER_N() - null, like %n
+ *
+ * Example:
+ *     out = BER_ENCODE(out, BER_U(64), BER_U(103), BER_S("str"));
+ *     if (BER_DECODE(buf, BER_U(&num1), BER_U(&num2), BER_S(&str)) == NULL)
+ */
+#define BER_U(num) (ber_encode_int, ber_decode_int, num)
+#define BER_S(str) (ber_encode_string, BER_DECODE_STRING_, str)
+#define BER_N() (BER_ENCODE_NULL_, BER_DECODE_NULL_, 0)
+
+/**
+ * Encode given items, see BER_U, BER_S and BER_N.
+ * The first item will be at the beginning of encoded data.
+ * Note that this does not check against output buffer overflow.
+ * @param out pointer to the **end** of the output buffer.
+ * The first encoded byte will be put in buf, next one in (buf - 1), etc.
+ * @return pointer to the next empty byte in the given buffer. Unlike
+ * ber_fprintf, this is not the first byte of encoded data.
+ */
+#define BER_ENCODE(out, ...) \
+    BER_CONCAT_(BER_ENCODE_, BER_NARGS_(__VA_ARGS__))(out, __VA_ARGS__)
+
+/**
+ * Decode given items, see BER_U, BER_S and BER_N.
+ * Strings are allocated with malloc(), just like %ms of ber_sscanf.
+ * Note that this does not check against input buffer overflow.
+ * @param buf modifiable pointer to the **beginning** of the input buffer.
+ * It's advanced past the decoded data, or set to NULL on the first error.
+ * @return the new value of *buf*
+ */
+#define BER_DECODE(buf, ...) \
+    ((void)(BER_CONCAT_(BER_DECODE_, BER_NARGS_(__VA_ARGS__))(buf, __VA_ARGS__)), (buf))
+
+/* implementation details of the macros above */
+#define BER_CONCAT_(a, b) BER_CONCAT__(a, b)
+#define BER_CONCAT__(a, b) a ## b
+#define BER_NARGS_(...) BER_NARGS__(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define BER_NARGS__(_1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+#define BER_ENCODE_NULL_(out, unused) ber_encode_null(out)
+#define BER_DECODE_NULL_(buf, unused) ber_decode_null(buf)
+#define BER_DECODE_STRING_(buf, str) ber_decode_string_alloc(buf, str, UINT32_MAX)
+
+#define BER_ITEM_ENC_(out, item) BER_ITEM_ENC__(out, BER_ITEM_UNPACK_ item)
+#define BER_ITEM_ENC__(...) BER_ITEM_ENC___(__VA_ARGS__)
+#define BER_ITEM_ENC___(out, enc, dec, arg) enc(out, arg)
+#define BER_ITEM_DEC_(buf, item) BER_ITEM_DEC__(buf, BER_ITEM_UNPACK_ item)
+#define BER_ITEM_DEC__(...) BER_ITEM_DEC___(__VA_ARGS__)
+#define BER_ITEM_DEC___(buf, enc, dec, arg) (((buf) = dec(buf, arg)) != NULL)
+#define BER_ITEM_UNPACK_(enc, dec, arg) enc, dec, arg
+
+/* encoding goes backwards, so the first item is the outermost call */
+#define BER_ENCODE_1(o, a) BER_ITEM_ENC_(o, a)
+#define BER_ENCODE_2(o, a, ...) BER_ITEM_ENC_(BER_ENCODE_1(o, __VA_ARGS__), a)
+#define BER_ENCODE_3(o, a, ...) BER_ITEM_ENC_(BER_ENCODE_2(o, __VA_ARGS__), a)
+#define BER_ENCODE_4(o, a, ...) BER_ITEM_ENC_(BER_ENCODE_3(o, __VA_ARGS__), a)
+#define BER_ENCODE_5(o, a, ...) BER_ITEM_ENC_(BER_ENCODE_4(o, __VA_ARGS__), a)
+#define BER_ENCODE_6(o, a, ...) BER_ITEM_ENC_(BER_ENCODE_5(o, __VA_ARGS__), a)
+#define BER_ENCODE_7(o, a, ...) BER_ITEM_ENC_(BER_ENCODE_6(o, __VA_ARGS__), a)
+#define BER_ENCODE_8(o, a, ...) BER_ITEM_ENC_(BER_ENCODE_7(o, __VA_ARGS__), a)
+
+#define BER_DECODE_1(b, a) BER_ITEM_DEC_(b, a)
+#define BER_DECODE_2(b, a, ...) BER_ITEM_DEC_(b, a) && BER_DECODE_1(b, __VA_ARGS__)
+#define BER_DECODE_3(b, a, ...) BER_ITEM_DEC_(b, a) && BER_DECODE_2(b, __VA_ARGS__)
+#define BER_DECODE_4(b, a, ...) BER_ITEM_DEC_(b, a) && BER_DECODE_3(b, __VA_ARGS__)
+#define BER_DECODE_5(b, a, ...) BER_ITEM_DEC_(b, a) && BER_DECODE_4(b, __VA_ARGS__)
+#define BER_DECODE_6(b, a, ...) BER_ITEM_DEC_(b, a) && BER_DECODE_5(b, __VA_ARGS__)
+#define BER_DECODE_7(b, a, ...) BER_ITEM_DEC_(b, a) && BER_DECODE_6(b, __VA_ARGS__)
+#define BER_DECODE_8(b, a, ...) BER_ITEM_DEC_(b, a) && BER_DECODE_7(b, __VA_ARGS__)
+
 #endif //BER_H
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#ifndef BER_STATS_H
+#define BER_STATS_H
+
+/*
+ * Private instrumentation of the library, not to be included by its users.
+ * They can read the counters with ber_stats_get instead.
+ */
+
+#include "ber.h"
+
+#ifdef BER_STATS
+extern __thread struct ber_stats ber_stats_tls;
+#define BER_STATS_ADD(field, num) ((void)(ber_stats_tls.field += (num)))
+#else
+#define BER_STATS_ADD(field, num) ((void)0)
+#endif
+#define BER_STATS_CALL(fn) BER_STATS_ADD(calls[BER_STATS_FN_##fn], 1)
+
+#endif //BER_STATS_H
@@ -10,8 +10,20 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "ber.h"
 #include "snmp.h"
+#include "agent.h"
+#include "poller.h"
+#include "archive.h"
+#include "parallel.h"
+#include "snmp_counter.h"
 
 static char
 to_printable(int n)
@@ -129,6 +141,697 @@ snmp_msg_test(uint8_t *buf, uint8_t *buf_end)
     printf("\n");
 }
 
+void
+snmp_msg_slice_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_varbind varbind_enc[2] = { 0 };
+    struct snmp_varbind varbind_dec[2] = { 0 };
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 1, 1, 0, SNMP_MSG_OID_END };
+    uint8_t copy[128];
+    uint8_t *enc_out;
+    const uint8_t *dec_out;
+    uint32_t varbinds_num, enc_len, i;
+
+    enc_header.community = "public";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    enc_header.request_id = 0x1234;
+
+    memcpy(varbind_enc[0].oid, oid, sizeof(oid));
+    varbind_enc[0].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbind_enc[0].value.s = "sysDescr";
+    memcpy(varbind_enc[1].oid, oid, sizeof(oid));
+    varbind_enc[1].value_type = SNMP_DATA_T_INTEGER;
+    varbind_enc[1].value.i = 42;
+
+    buf_end -= 18;
+
+    printf("# Testing non-mutating SNMP msg decoding\n");
+    enc_out = snmp_encode_msg(buf_end, &enc_header, 2, varbind_enc);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+    assert(enc_len <= sizeof(copy));
+    memcpy(copy, enc_out, enc_len);
+
+    /* the same buffer can be decoded over and over */
+    for (i = 0; i < 2; ++i) {
+        varbinds_num = 2;
+        dec_out = snmp_decode_msg_slice(enc_out, enc_len + 5, &dec_header, &varbinds_num, varbind_dec);
+        assert(dec_out == buf_end + 1);
+        assert(memcmp(copy, enc_out, enc_len) == 0);
+        assert(dec_header.community_len == strlen(enc_header.community));
+        assert(memcmp(dec_header.community, enc_header.community, dec_header.community_len) == 0);
+        assert(dec_header.pdu_type == enc_header.pdu_type);
+        assert(dec_header.request_id == enc_header.request_id);
+        assert(varbinds_num == 2);
+        assert(varbind_dec[0].value_type == SNMP_DATA_T_OCTET_STRING);
+        assert(varbind_dec[0].value_len == strlen(varbind_enc[0].value.s));
+        assert(memcmp(varbind_dec[0].value.s, varbind_enc[0].value.s, varbind_dec[0].value_len) == 0);
+        assert(varbind_dec[1].value_type == SNMP_DATA_T_INTEGER);
+        assert(varbind_dec[1].value.i == 42);
+        assert(memcmp(varbind_dec[1].oid, oid, sizeof(oid)) == 0);
+    }
+    printf("snmp_decode_msg_slice(%" PRIu32 " bytes) = %" PRIu32 " varbinds\n", enc_len, varbinds_num);
+    printf("\n");
+}
+
+static void
+assert_varbinds_equal(const struct snmp_varbind *a, const struct snmp_varbind *b, uint32_t num)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < num; ++i) {
+        for (j = 0; a[i].oid[j] != SNMP_MSG_OID_END; ++j) {
+            assert(a[i].oid[j] == b[i].oid[j]);
+        }
+        assert(b[i].oid[j] == SNMP_MSG_OID_END);
+        assert(a[i].value_type == b[i].value_type);
+        assert(a[i].value_len == b[i].value_len);
+        if (a[i].value_type == SNMP_DATA_T_OCTET_STRING) {
+            assert(a[i].value.s == b[i].value.s);
+        } else if (a[i].value_type == SNMP_DATA_T_COUNTER64) {
+            assert(a[i].value.i64 == b[i].value.i64);
+        } else if (a[i].value_type != SNMP_DATA_T_NULL && a[i].value_type < SNMP_DATA_T_NO_SUCH_OBJECT) {
+            assert(a[i].value.i == b[i].value.i);
+        }
+    }
+}
+
+void
+snmp_msg_validate_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_msg_header check_header = { 0 };
+    struct snmp_varbind varbind_enc[6] = { 0 };
+    struct snmp_varbind varbind_dec[6];
+    struct snmp_varbind varbind_check[6];
+    enum snmp_data_type types[] = { SNMP_DATA_T_INTEGER, SNMP_DATA_T_OCTET_STRING, SNMP_DATA_T_NULL,
+                                    SNMP_DATA_T_COUNTER32, SNMP_DATA_T_COUNTER64,
+                                    SNMP_DATA_T_NO_SUCH_INSTANCE };
+    uint8_t mutations[] = { 0x00, 0x01, 0x7F, 0x80, 0x81, 0xFF };
+    uint8_t long_null[] = { 0x30, 0x1b, 0x02, 0x01, 0x01, 0x04, 0x01, 'p',
+                            0xa2, 0x13, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+                            0x30, 0x08, 0x30, 0x06, 0x06, 0x01, 0x2b, 0x05, 0x81, 0x00 };
+    uint8_t long_arc[] = { 0x30, 0x1f, 0x02, 0x01, 0x01, 0x04, 0x01, 'p',
+                           0xa2, 0x17, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+                           0x30, 0x0c, 0x30, 0x0a, 0x06, 0x06, 0x2b, 0x8f, 0xff, 0xff, 0xff, 0x7f,
+                           0x05, 0x00 };
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 200000, SNMP_MSG_OID_END };
+    uint8_t *enc_out, orig;
+    const uint8_t *dec_out, *check_out;
+    uint32_t varbind_num, check_num, enc_len, i, j;
+
+    printf("# Testing SNMP msg validation\n");
+    enc_header.snmp_ver = 1;
+    enc_header.community = "public";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    enc_header.request_id = 70000;
+    for (i = 0; i < 6; ++i) {
+        memcpy(varbind_enc[i].oid, oid, sizeof(oid));
+        varbind_enc[i].value_type = types[i];
+        varbind_enc[i].value.i = 3000000000u + i;
+    }
+    varbind_enc[1].value.s = "eth0";
+    varbind_enc[4].value.i64 = 0xFEDCBA9876543210;
+
+    buf_end -= 18;
+    enc_out = snmp_encode_msg(buf_end, &enc_header, 6, varbind_enc);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+
+    dec_out = snmp_validate_msg(enc_out, enc_len, &varbind_num);
+    assert(dec_out == buf_end + 1);
+    assert(varbind_num == 6);
+    dec_out = snmp_decode_msg_unchecked(enc_out, &dec_header, &varbind_num, varbind_dec);
+    assert(dec_out == buf_end + 1);
+    assert(varbind_num == 6);
+    check_num = 6;
+    check_out = snmp_decode_msg_slice(enc_out, enc_len + 5, &check_header, &check_num, varbind_check);
+    assert(check_out == dec_out);
+    assert(dec_header.snmp_ver == 1 && dec_header.request_id == 70000);
+    assert(dec_header.community_len == 6 && memcmp(dec_header.community, "public", 6) == 0);
+    assert(dec_header.pdu_type == SNMP_DATA_T_PDU_GET_RESPONSE);
+    assert_varbinds_equal(varbind_dec, varbind_check, 6);
+    assert(varbind_dec[4].value.i64 == 0xFEDCBA9876543210);
+
+    /* only as many varbinds as fit in the array */
+    varbind_num = 2;
+    dec_out = snmp_decode_msg_unchecked(enc_out, &dec_header, &varbind_num, varbind_dec);
+    assert(varbind_num == 2 && dec_out < buf_end + 1);
+    assert(*dec_out == SNMP_DATA_T_SEQUENCE);
+    assert_varbinds_equal(varbind_dec, varbind_check, 2);
+
+    /* truncated */
+    for (i = 0; i < enc_len; ++i) {
+        dec_out = snmp_validate_msg(enc_out, i, &varbind_num);
+        assert(dec_out == NULL);
+    }
+
+    /* anything accepted by the validator decodes the same as with checks */
+    for (i = 0; i < enc_len; ++i) {
+        orig = enc_out[i];
+        for (j = 0; j < sizeof(mutations); ++j) {
+            enc_out[i] = mutations[j];
+            if (snmp_validate_msg(enc_out, enc_len, &varbind_num) == NULL) {
+                continue;
+            }
+            dec_out = snmp_decode_msg_unchecked(enc_out, &dec_header, &varbind_num, varbind_dec);
+            assert(dec_out != NULL);
+            check_num = 6;
+            if (snmp_decode_msg_slice(enc_out, enc_len + 5, &check_header, &check_num, varbind_check) != NULL) {
+                assert(check_num == varbind_num);
+                assert_varbinds_equal(varbind_dec, varbind_check, varbind_num);
+            }
+        }
+        enc_out[i] = orig;
+    }
+
+    /* types are checked, unlike in snmp_decode_msg */
+    enc_out[7] = BER_DATA_T_NULL; /* community */
+    dec_out = snmp_validate_msg(enc_out, enc_len, &varbind_num);
+    assert(dec_out == NULL);
+
+    /* empty value with a long-form length */
+    memcpy(buf, long_null, sizeof(long_null));
+    dec_out = snmp_validate_msg(buf, sizeof(long_null), &varbind_num);
+    assert(dec_out == buf + sizeof(long_null) && varbind_num == 1);
+    varbind_num = 6;
+    dec_out = snmp_decode_msg_unchecked(buf, &dec_header, &varbind_num, varbind_dec);
+    assert(dec_out == buf + sizeof(long_null) && varbind_num == 1);
+    assert(varbind_dec[0].value_type == SNMP_DATA_T_NULL);
+    assert(varbind_dec[0].oid[0] == 1 && varbind_dec[0].oid[1] == 3);
+    assert(varbind_dec[0].oid[2] == SNMP_MSG_OID_END);
+
+    /* 5-byte arc, the biggest one that fits in 32 bits */
+    memcpy(buf, long_arc, sizeof(long_arc));
+    dec_out = snmp_validate_msg(buf, sizeof(long_arc), &varbind_num);
+    assert(dec_out == buf + sizeof(long_arc) && varbind_num == 1);
+    varbind_num = 6;
+    dec_out = snmp_decode_msg_unchecked(buf, &dec_header, &varbind_num, varbind_dec);
+    assert(dec_out == buf + sizeof(long_arc) && varbind_num == 1);
+    assert(varbind_dec[0].oid[2] == UINT32_MAX);
+
+    /* 5-byte arc overflowing 32 bits */
+    buf[26] = 0x9f;
+    dec_out = snmp_validate_msg(buf, sizeof(long_arc), &varbind_num);
+    assert(dec_out == NULL);
+    printf("\n");
+}
+
+void
+snmp_varbind_iter_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_varbind varbind_enc[3] = { 0 };
+    struct snmp_varbind varbind_dec = { 0 };
+    struct snmp_varbind_iter iter;
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, 1, SNMP_MSG_OID_END };
+    uint8_t *enc_out;
+    const uint8_t *dec_out;
+    uint32_t i;
+    int rc;
+
+    enc_header.community = "public";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    enc_header.request_id = 7;
+
+    for (i = 0; i < 3; ++i) {
+        memcpy(varbind_enc[i].oid, oid, sizeof(oid));
+        varbind_enc[i].oid[10] = i + 1;
+    }
+    varbind_enc[0].value_type = SNMP_DATA_T_INTEGER;
+    varbind_enc[0].value.i = 1000;
+    varbind_enc[1].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbind_enc[1].value.s = "eth1";
+    varbind_enc[2].value_type = SNMP_DATA_T_NULL;
+
+    buf_end -= 18;
+
+    printf("# Testing lazy SNMP varbind decoding\n");
+    enc_out = snmp_encode_msg(buf_end, &enc_header, 3, varbind_enc);
+    dec_out = snmp_decode_msg_header(enc_out, (uint32_t)(buf_end + 5 - enc_out + 1), &dec_header, &iter);
+    assert(dec_out != NULL);
+    assert(dec_header.request_id == 7);
+
+    rc = snmp_varbind_iter_next(&iter, &varbind_dec);
+    assert(rc == 1);
+    assert(varbind_dec.value_type == SNMP_DATA_T_INTEGER);
+    assert(varbind_dec.value.i == 1000);
+    assert(varbind_dec.oid[10] == 1);
+
+    rc = snmp_varbind_iter_skip(&iter);
+    assert(rc == 1);
+
+    rc = snmp_varbind_iter_next(&iter, &varbind_dec);
+    assert(rc == 1);
+    assert(varbind_dec.value_type == SNMP_DATA_T_NULL);
+    assert(varbind_dec.oid[10] == 3);
+
+    rc = snmp_varbind_iter_next(&iter, &varbind_dec);
+    assert(rc == 0);
+    rc = snmp_varbind_iter_skip(&iter);
+    assert(rc == 0);
+    assert(iter.buf == buf_end + 1);
+
+    /* the same message, one varbind at a time */
+    dec_out = snmp_decode_msg_header(enc_out, (uint32_t)(buf_end + 5 - enc_out + 1), &dec_header, &iter);
+    for (i = 0; snmp_varbind_iter_next(&iter, &varbind_dec) == 1; ++i) {
+        assert(varbind_dec.value_type == varbind_enc[i].value_type);
+        printf("snmp_varbind_iter_next() = varbind #%" PRIu32 "\n", i);
+    }
+    assert(i == 3);
+    assert(varbind_dec.value_type == SNMP_DATA_T_NULL);
+    printf("\n");
+}
+
+void
+snmp_msg_compact_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_varbind varbind = { 0 };
+    struct snmp_varbind_compact varbind_enc[2] = { 0 };
+    struct snmp_varbind_compact varbind_dec[2] = { 0 };
+    struct ber_arena enc_arena, dec_arena;
+    uint32_t enc_arena_buf[64], dec_arena_buf[64];
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 3, SNMP_MSG_OID_END };
+    uint32_t long_oid[40], *dec_oid, *enc_oid;
+    uint8_t *enc_out, *classic_out, *classic_buf_end;
+    const uint8_t *dec_out;
+    uint32_t i, varbinds_num, enc_len;
+    int rc;
+
+    for (i = 0; i < sizeof(long_oid) / sizeof(long_oid[0]); ++i) {
+        long_oid[i] = i * 1000 + 1;
+    }
+    long_oid[0] = 1;
+    long_oid[1] = 3;
+
+    enc_header.community = "public";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    enc_header.request_id = 99;
+
+    ber_arena_init(&enc_arena, enc_arena_buf, sizeof(enc_arena_buf));
+    rc = snmp_varbind_compact_set_oid(&enc_arena, &varbind_enc[0], oid, 12);
+    assert(rc == 0);
+    varbind_enc[0].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbind_enc[0].value.s = "eth0-and-more";
+    varbind_enc[0].value_len = 4; /* slices don't have to be NUL-terminated */
+    rc = snmp_varbind_compact_set_oid(&enc_arena, &varbind_enc[1], long_oid, 40);
+    assert(rc == 0);
+    varbind_enc[1].value_type = SNMP_DATA_T_INTEGER;
+    varbind_enc[1].value.i = 123456;
+
+    buf_end -= 18;
+
+    printf("# Testing compact SNMP msg coding\n");
+    printf("snmp_encode_msg_compact(...)");
+    enc_out = snmp_encode_msg_compact(buf_end, &enc_header, &enc_arena, 2, varbind_enc);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+    hexdump("", enc_out, enc_len);
+
+    ber_arena_init(&dec_arena, dec_arena_buf, sizeof(dec_arena_buf));
+    varbinds_num = 2;
+    dec_out = snmp_decode_msg_compact(enc_out, enc_len + 5, &dec_header, &dec_arena, &varbinds_num, varbind_dec);
+    assert(dec_out == buf_end + 1);
+    assert(varbinds_num == 2);
+    assert(dec_header.request_id == 99);
+    assert(dec_arena.used == enc_arena.used);
+    for (i = 0; i < 2; ++i) {
+        assert(varbind_dec[i].oid_len == varbind_enc[i].oid_len);
+        dec_oid = snmp_varbind_compact_oid(&dec_arena, &varbind_dec[i]);
+        enc_oid = snmp_varbind_compact_oid(&enc_arena, &varbind_enc[i]);
+        assert(memcmp(dec_oid, enc_oid, varbind_dec[i].oid_len * sizeof(uint32_t)) == 0);
+        assert(varbind_dec[i].value_type == varbind_enc[i].value_type);
+    }
+    assert(varbind_dec[0].value_len == 4);
+    assert(memcmp(varbind_dec[0].value.s, "eth0", 4) == 0);
+    assert(varbind_dec[1].value.i == 123456);
+
+    /* the arena is too small for the 40-arc OID */
+    ber_arena_init(&dec_arena, dec_arena_buf, 30 * sizeof(uint32_t));
+    varbinds_num = 2;
+    dec_out = snmp_decode_msg_compact(enc_out, enc_len + 5, &dec_header, &dec_arena, &varbinds_num, varbind_dec);
+    assert(dec_out == NULL);
+
+    /* compact and classic varbinds encode the same */
+    memcpy(varbind.oid, oid, sizeof(oid));
+    varbind.value_type = SNMP_DATA_T_NULL;
+    varbind_enc[0].value_type = SNMP_DATA_T_NULL;
+    enc_out = snmp_encode_msg_compact(buf_end, &enc_header, &enc_arena, 1, varbind_enc);
+    classic_buf_end = enc_out - 1;
+    classic_out = snmp_encode_msg(classic_buf_end, &enc_header, 1, &varbind);
+    assert(classic_buf_end - classic_out == buf_end - enc_out);
+    assert(memcmp(classic_out, enc_out, (size_t)(buf_end - enc_out + 1)) == 0);
+    printf("\n");
+}
+
+void
+snmp_oid_enc_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbinds[2] = { 0 };
+    struct snmp_varbind_compact varbind_compact = { 0 };
+    struct snmp_oid_enc oid_enc[2];
+    const struct snmp_oid_enc *oid_encs[2] = { &oid_enc[0], &oid_enc[1] };
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 10, 1000001, SNMP_MSG_OID_END };
+    uint32_t long_oid[SNMP_MSG_OID_LEN + 1] = { 1, 3 };
+    uint8_t *enc_out, *pre_out, *pre_buf_end;
+    uint32_t i;
+    int rc;
+
+    printf("# Testing pre-encoded SNMP OID coding\n");
+    rc = snmp_oid_preencode(&oid_enc[0], oid, 12);
+    assert(rc == 0);
+    rc = snmp_oid_preencode(&oid_enc[1], oid, 11);
+    assert(rc == 0);
+    rc = snmp_oid_preencode(&oid_enc[1], long_oid, SNMP_MSG_OID_LEN + 1);
+    assert(rc == -1);
+    rc = snmp_oid_preencode(&oid_enc[1], long_oid, 1);
+    assert(rc == -1);
+    rc = snmp_oid_preencode(&oid_enc[1], long_oid, SNMP_MSG_OID_LEN);
+    assert(rc == 0);
+
+    enc_out = snmp_encode_oid(buf_end, oid);
+    pre_buf_end = enc_out;
+    pre_out = snmp_encode_oid_enc(pre_buf_end, &oid_enc[0]);
+    printf("snmp_encode_oid_enc(...)");
+    hexdump("", pre_out + 1, pre_buf_end - pre_out);
+    assert(pre_buf_end - pre_out == buf_end - enc_out);
+    assert(memcmp(pre_out + 1, enc_out + 1, (size_t)(buf_end - enc_out)) == 0);
+
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    for (i = 0; i < 2; ++i) {
+        memcpy(varbinds[i].oid, oid, sizeof(oid));
+        varbinds[i].value_type = SNMP_DATA_T_INTEGER;
+        varbinds[i].value.i = i;
+    }
+    varbinds[1].oid[11] = SNMP_MSG_OID_END;
+
+    buf_end -= 18;
+    enc_out = snmp_encode_msg(buf_end, &header, 2, varbinds);
+
+    memset(varbinds[0].oid, 0, sizeof(varbinds[0].oid)); /* must not be used */
+    memset(varbinds[1].oid, 0, sizeof(varbinds[1].oid));
+    rc = snmp_oid_preencode(&oid_enc[1], oid, 11);
+    assert(rc == 0);
+    pre_buf_end = enc_out - 1;
+    pre_out = snmp_encode_msg_oid_enc(pre_buf_end, &header, 2, varbinds, oid_encs);
+    assert(pre_buf_end - pre_out == buf_end - enc_out);
+    assert(memcmp(pre_out, enc_out, (size_t)(buf_end - enc_out + 1)) == 0);
+
+    /* NULL entries are encoded from the varbind */
+    memcpy(varbinds[1].oid, oid, sizeof(oid));
+    varbinds[1].oid[11] = SNMP_MSG_OID_END;
+    oid_encs[1] = NULL;
+    pre_out = snmp_encode_msg_oid_enc(pre_buf_end, &header, 2, varbinds, oid_encs);
+    assert(pre_buf_end - pre_out == buf_end - enc_out);
+    assert(memcmp(pre_out, enc_out, (size_t)(buf_end - enc_out + 1)) == 0);
+
+    /* compact varbinds don't need an arena for pre-encoded OIDs */
+    varbind_compact.oid_enc = &oid_enc[0];
+    varbind_compact.value_type = SNMP_DATA_T_INTEGER;
+    pre_out = snmp_encode_msg_compact(pre_buf_end, &header, NULL, 1, &varbind_compact);
+    assert(pre_out != NULL);
+    printf("\n");
+}
+
+static void
+snmp_tmpl_check(struct snmp_msg_tmpl *tmpl, uint32_t request_id, uint32_t value0, const char *value1)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbinds[3] = { 0 };
+    const uint8_t *dec_out;
+    uint32_t varbinds_num = 3;
+
+    /* decoders need 5 bytes of slack after the message */
+    assert(tmpl->len + 5 <= tmpl->size);
+    dec_out = snmp_decode_msg_slice(tmpl->buf, tmpl->len + 5, &header, &varbinds_num, varbinds);
+    assert(dec_out == tmpl->buf + tmpl->len);
+    assert(header.request_id == request_id);
+    assert(header.community_len == 6 && memcmp(header.community, "public", 6) == 0);
+    assert(varbinds_num == 3);
+    assert(varbinds[0].value_type == SNMP_DATA_T_INTEGER);
+    assert(varbinds[0].value.i == value0);
+    assert(varbinds[1].value_type == SNMP_DATA_T_OCTET_STRING);
+    assert(varbinds[1].value_len == strlen(value1));
+    assert(memcmp(varbinds[1].value.s, value1, varbinds[1].value_len) == 0);
+    assert(varbinds[2].oid[10] == 3);
+}
+
+void
+snmp_tmpl_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbinds[3] = { 0 };
+    struct snmp_tmpl_slot slots[3];
+    struct snmp_msg_tmpl tmpl;
+    struct snmp_msg_header dec_header;
+    struct snmp_varbind dec_varbinds[3];
+    union snmp_varbind_val value;
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, 1, SNMP_MSG_OID_END };
+    char long_str[201];
+    const uint8_t *dec_out;
+    uint32_t dec_num, i;
+    int rc;
+
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.request_id = 1;
+
+    for (i = 0; i < 3; ++i) {
+        memcpy(varbinds[i].oid, oid, sizeof(oid));
+        varbinds[i].oid[10] = i + 1;
+    }
+    varbinds[0].value_type = SNMP_DATA_T_INTEGER;
+    varbinds[1].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbinds[1].value.s = "up";
+    varbinds[2].value_type = SNMP_DATA_T_NULL;
+
+    memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = 0;
+
+    printf("# Testing SNMP msg templates\n");
+    rc = snmp_tmpl_compile(&tmpl, buf, 16, &header, 3, varbinds, slots);
+    assert(rc == -1);
+    rc = snmp_tmpl_compile(&tmpl, buf, 512, &header, 3, varbinds, slots);
+    assert(rc == 0);
+    printf("snmp_tmpl_compile(...)");
+    hexdump("", tmpl.buf, tmpl.len);
+    snmp_tmpl_check(&tmpl, 1, 0, "up");
+
+    /* same size patches */
+    rc = snmp_tmpl_set_header(&tmpl, 2, 0, 0);
+    assert(rc == 0);
+    value.i = 5;
+    rc = snmp_tmpl_set_value(&tmpl, 0, SNMP_DATA_T_INTEGER, &value, 0);
+    assert(rc == 0);
+    snmp_tmpl_check(&tmpl, 2, 5, "up");
+
+    /* growing and shrinking patches */
+    rc = snmp_tmpl_set_header(&tmpl, 0x12345678, 0, 0);
+    assert(rc == 0);
+    value.i = 0xDEADBEEF;
+    rc = snmp_tmpl_set_value(&tmpl, 0, SNMP_DATA_T_INTEGER, &value, 0);
+    assert(rc == 0);
+    value.s = long_str;
+    rc = snmp_tmpl_set_value(&tmpl, 1, SNMP_DATA_T_OCTET_STRING, &value, 200);
+    assert(rc == 0);
+    snmp_tmpl_check(&tmpl, 0x12345678, 0xDEADBEEF, long_str);
+
+    value.s = "down";
+    rc = snmp_tmpl_set_value(&tmpl, 1, SNMP_DATA_T_OCTET_STRING, &value, 4);
+    assert(rc == 0);
+    rc = snmp_tmpl_set_header(&tmpl, 3, 0, 0);
+    assert(rc == 0);
+    snmp_tmpl_check(&tmpl, 3, 0xDEADBEEF, "down");
+
+    /* the longest value */
+    value.i64 = 0xFFFFFFFFFFFFFFFFULL;
+    rc = snmp_tmpl_set_value(&tmpl, 2, SNMP_DATA_T_COUNTER64, &value, 0);
+    assert(rc == 0);
+    snmp_tmpl_check(&tmpl, 3, 0xDEADBEEF, "down");
+    dec_num = 3;
+    dec_out = snmp_decode_msg_slice(tmpl.buf, tmpl.len + 5, &dec_header, &dec_num, dec_varbinds);
+    assert(dec_out == tmpl.buf + tmpl.len && dec_num == 3);
+    assert(dec_varbinds[2].value_type == SNMP_DATA_T_COUNTER64);
+    assert(dec_varbinds[2].value.i64 == 0xFFFFFFFFFFFFFFFFULL);
+
+    /* doesn't fit in the buffer */
+    value.s = long_str;
+    tmpl.size = tmpl.len + 100;
+    rc = snmp_tmpl_set_value(&tmpl, 1, SNMP_DATA_T_OCTET_STRING, &value, 200);
+    assert(rc == -1);
+    rc = snmp_tmpl_set_value(&tmpl, 3, SNMP_DATA_T_NULL, &value, 0);
+    assert(rc == -1);
+    snmp_tmpl_check(&tmpl, 3, 0xDEADBEEF, "down");
+
+    /* request_id alone would fit, but the header is patched all or nothing */
+    tmpl.size = tmpl.len + 5 + 3;
+    rc = snmp_tmpl_set_header(&tmpl, 0x12345678, 0x12345678, 0x12345678);
+    assert(rc == -1);
+    snmp_tmpl_check(&tmpl, 3, 0xDEADBEEF, "down");
+    rc = snmp_tmpl_set_header(&tmpl, 0x12345678, 0, 0);
+    assert(rc == 0);
+    snmp_tmpl_check(&tmpl, 0x12345678, 0xDEADBEEF, "down");
+    printf("\n");
+}
+
+void
+snmp_sizeof_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbinds[3] = { 0 };
+    struct snmp_varbind_compact varbind_compact[2] = { 0 };
+    struct snmp_oid_enc oid_enc;
+    struct ber_arena arena;
+    uint32_t arena_buf[32];
+    uint32_t oid[] = { 1, 3, 6, 1, 4, 1, 26609, 2, 1, 1, 2, 0, SNMP_MSG_OID_END };
+    char long_str[300];
+    uint8_t *enc_out;
+    uint32_t i;
+    int rc;
+
+    memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = 0;
+
+    printf("# Testing SNMP size pre-pass\n");
+    enc_out = snmp_encode_oid(buf_end, oid);
+    assert(snmp_sizeof_oid(oid) == (uint32_t)(buf_end - enc_out));
+    enc_out = snmp_encode_oid_len(buf_end, oid, 7);
+    assert(snmp_sizeof_oid_len(oid, 7) == (uint32_t)(buf_end - enc_out));
+
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.request_id = 0x10000;
+    header.error_status = 2;
+    header.error_index = 300;
+
+    for (i = 0; i < 3; ++i) {
+        memcpy(varbinds[i].oid, oid, sizeof(oid));
+    }
+    varbinds[0].value_type = SNMP_DATA_T_INTEGER;
+    varbinds[0].value.i = 0xFFFFFFFF;
+    varbinds[1].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbinds[1].value.s = long_str;
+    varbinds[2].value_type = SNMP_DATA_T_NULL;
+
+    for (i = 1; i <= 3; ++i) {
+        enc_out = snmp_encode_msg(buf_end, &header, i, varbinds);
+        printf("snmp_sizeof_msg(%" PRIu32 " varbinds) = %" PRIu32 "\n", i, snmp_sizeof_msg(&header, i, varbinds));
+        assert(snmp_sizeof_msg(&header, i, varbinds) == (uint32_t)(buf_end - enc_out + 1));
+    }
+
+    varbinds[0].value_type = SNMP_DATA_T_PDU_TRAP;
+    assert(snmp_sizeof_msg(&header, 1, varbinds) == 0);
+
+    rc = snmp_oid_preencode(&oid_enc, oid, 9);
+    assert(rc == 0);
+    ber_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    rc = snmp_varbind_compact_set_oid(&arena, &varbind_compact[0], oid, 12);
+    assert(rc == 0);
+    varbind_compact[0].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbind_compact[0].value.s = long_str;
+    varbind_compact[0].value_len = 130;
+    varbind_compact[1].oid_enc = &oid_enc;
+    varbind_compact[1].value_type = SNMP_DATA_T_INTEGER;
+    enc_out = snmp_encode_msg_compact(buf_end, &header, &arena, 2, varbind_compact);
+    assert(snmp_sizeof_msg_compact(&header, &arena, 2, varbind_compact) == (uint32_t)(buf_end - enc_out + 1));
+    printf("\n");
+}
+
+void
+ber_tape_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbinds[3] = { 0 };
+    struct ber_tape_entry tape[24];
+    const struct ber_tape_entry *entry;
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 1, SNMP_MSG_OID_END };
+    uint32_t path[] = { 0, 2, 3, 1, 1 };
+    uint32_t i, num, size, tape_len;
+    uint8_t *out, *dec_out;
+    int rc;
+
+    printf("# Testing BER tape indexing\n");
+    header.snmp_ver = 1;
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.request_id = 70000;
+    for (i = 0; i < 3; ++i) {
+        memcpy(varbinds[i].oid, oid, sizeof(oid));
+        varbinds[i].value_type = SNMP_DATA_T_INTEGER;
+        varbinds[i].value.i = 1000 * i;
+    }
+    out = snmp_encode_msg(buf_end, &header, 3, varbinds);
+    size = (uint32_t)(buf_end - out + 1);
+
+    /* message, 3 header fields, pdu, 3 pdu fields, varbind list, 3 * (varbind, oid, value) */
+    tape_len = 24;
+    rc = ber_tape_index(out, size, tape, &tape_len);
+    assert(rc == 0);
+    assert(tape_len == 17);
+    assert(tape[0].type == 0x30 && tape[0].depth == 0 && tape[0].span == 17);
+    assert(tape[0].hdr_off == 0 && tape[0].value_off + tape[0].len == size);
+    assert(tape[3].type == SNMP_DATA_T_PDU_GET_RESPONSE && tape[3].span == 14);
+    for (i = 0; i < tape_len; ++i) {
+        assert(tape[i].span >= 1 && i + tape[i].span <= tape_len);
+    }
+
+    /* random access */
+    entry = ber_tape_path(tape, tape_len, path, 5);
+    assert(entry != NULL && entry->type == BER_DATA_T_INTEGER && entry->depth == 4);
+    dec_out = ber_decode_int(out + entry->hdr_off, &num);
+    assert(dec_out == out + entry->value_off + entry->len);
+    assert(num == 1000);
+    path[1] = 1;
+    entry = ber_tape_path(tape, tape_len, path, 2);
+    path[1] = 2;
+    assert(entry == &tape[2] && entry->len == 6 && memcmp(out + entry->value_off, "public", 6) == 0);
+    entry = ber_tape_child(&tape[7], 2);
+    assert(entry == &tape[14]);
+    entry = ber_tape_child(&tape[7], 3);
+    assert(entry == NULL);
+    entry = ber_tape_child(&tape[1], 0);
+    assert(entry == NULL);
+    path[0] = 1;
+    entry = ber_tape_path(tape, tape_len, path, 5);
+    assert(entry == NULL);
+    path[0] = 0;
+    path[3] = 3;
+    entry = ber_tape_path(tape, tape_len, path, 5);
+    assert(entry == NULL);
+
+    /* multiple top-level objects */
+    out = ber_encode_int(out - 1, 42) + 1;
+    size += 3;
+    tape_len = 24;
+    rc = ber_tape_index(out, size, tape, &tape_len);
+    assert(rc == 0);
+    assert(tape_len == 18 && tape[0].span == 1 && tape[1].hdr_off == 3);
+    path[0] = 1;
+    path[3] = 1;
+    entry = ber_tape_path(tape, tape_len, path, 5);
+    assert(entry == &tape[14]);
+
+    /* malformed */
+    tape_len = 16;
+    rc = ber_tape_index(out, size, tape, &tape_len);
+    assert(rc == -1);
+    for (i = 0; i < size; ++i) {
+        tape_len = 24;
+        rc = ber_tape_index(out, i, tape, &tape_len);
+        assert(rc == (i == 0 || i == 3 ? 0 : -1));
+    }
+    out[4]++; /* message longer than the buffer */
+    tape_len = 24;
+    rc = ber_tape_index(out, size, tape, &tape_len);
+    assert(rc == -1);
+    printf("\n");
+}
+
 void
 snmp_oid_test(uint8_t *buf, uint8_t *buf_end)
 {
@@ -162,7 +865,10 @@ void
 ber_fprintf_test(uint8_t *buf, uint8_t *buf_end)
 {
     uint8_t *enc_out, *dec_out;
-    uint32_t num1, num2;
+    struct ber_arena arena;
+    uint8_t arena_buf[64];
+    uint8_t fmt_buf[64];
+    uint32_t num1, num2, enc_len;
     char *str = NULL;
 
     printf("# Testing fprintf syntax-like coding.\n");
@@ -175,8 +881,90 @@ ber_fprintf_test(uint8_t *buf, uint8_t *buf_end)
     assert(num1 == 64);
     assert(num2 == 103);
     assert(strcmp("testing_strings_123", str) <= 0);
+    free(str);
 
+    ber_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    dec_out = ber_sscanf_arena(enc_out, &arena, "%u%u%as", &num1, &num2, &str);
+    assert(dec_out == buf_end + 1);
+    assert(num1 == 64 && num2 == 103);
+    assert(strcmp("testing_strings_123", str) == 0);
+    assert((uint8_t *)str >= arena_buf && (uint8_t *)str < arena_buf + sizeof(arena_buf));
+
+    /* no space for the string */
+    ber_arena_init(&arena, arena_buf, 8);
+    dec_out = ber_sscanf_arena(enc_out, &arena, "%u%u%as", &num1, &num2, &str);
+    assert(dec_out == NULL);
+
+    /* compile-time format gives the same encoding */
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+    memcpy(fmt_buf, enc_out, enc_len);
+    enc_out = BER_ENCODE(buf_end, BER_U(64), BER_U(103), BER_S("testing_strings_123"));
+    assert((uint32_t)(buf_end - enc_out) == enc_len);
+    assert(memcmp(enc_out + 1, fmt_buf, enc_len) == 0);
+
+    dec_out = enc_out + 1;
+    dec_out = BER_DECODE(dec_out, BER_U(&num1), BER_U(&num2), BER_S(&str));
+    assert(dec_out == buf_end + 1);
+    assert(num1 == 64 && num2 == 103);
+    assert(strcmp("testing_strings_123", str) == 0);
     free(str);
+
+    enc_out = BER_ENCODE(buf_end, BER_N(), BER_U(0xFFFFFFFF));
+    hexdump("BER_ENCODE(BER_N(), BER_U(0xFFFFFFFF))", enc_out + 1, buf_end - enc_out);
+    dec_out = enc_out + 1;
+    dec_out = BER_DECODE(dec_out, BER_N(), BER_U(&num1));
+    assert(dec_out == buf_end + 1);
+    assert(num1 == 0xFFFFFFFF);
+
+    /* decoding stops at the first error */
+    enc_out = BER_ENCODE(buf_end, BER_U(1), BER_S("too long"), BER_U(2));
+    enc_out[5] = 0x85;
+    num2 = 0;
+    dec_out = enc_out + 1;
+    dec_out = BER_DECODE(dec_out, BER_U(&num1), BER_S(&str), BER_U(&num2));
+    assert(dec_out == NULL && num1 == 1 && num2 == 0);
+    printf("\n");
+}
+
+void
+ber_snscanf_test(uint8_t *buf, uint8_t *buf_end)
+{
+    const uint8_t *dec_out;
+    uint8_t *enc_out;
+    const char *str;
+    char *astr = NULL;
+    uint32_t num1, num2, str_len, enc_len, i;
+
+    printf("# Testing bounded sscanf syntax-like decoding\n");
+    enc_out = ber_fprintf(buf_end, "%u%s%n%u%s", 64, "zero-copy", 0xFFFFFFFF, "copy");
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+
+    dec_out = ber_snscanf(enc_out, enc_len, "%u%.*s%n%u%ms", &num1, &str_len, &str, &num2, &astr);
+    assert(dec_out == buf_end + 1);
+    assert(num1 == 64 && num2 == 0xFFFFFFFF);
+    assert(str_len == 9 && memcmp(str, "zero-copy", 9) == 0);
+    assert(str >= (const char *)enc_out && str < (const char *)buf_end);
+    assert(strcmp(astr, "copy") == 0);
+    free(astr);
+
+    /* every truncated input is rejected */
+    for (i = 0; i < enc_len; ++i) {
+        dec_out = ber_snscanf(enc_out, i, "%u%.*s%n%u%.*s", &num1, &str_len, &str, &num2, &str_len, &str);
+        assert(dec_out == NULL);
+    }
+
+    /* types are checked */
+    dec_out = ber_snscanf(enc_out, enc_len, "%.*s", &str_len, &str);
+    assert(dec_out == NULL);
+    dec_out = ber_snscanf(enc_out, enc_len, "%u%u", &num1, &num2);
+    assert(dec_out == NULL);
+    dec_out = ber_snscanf(enc_out, enc_len, "%u%.s", &num1, &str);
+    assert(dec_out == NULL);
+
+    /* string length past the end of buffer */
+    enc_out[4] = 0x84;
+    dec_out = ber_snscanf(enc_out, enc_len, "%u%.*s", &num1, &str_len, &str);
+    assert(dec_out == NULL);
     printf("\n");
 }
 
@@ -199,6 +987,79 @@ ber_vlint_test(uint8_t *buf, uint8_t *buf_end)
     printf("\n");
 }
 
+void
+ber_vlint_batch_test(uint8_t *buf, uint8_t *buf_end)
+{
+    uint8_t *enc_out, *dec_out, *ptr;
+    uint32_t values[80], nums[80];
+    uint32_t i, num, nums_len, enc_len;
+
+    printf("# Testing batch variable-length-integer decoding.\n");
+    /* long runs of single-byte vlints with multi-byte ones in between */
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        values[i] = i % 23 == 7 ? 26609 * i : i % 23 == 19 ? (uint32_t)-1 : i;
+    }
+    values[i - 1] = 65536;
+
+    enc_out = buf_end;
+    for (i = sizeof(values) / sizeof(values[0]); i > 0; --i) {
+        enc_out = ber_encode_vlint(enc_out, values[i - 1]);
+    }
+    enc_len = (uint32_t)(buf_end - enc_out);
+
+    nums_len = sizeof(nums) / sizeof(nums[0]);
+    dec_out = ber_decode_vlint_batch(enc_out + 1, enc_len, nums, &nums_len);
+    assert(dec_out == buf_end + 1);
+    assert(nums_len == sizeof(values) / sizeof(values[0]));
+
+    ptr = enc_out + 1;
+    for (i = 0; i < nums_len; ++i) {
+        ptr = ber_decode_vlint(ptr, &num);
+        assert(num == values[i]);
+        assert(nums[i] == num);
+    }
+    assert(ptr == dec_out);
+    printf("ber_decode_vlint_batch(%" PRIu32 " bytes) = %" PRIu32 " vlints\n", enc_len, nums_len);
+
+    /* nums array too small */
+    nums_len = sizeof(nums) / sizeof(nums[0]) - 1;
+    dec_out = ber_decode_vlint_batch(enc_out + 1, enc_len, nums, &nums_len);
+    assert(dec_out == NULL);
+
+    /* last vlint not terminated */
+    nums_len = sizeof(nums) / sizeof(nums[0]);
+    dec_out = ber_decode_vlint_batch(enc_out + 1, enc_len - 1, nums, &nums_len);
+    assert(dec_out == NULL);
+
+    /* vlint longer than 5 bytes */
+    memset(buf, 0x81, 40);
+    buf[40] = 0x01;
+    nums_len = sizeof(nums) / sizeof(nums[0]);
+    dec_out = ber_decode_vlint_batch(buf, 41, nums, &nums_len);
+    assert(dec_out == NULL);
+
+    /* 5-byte vlint overflowing 32 bits, in the middle of single-byte ones
+     * for the SIMD path and alone for the scalar one */
+    memset(buf, 0x01, 60);
+    memcpy(buf + 20, "\x8f\x80\x80\x80\x00", 5);
+    nums_len = sizeof(nums) / sizeof(nums[0]);
+    dec_out = ber_decode_vlint_batch(buf, 60, nums, &nums_len);
+    assert(dec_out == buf + 60 && nums_len == 56 && nums[20] == 0xF0000000);
+    dec_out = ber_decode_vlint(buf + 20, &num);
+    assert(dec_out == buf + 25 && num == 0xF0000000);
+
+    buf[20] = 0x90;
+    nums_len = sizeof(nums) / sizeof(nums[0]);
+    dec_out = ber_decode_vlint_batch(buf, 60, nums, &nums_len);
+    assert(dec_out == NULL);
+    nums_len = sizeof(nums) / sizeof(nums[0]);
+    dec_out = ber_decode_vlint_batch(buf + 20, 5, nums, &nums_len);
+    assert(dec_out == NULL);
+    dec_out = ber_decode_vlint(buf + 20, &num);
+    assert(dec_out == NULL);
+    printf("\n");
+}
+
 void
 ber_int_test(uint8_t *buf, uint8_t *buf_end)
 {
@@ -218,6 +1079,54 @@ ber_int_test(uint8_t *buf, uint8_t *buf_end)
     printf("\n");
 }
 
+void
+ber_uint64_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct ber_writer w;
+    struct ber_stream_token tok = { 0 };
+    uint8_t *enc_out, *dec_out;
+    uint64_t values[] = { 0, 42, 127, 128, 255, 256, 0x7FFFFFFF, 0xFFFFFFFF, 0x100000000,
+                          0x7FFFFFFFFFFFFFFF, 0x8000000000000000, 0xFFFFFFFFFFFFFFFF };
+    uint32_t sizes[] = { 3, 3, 3, 4, 4, 4, 6, 7, 7, 10, 11, 11 };
+    uint64_t num;
+    uint32_t i, size;
+    int rc;
+
+    printf("# Testing BER 64-bit integer coding\n");
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        printf("ber_encode_uint64(%" PRIu64 ")", values[i]);
+        enc_out = ber_encode_uint64(buf_end, values[i], 0x46);
+        size = (uint32_t)(buf_end - enc_out);
+        hexdump("", enc_out + 1, size);
+        assert(size == sizes[i] && size == ber_sizeof_uint64(values[i]));
+        assert(enc_out[1] == 0x46 && enc_out[2] == size - 2);
+        /* never encoded as negative */
+        assert((enc_out[3] & 0x80) == 0);
+        dec_out = ber_decode_uint64(enc_out + 1, &num);
+        assert(num == values[i]);
+        assert(dec_out == buf_end + 1);
+
+        tok.len = size - 2;
+        tok.value = enc_out + 3;
+        rc = ber_stream_token_uint64(&tok, &num);
+        assert(rc == 0 && num == values[i]);
+
+        ber_writer_init(&w, buf, size, NULL, NULL);
+        rc = ber_writer_uint64(&w, values[i], 0x46);
+        assert(rc == 0 && w.len == size);
+        assert(memcmp(buf, enc_out + 1, size) == 0);
+    }
+
+    /* 9 bytes are fine only with a leading sign byte */
+    memcpy(buf, "\x46\x09\x01\x00\x00\x00\x00\x00\x00\x00\x00", 11);
+    dec_out = ber_decode_uint64(buf, &num);
+    assert(dec_out == NULL);
+    memcpy(buf, "\x46\x00", 2);
+    dec_out = ber_decode_uint64(buf, &num);
+    assert(dec_out == NULL);
+    printf("\n");
+}
+
 void
 ber_length_test(uint8_t *buf, uint8_t *buf_end)
 {
@@ -237,6 +1146,147 @@ ber_length_test(uint8_t *buf, uint8_t *buf_end)
     printf("\n");
 }
 
+void
+ber_sizeof_test(uint8_t *buf, uint8_t *buf_end)
+{
+    uint32_t values[] = { 0, 42, 127, 128, 255, 256, 16383, 16384, 65535, 65536,
+                          0xFFFFFF, 0x1000000, 0x0FFFFFFF, 0x10000000, 0xFFFFFFFF };
+    uint8_t *enc_out;
+    uint32_t i;
+
+    printf("# Testing BER size pre-pass\n");
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        enc_out = ber_encode_vlint(buf_end, values[i]);
+        assert(ber_sizeof_vlint(values[i]) == (uint32_t)(buf_end - enc_out));
+        enc_out = ber_encode_int(buf_end, values[i]);
+        assert(ber_sizeof_int(values[i]) == (uint32_t)(buf_end - enc_out));
+        enc_out = ber_encode_length(buf_end, values[i]);
+        assert(ber_sizeof_length(values[i]) == (uint32_t)(buf_end - enc_out));
+        if (values[i] < (uint32_t)(buf_end - buf) - 6) {
+            enc_out = ber_encode_string_len(buf_end, (const char *)buf, values[i]);
+            assert(ber_sizeof_string_len(values[i]) == (uint32_t)(buf_end - enc_out));
+        }
+        printf("ber_sizeof_int(%" PRIu32 ") = %" PRIu32 "\n", values[i], ber_sizeof_int(values[i]));
+    }
+    printf("\n");
+}
+
+void
+ber_stream_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct ber_stream s;
+    struct ber_stream_token tok;
+    uint8_t *enc_out;
+    uint32_t enc_len, consumed, num, tokens = 0;
+    char long_str[200], huge_str[BER_STREAM_VALUE_MAX + 64];
+    uint8_t bad_len[] = { 0x30, 0x03, 0x02, 0x04, 0x00 };
+    uint8_t bad_hdr[] = { 0x30, 0x01, 0x02, 0x01, 0x05 };
+    uint8_t indefinite[] = { 0x30, 0x80 };
+    uint32_t i;
+    int rc;
+
+    memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = 0;
+    for (i = 0; i < sizeof(huge_str) - 1; ++i) {
+        huge_str[i] = (char)('a' + i % 26);
+    }
+    huge_str[sizeof(huge_str) - 1] = 0;
+
+    printf("# Testing resumable BER decoding\n");
+    enc_out = ber_fprintf(buf_end, "%u%s%u", 0x12345678, long_str, 5);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+
+    /* feed the data byte by byte */
+    ber_stream_init(&s);
+    for (i = 0; i < enc_len; ++i) {
+        rc = ber_stream_feed(&s, enc_out + i, 1, &consumed, &tok);
+        assert(consumed == 1);
+        if (rc == BER_STREAM_NEED_MORE) {
+            continue;
+        }
+
+        assert(rc == BER_STREAM_TOKEN);
+        assert(tok.depth == 0 && !tok.constructed);
+        switch (tokens++) {
+            case 0:
+                assert(tok.type == BER_DATA_T_INTEGER);
+                rc = ber_stream_token_int(&tok, &num);
+                assert(rc == 0 && num == 0x12345678);
+                break;
+            case 1:
+                assert(tok.type == BER_DATA_T_OCTET_STRING);
+                assert(tok.len == sizeof(long_str) - 1);
+                assert(memcmp(tok.value, long_str, tok.len) == 0);
+                break;
+            case 2:
+                rc = ber_stream_token_int(&tok, &num);
+                assert(rc == 0 && num == 5);
+                break;
+            default:
+                assert(0);
+        }
+    }
+    assert(tokens == 3);
+
+    /* the whole value in a single chunk is not copied */
+    ber_stream_init(&s);
+    rc = ber_stream_feed(&s, enc_out, enc_len, &consumed, &tok);
+    assert(rc == BER_STREAM_TOKEN);
+    rc = ber_stream_feed(&s, enc_out + consumed, enc_len - consumed, &consumed, &tok);
+    assert(rc == BER_STREAM_TOKEN);
+    assert(tok.value > enc_out && tok.value < enc_out + enc_len);
+
+    /* value too long to be buffered, but whole in a single chunk */
+    enc_out = ber_fprintf(buf_end, "%s", huge_str);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+    ber_stream_init(&s);
+    rc = ber_stream_feed(&s, enc_out, enc_len, &consumed, &tok);
+    assert(rc == BER_STREAM_TOKEN && consumed == enc_len);
+    assert(tok.len == sizeof(huge_str) - 1 && tok.value_off == 0 && tok.value_len == tok.len);
+    assert(memcmp(tok.value, huge_str, tok.len) == 0);
+
+    /* the same value split between chunks is reported in pieces */
+    ber_stream_init(&s);
+    num = 0;
+    tokens = 0;
+    for (i = 0; i < enc_len; i += consumed) {
+        rc = ber_stream_feed(&s, enc_out + i, enc_len - i < 100 ? enc_len - i : 100, &consumed, &tok);
+        if (rc == BER_STREAM_NEED_MORE) {
+            continue;
+        }
+
+        assert(rc == BER_STREAM_TOKEN);
+        assert(tok.type == BER_DATA_T_OCTET_STRING && tok.len == sizeof(huge_str) - 1);
+        assert(tok.value_off == num && tok.value_len > 0);
+        assert(memcmp(tok.value, huge_str + num, tok.value_len) == 0);
+        num += tok.value_len;
+        ++tokens;
+    }
+    assert(num == sizeof(huge_str) - 1 && tokens > 1);
+
+    /* integer longer than its enclosing sequence */
+    ber_stream_init(&s);
+    rc = ber_stream_feed(&s, bad_len, sizeof(bad_len), &consumed, &tok);
+    assert(rc == BER_STREAM_TOKEN);
+    assert(tok.constructed && tok.len == 3);
+    rc = ber_stream_feed(&s, bad_len + consumed, sizeof(bad_len) - consumed, &consumed, &tok);
+    assert(rc == BER_STREAM_ERROR);
+    rc = ber_stream_feed(&s, bad_len, sizeof(bad_len), &consumed, &tok);
+    assert(rc == BER_STREAM_ERROR);
+
+    /* integer header longer than its enclosing sequence */
+    ber_stream_init(&s);
+    rc = ber_stream_feed(&s, bad_hdr, sizeof(bad_hdr), &consumed, &tok);
+    assert(rc == BER_STREAM_TOKEN && tok.constructed && tok.len == 1);
+    rc = ber_stream_feed(&s, bad_hdr + consumed, sizeof(bad_hdr) - consumed, &consumed, &tok);
+    assert(rc == BER_STREAM_ERROR);
+
+    ber_stream_init(&s);
+    rc = ber_stream_feed(&s, indefinite, sizeof(indefinite), &consumed, &tok);
+    assert(rc == BER_STREAM_ERROR);
+    printf("\n");
+}
+
 void
 ber_string_test(uint8_t *buf, uint8_t *buf_end)
 {
@@ -244,10 +1294,13 @@ ber_string_test(uint8_t *buf, uint8_t *buf_end)
     const char *values[] = { "a", "ab", "test123", "testing_longer_name" };
     const char *str;
     char *astr;
+    struct ber_arena arena;
+    uint8_t arena_buf[32];
     uint8_t next;
     uint32_t i, enc_method, str_len;
 
     printf("# Testing BER string coding\n");
+    ber_arena_init(&arena, arena_buf, sizeof(arena_buf));
     for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
         printf("ber_encode_string(\"%s\")", values[i]);
         for (enc_method = 0; enc_method < 2; ++enc_method) {
@@ -268,6 +1321,14 @@ ber_string_test(uint8_t *buf, uint8_t *buf_end)
             assert(dec_out == buf_end + 1);
             free(astr);
 
+            ber_arena_reset(&arena);
+            dec_out = ber_decode_string_arena(enc_out + 1, &arena, &astr, 128);
+            assert(strcmp(astr, values[i]) == 0);
+            assert(dec_out == buf_end + 1);
+            assert(arena.used == str_len + 1);
+            dec_out = ber_decode_string_arena(enc_out + 1, &arena, &astr, str_len - 1);
+            assert(dec_out == NULL);
+
             dec_out = ber_decode_string_buffer(enc_out + 1, &str, 128, &next);
             assert(strlen(str) == strlen(values[i]));
             assert(strncmp(str, values[i], str_len) == 0);
@@ -278,6 +1339,1366 @@ ber_string_test(uint8_t *buf, uint8_t *buf_end)
     printf("\n");
 }
 
+void
+snmp_msg_batch_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_varbind enc_varbinds[4] = { 0 };
+    struct snmp_varbind batch_varbinds[20][4];
+    struct snmp_varbind dec_varbinds[4];
+    struct snmp_msg_batch msgs[20];
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, SNMP_MSG_OID_END };
+    uint8_t msg_buf[4096];
+    uint8_t *enc_out, *msg_end = msg_buf + sizeof(msg_buf) - 1;
+    uint32_t i, j, varbind_num, enc_len, dec_num;
+
+    enc_header.community = "public";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    for (i = 0; i < 4; ++i) {
+        memcpy(enc_varbinds[i].oid, oid, sizeof(oid));
+        enc_varbinds[i].value_type = SNMP_DATA_T_INTEGER;
+        enc_varbinds[i].value.i = i * 100000;
+    }
+
+    /* messages with 0-4 varbinds, every 7th one is broken */
+    for (i = 0; i < 20; ++i) {
+        enc_header.request_id = i;
+        enc_out = snmp_encode_msg(msg_end, &enc_header, i % 5, enc_varbinds);
+        enc_len = (uint32_t)(msg_end - enc_out + 1);
+        if (i % 7 == 3) {
+            assert(enc_out[13] == SNMP_DATA_T_PDU_GET_RESPONSE);
+            enc_out[13] = SNMP_DATA_T_PDU_TRAP;
+        }
+
+        msgs[i].buf = enc_out;
+        msgs[i].buf_len = enc_len + 5;
+        msgs[i].varbind_num = i == 9 ? 2 : 4;
+        msgs[i].varbinds = batch_varbinds[i];
+        msg_end = enc_out - 6;
+    }
+
+    printf("# Testing batch SNMP msg decoding\n");
+    dec_num = snmp_decode_msg_batch(msgs, 20);
+    assert(dec_num == 17);
+    for (i = 0; i < 20; ++i) {
+        varbind_num = i == 9 ? 2 : 4;
+        if (snmp_decode_msg_slice(msgs[i].buf, msgs[i].buf_len, &dec_header, &varbind_num, dec_varbinds) == NULL) {
+            assert(msgs[i].status == -1);
+            continue;
+        }
+
+        assert(msgs[i].status == 0);
+        assert(msgs[i].header.request_id == i);
+        assert(msgs[i].varbind_num == varbind_num);
+        assert(varbind_num == (i == 9 ? 2 : i % 5));
+        for (j = 0; j < varbind_num; ++j) {
+            assert(memcmp(msgs[i].varbinds[j].oid, dec_varbinds[j].oid, sizeof(oid)) == 0);
+            assert(msgs[i].varbinds[j].value.i == dec_varbinds[j].value.i);
+        }
+    }
+
+    dec_num = snmp_decode_msg_batch(msgs, 0);
+    assert(dec_num == 0);
+    printf("\n");
+}
+
+void
+snmp_bulk_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_varbind enc_varbinds[6] = { 0 };
+    struct snmp_varbind dec_varbinds[6];
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, SNMP_MSG_OID_END };
+    uint8_t *out, *dec_out;
+    uint32_t i, varbind_num, encoded_num, size;
+
+    printf("# Testing SNMP GetBulk msg\n");
+    enc_header.snmp_ver = 1;
+    enc_header.community = "public";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_BULK_REQUEST;
+    enc_header.request_id = 42;
+    enc_header.error_status = 5; /* ignored */
+    enc_header.non_repeaters = 1;
+    enc_header.max_repetitions = 300;
+    memcpy(enc_varbinds[0].oid, oid, sizeof(oid));
+    enc_varbinds[0].value_type = SNMP_DATA_T_NULL;
+
+    out = snmp_encode_msg(buf_end, &enc_header, 1, enc_varbinds);
+    size = (uint32_t)(buf_end - out + 1);
+    assert(size == snmp_sizeof_msg(&enc_header, 1, enc_varbinds));
+    varbind_num = 6;
+    dec_out = snmp_decode_msg(out, size + 5, &dec_header, &varbind_num, dec_varbinds);
+    assert(dec_out != NULL);
+    assert(dec_header.pdu_type == SNMP_DATA_T_PDU_GET_BULK_REQUEST);
+    assert(dec_header.request_id == 42);
+    assert(dec_header.non_repeaters == 1 && dec_header.max_repetitions == 300);
+    assert(dec_header.error_status == 0 && dec_header.error_index == 0);
+    assert(varbind_num == 1);
+
+    /* response rows are truncated to what fits, the last one is an exception */
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    enc_header.error_status = 0;
+    for (i = 0; i < 6; ++i) {
+        memcpy(enc_varbinds[i].oid, oid, sizeof(oid));
+        enc_varbinds[i].oid[10] = i;
+        enc_varbinds[i].oid[11] = SNMP_MSG_OID_END;
+        enc_varbinds[i].value_type = SNMP_DATA_T_INTEGER;
+        enc_varbinds[i].value.i = i * 1000;
+    }
+    enc_varbinds[3].value_type = SNMP_DATA_T_END_OF_MIB_VIEW;
+
+    size = snmp_sizeof_msg(&enc_header, 4, enc_varbinds);
+    assert(snmp_sizeof_msg(&enc_header, 5, enc_varbinds) > size);
+    out = snmp_encode_msg_fit(buf_end, size, &enc_header, 6, enc_varbinds, &encoded_num);
+    assert(out != NULL && encoded_num == 4);
+    assert((uint32_t)(buf_end - out + 1) == size);
+    assert(out[size - 2] == SNMP_DATA_T_END_OF_MIB_VIEW && out[size - 1] == 0);
+
+    varbind_num = 6;
+    dec_out = snmp_decode_msg(out, size + 5, &dec_header, &varbind_num, dec_varbinds);
+    assert(dec_out != NULL);
+    assert(dec_header.non_repeaters == 0 && dec_header.max_repetitions == 0);
+    assert(varbind_num == 4);
+    assert(dec_varbinds[2].value.i == 2000 && dec_varbinds[2].oid[10] == 2);
+    assert(dec_varbinds[3].value_type == SNMP_DATA_T_END_OF_MIB_VIEW);
+
+    out = snmp_encode_msg_fit(buf_end, size + 1000, &enc_header, 6, enc_varbinds, &encoded_num);
+    assert(out != NULL && encoded_num == 6);
+    assert((uint32_t)(buf_end - out + 1) == snmp_sizeof_msg(&enc_header, 6, enc_varbinds));
+
+    out = snmp_encode_msg_fit(buf_end, 10, &enc_header, 6, enc_varbinds, &encoded_num);
+    assert(out == NULL);
+    printf("\n");
+}
+
+void
+snmp_app_types_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_varbind enc_varbinds[4] = { 0 };
+    struct snmp_varbind dec_varbinds[4];
+    struct snmp_stream stream;
+    enum snmp_data_type types[] = { SNMP_DATA_T_COUNTER32, SNMP_DATA_T_GAUGE32,
+                                    SNMP_DATA_T_TIMETICKS, SNMP_DATA_T_COUNTER64 };
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 1, SNMP_MSG_OID_END };
+    struct ber_writer w;
+    uint8_t *out;
+    const uint8_t *dec_out;
+    uint32_t i, varbind_num, size, consumed;
+    int rc;
+
+    printf("# Testing SNMP application types\n");
+    enc_header.snmp_ver = 1;
+    enc_header.community = "public";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    for (i = 0; i < 4; ++i) {
+        memcpy(enc_varbinds[i].oid, oid, sizeof(oid));
+        enc_varbinds[i].value_type = types[i];
+        enc_varbinds[i].value.i = 0xFFFFFFF0 + i;
+    }
+    enc_varbinds[3].value.i64 = 0xFEDCBA9876543210;
+
+    out = snmp_encode_msg(buf_end, &enc_header, 4, enc_varbinds);
+    size = (uint32_t)(buf_end - out + 1);
+    hexdump("snmp_encode_msg", out, size);
+    assert(size == snmp_sizeof_msg(&enc_header, 4, enc_varbinds));
+
+    ber_writer_init(&w, buf, (uint32_t)(out - buf), NULL, NULL);
+    rc = snmp_write_msg(&w, &enc_header, 4, enc_varbinds);
+    assert(rc == 0);
+    assert(w.len == size && memcmp(buf, out, size) == 0);
+
+    varbind_num = 4;
+    dec_out = snmp_decode_msg_slice(out, size + 5, &dec_header, &varbind_num, dec_varbinds);
+    assert(dec_out != NULL);
+    assert(varbind_num == 4);
+    for (i = 0; i < 3; ++i) {
+        assert(dec_varbinds[i].value_type == types[i]);
+        assert(dec_varbinds[i].value.i == 0xFFFFFFF0 + i);
+    }
+    assert(dec_varbinds[3].value_type == SNMP_DATA_T_COUNTER64);
+    assert(dec_varbinds[3].value.i64 == 0xFEDCBA9876543210);
+
+    snmp_stream_init(&stream);
+    rc = snmp_stream_feed(&stream, out, size, &consumed, &dec_header, &dec_varbinds[0]);
+    assert(rc == SNMP_STREAM_HEADER);
+    for (i = 0; i < 4; ++i) {
+        out += consumed;
+        size -= consumed;
+        rc = snmp_stream_feed(&stream, out, size, &consumed, &dec_header, &dec_varbinds[0]);
+        assert(rc == SNMP_STREAM_VARBIND);
+        assert(dec_varbinds[0].value_type == types[i]);
+    }
+    assert(dec_varbinds[0].value.i64 == 0xFEDCBA9876543210);
+
+    /* Counter32 has to fit in 32 bits */
+    out = snmp_encode_msg(buf_end, &enc_header, 4, enc_varbinds);
+    size = (uint32_t)(buf_end - out + 1);
+    assert(out[size - 11] == SNMP_DATA_T_COUNTER64);
+    out[size - 11] = SNMP_DATA_T_COUNTER32;
+    varbind_num = 4;
+    dec_out = snmp_decode_msg(out, size + 5, &dec_header, &varbind_num, dec_varbinds);
+    assert(dec_out == NULL);
+    printf("\n");
+}
+
+void
+snmp_stream_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header enc_header = { 0 };
+    struct snmp_msg_header dec_header = { 0 };
+    struct snmp_varbind enc_varbinds[3] = { 0 };
+    struct snmp_varbind dec_varbind = { 0 };
+    struct snmp_stream s;
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 200000, SNMP_MSG_OID_END };
+    uint8_t *enc_out, *msg_end;
+    uint32_t enc_len, chunk, off, consumed, i, msgs, varbinds, descr_off;
+    char descr[600];
+    int rc;
+
+    enc_header.snmp_ver = 1;
+    enc_header.community = "private";
+    enc_header.pdu_type = SNMP_DATA_T_PDU_SET_REQUEST;
+    enc_header.request_id = 0x7FFFFFFF;
+    enc_header.error_index = 2;
+
+    for (i = 0; i < 3; ++i) {
+        memcpy(enc_varbinds[i].oid, oid, sizeof(oid));
+        enc_varbinds[i].oid[11] += i;
+    }
+    enc_varbinds[0].value_type = SNMP_DATA_T_INTEGER;
+    enc_varbinds[0].value.i = 1000;
+    enc_varbinds[1].value_type = SNMP_DATA_T_OCTET_STRING;
+    enc_varbinds[1].value.s = "eth1";
+    enc_varbinds[2].value_type = SNMP_DATA_T_NULL;
+
+    /* two messages back to back, the second one without varbinds */
+    msg_end = snmp_encode_msg(buf_end, &enc_header, 0, enc_varbinds) - 1;
+    enc_out = snmp_encode_msg(msg_end, &enc_header, 3, enc_varbinds);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+
+    printf("# Testing resumable SNMP msg decoding\n");
+    for (chunk = 1; chunk <= enc_len; chunk += 6) {
+        snmp_stream_init(&s);
+        msgs = varbinds = 0;
+        for (off = 0; off < enc_len;) {
+            i = enc_len - off < chunk ? enc_len - off : chunk;
+            do {
+                rc = snmp_stream_feed(&s, enc_out + off, i, &consumed, &dec_header, &dec_varbind);
+                off += consumed;
+                i -= consumed;
+                switch (rc) {
+                    case SNMP_STREAM_HEADER:
+                        assert(dec_header.snmp_ver == 1);
+                        assert(strcmp(dec_header.community, "private") == 0);
+                        assert(dec_header.pdu_type == SNMP_DATA_T_PDU_SET_REQUEST);
+                        assert(dec_header.request_id == 0x7FFFFFFF);
+                        assert(dec_header.error_status == 0);
+                        assert(dec_header.error_index == 2);
+                        assert(varbinds == 0);
+                        break;
+                    case SNMP_STREAM_VARBIND:
+                        assert(memcmp(dec_varbind.oid, enc_varbinds[varbinds].oid, sizeof(oid)) == 0);
+                        assert(dec_varbind.value_type == enc_varbinds[varbinds].value_type);
+                        if (varbinds == 0) {
+                            assert(dec_varbind.value.i == 1000);
+                        } else if (varbinds == 1) {
+                            assert(dec_varbind.value_len == 4);
+                            assert(memcmp(dec_varbind.value.s, "eth1", 4) == 0);
+                        }
+                        ++varbinds;
+                        break;
+                    case SNMP_STREAM_END:
+                        assert(varbinds == (msgs == 0 ? 3 : 0));
+                        varbinds = 0;
+                        ++msgs;
+                        break;
+                    case SNMP_STREAM_NEED_MORE:
+                        assert(i == 0);
+                        break;
+                    default:
+                        assert(0);
+                }
+            } while (rc != SNMP_STREAM_NEED_MORE);
+        }
+
+        assert(msgs == 2);
+        rc = snmp_stream_feed(&s, NULL, 0, &consumed, &dec_header, &dec_varbind);
+        assert(rc == SNMP_STREAM_NEED_MORE);
+    }
+
+    /* string value longer than BER_STREAM_VALUE_MAX */
+    for (i = 0; i < sizeof(descr) - 1; ++i) {
+        descr[i] = (char)('a' + i % 26);
+    }
+    descr[sizeof(descr) - 1] = 0;
+    enc_varbinds[1].value.s = descr;
+    enc_out = snmp_encode_msg(buf_end, &enc_header, 2, enc_varbinds);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+
+    /* fed in small chunks and then all at once */
+    for (chunk = 64; chunk != 0; chunk = chunk < enc_len ? enc_len : 0) {
+        snmp_stream_init(&s);
+        varbinds = descr_off = 0;
+        for (off = 0; off < enc_len;) {
+            i = enc_len - off < chunk ? enc_len - off : chunk;
+            do {
+                rc = snmp_stream_feed(&s, enc_out + off, i, &consumed, &dec_header, &dec_varbind);
+                off += consumed;
+                i -= consumed;
+                switch (rc) {
+                    case SNMP_STREAM_VALUE_PART:
+                        /* only a value split between chunks comes in pieces */
+                        assert(chunk < enc_len && varbinds == 1);
+                        assert(dec_varbind.value_type == SNMP_DATA_T_OCTET_STRING);
+                        assert(memcmp(dec_varbind.value.s, descr + descr_off, dec_varbind.value_len) == 0);
+                        descr_off += dec_varbind.value_len;
+                        break;
+                    case SNMP_STREAM_VARBIND:
+                        if (varbinds == 1) {
+                            assert(memcmp(dec_varbind.value.s, descr + descr_off, dec_varbind.value_len) == 0);
+                            descr_off += dec_varbind.value_len;
+                            assert(descr_off == sizeof(descr) - 1);
+                        }
+                        ++varbinds;
+                        break;
+                    case SNMP_STREAM_HEADER:
+                    case SNMP_STREAM_END:
+                    case SNMP_STREAM_NEED_MORE:
+                        break;
+                    default:
+                        assert(0);
+                }
+            } while (rc != SNMP_STREAM_NEED_MORE);
+        }
+        assert(varbinds == 2);
+    }
+
+    /* unsupported PDU type */
+    enc_varbinds[1].value.s = "eth1";
+    enc_out = snmp_encode_msg(buf_end, &enc_header, 3, enc_varbinds);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+    assert(enc_out[14] == SNMP_DATA_T_PDU_SET_REQUEST);
+    enc_out[14] = SNMP_DATA_T_PDU_TRAP;
+    snmp_stream_init(&s);
+    rc = snmp_stream_feed(&s, enc_out, enc_len, &consumed, &dec_header, &dec_varbind);
+    assert(rc == SNMP_STREAM_ERROR);
+    rc = snmp_stream_feed(&s, enc_out, enc_len, &consumed, &dec_header, &dec_varbind);
+    assert(rc == SNMP_STREAM_ERROR);
+    printf("\n");
+}
+
+static const uint32_t agent_sys_descr_oid[] = { 1, 3, 6, 1, 2, 1, 1, 1, 0 };
+static const uint32_t agent_sys_uptime_oid[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+static const uint32_t agent_sys_name_oid[] = { 1, 3, 6, 1, 2, 1, 1, 5, 0 };
+static char agent_sys_name[64] = "cber";
+
+static int
+agent_get_string(const struct snmp_mib_entry *entry, struct snmp_varbind *varbind)
+{
+    varbind->value_type = SNMP_DATA_T_OCTET_STRING;
+    varbind->value.s = entry->ctx;
+    return 0;
+}
+
+static int
+agent_get_uptime(const struct snmp_mib_entry *entry, struct snmp_varbind *varbind)
+{
+    varbind->value_type = SNMP_DATA_T_INTEGER;
+    varbind->value.i = 4242;
+    return 0;
+}
+
+static int
+agent_set_string(const struct snmp_mib_entry *entry, const struct snmp_varbind *varbind)
+{
+    if (varbind->value_type != SNMP_DATA_T_OCTET_STRING || strlen(varbind->value.s) >= 64) {
+        return -1;
+    }
+
+    strcpy(entry->ctx, varbind->value.s);
+    return 0;
+}
+
+/** Send a request to the agent on loopback and decode its response */
+static int
+agent_request(int fd, uint16_t port, struct snmp_msg_header *header,
+              uint32_t varbind_num, struct snmp_varbind *varbinds,
+              struct snmp_msg_header *resp_header, uint32_t *resp_num,
+              struct snmp_varbind *resp_varbinds, uint8_t *buf, uint32_t buf_len)
+{
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in sin;
+    } addr;
+    uint8_t *buf_end = buf + buf_len - 1;
+    uint8_t *out;
+    ssize_t len;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin.sin_family = AF_INET;
+    addr.sin.sin_port = htons(port);
+    addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    out = snmp_encode_msg(buf_end, header, varbind_num, varbinds);
+    len = sendto(fd, out, (size_t)(buf_end - out + 1), 0, &addr.sa, sizeof(addr.sin));
+    assert(len == buf_end - out + 1);
+
+    len = recv(fd, buf, buf_len - 5, 0);
+    if (len <= 0) {
+        return -1;
+    }
+
+    return snmp_decode_msg(buf, (uint32_t)len + 5, resp_header, resp_num, resp_varbinds) ? 0 : -1;
+}
+
+void
+snmp_agent_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_mib_entry mib[] = {
+        { agent_sys_descr_oid, 9, agent_get_string, NULL, "cber agent" },
+        { agent_sys_uptime_oid, 9, agent_get_uptime, NULL, NULL },
+        { agent_sys_name_oid, 9, agent_get_string, agent_set_string, agent_sys_name },
+    };
+    struct snmp_agent_config config = { 0 };
+    struct snmp_msg_header header = { 0 };
+    struct snmp_msg_header resp_header = { 0 };
+    struct snmp_varbind varbinds[2] = { 0 };
+    struct snmp_varbind resp_varbinds[8];
+    struct timeval timeout = { 1, 0 };
+    struct snmp_agent *agent;
+    uint32_t buf_len = (uint32_t)(buf_end - buf + 1);
+    uint32_t resp_num;
+    uint16_t port;
+    int fd, rc;
+
+    config.addr = "127.0.0.1";
+    config.worker_num = 2;
+    config.community = "public";
+    config.mib = mib;
+    config.mib_len = 3;
+
+    printf("# Testing SNMP agent on loopback\n");
+    agent = snmp_agent_start(&config);
+    assert(agent != NULL);
+    port = snmp_agent_port(agent);
+    assert(port != 0);
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(fd >= 0);
+    rc = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    assert(rc == 0);
+
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_REQUEST;
+    header.request_id = 1;
+    memcpy(varbinds[0].oid, agent_sys_descr_oid, sizeof(agent_sys_descr_oid));
+    varbinds[0].oid[9] = SNMP_MSG_OID_END;
+    varbinds[0].value_type = SNMP_DATA_T_NULL;
+    memcpy(varbinds[1].oid, agent_sys_uptime_oid, sizeof(agent_sys_uptime_oid));
+    varbinds[1].oid[9] = SNMP_MSG_OID_END;
+    varbinds[1].value_type = SNMP_DATA_T_NULL;
+
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 2, varbinds, &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == 0);
+    assert(resp_header.pdu_type == SNMP_DATA_T_PDU_GET_RESPONSE);
+    assert(resp_header.request_id == 1);
+    assert(resp_header.error_status == SNMP_AGENT_ERR_NO_ERROR);
+    assert(resp_num == 2);
+    assert(strcmp(resp_varbinds[0].value.s, "cber agent") == 0);
+    assert(resp_varbinds[1].value.i == 4242);
+
+    /* GETNEXT walks to the following object */
+    header.pdu_type = SNMP_DATA_T_PDU_GET_NEXT_REQUEST;
+    header.request_id = 2;
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 1, varbinds, &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == 0);
+    assert(resp_header.request_id == 2 && resp_num == 1);
+    assert(memcmp(resp_varbinds[0].oid, agent_sys_uptime_oid, sizeof(agent_sys_uptime_oid)) == 0);
+    assert(resp_varbinds[0].value.i == 4242);
+
+    /* SET, then GET the new value */
+    header.pdu_type = SNMP_DATA_T_PDU_SET_REQUEST;
+    header.request_id = 3;
+    memcpy(varbinds[1].oid, agent_sys_name_oid, sizeof(agent_sys_name_oid));
+    varbinds[1].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbinds[1].value.s = "router-1";
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 1, &varbinds[1], &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == 0);
+    assert(resp_header.error_status == SNMP_AGENT_ERR_NO_ERROR && resp_num == 1);
+    assert(strcmp(agent_sys_name, "router-1") == 0);
+
+    header.pdu_type = SNMP_DATA_T_PDU_GET_REQUEST;
+    header.request_id = 4;
+    varbinds[1].value_type = SNMP_DATA_T_NULL;
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 1, &varbinds[1], &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == 0);
+    assert(strcmp(resp_varbinds[0].value.s, "router-1") == 0);
+
+    /* read-only object */
+    header.pdu_type = SNMP_DATA_T_PDU_SET_REQUEST;
+    header.request_id = 5;
+    varbinds[0].value_type = SNMP_DATA_T_INTEGER;
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 1, varbinds, &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == 0);
+    assert(resp_header.error_status == SNMP_AGENT_ERR_READ_ONLY);
+    assert(resp_header.error_index == 1);
+    assert(strcmp(agent_sys_name, "router-1") == 0);
+
+    /* the second varbind is past the end of the MIB */
+    header.pdu_type = SNMP_DATA_T_PDU_GET_NEXT_REQUEST;
+    header.request_id = 6;
+    varbinds[0].value_type = SNMP_DATA_T_NULL;
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 2, varbinds, &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == 0);
+    assert(resp_header.error_status == SNMP_AGENT_ERR_NO_SUCH_NAME);
+    assert(resp_header.error_index == 2);
+    assert(memcmp(resp_varbinds[1].oid, agent_sys_name_oid, sizeof(agent_sys_name_oid)) == 0);
+
+    /* GETBULK walks a non-repeater once and the repeater to the end of MIB */
+    header.snmp_ver = 1;
+    header.pdu_type = SNMP_DATA_T_PDU_GET_BULK_REQUEST;
+    header.request_id = 7;
+    header.non_repeaters = 1;
+    header.max_repetitions = 10;
+    memcpy(varbinds[1].oid, agent_sys_descr_oid, sizeof(agent_sys_descr_oid));
+    resp_num = 8;
+    rc = agent_request(fd, port, &header, 2, varbinds, &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == 0);
+    assert(resp_header.pdu_type == SNMP_DATA_T_PDU_GET_RESPONSE);
+    assert(resp_header.request_id == 7 && resp_header.error_status == 0);
+    assert(resp_num == 4);
+    assert(memcmp(resp_varbinds[0].oid, agent_sys_uptime_oid, sizeof(agent_sys_uptime_oid)) == 0);
+    assert(memcmp(resp_varbinds[1].oid, agent_sys_uptime_oid, sizeof(agent_sys_uptime_oid)) == 0);
+    assert(resp_varbinds[1].value.i == 4242);
+    assert(strcmp(resp_varbinds[2].value.s, "router-1") == 0);
+    assert(resp_varbinds[3].value_type == SNMP_DATA_T_END_OF_MIB_VIEW);
+    assert(memcmp(resp_varbinds[3].oid, agent_sys_name_oid, sizeof(agent_sys_name_oid)) == 0);
+
+    /* wrong community is dropped */
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 200000;
+    rc = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    assert(rc == 0);
+    header.community = "private";
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 1, varbinds, &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == -1);
+
+    /* so is GETBULK in SNMPv1 */
+    header.snmp_ver = 0;
+    header.community = "public";
+    resp_num = 4;
+    rc = agent_request(fd, port, &header, 1, varbinds, &resp_header, &resp_num, resp_varbinds, buf, buf_len);
+    assert(rc == -1);
+
+    assert(snmp_agent_requests(agent) == 7);
+    close(fd);
+    snmp_agent_stop(agent);
+    printf("\n");
+}
+
+struct poller_test_ctx {
+    uint32_t ok;
+    uint32_t timeouts;
+    uint32_t now;
+};
+
+static uint32_t
+poller_test_clock(void *ctx)
+{
+    struct poller_test_ctx *test = ctx;
+
+    return test->now;
+}
+
+static void
+poller_test_cb(void *ctx, void *req_ctx, int status, const struct snmp_msg_header *header,
+               uint32_t varbind_num, const struct snmp_varbind *varbinds)
+{
+    struct poller_test_ctx *test = ctx;
+
+    assert(req_ctx == &test->ok);
+    if (status == SNMP_POLLER_TIMEOUT) {
+        assert(header == NULL);
+        ++test->timeouts;
+        return;
+    }
+
+    assert(status == SNMP_POLLER_OK);
+    assert(header->error_status == 0);
+    assert(varbind_num == 1);
+    assert(varbinds[0].value_len == 10);
+    assert(memcmp(varbinds[0].value.s, "cber agent", 10) == 0);
+    ++test->ok;
+}
+
+void
+snmp_poller_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_mib_entry mib[] = {
+        { agent_sys_descr_oid, 9, agent_get_string, NULL, "cber agent" },
+    };
+    struct snmp_agent_config agent_config = { 0 };
+    struct snmp_poller_config config = { 0 };
+    struct poller_test_ctx test = { 0 };
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbind = { 0 };
+    struct sockaddr_in addr = { 0 };
+    struct snmp_agent *agent;
+    struct snmp_poller *poller;
+    uint32_t sent = 0, timeouts;
+    uint64_t retransmits;
+    int rc;
+
+    agent_config.addr = "127.0.0.1";
+    agent_config.worker_num = 1;
+    agent_config.community = "public";
+    agent_config.mib = mib;
+    agent_config.mib_len = 1;
+    agent = snmp_agent_start(&agent_config);
+    assert(agent != NULL);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(snmp_agent_port(agent));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    config.socket_num = 2;
+    config.max_inflight = 64;
+    config.timeout_ms = 50;
+    config.retries = 1;
+    config.cb = poller_test_cb;
+    config.clock = poller_test_clock;
+    config.ctx = &test;
+    poller = snmp_poller_create(&config);
+    assert(poller != NULL);
+
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_REQUEST;
+    memcpy(varbind.oid, agent_sys_descr_oid, sizeof(agent_sys_descr_oid));
+    varbind.oid[9] = SNMP_MSG_OID_END;
+    varbind.value_type = SNMP_DATA_T_NULL;
+
+    printf("# Testing asynchronous SNMP poller\n");
+    /* keep the request table full, so its slots are reused. The clock only
+     * ticks 1ms per run, so a slow agent doesn't make requests time out. */
+    while (sent < 1000 || snmp_poller_inflight(poller) > 0) {
+        while (sent < 1000 && snmp_poller_send(poller, &addr, &header, 1, &varbind, &test.ok) == 0) {
+            ++sent;
+        }
+        rc = snmp_poller_run(poller, 10);
+        assert(rc >= 0);
+        ++test.now;
+    }
+    /* a lost datagram could still time out twice */
+    assert(test.ok + test.timeouts == 1000);
+    assert(test.ok > 0);
+
+    /* requests with a wrong community are dropped by the agent */
+    header.community = "private";
+    timeouts = test.timeouts;
+    retransmits = snmp_poller_retransmits(poller);
+    for (sent = 0; sent < 64; ++sent) {
+        rc = snmp_poller_send(poller, &addr, &header, 1, &varbind, &test.ok);
+        assert(rc == 0);
+    }
+    rc = snmp_poller_send(poller, &addr, &header, 1, &varbind, &test.ok);
+    assert(rc == -1);
+    assert(snmp_poller_inflight(poller) == 64);
+
+    while (snmp_poller_inflight(poller) > 0) {
+        rc = snmp_poller_run(poller, 1);
+        assert(rc >= 0);
+        test.now += 10;
+    }
+    assert(test.timeouts - timeouts == 64);
+    assert(test.ok + test.timeouts == 1064);
+    assert(snmp_poller_retransmits(poller) - retransmits == 64);
+    snmp_poller_destroy(poller);
+
+    /* timeouts above 64ms go through the higher levels of the timer wheel */
+    config.timeout_ms = 150;
+    config.retries = 0;
+    poller = snmp_poller_create(&config);
+    assert(poller != NULL);
+    for (sent = 0; sent < 8; ++sent) {
+        rc = snmp_poller_send(poller, &addr, &header, 1, &varbind, &test.ok);
+        assert(rc == 0);
+    }
+
+    timeouts = test.timeouts;
+    test.now += 149;
+    rc = snmp_poller_run(poller, 1);
+    assert(rc == 0);
+    assert(snmp_poller_inflight(poller) == 8);
+
+    ++test.now;
+    rc = snmp_poller_run(poller, 1);
+    assert(rc == 8);
+    assert(test.timeouts - timeouts == 8);
+    assert(snmp_poller_retransmits(poller) == 0);
+
+    snmp_poller_destroy(poller);
+    snmp_agent_stop(agent);
+    printf("\n");
+}
+
+void
+ber_archive_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbind = { 0 };
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0, SNMP_MSG_OID_END };
+    uint64_t times[] = { 10, 20, 20, 30 };
+    char path[64], idx_path[68];
+    struct ber_archive *ar;
+    const uint8_t *rec, *rec_end, *first, *dec_out;
+    uint8_t *out;
+    uint32_t msg_len, len, num, varbind_num, i;
+    uint64_t time, rec_num;
+    struct stat st;
+    off_t data_size;
+    size_t written;
+    FILE *f;
+    int rc;
+
+    printf("# Testing BER record archive\n");
+    snprintf(path, sizeof(path), "/tmp/ber-test-archive-%d", (int)getpid());
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    unlink(path);
+    unlink(idx_path);
+
+    ar = ber_archive_open(path, 0);
+    assert(ar == NULL);
+    ar = ber_archive_open(path, BER_ARCHIVE_WRITE);
+    assert(ar != NULL);
+    assert(ber_archive_count(ar) == 0);
+    rec = ber_archive_get(ar, 0, &len, NULL);
+    assert(rec == NULL);
+    rec_num = ber_archive_seek_time(ar, 0);
+    assert(rec_num == 0);
+
+    header.snmp_ver = 1;
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    memcpy(varbind.oid, oid, sizeof(oid));
+    varbind.value_type = SNMP_DATA_T_TIMETICKS;
+    for (i = 0; i < 4; ++i) {
+        header.request_id = i;
+        varbind.value.i = 1000 * i;
+        out = snmp_encode_msg(buf_end, &header, 1, &varbind);
+        msg_len = (uint32_t)(buf_end - out + 1);
+        rc = ber_archive_append(ar, times[i], out, msg_len);
+        assert(rc == 0);
+    }
+    rc = ber_archive_append(ar, 29, out, msg_len);
+    assert(rc == -1);
+    rc = ber_archive_append(ar, 30, out, 0);
+    assert(rc == -1);
+
+    /* records appended through the same handle are readable right away */
+    rec = ber_archive_get(ar, 3, &len, &time);
+    assert(rec != NULL && len == msg_len && time == 30);
+    assert(memcmp(rec, out, msg_len) == 0);
+    ber_archive_close(ar);
+
+    /* a torn append: record data, but only half of its index entry */
+    f = fopen(path, "ab");
+    assert(f != NULL);
+    written = fwrite(out, 1, msg_len, f);
+    assert(written == msg_len);
+    fclose(f);
+    f = fopen(idx_path, "ab");
+    assert(f != NULL);
+    written = fwrite(out, 1, 10, f);
+    assert(written == 10);
+    fclose(f);
+
+    ar = ber_archive_open(path, 0);
+    assert(ar != NULL);
+    assert(ber_archive_count(ar) == 4);
+    rc = ber_archive_append(ar, 40, out, msg_len);
+    assert(rc == -1);
+    for (i = 0; i < 4; ++i) {
+        rec = ber_archive_get(ar, i, &len, &time);
+        assert(rec != NULL && time == times[i]);
+        /* zero-copy decode straight from the mapping */
+        varbind_num = 1;
+        dec_out = snmp_decode_msg_slice(rec, len + 5, &header, &varbind_num, &varbind);
+        assert(dec_out == rec + len);
+        assert(header.request_id == i && varbind.value.i == 1000 * i);
+        dec_out = ber_decode_int((uint8_t *)(uintptr_t)rec + 2, &num);
+        assert(dec_out == rec + 5 && num == 1);
+    }
+    rec = ber_archive_get(ar, 4, &len, &time);
+    assert(rec == NULL);
+
+    rec_num = ber_archive_seek_time(ar, 0);
+    assert(rec_num == 0);
+    rec_num = ber_archive_seek_time(ar, 10);
+    assert(rec_num == 0);
+    rec_num = ber_archive_seek_time(ar, 11);
+    assert(rec_num == 1);
+    rec_num = ber_archive_seek_time(ar, 20);
+    assert(rec_num == 1);
+    rec_num = ber_archive_seek_time(ar, 30);
+    assert(rec_num == 3);
+    rec_num = ber_archive_seek_time(ar, 31);
+    assert(rec_num == 4);
+    ber_archive_close(ar);
+
+    /* reopening for writing drops the torn record */
+    ar = ber_archive_open(path, BER_ARCHIVE_WRITE);
+    assert(ar != NULL);
+    assert(ber_archive_count(ar) == 4);
+    rc = ber_archive_append(ar, 40, out, msg_len);
+    assert(rc == 0);
+    rec = ber_archive_get(ar, 4, &len, &time);
+    assert(rec != NULL && time == 40 && memcmp(rec, out, msg_len) == 0);
+    rec = ber_archive_get(ar, 3, &len, &time);
+    assert(rec != NULL && time == 30);
+    rec_end = rec + len;
+    rec = ber_archive_get(ar, 4, &len, &time);
+    assert(rec == rec_end);
+    ber_archive_close(ar);
+
+    /* a corrupted entry in the middle of the index */
+    f = fopen(idx_path, "r+b");
+    assert(f != NULL);
+    rc = fseek(f, (long)(sizeof(BER_ARCHIVE_MAGIC) - 1 + 3 * sizeof(uint64_t) + sizeof(uint64_t)), SEEK_SET);
+    assert(rc == 0);
+    time = UINT64_MAX;
+    written = fwrite(&time, sizeof(time), 1, f);
+    assert(written == 1);
+    fclose(f);
+
+    ar = ber_archive_open(path, BER_ARCHIVE_WRITE);
+    assert(ar != NULL);
+    assert(ber_archive_count(ar) == 5);
+    rec = ber_archive_get(ar, 1, &len, &time);
+    assert(rec == NULL);
+    rec = ber_archive_get(ar, 2, &len, &time);
+    assert(rec != NULL && time == 20);
+
+    /* failed refresh keeps the previous state */
+    f = fopen(idx_path, "r+b");
+    assert(f != NULL);
+    written = fwrite("XXXXXXXX", 1, 8, f);
+    assert(written == 8);
+    fclose(f);
+    rc = ber_archive_refresh(ar);
+    assert(rc == -1);
+    assert(ber_archive_count(ar) == 5);
+    rec = ber_archive_get(ar, 4, &len, &time);
+    assert(rec != NULL && time == 40);
+    ber_archive_close(ar);
+
+    /* records without an index are neither indexed from scratch nor truncated */
+    rc = stat(path, &st);
+    assert(rc == 0 && st.st_size > 0);
+    data_size = st.st_size;
+    unlink(idx_path);
+    ar = ber_archive_open(path, BER_ARCHIVE_WRITE);
+    assert(ar == NULL);
+    rc = access(idx_path, F_OK);
+    assert(rc != 0);
+    rc = stat(path, &st);
+    assert(rc == 0 && st.st_size == data_size);
+    unlink(path);
+
+    /* records stay valid while the mapping grows */
+    ar = ber_archive_open(path, BER_ARCHIVE_WRITE);
+    assert(ar != NULL);
+    rc = ber_archive_append(ar, 0, out, msg_len);
+    assert(rc == 0);
+    first = ber_archive_get(ar, 0, &len, &time);
+    assert(first != NULL && len == msg_len);
+    for (i = 1; i < 1000; ++i) {
+        rc = ber_archive_append(ar, i, out, msg_len);
+        assert(rc == 0);
+        rec = ber_archive_get(ar, i, &len, &time);
+        assert(rec != NULL && time == i);
+        assert(memcmp(first, out, msg_len) == 0);
+    }
+    rc = ber_archive_refresh(ar);
+    assert(rc == 0);
+    assert(memcmp(first, out, msg_len) == 0);
+    ber_archive_close(ar);
+
+    unlink(path);
+    unlink(idx_path);
+    printf("\n");
+}
+
+#define PARALLEL_TEST_MSGS 300
+
+struct parallel_test_ctx {
+    uint32_t request_ids[PARALLEL_TEST_MSGS];
+    uint64_t next_msg;
+    uint64_t sum;
+};
+
+static void
+parallel_test_msg_cb(void *ctx, void *chunk_ctx, uint64_t msg_idx,
+                     const struct snmp_msg_header *header, uint32_t varbind_num,
+                     const struct snmp_varbind *varbinds)
+{
+    struct parallel_test_ctx *t = ctx;
+    uint64_t *chunk_sum = chunk_ctx;
+
+    /* every message has its own slot, so no locking is needed */
+    assert(msg_idx < PARALLEL_TEST_MSGS);
+    if (header == NULL) {
+        t->request_ids[msg_idx] = UINT32_MAX;
+        return;
+    }
+
+    assert(varbind_num == 1 && varbinds[0].value.i == header->request_id * 3);
+    t->request_ids[msg_idx] = header->request_id;
+    *chunk_sum += varbinds[0].value.i;
+}
+
+static void
+parallel_test_chunk_cb(void *ctx, void *chunk_ctx, uint64_t first_msg, uint64_t msg_num)
+{
+    struct parallel_test_ctx *t = ctx;
+
+    assert(first_msg == t->next_msg);
+    t->next_msg += msg_num;
+    t->sum += *(uint64_t *)chunk_ctx;
+}
+
+void
+snmp_parallel_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbind = { 0 };
+    struct snmp_parallel_config config = { 0 };
+    struct parallel_test_ctx t;
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, 1, SNMP_MSG_OID_END };
+    uint32_t threads[] = { 4, 1, 3 }, chunks[] = { 0, 1, 1000 };
+    char community[151];
+    uint8_t *stream, *out;
+    uint64_t stream_len = 0, msg_num, sum = 0;
+    uint32_t msg_len, i, j;
+    int rc;
+
+    printf("# Testing parallel SNMP stream decoding\n");
+    stream = malloc(PARALLEL_TEST_MSGS * 256 + 5);
+    assert(stream != NULL);
+    memset(community, 'c', sizeof(community) - 1);
+    community[sizeof(community) - 1] = 0;
+
+    header.snmp_ver = 1;
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    memcpy(varbind.oid, oid, sizeof(oid));
+    varbind.value_type = SNMP_DATA_T_INTEGER;
+    for (i = 0; i < PARALLEL_TEST_MSGS; ++i) {
+        /* some messages have long-form lengths */
+        header.community = i % 7 == 0 ? community : "public";
+        header.request_id = i;
+        varbind.value.i = i * 3;
+        out = snmp_encode_msg(buf_end, &header, 1, &varbind);
+        msg_len = (uint32_t)(buf_end - out + 1);
+        memcpy(stream + stream_len, out, msg_len);
+        if (i == 150) {
+            stream[stream_len + 13] = SNMP_DATA_T_INTEGER; /* unsupported PDU type */
+        } else {
+            sum += i * 3;
+        }
+        stream_len += msg_len;
+    }
+    memset(stream + stream_len, 0, 5);
+
+    config.chunk_ctx_size = sizeof(uint64_t);
+    config.msg_cb = parallel_test_msg_cb;
+    config.chunk_cb = parallel_test_chunk_cb;
+    config.ctx = &t;
+    for (j = 0; j < 3; ++j) {
+        memset(&t, 0, sizeof(t));
+        config.thread_num = threads[j];
+        config.chunk_num = chunks[j];
+        rc = snmp_decode_parallel(stream, stream_len, &config, &msg_num);
+        assert(rc == 0);
+        assert(msg_num == PARALLEL_TEST_MSGS);
+        assert(t.next_msg == PARALLEL_TEST_MSGS);
+        assert(t.sum == sum);
+        for (i = 0; i < PARALLEL_TEST_MSGS; ++i) {
+            assert(t.request_ids[i] == (i == 150 ? UINT32_MAX : i));
+        }
+    }
+
+    /* the last message is truncated */
+    rc = snmp_decode_parallel(stream, stream_len - 1, &config, &msg_num);
+    assert(rc == -1);
+    /* not a SEQUENCE */
+    rc = snmp_decode_parallel(stream + 1, stream_len - 1, &config, &msg_num);
+    assert(rc == -1);
+
+    memset(&t, 0, sizeof(t));
+    rc = snmp_decode_parallel(stream, 0, &config, &msg_num);
+    assert(rc == 0);
+    assert(msg_num == 0 && t.next_msg == 0);
+
+    config.thread_num = 0;
+    rc = snmp_decode_parallel(stream, stream_len, &config, &msg_num);
+    assert(rc == -1);
+
+    free(stream);
+    printf("\n");
+}
+
+struct writer_sink {
+    uint8_t data[1024];
+    uint32_t len;
+};
+
+static int
+writer_sink_flush(void *ctx, const uint8_t *data, uint32_t len)
+{
+    struct writer_sink *sink = ctx;
+
+    if (sink->len + len > sizeof(sink->data)) {
+        return -1;
+    }
+
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+void
+snmp_gen_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbind = { 0 };
+    struct snmp_counter_response enc_resp = { 0 };
+    struct snmp_counter_response dec_resp;
+    struct snmp_counter_sample enc_sample = { 0 };
+    struct snmp_counter_sample dec_sample;
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 200000, SNMP_MSG_OID_END };
+    uint8_t *out, *gen_out;
+    const uint8_t *dec_out;
+    uint32_t size, i;
+
+    printf("# Testing ber-gen generated codecs\n");
+    header.snmp_ver = 1;
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.request_id = 70000;
+    memcpy(varbind.oid, oid, sizeof(oid));
+    varbind.value_type = SNMP_DATA_T_COUNTER32;
+    varbind.value.i = 123456789;
+
+    enc_resp.version = 1;
+    enc_resp.community = "public";
+    enc_resp.community_len = 6;
+    enc_resp.pdu.request_id = 70000;
+    memcpy(enc_resp.pdu.varbinds.varbind.name, oid, 12 * sizeof(*oid));
+    enc_resp.pdu.varbinds.varbind.name_len = 12;
+    enc_resp.pdu.varbinds.varbind.value = 123456789;
+
+    /* byte-identical to the hand-written encoder */
+    out = snmp_encode_msg(buf_end, &header, 1, &varbind);
+    size = (uint32_t)(buf_end - out + 1);
+    gen_out = snmp_counter_response_encode(out - 1, &enc_resp);
+    assert(gen_out != NULL);
+    assert(out - 1 - gen_out == size);
+    hexdump("snmp_counter_response_encode", gen_out + 1, size);
+    assert(memcmp(gen_out + 1, out, size) == 0);
+
+    dec_out = snmp_counter_response_decode(out, size, &dec_resp);
+    assert(dec_out == out + size);
+    assert(dec_resp.version == 1);
+    assert(dec_resp.community_len == 6 && memcmp(dec_resp.community, "public", 6) == 0);
+    assert(dec_resp.pdu.request_id == 70000);
+    assert(dec_resp.pdu.error_status == 0 && dec_resp.pdu.error_index == 0);
+    assert(dec_resp.pdu.varbinds.varbind.name_len == 12);
+    assert(memcmp(dec_resp.pdu.varbinds.varbind.name, oid, 12 * sizeof(*oid)) == 0);
+    assert(dec_resp.pdu.varbinds.varbind.value == 123456789);
+    for (i = 0; i < size; ++i) {
+        dec_out = snmp_counter_response_decode(out, i, &dec_resp);
+        assert(dec_out == NULL);
+    }
+
+    /* schema constraints */
+    enc_resp.pdu.error_status = 19;
+    gen_out = snmp_counter_response_encode(buf_end, &enc_resp);
+    assert(gen_out == NULL);
+    enc_resp.pdu.error_status = 0;
+    header.error_status = 19;
+    out = snmp_encode_msg(buf_end, &header, 1, &varbind);
+    size = (uint32_t)(buf_end - out + 1);
+    dec_out = snmp_counter_response_decode(out, size, &dec_resp);
+    assert(dec_out == NULL);
+    header.error_status = 0;
+    varbind.value_type = SNMP_DATA_T_GAUGE32;
+    out = snmp_encode_msg(buf_end, &header, 1, &varbind);
+    dec_out = snmp_counter_response_decode(out, size, &dec_resp);
+    assert(dec_out == NULL);
+
+    /* fixed-size type */
+    enc_sample.if_index = 1000;
+    enc_sample.status = 2;
+    enc_sample.mac = "\x00\x11\x22\x33\x44\x55";
+    enc_sample.mac_len = 6;
+    out = snmp_counter_sample_encode(buf_end, &enc_sample);
+    assert(buf_end - out == 19);
+    hexdump("snmp_counter_sample_encode", out + 1, 19);
+    dec_out = snmp_counter_sample_decode(out + 1, 19, &dec_sample);
+    assert(dec_out == buf_end + 1);
+    assert(dec_sample.if_index == 1000 && dec_sample.status == 2);
+    assert(dec_sample.mac_len == 6 && memcmp(dec_sample.mac, enc_sample.mac, 6) == 0);
+    dec_out = snmp_counter_sample_decode(out + 1, 18, &dec_sample);
+    assert(dec_out == NULL);
+    enc_sample.if_index = 255;
+    gen_out = snmp_counter_sample_encode(buf_end, &enc_sample);
+    assert(gen_out == NULL);
+    enc_sample.if_index = 1000;
+    enc_sample.mac_len = 5;
+    gen_out = snmp_counter_sample_encode(buf_end, &enc_sample);
+    assert(gen_out == NULL);
+    printf("\n");
+}
+
+void
+ber_stats_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbind = { 0 };
+    struct ber_stats stats, zero = { 0 };
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0, SNMP_MSG_OID_END };
+    uint32_t varbind_num, msg_len, i;
+    uint8_t *out;
+    const uint8_t *dec_out;
+
+    printf("# Testing instrumentation counters\n");
+    header.snmp_ver = 1;
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.request_id = 1234;
+    memcpy(varbind.oid, oid, sizeof(oid));
+    varbind.value_type = SNMP_DATA_T_TIMETICKS;
+    varbind.value.i = 100000;
+
+    ber_stats_reset();
+    buf_end -= 5;
+    out = snmp_encode_msg(buf_end, &header, 1, &varbind);
+    assert(out != NULL);
+    msg_len = (uint32_t)(buf_end - out + 1);
+
+    varbind_num = 1;
+    dec_out = snmp_decode_msg_slice(out, msg_len + 5, &header, &varbind_num, &varbind);
+    assert(dec_out == buf_end + 1);
+    dec_out = snmp_validate_msg(out, msg_len, &varbind_num);
+    assert(dec_out == buf_end + 1);
+
+    /* unsupported PDU type */
+    out[13] = SNMP_DATA_T_INTEGER;
+    varbind_num = 1;
+    dec_out = snmp_decode_msg_slice(out, msg_len + 5, &header, &varbind_num, &varbind);
+    assert(dec_out == NULL);
+
+    /* version too long to fit in uint32_t */
+    out[13] = SNMP_DATA_T_PDU_GET_RESPONSE;
+    out[3] = 5;
+    varbind_num = 1;
+    dec_out = snmp_decode_msg_slice(out, msg_len + 5, &header, &varbind_num, &varbind);
+    assert(dec_out == NULL);
+
+    ber_stats_get(&stats);
+#ifdef BER_STATS
+    assert(stats.bytes_encoded == msg_len);
+    assert(stats.bytes_decoded == msg_len);
+    assert(stats.long_lengths == 0);
+    assert(stats.calls[BER_STATS_FN_SNMP_ENCODE_MSG] == 1);
+    assert(stats.calls[BER_STATS_FN_SNMP_DECODE_MSG] == 3);
+    assert(stats.calls[BER_STATS_FN_SNMP_VALIDATE_MSG] == 1);
+    assert(stats.calls[BER_STATS_FN_ENCODE_INT] == 3 + 1);
+    assert(stats.calls[BER_STATS_FN_DECODE_UINT64] == 1);
+    for (i = 0; i < BER_STATS_ERR_MAX; ++i) {
+        assert(stats.errors[i] == (i == BER_STATS_ERR_PDU || i == BER_STATS_ERR_INT));
+    }
+
+    ber_stats_reset();
+    ber_stats_get(&stats);
+#endif
+    assert(memcmp(&stats, &zero, sizeof(stats)) == 0);
+
+    for (i = 0; i < BER_STATS_FN_MAX; ++i) {
+        assert(ber_stats_fn_name((enum ber_stats_fn)i) != NULL);
+    }
+    assert(ber_stats_fn_name(BER_STATS_FN_MAX) == NULL);
+    printf("\n");
+}
+
+void
+snmp_writer_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbinds[3] = { 0 };
+    struct ber_writer w;
+    struct writer_sink sink = { { 0 }, 0 };
+    uint8_t wbuf[160];
+    char long_str[200];
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 200000, SNMP_MSG_OID_END };
+    uint8_t *enc_out;
+    uint32_t i, enc_len;
+    int rc;
+
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.request_id = 70000;
+
+    memset(long_str, 'a', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = 0;
+
+    memcpy(varbinds[0].oid, oid, sizeof(oid));
+    varbinds[0].value_type = SNMP_DATA_T_INTEGER;
+    varbinds[0].value.i = 300;
+    memcpy(varbinds[1].oid, oid, sizeof(oid));
+    varbinds[1].value_type = SNMP_DATA_T_OCTET_STRING;
+    varbinds[1].value.s = long_str;
+    memcpy(varbinds[2].oid, oid, sizeof(oid));
+    varbinds[2].value_type = SNMP_DATA_T_NULL;
+
+    printf("# Testing front-to-back SNMP msg encoding\n");
+    enc_out = snmp_encode_msg(buf_end, &header, 3, varbinds);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+
+    /* whole message fits in the buffer */
+    ber_writer_init(&w, buf, (uint32_t)(enc_out - buf), NULL, NULL);
+    rc = snmp_write_msg(&w, &header, 3, varbinds);
+    assert(rc == 0);
+    assert(w.len == enc_len);
+    assert(memcmp(w.buf, enc_out, enc_len) == 0);
+    hexdump("snmp_write_msg(...)", w.buf, w.len);
+
+    /* too small buffer with nowhere to flush */
+    ber_writer_init(&w, wbuf, sizeof(wbuf), NULL, NULL);
+    rc = snmp_write_msg(&w, &header, 3, varbinds);
+    assert(rc == -1);
+
+    /* the same message flushed while it's written */
+    ber_writer_init(&w, wbuf, sizeof(wbuf), writer_sink_flush, &sink);
+    rc = snmp_write_msg(&w, &header, 3, varbinds);
+    assert(rc == 0);
+    rc = ber_writer_flush(&w);
+    assert(rc == 0);
+    assert(sink.len == enc_len);
+    assert(memcmp(sink.data, enc_out, enc_len) == 0);
+    sink.len = 0;
+
+    /* content not matching the known length */
+    ber_writer_init(&w, wbuf, sizeof(wbuf), NULL, NULL);
+    rc = ber_writer_begin_len(&w, SNMP_DATA_T_SEQUENCE, 3);
+    assert(rc == 0);
+    rc = ber_writer_null(&w);
+    assert(rc == 0);
+    rc = ber_writer_end(&w);
+    assert(rc == -1);
+
+    /* a stream of smaller messages through a small buffer */
+    varbinds[1].value.s = "eth0";
+    enc_out = snmp_encode_msg(buf_end, &header, 3, varbinds);
+    enc_len = (uint32_t)(buf_end - enc_out + 1);
+    ber_writer_init(&w, wbuf, sizeof(wbuf), writer_sink_flush, &sink);
+    for (i = 0; i < 5; ++i) {
+        rc = snmp_write_msg(&w, &header, 3, varbinds);
+        assert(rc == 0);
+    }
+    rc = ber_writer_flush(&w);
+    assert(rc == 0);
+    assert(w.len == 0);
+    assert(sink.len == 5 * enc_len);
+    for (i = 0; i < 5; ++i) {
+        assert(memcmp(sink.data + i * enc_len, enc_out, enc_len) == 0);
+    }
+
+    /* unbalanced end */
+    ber_writer_init(&w, wbuf, sizeof(wbuf), NULL, NULL);
+    rc = ber_writer_end(&w);
+    assert(rc == -1);
+    printf("\n");
+}
+
+void
+snmp_msg_iov_test(uint8_t *buf, uint8_t *buf_end)
+{
+    struct snmp_msg_header header = { 0 };
+    struct snmp_varbind varbinds[5] = { 0 };
+    uint32_t oid[] = { 1, 3, 6, 1, 2, 1, 1, 1, 0, SNMP_MSG_OID_END };
+    char descr[300], blob[200];
+    uint8_t hdr[128], flat[1024];
+    struct iovec iov[8];
+    uint8_t *out, *hdr_out, *hdr_end = hdr + sizeof(hdr) - 1;
+    uint32_t iov_num, msg_len, flat_len, i;
+
+    printf("# Testing SNMP msg scatter-gather encoding\n");
+    memset(descr, 'd', sizeof(descr) - 1);
+    descr[sizeof(descr) - 1] = 0;
+    memset(blob, 'b', sizeof(blob) - 1);
+    blob[sizeof(blob) - 1] = 0;
+
+    header.snmp_ver = 1;
+    header.community = "public";
+    header.pdu_type = SNMP_DATA_T_PDU_GET_RESPONSE;
+    header.request_id = 4321;
+    for (i = 0; i < 5; ++i) {
+        memcpy(varbinds[i].oid, oid, sizeof(oid));
+        varbinds[i].oid[7] = i + 1;
+        varbinds[i].value_type = SNMP_DATA_T_OCTET_STRING;
+    }
+    varbinds[0].value.s = descr;
+    varbinds[1].value_type = SNMP_DATA_T_INTEGER;
+    varbinds[1].value.i = 7;
+    varbinds[2].value.s = blob;
+    varbinds[3].value.s = descr;
+    varbinds[4].value.s = "eth0";
+
+    out = snmp_encode_msg(buf_end, &header, 5, varbinds);
+    assert(out != NULL);
+    msg_len = (uint32_t)(buf_end - out + 1);
+
+    iov_num = 8;
+    hdr_out = snmp_encode_msg_iov(hdr_end, &header, 5, varbinds, iov, &iov_num);
+    assert(hdr_out == iov[0].iov_base);
+    /* header + descr, int + blob, descr, the last short string */
+    assert(iov_num == 7);
+    assert(iov[1].iov_base == descr && iov[3].iov_base == blob && iov[5].iov_base == descr);
+
+    flat_len = 0;
+    for (i = 0; i < iov_num; ++i) {
+        assert(flat_len + iov[i].iov_len <= sizeof(flat));
+        memcpy(flat + flat_len, iov[i].iov_base, iov[i].iov_len);
+        flat_len += (uint32_t)iov[i].iov_len;
+    }
+    assert(flat_len == msg_len);
+    assert(memcmp(flat, out, msg_len) == 0);
+
+    /* long strings only, the last one ends the message */
+    iov_num = 3;
+    hdr_out = snmp_encode_msg_iov(hdr_end, &header, 1, varbinds, iov, &iov_num);
+    assert(hdr_out != NULL);
+    assert(iov_num == 2);
+    assert(iov[1].iov_base == descr && iov[1].iov_len == sizeof(descr) - 1);
+
+    /* not enough iovecs */
+    iov_num = 6;
+    hdr_out = snmp_encode_msg_iov(hdr_end, &header, 5, varbinds, iov, &iov_num);
+    assert(hdr_out == NULL);
+    printf("\n");
+}
+
 static int
 run_tests(void)
 {
@@ -287,23 +2708,74 @@ run_tests(void)
     memset(buf, -1, 1024); //for debug purposes
     ber_vlint_test(buf, buf_end);
     memset(buf, -1, 1024);
+    ber_vlint_batch_test(buf, buf_end);
+    memset(buf, -1, 1024);
     ber_int_test(buf, buf_end);
     memset(buf, -1, 1024);
+    ber_uint64_test(buf, buf_end);
+    memset(buf, -1, 1024);
     ber_length_test(buf, buf_end);
     memset(buf, -1, 1024);
     ber_string_test(buf, buf_end);
     memset(buf, -1, 1024);
+    ber_stream_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    ber_sizeof_test(buf, buf_end);
+    memset(buf, -1, 1024);
     ber_fprintf_test(buf, buf_end);
     memset(buf, -1, 1024);
+    ber_snscanf_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    ber_tape_test(buf, buf_end);
+    memset(buf, -1, 1024);
     snmp_oid_test(buf, buf_end);
     memset(buf, -1, 1024);
+    snmp_oid_enc_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_tmpl_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_sizeof_test(buf, buf_end);
+    memset(buf, -1, 1024);
     snmp_msg_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_msg_slice_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_msg_validate_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_varbind_iter_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_msg_compact_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_writer_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_msg_iov_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_stream_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_msg_batch_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_bulk_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_app_types_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_gen_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    ber_stats_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_agent_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_poller_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    ber_archive_test(buf, buf_end);
+    memset(buf, -1, 1024);
+    snmp_parallel_test(buf, buf_end);
 
     return 0;
 }
 
 #define AFL_MAX_INPUT 4096
 #define AFL_VARBINDS 8
+#define AFL_TAPE_LEN 64
 
 static int
 ber_string_len_fits(uint8_t *buf, size_t buf_len, uint32_t *str_len)
@@ -327,7 +2799,8 @@ afl_ber_decode(uint8_t *buf, size_t len)
 {
     const char *str;
     char *alloc_str = NULL;
-    uint32_t num, str_len;
+    struct ber_tape_entry tape[AFL_TAPE_LEN];
+    uint32_t num, str_len, tape_len;
     uint8_t next;
 
     (void)ber_decode_vlint(buf, &num);
@@ -341,6 +2814,11 @@ afl_ber_decode(uint8_t *buf, size_t len)
         (void)ber_decode_string_alloc(buf, &alloc_str, AFL_MAX_INPUT);
         free(alloc_str);
     }
+
+    /* bounded decoding has to be safe on any input */
+    (void)ber_snscanf(buf, (uint32_t)len, "%u%.*s%n%u", &num, &str_len, &str, &num);
+    tape_len = AFL_TAPE_LEN;
+    (void)ber_tape_index(buf, (uint32_t)len, tape, &tape_len);
 }
 
 static void
@@ -348,6 +2826,7 @@ afl_snmp_decode(uint8_t *buf, size_t len)
 {
     struct snmp_msg_header header = { 0 };
     struct snmp_varbind varbinds[AFL_VARBINDS] = { 0 };
+    struct snmp_varbind_iter iter;
     uint8_t msg[AFL_MAX_INPUT] = { 0 };
     uint32_t oid[SNMP_MSG_OID_LEN] = { 0 };
     uint32_t oid_len;
@@ -356,6 +2835,19 @@ afl_snmp_decode(uint8_t *buf, size_t len)
     oid_len = SNMP_MSG_OID_LEN;
     (void)snmp_decode_oid(buf, (uint32_t)len, oid, &oid_len);
 
+    varbind_num = AFL_VARBINDS;
+    (void)snmp_decode_msg_slice(buf, (uint32_t)len, &header, &varbind_num, varbinds);
+
+    if (snmp_validate_msg(buf, (uint32_t)len, &varbind_num) != NULL) {
+        varbind_num = AFL_VARBINDS;
+        (void)snmp_decode_msg_unchecked(buf, &header, &varbind_num, varbinds);
+    }
+
+    if (snmp_decode_msg_header(buf, (uint32_t)len, &header, &iter) != NULL) {
+        while (snmp_varbind_iter_next(&iter, &varbinds[0]) == 1) {
+        }
+    }
+
     memcpy(msg, buf, len);
     varbind_num = AFL_VARBINDS;
     (void)snmp_decode_msg(msg, (uint32_t)len, &header, &varbind_num, varbinds);
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ber.h"
+#include "snmp.h"
+#include "parallel.h"
+
+struct snmp_parallel_chunk {
+    const uint8_t *buf;
+    uint64_t len;
+    uint64_t first_msg;
+    uint64_t msg_num;
+    void *ctx;
+    int done;
+};
+
+struct snmp_parallel {
+    const struct snmp_parallel_config *config;
+    struct snmp_parallel_chunk *chunks;
+    uint32_t chunk_num;
+    uint32_t next_chunk;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/** Get the end of the SEQUENCE at *buf* or NULL if it doesn't fit before *end* */
+static const uint8_t *
+snmp_parallel_next(const uint8_t *buf, const uint8_t *end)
+{
+    uint64_t left = (uint64_t)(end - buf);
+    const uint8_t *value;
+    uint32_t len;
+
+    /* keep the message and its slack addressable by snmp_decode_msg_slice */
+    value = ber_decode_header(buf, left > UINT32_MAX - 5 ? UINT32_MAX - 5 : (uint32_t)left,
+                              SNMP_DATA_T_SEQUENCE, &len);
+    if (value == NULL) {
+        return NULL;
+    }
+
+    return value + len;
+}
+
+/** Split the buffer into chunks of similar size at message boundaries */
+static int
+snmp_parallel_split(struct snmp_parallel *p, const uint8_t *buf, uint64_t buf_len,
+                    uint64_t *msg_num)
+{
+    struct snmp_parallel_chunk *chunk = p->chunks;
+    struct snmp_parallel_chunk *last_chunk = p->chunks + p->chunk_num - 1;
+    const uint8_t *end = buf + buf_len;
+    uint64_t target = buf_len / p->chunk_num + 1, msg = 0;
+
+    chunk->buf = buf;
+    while (buf < end) {
+        buf = snmp_parallel_next(buf, end);
+        if (buf == NULL) {
+            return -1;
+        }
+        ++msg;
+
+        if ((uint64_t)(buf - chunk->buf) >= target && buf < end && chunk < last_chunk) {
+            chunk->len = (uint64_t)(buf - chunk->buf);
+            chunk->msg_num = msg - chunk->first_msg;
+            ++chunk;
+            chunk->buf = buf;
+            chunk->first_msg = msg;
+        }
+    }
+
+    chunk->len = (uint64_t)(buf - chunk->buf);
+    chunk->msg_num = msg - chunk->first_msg;
+    p->chunk_num = (uint32_t)(chunk - p->chunks) + 1;
+    *msg_num = msg;
+
+    return 0;
+}
+
+static void
+snmp_parallel_decode_chunk(struct snmp_parallel *p, struct snmp_parallel_chunk *chunk)
+{
+    const struct snmp_parallel_config *config = p->config;
+    struct snmp_varbind varbinds[SNMP_PARALLEL_MAX_VARBINDS];
+    struct snmp_msg_header header;
+    const uint8_t *buf = chunk->buf, *end = chunk->buf + chunk->len, *next;
+    uint64_t msg_idx = chunk->first_msg;
+    uint32_t varbind_num;
+
+    for (; buf < end; buf = next, ++msg_idx) {
+        /* already validated by snmp_parallel_split */
+        next = snmp_parallel_next(buf, end);
+
+        varbind_num = SNMP_PARALLEL_MAX_VARBINDS;
+        if (snmp_decode_msg_slice(buf, (uint32_t)(next - buf) + 5, &header, &varbind_num,
+                                  varbinds) == NULL) {
+            config->msg_cb(config->ctx, chunk->ctx, msg_idx, NULL, 0, NULL);
+            continue;
+        }
+
+        config->msg_cb(config->ctx, chunk->ctx, msg_idx, &header, varbind_num, varbinds);
+    }
+}
+
+static void *
+snmp_parallel_worker_run(void *arg)
+{
+    struct snmp_parallel *p = arg;
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(&p->next_chunk, 1, __ATOMIC_RELAXED)) < p->chunk_num) {
+        snmp_parallel_decode_chunk(p, &p->chunks[i]);
+
+        pthread_mutex_lock(&p->lock);
+        p->chunks[i].done = 1;
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    return NULL;
+}
+
+int
+snmp_decode_parallel(const uint8_t *buf, uint64_t buf_len,
+                     const struct snmp_parallel_config *config, uint64_t *msg_num)
+{
+    struct snmp_parallel p = { 0 };
+    struct snmp_parallel_chunk *chunk;
+    pthread_t *threads = NULL;
+    uint8_t *chunk_ctxs = NULL;
+    uint32_t ctx_size, thread_num, i;
+    int rc = -1;
+
+    if (config->thread_num == 0 || config->msg_cb == NULL) {
+        return -1;
+    }
+
+    p.config = config;
+    p.chunk_num = config->chunk_num;
+    if (p.chunk_num == 0) {
+        p.chunk_num = config->thread_num * SNMP_PARALLEL_CHUNKS_PER_THREAD;
+    }
+
+    /* keep per-chunk user data aligned */
+    ctx_size = (config->chunk_ctx_size + 15) & ~15u;
+    p.chunks = calloc(p.chunk_num, sizeof(*p.chunks));
+    chunk_ctxs = calloc(p.chunk_num, ctx_size > 0 ? ctx_size : 1);
+    if (p.chunks == NULL || chunk_ctxs == NULL ||
+        snmp_parallel_split(&p, buf, buf_len, msg_num) != 0) {
+        goto out;
+    }
+
+    for (i = 0; i < p.chunk_num; ++i) {
+        p.chunks[i].ctx = ctx_size > 0 ? chunk_ctxs + (size_t)i * ctx_size : NULL;
+    }
+
+    thread_num = config->thread_num < p.chunk_num ? config->thread_num : p.chunk_num;
+    threads = calloc(thread_num, sizeof(*threads));
+    if (threads == NULL) {
+        goto out;
+    }
+
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+
+    /* fewer threads will still decode all the chunks */
+    for (i = 0; i < thread_num; ++i) {
+        if (pthread_create(&threads[i], NULL, snmp_parallel_worker_run, &p) != 0) {
+            break;
+        }
+    }
+    thread_num = i;
+
+    if (thread_num > 0) {
+        for (i = 0; i < p.chunk_num; ++i) {
+            chunk = &p.chunks[i];
+
+            pthread_mutex_lock(&p.lock);
+            while (!chunk->done) {
+                pthread_cond_wait(&p.cond, &p.lock);
+            }
+            pthread_mutex_unlock(&p.lock);
+
+            if (config->chunk_cb != NULL) {
+                config->chunk_cb(config->ctx, chunk->ctx, chunk->first_msg, chunk->msg_num);
+            }
+        }
+
+        rc = 0;
+    }
+
+    for (i = 0; i < thread_num; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+
+out:
+    free(threads);
+    free(chunk_ctxs);
+    free(p.chunks);
+    return rc;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#ifndef BER_SNMP_PARALLEL_H
+#define BER_SNMP_PARALLEL_H
+
+#include <stdint.h>
+#include "snmp.h"
+
+/** Max number of varbinds decoded from a single message, the rest is ignored */
+#define SNMP_PARALLEL_MAX_VARBINDS 16
+/** Number of chunks per thread if not set in struct snmp_parallel_config */
+#define SNMP_PARALLEL_CHUNKS_PER_THREAD 4
+
+/**
+ * Called on a worker thread for every message.
+ * @param ctx user context given in struct snmp_parallel_config
+ * @param chunk_ctx zeroed per-chunk user data, see *chunk_ctx_size*
+ * @param msg_idx number of the message in the whole buffer
+ * @param header decoded header or NULL if the message couldn't be decoded
+ * @param varbind_num number of decoded varbinds
+ * @param varbinds decoded varbinds. Just like with snmp_decode_msg_slice,
+ * strings are not NUL-terminated. All data is valid only during this call.
+ */
+typedef void (*snmp_parallel_msg_cb)(void *ctx, void *chunk_ctx, uint64_t msg_idx,
+                                     const struct snmp_msg_header *header,
+                                     uint32_t varbind_num, const struct snmp_varbind *varbinds);
+
+/**
+ * Called on the thread calling snmp_decode_parallel once a chunk is
+ * decoded, in the order of chunks in the buffer. This is where per-chunk
+ * results can be merged without any locking.
+ * @param ctx user context given in struct snmp_parallel_config
+ * @param chunk_ctx per-chunk user data filled by snmp_parallel_msg_cb
+ * @param first_msg number of the first message in the chunk
+ * @param msg_num number of messages in the chunk
+ */
+typedef void (*snmp_parallel_chunk_cb)(void *ctx, void *chunk_ctx, uint64_t first_msg,
+                                       uint64_t msg_num);
+
+/** Parallel decoding settings, see snmp_decode_parallel */
+struct snmp_parallel_config {
+    uint32_t thread_num; /**< number of decoding threads */
+    uint32_t chunk_num; /**< number of chunks, 0 for SNMP_PARALLEL_CHUNKS_PER_THREAD per thread */
+    uint32_t chunk_ctx_size; /**< size of per-chunk user data, can be 0 */
+    snmp_parallel_msg_cb msg_cb;
+    snmp_parallel_chunk_cb chunk_cb; /**< can be NULL */
+    void *ctx;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Decode concatenated SNMP messages on multiple threads.
+ * The buffer is first split into chunks of similar size at message
+ * boundaries, found with a single pass over the outer SEQUENCE headers.
+ * The chunks are then decoded with snmp_decode_msg_slice by a pool of
+ * *thread_num* threads, while the calling thread waits for them in order
+ * and calls *chunk_cb*.
+ * @param buf pointer to the **beginning** of the input buffer. Just like
+ * with snmp_decode_msg_slice, it has to be readable for 5 bytes past
+ * *buf_len*. It's never written.
+ * @param buf_len size of all messages in *buf*
+ * @param config decoding settings
+ * @param msg_num pointer to put the total number of messages into
+ * @return 0 on success or -1 if *buf* is not a sequence of complete BER
+ * SEQUENCEs, or memory or threads couldn't be allocated. Malformed
+ * messages inside well-formed SEQUENCEs are not errors, they are passed
+ * to *msg_cb* with NULL header.
+ */
+int snmp_decode_parallel(const uint8_t *buf, uint64_t buf_len,
+                         const struct snmp_parallel_config *config, uint64_t *msg_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //BER_SNMP_PARALLEL_H
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "ber.h"
+#include "snmp.h"
+#include "poller.h"
+
+#define SNMP_POLLER_NONE UINT32_MAX
+/** Each wheel level has 64 slots, so 4 levels cover 2^24 ms (~4.6h) */
+#define SNMP_POLLER_WHEEL_BITS 6
+#define SNMP_POLLER_WHEEL_SIZE (1 << SNMP_POLLER_WHEEL_BITS)
+#define SNMP_POLLER_WHEEL_MASK (SNMP_POLLER_WHEEL_SIZE - 1)
+#define SNMP_POLLER_WHEEL_LEVELS 4
+#define SNMP_POLLER_WHEEL_MAX ((1u << (SNMP_POLLER_WHEEL_BITS * SNMP_POLLER_WHEEL_LEVELS)) - 1)
+/** Space left after every received datagram, see snmp_decode_msg */
+#define SNMP_POLLER_MSG_SLACK 8
+
+struct snmp_poller_req {
+    uint32_t request_id;
+    uint32_t expiry; /**< in ms, compared with wrap-around */
+    uint32_t timer_next;
+    uint32_t timer_prev;
+    uint32_t timer_list; /**< index of the wheel slot list */
+    uint32_t retries_left;
+    uint32_t off; /**< offset of the encoded request in *msg* */
+    struct sockaddr_in addr;
+    void *req_ctx;
+    uint8_t msg[SNMP_POLLER_REQ_SIZE];
+};
+
+struct snmp_poller {
+    struct snmp_poller_config config;
+    struct pollfd *fds;
+    struct snmp_poller_req *reqs;
+    uint32_t *free_reqs;
+    uint32_t free_num;
+    uint32_t *hash; /**< request_id -> index in *reqs* */
+    uint32_t hash_mask;
+    uint32_t hash_shift;
+    uint32_t next_request_id;
+    uint32_t tick; /**< current time of the wheel in ms */
+    uint32_t timer_num;
+    uint32_t wheel[SNMP_POLLER_WHEEL_LEVELS * SNMP_POLLER_WHEEL_SIZE];
+    uint64_t retransmits;
+    int completed;
+    struct mmsghdr rx_hdrs[SNMP_POLLER_BATCH];
+    struct iovec rx_iovs[SNMP_POLLER_BATCH];
+    struct sockaddr_in rx_addrs[SNMP_POLLER_BATCH];
+    struct snmp_msg_batch msgs[SNMP_POLLER_BATCH];
+    uint32_t src[SNMP_POLLER_BATCH];
+    struct snmp_varbind varbinds[SNMP_POLLER_BATCH][SNMP_POLLER_MAX_VARBINDS];
+    uint8_t rx_bufs[SNMP_POLLER_BATCH][SNMP_POLLER_MSG_SIZE];
+};
+
+static uint32_t
+snmp_poller_now(const struct snmp_poller *p)
+{
+    struct timespec ts;
+
+    if (p->config.clock != NULL) {
+        return p->config.clock(p->config.ctx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000 + (uint32_t)(ts.tv_nsec / 1000000);
+}
+
+static uint32_t
+snmp_poller_hash(const struct snmp_poller *p, uint32_t request_id)
+{
+    return (request_id * 0x9E3779B1u) >> p->hash_shift;
+}
+
+/** Find hash table position of given request_id or SNMP_POLLER_NONE */
+static uint32_t
+snmp_poller_lookup(const struct snmp_poller *p, uint32_t request_id)
+{
+    uint32_t pos = snmp_poller_hash(p, request_id);
+
+    while (p->hash[pos] != SNMP_POLLER_NONE) {
+        if (p->reqs[p->hash[pos]].request_id == request_id) {
+            return pos;
+        }
+        pos = (pos + 1) & p->hash_mask;
+    }
+
+    return SNMP_POLLER_NONE;
+}
+
+static void
+snmp_poller_hash_insert(struct snmp_poller *p, uint32_t idx)
+{
+    uint32_t pos = snmp_poller_hash(p, p->reqs[idx].request_id);
+
+    while (p->hash[pos] != SNMP_POLLER_NONE) {
+        pos = (pos + 1) & p->hash_mask;
+    }
+
+    p->hash[pos] = idx;
+}
+
+/** Remove entry with linear probing backward shift, so no tombstones are needed */
+static void
+snmp_poller_hash_remove(struct snmp_poller *p, uint32_t pos)
+{
+    uint32_t next = pos, home;
+
+    for (;;) {
+        next = (next + 1) & p->hash_mask;
+        if (p->hash[next] == SNMP_POLLER_NONE) {
+            break;
+        }
+
+        /* move the entry back unless its home slot is in (pos, next] */
+        home = snmp_poller_hash(p, p->reqs[p->hash[next]].request_id);
+        if (((next - home) & p->hash_mask) >= ((next - pos) & p->hash_mask)) {
+            p->hash[pos] = p->hash[next];
+            pos = next;
+        }
+    }
+
+    p->hash[pos] = SNMP_POLLER_NONE;
+}
+
+static void
+snmp_poller_timer_add(struct snmp_poller *p, uint32_t idx)
+{
+    struct snmp_poller_req *req = &p->reqs[idx];
+    uint32_t delta = req->expiry - p->tick;
+    uint32_t level, list;
+
+    if ((int32_t)delta <= 0) {
+        /* already expired, handle it on the next tick */
+        delta = 1;
+        req->expiry = p->tick + 1;
+    } else if (delta > SNMP_POLLER_WHEEL_MAX) {
+        delta = SNMP_POLLER_WHEEL_MAX;
+        req->expiry = p->tick + delta;
+    }
+
+    level = 0;
+    while (delta >= 1u << (SNMP_POLLER_WHEEL_BITS * (level + 1))) {
+        ++level;
+    }
+
+    list = level * SNMP_POLLER_WHEEL_SIZE +
+           ((req->expiry >> (SNMP_POLLER_WHEEL_BITS * level)) & SNMP_POLLER_WHEEL_MASK);
+    req->timer_list = list;
+    req->timer_prev = SNMP_POLLER_NONE;
+    req->timer_next = p->wheel[list];
+    if (req->timer_next != SNMP_POLLER_NONE) {
+        p->reqs[req->timer_next].timer_prev = idx;
+    }
+    p->wheel[list] = idx;
+    ++p->timer_num;
+}
+
+static void
+snmp_poller_timer_del(struct snmp_poller *p, uint32_t idx)
+{
+    struct snmp_poller_req *req = &p->reqs[idx];
+
+    if (req->timer_prev != SNMP_POLLER_NONE) {
+        p->reqs[req->timer_prev].timer_next = req->timer_next;
+    } else {
+        p->wheel[req->timer_list] = req->timer_next;
+    }
+
+    if (req->timer_next != SNMP_POLLER_NONE) {
+        p->reqs[req->timer_next].timer_prev = req->timer_prev;
+    }
+
+    --p->timer_num;
+}
+
+/** Detach the list of given wheel slot */
+static uint32_t
+snmp_poller_timer_take(struct snmp_poller *p, uint32_t list)
+{
+    uint32_t idx = p->wheel[list], next;
+
+    p->wheel[list] = SNMP_POLLER_NONE;
+    for (next = idx; next != SNMP_POLLER_NONE; next = p->reqs[next].timer_next) {
+        --p->timer_num;
+    }
+
+    return idx;
+}
+
+/** Move timers of the current slot of given level to the lower levels */
+static uint32_t
+snmp_poller_cascade(struct snmp_poller *p, uint32_t level)
+{
+    uint32_t slot = (p->tick >> (SNMP_POLLER_WHEEL_BITS * level)) & SNMP_POLLER_WHEEL_MASK;
+    uint32_t idx, next;
+
+    idx = snmp_poller_timer_take(p, level * SNMP_POLLER_WHEEL_SIZE + slot);
+    while (idx != SNMP_POLLER_NONE) {
+        next = p->reqs[idx].timer_next;
+        snmp_poller_timer_add(p, idx);
+        idx = next;
+    }
+
+    return slot;
+}
+
+static void
+snmp_poller_req_free(struct snmp_poller *p, uint32_t idx)
+{
+    p->free_reqs[p->free_num++] = idx;
+}
+
+static int
+snmp_poller_transmit(struct snmp_poller *p, uint32_t idx)
+{
+    struct snmp_poller_req *req = &p->reqs[idx];
+    int fd = p->fds[req->request_id % p->config.socket_num].fd;
+    ssize_t rc;
+
+    rc = sendto(fd, req->msg + req->off, SNMP_POLLER_REQ_SIZE - req->off, 0,
+                (const struct sockaddr *)&req->addr, sizeof(req->addr));
+    /* a full socket buffer is no different than a lost datagram */
+    return rc >= 0 || errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+}
+
+static void
+snmp_poller_expire(struct snmp_poller *p, uint32_t idx)
+{
+    struct snmp_poller_req *req = &p->reqs[idx];
+
+    if (req->retries_left > 0) {
+        --req->retries_left;
+        ++p->retransmits;
+        (void)snmp_poller_transmit(p, idx);
+        req->expiry = p->tick + p->config.timeout_ms;
+        snmp_poller_timer_add(p, idx);
+        return;
+    }
+
+    snmp_poller_hash_remove(p, snmp_poller_lookup(p, req->request_id));
+    snmp_poller_req_free(p, idx);
+    ++p->completed;
+    p->config.cb(p->config.ctx, req->req_ctx, SNMP_POLLER_TIMEOUT, NULL, 0, NULL);
+}
+
+/** Advance the wheel up to *now* and handle all expired timers */
+static void
+snmp_poller_advance(struct snmp_poller *p, uint32_t now)
+{
+    uint32_t idx, next, level;
+
+    if (p->timer_num == 0) {
+        p->tick = now;
+        return;
+    }
+
+    while ((int32_t)(now - p->tick) > 0) {
+        ++p->tick;
+        if ((p->tick & SNMP_POLLER_WHEEL_MASK) == 0) {
+            for (level = 1; level < SNMP_POLLER_WHEEL_LEVELS; ++level) {
+                if (snmp_poller_cascade(p, level) != 0) {
+                    break;
+                }
+            }
+        }
+
+        idx = snmp_poller_timer_take(p, p->tick & SNMP_POLLER_WHEEL_MASK);
+        while (idx != SNMP_POLLER_NONE) {
+            next = p->reqs[idx].timer_next;
+            snmp_poller_expire(p, idx);
+            idx = next;
+        }
+    }
+}
+
+struct snmp_poller *
+snmp_poller_create(const struct snmp_poller_config *config)
+{
+    struct snmp_poller *p;
+    struct sockaddr_in addr = { 0 };
+    uint32_t i, hash_size = 1, hash_bits = 0;
+    int rcvbuf = 4 * 1024 * 1024;
+
+    if (config->socket_num == 0 || config->max_inflight == 0 ||
+        config->max_inflight > UINT32_MAX / 4 || config->cb == NULL) {
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return NULL;
+    }
+
+    /* keep the load factor at most 50% */
+    while (hash_size < config->max_inflight * 2) {
+        hash_size <<= 1;
+        ++hash_bits;
+    }
+
+    p->config = *config;
+    p->hash_mask = hash_size - 1;
+    p->hash_shift = 32 - hash_bits;
+    p->fds = calloc(config->socket_num, sizeof(*p->fds));
+    p->reqs = calloc(config->max_inflight, sizeof(*p->reqs));
+    p->free_reqs = calloc(config->max_inflight, sizeof(*p->free_reqs));
+    p->hash = malloc(hash_size * sizeof(*p->hash));
+    if (p->fds == NULL || p->reqs == NULL || p->free_reqs == NULL || p->hash == NULL) {
+        snmp_poller_destroy(p);
+        return NULL;
+    }
+
+    memset(p->hash, 0xFF, hash_size * sizeof(*p->hash));
+    memset(p->wheel, 0xFF, sizeof(p->wheel));
+    for (i = 0; i < config->max_inflight; ++i) {
+        p->free_reqs[i] = config->max_inflight - 1 - i;
+    }
+    p->free_num = config->max_inflight;
+    p->next_request_id = 1;
+    p->tick = snmp_poller_now(p);
+
+    for (i = 0; i < SNMP_POLLER_BATCH; ++i) {
+        p->rx_iovs[i].iov_base = p->rx_bufs[i];
+        p->rx_iovs[i].iov_len = SNMP_POLLER_MSG_SIZE - SNMP_POLLER_MSG_SLACK;
+        p->rx_hdrs[i].msg_hdr.msg_iov = &p->rx_iovs[i];
+        p->rx_hdrs[i].msg_hdr.msg_iovlen = 1;
+        p->rx_hdrs[i].msg_hdr.msg_name = &p->rx_addrs[i];
+    }
+
+    for (i = 0; i < config->socket_num; ++i) {
+        p->fds[i].fd = -1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    for (i = 0; i < config->socket_num; ++i) {
+        p->fds[i].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        p->fds[i].events = POLLIN;
+        if (p->fds[i].fd < 0 || bind(p->fds[i].fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            snmp_poller_destroy(p);
+            return NULL;
+        }
+
+        /* best effort, there may be thousands of responses at once */
+        (void)setsockopt(p->fds[i].fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    return p;
+}
+
+void
+snmp_poller_destroy(struct snmp_poller *p)
+{
+    uint32_t i;
+
+    if (p->fds != NULL) {
+        for (i = 0; i < p->config.socket_num; ++i) {
+            if (p->fds[i].fd >= 0) {
+                close(p->fds[i].fd);
+            }
+        }
+    }
+
+    free(p->fds);
+    free(p->reqs);
+    free(p->free_reqs);
+    free(p->hash);
+    free(p);
+}
+
+int
+snmp_poller_send(struct snmp_poller *p, const struct sockaddr_in *addr,
+                 struct snmp_msg_header *header, uint32_t varbind_num,
+                 struct snmp_varbind *varbinds, void *req_ctx)
+{
+    struct snmp_poller_req *req;
+    uint8_t *out;
+    uint32_t idx;
+
+    if (p->free_num == 0) {
+        return -1;
+    }
+
+    /* keep request_id positive for agents that treat it as Integer32 */
+    do {
+        header->request_id = p->next_request_id++ & 0x7FFFFFFF;
+    } while (header->request_id == 0 || snmp_poller_lookup(p, header->request_id) != SNMP_POLLER_NONE);
+
+    if (snmp_sizeof_msg(header, varbind_num, varbinds) > SNMP_POLLER_REQ_SIZE) {
+        return -1;
+    }
+
+    idx = p->free_reqs[p->free_num - 1];
+    req = &p->reqs[idx];
+    out = snmp_encode_msg(req->msg + SNMP_POLLER_REQ_SIZE - 1, header, varbind_num, varbinds);
+    if (out == NULL) {
+        return -1;
+    }
+
+    req->off = (uint32_t)(out - req->msg);
+    req->request_id = header->request_id;
+    req->retries_left = p->config.retries;
+    req->addr = *addr;
+    req->req_ctx = req_ctx;
+    if (snmp_poller_transmit(p, idx) != 0) {
+        return -1;
+    }
+
+    --p->free_num;
+    snmp_poller_hash_insert(p, idx);
+    req->expiry = snmp_poller_now(p) + p->config.timeout_ms;
+    snmp_poller_timer_add(p, idx);
+
+    return 0;
+}
+
+static void
+snmp_poller_receive(struct snmp_poller *p, uint32_t rx_num)
+{
+    struct snmp_msg_batch *msg;
+    struct snmp_poller_req *req;
+    const struct sockaddr_in *from;
+    uint32_t i, pos, idx, msg_num = 0;
+    void *req_ctx;
+
+    for (i = 0; i < rx_num; ++i) {
+        if (p->rx_hdrs[i].msg_len < 2) {
+            continue;
+        }
+
+        msg = &p->msgs[msg_num];
+        msg->buf = p->rx_bufs[i];
+        msg->buf_len = p->rx_hdrs[i].msg_len + 5;
+        msg->varbind_num = SNMP_POLLER_MAX_VARBINDS;
+        msg->varbinds = p->varbinds[msg_num];
+        p->src[msg_num++] = i;
+    }
+
+    snmp_decode_msg_batch(p->msgs, msg_num);
+
+    for (i = 0; i < msg_num; ++i) {
+        msg = &p->msgs[i];
+        if (msg->status != 0 || msg->header.pdu_type != SNMP_DATA_T_PDU_GET_RESPONSE) {
+            continue;
+        }
+
+        pos = snmp_poller_lookup(p, msg->header.request_id);
+        if (pos == SNMP_POLLER_NONE) {
+            continue; /* late response to an already completed request */
+        }
+
+        /* don't accept responses from anyone else than the polled agent */
+        idx = p->hash[pos];
+        req = &p->reqs[idx];
+        from = &p->rx_addrs[p->src[i]];
+        if (from->sin_addr.s_addr != req->addr.sin_addr.s_addr || from->sin_port != req->addr.sin_port) {
+            continue;
+        }
+
+        req_ctx = req->req_ctx;
+        snmp_poller_hash_remove(p, pos);
+        snmp_poller_timer_del(p, idx);
+        snmp_poller_req_free(p, idx);
+        ++p->completed;
+        p->config.cb(p->config.ctx, req_ctx, SNMP_POLLER_OK, &msg->header, msg->varbind_num, msg->varbinds);
+    }
+}
+
+int
+snmp_poller_run(struct snmp_poller *p, uint32_t wait_ms)
+{
+    uint32_t i, j;
+    int ready, rx_num;
+
+    p->completed = 0;
+    ready = poll(p->fds, p->config.socket_num, (int)wait_ms);
+    if (ready < 0 && errno != EINTR) {
+        return -1;
+    }
+
+    for (i = 0; ready > 0 && i < p->config.socket_num; ++i) {
+        if ((p->fds[i].revents & POLLIN) == 0) {
+            continue;
+        }
+
+        /* drain the socket, unless it's being flooded */
+        do {
+            for (j = 0; j < SNMP_POLLER_BATCH; ++j) {
+                p->rx_hdrs[j].msg_hdr.msg_namelen = sizeof(p->rx_addrs[j]);
+            }
+
+            rx_num = recvmmsg(p->fds[i].fd, p->rx_hdrs, SNMP_POLLER_BATCH, MSG_DONTWAIT, NULL);
+            if (rx_num > 0) {
+                snmp_poller_receive(p, (uint32_t)rx_num);
+            }
+        } while (rx_num == SNMP_POLLER_BATCH && p->free_num < p->config.max_inflight);
+    }
+
+    snmp_poller_advance(p, snmp_poller_now(p));
+    return p->completed;
+}
+
+uint32_t
+snmp_poller_inflight(const struct snmp_poller *p)
+{
+    return p->config.max_inflight - p->free_num;
+}
+
+uint64_t
+snmp_poller_retransmits(const struct snmp_poller *p)
+{
+    return p->retransmits;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2017 Dariusz Stojaczyk. All Rights Reserved.
+ * The following source code is released under an MIT-style license,
+ * that can be found in the LICENSE file.
+ */
+
+#ifndef BER_SNMP_POLLER_H
+#define BER_SNMP_POLLER_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "snmp.h"
+
+/** Max size of a single encoded request, kept for retransmissions */
+#define SNMP_POLLER_REQ_SIZE 484
+/** Max size of a single received response */
+#define SNMP_POLLER_MSG_SIZE 1500
+/** Max number of varbinds decoded from a single response, the rest is ignored */
+#define SNMP_POLLER_MAX_VARBINDS 16
+/** Max number of datagrams received with a single syscall */
+#define SNMP_POLLER_BATCH 32
+
+/** Request completion status passed to snmp_poller_cb */
+enum snmp_poller_status {
+    SNMP_POLLER_OK = 0,
+    SNMP_POLLER_TIMEOUT = -1,
+};
+
+/**
+ * Called once for every request sent with snmp_poller_send.
+ * @param ctx user context given in struct snmp_poller_config
+ * @param req_ctx user context given to snmp_poller_send
+ * @param status SNMP_POLLER_OK if a response was received or
+ * SNMP_POLLER_TIMEOUT if all retries timed out
+ * @param header decoded response header, NULL on timeout
+ * @param varbind_num number of decoded varbinds
+ * @param varbinds decoded varbinds. Just like with snmp_decode_msg_slice,
+ * strings are not NUL-terminated. All data is valid only during this call.
+ */
+typedef void (*snmp_poller_cb)(void *ctx, void *req_ctx, int status,
+                               const struct snmp_msg_header *header,
+                               uint32_t varbind_num, const struct snmp_varbind *varbinds);
+
+/**
+ * Source of time for request timeouts.
+ * @param ctx user context given in struct snmp_poller_config
+ * @return current time in milliseconds, wrapping around at UINT32_MAX
+ */
+typedef uint32_t (*snmp_poller_clock_cb)(void *ctx);
+
+/** Poller settings, see snmp_poller_create */
+struct snmp_poller_config {
+    uint32_t socket_num; /**< number of UDP sockets to spread requests over */
+    uint32_t max_inflight; /**< max number of requests waiting for a response */
+    uint32_t timeout_ms; /**< time to wait for a response before retrying */
+    uint32_t retries; /**< number of retransmissions before giving up */
+    snmp_poller_cb cb;
+    snmp_poller_clock_cb clock; /**< can be NULL for CLOCK_MONOTONIC */
+    void *ctx;
+};
+
+struct snmp_poller;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create an asynchronous SNMP poller.
+ * The poller keeps up to *max_inflight* requests in flight. Responses are
+ * matched to requests by their request_id with an open-addressed hash table,
+ * and timeouts are tracked with a hierarchical timer wheel of 1ms
+ * resolution. All memory is allocated upfront. The poller is not
+ * thread-safe, but multiple pollers can be used from separate threads.
+ * @param config poller settings
+ * @return poller handle or NULL if memory or sockets couldn't be allocated
+ */
+struct snmp_poller *snmp_poller_create(const struct snmp_poller_config *config);
+
+/**
+ * Destroy the poller. Callbacks of requests still in flight are not called.
+ * @param poller poller created with snmp_poller_create
+ */
+void snmp_poller_destroy(struct snmp_poller *poller);
+
+/**
+ * Encode and send a request.
+ * The request_id in *header* is overwritten, the poller assigns its own.
+ * @param poller poller created with snmp_poller_create
+ * @param addr address of the agent
+ * @param header header to be encoded
+ * @param varbind_num number of following snmp_varbind* items
+ * @param varbinds pointer to array of varbinds to be encoded
+ * @param req_ctx user context passed to the callback
+ * @return 0 on success or -1 if *max_inflight* requests are already
+ * in flight, the request is bigger than SNMP_POLLER_REQ_SIZE, or it
+ * couldn't be encoded or sent.
+ */
+int snmp_poller_send(struct snmp_poller *poller, const struct sockaddr_in *addr,
+                     struct snmp_msg_header *header, uint32_t varbind_num,
+                     struct snmp_varbind *varbinds, void *req_ctx);
+
+/**
+ * Receive responses and handle timeouts, calling the callback for every
+ * completed request.
+ * @param poller poller created with snmp_poller_create
+ * @param wait_ms max time to wait for the first response. Timeouts are
+ * checked after the wait, so this is also their precision.
+ * @return number of completed requests or -1 on socket error
+ */
+int snmp_poller_run(struct snmp_poller *poller, uint32_t wait_ms);
+
+/**
+ * Get the number of requests still waiting for a response.
+ * @param poller poller created with snmp_poller_create
+ * @return number of requests in flight
+ */
+uint32_t snmp_poller_inflight(const struct snmp_poller *poller);
+
+/**
+ * Get the number of retransmissions done so far.
+ * @param poller poller created with snmp_poller_create
+ * @return number of requests sent again after a timeout
+ */
+uint64_t snmp_poller_retransmits(const struct snmp_poller *poller);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //BER_SNMP_POLLER_H
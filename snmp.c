@@ -7,256 +7,2034 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/uio.h>
 #include "ber.h"
 #include "snmp.h"
+#include "ber_stats.h"
+
+/** Count a failed SNMP message decoding and return NULL */
+#define SNMP_DECODE_FAIL(reason) \
+    (BER_STATS_ADD(errors[BER_STATS_ERR_##reason], 1), (uint8_t *)NULL)
+
+/** GetBulk carries non-repeaters in place of error-status */
+static uint32_t
+snmp_header_error_status(const struct snmp_msg_header *header)
+{
+    if (header->pdu_type == SNMP_DATA_T_PDU_GET_BULK_REQUEST) {
+        return header->non_repeaters;
+    }
+
+    return header->error_status;
+}
+
+/** GetBulk carries max-repetitions in place of error-index */
+static uint32_t
+snmp_header_error_index(const struct snmp_msg_header *header)
+{
+    if (header->pdu_type == SNMP_DATA_T_PDU_GET_BULK_REQUEST) {
+        return header->max_repetitions;
+    }
+
+    return header->error_index;
+}
+
+/** Move just decoded GetBulk fields to where they belong */
+static void
+snmp_header_decode_bulk(struct snmp_msg_header *header)
+{
+    header->non_repeaters = 0;
+    header->max_repetitions = 0;
+    if (header->pdu_type == SNMP_DATA_T_PDU_GET_BULK_REQUEST) {
+        header->non_repeaters = header->error_status;
+        header->max_repetitions = header->error_index;
+        header->error_status = 0;
+        header->error_index = 0;
+    }
+}
+
+static int
+snmp_pdu_type_valid(uint8_t pdu_type)
+{
+    return pdu_type == SNMP_DATA_T_PDU_GET_REQUEST ||
+           pdu_type == SNMP_DATA_T_PDU_GET_NEXT_REQUEST ||
+           pdu_type == SNMP_DATA_T_PDU_GET_RESPONSE ||
+           pdu_type == SNMP_DATA_T_PDU_SET_REQUEST ||
+           pdu_type == SNMP_DATA_T_PDU_GET_BULK_REQUEST;
+}
 
 uint8_t *
 snmp_encode_oid(uint8_t *out, uint32_t *oid)
 {
-    uint32_t *oid_start = oid;
+    uint32_t oid_len = 0;
+
+    while (oid[oid_len] != SNMP_MSG_OID_END) {
+        ++oid_len;
+    }
+
+    return snmp_encode_oid_len(out, oid, oid_len);
+}
+
+uint8_t *
+snmp_encode_oid_len(uint8_t *out, const uint32_t *oid, uint32_t oid_len)
+{
     uint8_t *out_start = out;
+    uint32_t i;
+
+    for (i = oid_len - 1; i > 1; --i) {
+        out = ber_encode_vlint(out, oid[i]);
+    }
+
+    out = ber_encode_vlint(out, oid[0] * 40 + oid[1]);
+    out = ber_encode_length(out, (uint32_t)(out_start - out));
+    *out-- = SNMP_DATA_T_OBJECT;
+
+    return out;
+}
+
+uint32_t
+snmp_sizeof_oid(uint32_t *oid)
+{
+    uint32_t oid_len = 0;
+
+    while (oid[oid_len] != SNMP_MSG_OID_END) {
+        ++oid_len;
+    }
+
+    return snmp_sizeof_oid_len(oid, oid_len);
+}
+
+uint32_t
+snmp_sizeof_oid_len(const uint32_t *oid, uint32_t oid_len)
+{
+    uint32_t len, i;
+
+    len = ber_sizeof_vlint(oid[0] * 40 + oid[1]);
+    for (i = 2; i < oid_len; ++i) {
+        len += ber_sizeof_vlint(oid[i]);
+    }
+
+    return 1 + ber_sizeof_length(len) + len;
+}
+
+int
+snmp_oid_preencode(struct snmp_oid_enc *enc, const uint32_t *oid, uint32_t oid_len)
+{
+    uint8_t *out_end = enc->data + sizeof(enc->data) - 1;
+    uint8_t *out;
+
+    if (oid_len < 2 || oid_len > SNMP_MSG_OID_LEN) {
+        return -1;
+    }
+
+    out = snmp_encode_oid_len(out_end, oid, oid_len);
+    enc->len = (uint32_t)(out_end - out);
+    memmove(enc->data, out + 1, enc->len);
+
+    return 0;
+}
+
+uint8_t *
+snmp_encode_oid_enc(uint8_t *out, const struct snmp_oid_enc *enc)
+{
+    out -= enc->len;
+    memcpy(out + 1, enc->data, enc->len);
+
+    return out;
+}
+
+/** Decode OID arcs from the value of BER object of given length */
+static uint8_t *
+snmp_decode_oid_value(uint8_t *buf, uint32_t len, uint32_t *oid, uint32_t *oid_len)
+{
+    uint32_t arcs_len;
+    div_t first;
+
+    first = div(*buf++, 40);
+    oid[0] = (uint32_t)first.quot;
+    oid[1] = (uint32_t)first.rem;
+
+    /* leave space for the first two arcs and SNMP_MSG_OID_END */
+    arcs_len = *oid_len - 3;
+    buf = ber_decode_vlint_batch(buf, len - 1, oid + 2, &arcs_len);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    oid[2 + arcs_len] = SNMP_MSG_OID_END;
+    *oid_len = arcs_len + 3;
+
+    return buf;
+}
+
+uint8_t *
+snmp_decode_oid(uint8_t *buf, uint32_t buf_len, uint32_t *oid, uint32_t *oid_len)
+{
+    uint32_t len;
+
+    buf++; /* ignore ber type, assume it's an object */
+    buf = ber_decode_length(buf, &len);
+    if (buf == NULL || len == 0 || *oid_len < 3 ||
+        len + 2 + 5 /* 5 bytes of vlint */ > buf_len) {
+        return NULL;
+    }
+
+    return snmp_decode_oid_value(buf, len, oid, oid_len);
+}
+
+static uint8_t *
+snmp_encode_value(uint8_t *out, enum snmp_data_type value_type,
+                  const union snmp_varbind_val *value, uint32_t value_len)
+{
+    switch (value_type) {
+        case SNMP_DATA_T_INTEGER:
+            out = ber_encode_int(out, value->i);
+            break;
+        case SNMP_DATA_T_COUNTER32:
+        case SNMP_DATA_T_GAUGE32:
+        case SNMP_DATA_T_TIMETICKS:
+            out = ber_encode_uint64(out, value->i, (uint8_t)value_type);
+            break;
+        case SNMP_DATA_T_COUNTER64:
+            out = ber_encode_uint64(out, value->i64, (uint8_t)value_type);
+            break;
+        case SNMP_DATA_T_OCTET_STRING:
+            out = ber_encode_string_len(out, value->s, value_len);
+            break;
+        case SNMP_DATA_T_NULL:
+            out = ber_encode_null(out);
+            break;
+        case SNMP_DATA_T_NO_SUCH_OBJECT:
+        case SNMP_DATA_T_NO_SUCH_INSTANCE:
+        case SNMP_DATA_T_END_OF_MIB_VIEW:
+            out = ber_encode_null(out);
+            out[1] = (uint8_t)value_type;
+            break;
+        default:
+            return NULL;
+    }
+
+    return out;
+}
+
+/** Encode a single varbind. If *oid_enc* is not NULL, *oid* is ignored. */
+static uint8_t *
+snmp_encode_varbind(uint8_t *out, const struct snmp_oid_enc *oid_enc,
+                    const uint32_t *oid, uint32_t oid_len,
+                    enum snmp_data_type value_type, const union snmp_varbind_val *value,
+                    uint32_t value_len)
+{
+    uint8_t *out_prev = out;
+
+    out = snmp_encode_value(out, value_type, value, value_len);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    if (oid_enc != NULL) {
+        out = snmp_encode_oid_enc(out, oid_enc);
+    } else {
+        out = snmp_encode_oid_len(out, oid, oid_len);
+    }
+    out = ber_encode_length(out, (uint32_t)(out_prev - out));
+    *out-- = SNMP_DATA_T_SEQUENCE;
+
+    return out;
+}
+
+/**
+ * Encode everything but the varbinds, which are already encoded
+ * between *out* and *out_end*, except for *ref_len* bytes of string
+ * values which are referenced rather than copied, see snmp_encode_msg_iov.
+ */
+static uint8_t *
+snmp_encode_header(uint8_t *out, uint8_t *out_end, uint32_t ref_len,
+                   struct snmp_msg_header *header)
+{
+    out = ber_encode_length(out, (uint32_t)(out_end - out) + ref_len);
+    *out-- = SNMP_DATA_T_SEQUENCE;
+
+    /* writing pdu header */
+    out = ber_encode_int(out, snmp_header_error_index(header));
+    out = ber_encode_int(out, snmp_header_error_status(header));
+    out = ber_encode_int(out, header->request_id);
+
+    out = ber_encode_length(out, (uint32_t)(out_end - out) + ref_len);
+    *out-- = header->pdu_type;
+
+    /* writing the rest of snmp msg data */
+    out = ber_encode_string(out, header->community);
+    out = ber_encode_int(out, header->snmp_ver);
+
+    out = ber_encode_length(out, (uint32_t)(out_end - out) + ref_len);
+    *out = SNMP_DATA_T_SEQUENCE;
+
+    BER_STATS_CALL(SNMP_ENCODE_MSG);
+    BER_STATS_ADD(bytes_encoded, out_end - out + 1 + ref_len);
+
+    return out;
+}
+
+/**
+ * Get the size of a single varbind's content, or 0 if it can't be encoded.
+ * If *oid_enc* is not NULL, *oid* is ignored.
+ */
+static uint32_t
+snmp_sizeof_varbind_content(const struct snmp_oid_enc *oid_enc, const uint32_t *oid,
+                            uint32_t oid_len, enum snmp_data_type value_type,
+                            const union snmp_varbind_val *value, uint32_t value_len)
+{
+    uint32_t len;
+
+    switch (value_type) {
+        case SNMP_DATA_T_INTEGER:
+            len = ber_sizeof_int(value->i);
+            break;
+        case SNMP_DATA_T_COUNTER32:
+        case SNMP_DATA_T_GAUGE32:
+        case SNMP_DATA_T_TIMETICKS:
+            len = ber_sizeof_uint64(value->i);
+            break;
+        case SNMP_DATA_T_COUNTER64:
+            len = ber_sizeof_uint64(value->i64);
+            break;
+        case SNMP_DATA_T_OCTET_STRING:
+            len = ber_sizeof_string_len(value_len);
+            break;
+        case SNMP_DATA_T_NULL:
+        case SNMP_DATA_T_NO_SUCH_OBJECT:
+        case SNMP_DATA_T_NO_SUCH_INSTANCE:
+        case SNMP_DATA_T_END_OF_MIB_VIEW:
+            len = 2;
+            break;
+        default:
+            return 0;
+    }
+
+    return len + (oid_enc != NULL ? oid_enc->len : snmp_sizeof_oid_len(oid, oid_len));
+}
 
-    while (*oid != SNMP_MSG_OID_END) {
-        ++oid;
+/** Get the size of a single varbind. If *oid_enc* is not NULL, *oid* is ignored. */
+static uint32_t
+snmp_sizeof_varbind(const struct snmp_oid_enc *oid_enc, const uint32_t *oid, uint32_t oid_len,
+                    enum snmp_data_type value_type, const union snmp_varbind_val *value,
+                    uint32_t value_len)
+{
+    uint32_t len = snmp_sizeof_varbind_content(oid_enc, oid, oid_len, value_type, value,
+                                               value_len);
+
+    if (len == 0) {
+        return 0;
+    }
+
+    return 1 + ber_sizeof_length(len) + len;
+}
+
+/** Get the size of everything but the varbinds, which take *len* bytes */
+static uint32_t
+snmp_sizeof_header(struct snmp_msg_header *header, uint32_t len)
+{
+    len += 1 + ber_sizeof_length(len);
+
+    len += ber_sizeof_int(snmp_header_error_index(header));
+    len += ber_sizeof_int(snmp_header_error_status(header));
+    len += ber_sizeof_int(header->request_id);
+    len += 1 + ber_sizeof_length(len);
+
+    len += ber_sizeof_string_len((uint32_t)strlen(header->community));
+    len += ber_sizeof_int(header->snmp_ver);
+
+    return 1 + ber_sizeof_length(len) + len;
+}
+
+/** Get the size of all *varbinds*, or 0 if any of them can't be encoded */
+static uint32_t
+snmp_sizeof_varbinds(uint32_t varbind_num, struct snmp_varbind *varbinds)
+{
+    struct snmp_varbind *varbind;
+    uint32_t len = 0, varbind_len, oid_len, value_len, i;
+
+    for (i = 0; i < varbind_num; ++i) {
+        varbind = &varbinds[i];
+
+        oid_len = 0;
+        while (varbind->oid[oid_len] != SNMP_MSG_OID_END) {
+            ++oid_len;
+        }
+
+        value_len = 0;
+        if (varbind->value_type == SNMP_DATA_T_OCTET_STRING) {
+            value_len = (uint32_t)strlen(varbind->value.s);
+        }
+
+        varbind_len = snmp_sizeof_varbind(NULL, varbind->oid, oid_len,
+                                          varbind->value_type, &varbind->value, value_len);
+        if (varbind_len == 0) {
+            return 0;
+        }
+
+        len += varbind_len;
+    }
+
+    return len;
+}
+
+uint32_t
+snmp_sizeof_msg(struct snmp_msg_header *header, uint32_t varbind_num,
+                struct snmp_varbind *varbinds)
+{
+    uint32_t len = snmp_sizeof_varbinds(varbind_num, varbinds);
+
+    if (len == 0 && varbind_num > 0) {
+        return 0;
+    }
+
+    return snmp_sizeof_header(header, len);
+}
+
+uint32_t
+snmp_sizeof_msg_compact(struct snmp_msg_header *header, const struct ber_arena *arena,
+                        uint32_t varbind_num, const struct snmp_varbind_compact *varbinds)
+{
+    const struct snmp_varbind_compact *varbind;
+    const uint32_t *oid;
+    uint32_t len = 0, varbind_len, i;
+
+    for (i = 0; i < varbind_num; ++i) {
+        varbind = &varbinds[i];
+        oid = varbind->oid_enc == NULL ? snmp_varbind_compact_oid(arena, varbind) : NULL;
+        varbind_len = snmp_sizeof_varbind(varbind->oid_enc, oid, varbind->oid_len,
+                                          varbind->value_type, &varbind->value, varbind->value_len);
+        if (varbind_len == 0) {
+            return 0;
+        }
+
+        len += varbind_len;
+    }
+
+    return snmp_sizeof_header(header, len);
+}
+
+/** Encode message, copying OIDs from *oid_encs* where it's not NULL */
+static uint8_t *
+snmp_encode_msg_varbinds(uint8_t *out, struct snmp_msg_header *header, uint32_t varbind_num,
+                         struct snmp_varbind *varbinds, const struct snmp_oid_enc *const *oid_encs)
+{
+    struct snmp_varbind *varbind;
+    const struct snmp_oid_enc *oid_enc;
+    uint8_t *out_end = out;
+    uint32_t oid_len, value_len;
+    int i;
+
+    /* writing varbinds */
+    for (i = varbind_num - 1; i >= 0; --i) {
+        varbind = &varbinds[i];
+        oid_enc = oid_encs != NULL ? oid_encs[i] : NULL;
+
+        oid_len = 0;
+        while (oid_enc == NULL && varbind->oid[oid_len] != SNMP_MSG_OID_END) {
+            ++oid_len;
+        }
+
+        value_len = 0;
+        if (varbind->value_type == SNMP_DATA_T_OCTET_STRING) {
+            value_len = (uint32_t)strlen(varbind->value.s);
+        }
+
+        out = snmp_encode_varbind(out, oid_enc, varbind->oid, oid_len, varbind->value_type,
+                                  &varbind->value, value_len);
+        if (out == NULL) {
+            return NULL;
+        }
+    }
+
+    return snmp_encode_header(out, out_end, 0, header);
+}
+
+uint8_t *
+snmp_encode_msg(uint8_t *out, struct snmp_msg_header *header,
+                uint32_t varbind_num, struct snmp_varbind *varbinds)
+{
+    return snmp_encode_msg_varbinds(out, header, varbind_num, varbinds, NULL);
+}
+
+uint8_t *
+snmp_encode_msg_oid_enc(uint8_t *out, struct snmp_msg_header *header, uint32_t varbind_num,
+                        struct snmp_varbind *varbinds, const struct snmp_oid_enc *const *oid_encs)
+{
+    return snmp_encode_msg_varbinds(out, header, varbind_num, varbinds, oid_encs);
+}
+
+uint8_t *
+snmp_encode_msg_fit(uint8_t *out, uint32_t out_size, struct snmp_msg_header *header,
+                    uint32_t varbind_num, struct snmp_varbind *varbinds,
+                    uint32_t *encoded_num)
+{
+    struct snmp_varbind *varbind;
+    uint32_t len = 0, varbind_len, oid_len, value_len, i;
+
+    if (snmp_sizeof_header(header, 0) > out_size) {
+        return NULL;
+    }
+
+    for (i = 0; i < varbind_num; ++i) {
+        varbind = &varbinds[i];
+
+        oid_len = 0;
+        while (varbind->oid[oid_len] != SNMP_MSG_OID_END) {
+            ++oid_len;
+        }
+
+        value_len = 0;
+        if (varbind->value_type == SNMP_DATA_T_OCTET_STRING) {
+            value_len = (uint32_t)strlen(varbind->value.s);
+        }
+
+        varbind_len = snmp_sizeof_varbind(NULL, varbind->oid, oid_len,
+                                          varbind->value_type, &varbind->value, value_len);
+        if (varbind_len == 0) {
+            return NULL;
+        }
+
+        if (snmp_sizeof_header(header, len + varbind_len) > out_size) {
+            break;
+        }
+
+        len += varbind_len;
+    }
+
+    *encoded_num = i;
+    return snmp_encode_msg(out, header, i, varbinds);
+}
+
+uint8_t *
+snmp_encode_msg_compact(uint8_t *out, struct snmp_msg_header *header, const struct ber_arena *arena,
+                        uint32_t varbind_num, const struct snmp_varbind_compact *varbinds)
+{
+    const struct snmp_varbind_compact *varbind;
+    const uint32_t *oid;
+    uint8_t *out_end = out;
+    int i;
+
+    /* writing varbinds */
+    for (i = varbind_num - 1; i >= 0; --i) {
+        varbind = &varbinds[i];
+        oid = varbind->oid_enc == NULL ? snmp_varbind_compact_oid(arena, varbind) : NULL;
+        out = snmp_encode_varbind(out, varbind->oid_enc, oid, varbind->oid_len,
+                                  varbind->value_type, &varbind->value, varbind->value_len);
+        if (out == NULL) {
+            return NULL;
+        }
+    }
+
+    return snmp_encode_header(out, out_end, 0, header);
+}
+
+/** Add a buffer to the iovec array that is being filled backwards */
+static int
+snmp_iov_prepend(struct iovec *iov, uint32_t *iov_free, const void *base, size_t len)
+{
+    if (*iov_free == 0) {
+        return -1;
     }
-    --oid;
 
-    while (oid != oid_start) {
-        out = ber_encode_vlint(out, *oid);
-        --oid;
+    --*iov_free;
+    iov[*iov_free].iov_base = (void *)(uintptr_t)base;
+    iov[*iov_free].iov_len = len;
+    return 0;
+}
+
+uint8_t *
+snmp_encode_msg_iov(uint8_t *out, struct snmp_msg_header *header, uint32_t varbind_num,
+                    struct snmp_varbind *varbinds, struct iovec *iov, uint32_t *iov_num)
+{
+    struct snmp_varbind *varbind;
+    uint8_t *out_end = out, *seg_end = out, *varbind_end;
+    uint32_t oid_len, value_len, ref_len = 0, iov_free = *iov_num;
+    int i;
+
+    /* writing varbinds, the same as snmp_encode_msg */
+    for (i = varbind_num - 1; i >= 0; --i) {
+        varbind = &varbinds[i];
+
+        oid_len = 0;
+        while (varbind->oid[oid_len] != SNMP_MSG_OID_END) {
+            ++oid_len;
+        }
+
+        value_len = 0;
+        if (varbind->value_type == SNMP_DATA_T_OCTET_STRING) {
+            value_len = (uint32_t)strlen(varbind->value.s);
+        }
+
+        if (value_len < SNMP_MSG_IOV_MIN_LEN) {
+            out = snmp_encode_varbind(out, NULL, varbind->oid, oid_len,
+                                      varbind->value_type, &varbind->value, value_len);
+            if (out == NULL) {
+                return NULL;
+            }
+            continue;
+        }
+
+        /* close the headers written so far and reference the string after them */
+        if ((out != seg_end &&
+             snmp_iov_prepend(iov, &iov_free, out + 1, (size_t)(seg_end - out)) != 0) ||
+            snmp_iov_prepend(iov, &iov_free, varbind->value.s, value_len) != 0) {
+            return NULL;
+        }
+        seg_end = varbind_end = out;
+        ref_len += value_len;
+
+        out = ber_encode_length(out, value_len);
+        *out-- = SNMP_DATA_T_OCTET_STRING;
+        out = snmp_encode_oid_len(out, varbind->oid, oid_len);
+        out = ber_encode_length(out, (uint32_t)(varbind_end - out) + value_len);
+        *out-- = SNMP_DATA_T_SEQUENCE;
+    }
+
+    out = snmp_encode_header(out, out_end, ref_len, header);
+    if (snmp_iov_prepend(iov, &iov_free, out, (size_t)(seg_end - out + 1)) != 0) {
+        return NULL;
+    }
+
+    *iov_num -= iov_free;
+    memmove(iov, iov + iov_free, *iov_num * sizeof(*iov));
+
+    return out;
+}
+
+int
+snmp_write_oid(struct ber_writer *w, const uint32_t *oid, uint32_t oid_len)
+{
+    uint32_t i;
+
+    if (ber_writer_begin(w, SNMP_DATA_T_OBJECT) != 0 ||
+        ber_writer_vlint(w, oid[0] * 40 + oid[1]) != 0) {
+        return -1;
+    }
+
+    for (i = 2; i < oid_len; ++i) {
+        if (ber_writer_vlint(w, oid[i]) != 0) {
+            return -1;
+        }
+    }
+
+    return ber_writer_end(w);
+}
+
+int
+snmp_write_msg_begin(struct ber_writer *w, struct snmp_msg_header *header)
+{
+    if (ber_writer_begin(w, SNMP_DATA_T_SEQUENCE) != 0 ||
+        ber_writer_int(w, header->snmp_ver) != 0 ||
+        ber_writer_string_len(w, header->community, (uint32_t)strlen(header->community)) != 0 ||
+        ber_writer_begin(w, (uint8_t)header->pdu_type) != 0 ||
+        ber_writer_int(w, header->request_id) != 0 ||
+        ber_writer_int(w, snmp_header_error_status(header)) != 0 ||
+        ber_writer_int(w, snmp_header_error_index(header)) != 0 ||
+        ber_writer_begin(w, SNMP_DATA_T_SEQUENCE) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+snmp_write_varbind(struct ber_writer *w, struct snmp_varbind *varbind)
+{
+    uint32_t oid_len = 0, value_len = 0, len;
+    int rc;
+
+    while (varbind->oid[oid_len] != SNMP_MSG_OID_END) {
+        ++oid_len;
+    }
+
+    if (varbind->value_type == SNMP_DATA_T_OCTET_STRING) {
+        value_len = (uint32_t)strlen(varbind->value.s);
+    }
+
+    /* with the length known up front, long values can be flushed as they're written */
+    len = snmp_sizeof_varbind_content(NULL, varbind->oid, oid_len,
+                                      varbind->value_type, &varbind->value, value_len);
+    if (len == 0 || ber_writer_begin_len(w, SNMP_DATA_T_SEQUENCE, len) != 0) {
+        return -1;
+    }
+
+    if (snmp_write_oid(w, varbind->oid, oid_len) != 0) {
+        return -1;
+    }
+
+    switch (varbind->value_type) {
+        case SNMP_DATA_T_INTEGER:
+            rc = ber_writer_int(w, varbind->value.i);
+            break;
+        case SNMP_DATA_T_COUNTER32:
+        case SNMP_DATA_T_GAUGE32:
+        case SNMP_DATA_T_TIMETICKS:
+            rc = ber_writer_uint64(w, varbind->value.i, (uint8_t)varbind->value_type);
+            break;
+        case SNMP_DATA_T_COUNTER64:
+            rc = ber_writer_uint64(w, varbind->value.i64, (uint8_t)varbind->value_type);
+            break;
+        case SNMP_DATA_T_OCTET_STRING:
+            rc = ber_writer_string_len(w, varbind->value.s, value_len);
+            break;
+        case SNMP_DATA_T_NULL:
+            rc = ber_writer_null(w);
+            break;
+        case SNMP_DATA_T_NO_SUCH_OBJECT:
+        case SNMP_DATA_T_NO_SUCH_INSTANCE:
+        case SNMP_DATA_T_END_OF_MIB_VIEW: {
+            uint8_t exception[2] = { (uint8_t)varbind->value_type, 0 };
+
+            rc = ber_writer_raw(w, exception, sizeof(exception));
+            break;
+        }
+        default:
+            return -1;
+    }
+
+    if (rc != 0) {
+        return -1;
+    }
+
+    return ber_writer_end(w);
+}
+
+int
+snmp_write_msg_end(struct ber_writer *w)
+{
+    if (ber_writer_end(w) != 0 || ber_writer_end(w) != 0 || ber_writer_end(w) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Same as snmp_write_msg_begin, but with the lengths written up front,
+ * so that the message doesn't have to fit in the writer's buffer.
+ * *len* is the size of all varbinds.
+ */
+static int
+snmp_write_msg_begin_len(struct ber_writer *w, struct snmp_msg_header *header, uint32_t len)
+{
+    uint32_t community_len = (uint32_t)strlen(header->community);
+    uint32_t pdu_len, msg_len;
+
+    pdu_len = ber_sizeof_int(header->request_id) +
+              ber_sizeof_int(snmp_header_error_status(header)) +
+              ber_sizeof_int(snmp_header_error_index(header)) +
+              1 + ber_sizeof_length(len) + len;
+    msg_len = ber_sizeof_int(header->snmp_ver) + ber_sizeof_string_len(community_len) +
+              1 + ber_sizeof_length(pdu_len) + pdu_len;
+
+    if (ber_writer_begin_len(w, SNMP_DATA_T_SEQUENCE, msg_len) != 0 ||
+        ber_writer_int(w, header->snmp_ver) != 0 ||
+        ber_writer_string_len(w, header->community, community_len) != 0 ||
+        ber_writer_begin_len(w, (uint8_t)header->pdu_type, pdu_len) != 0 ||
+        ber_writer_int(w, header->request_id) != 0 ||
+        ber_writer_int(w, snmp_header_error_status(header)) != 0 ||
+        ber_writer_int(w, snmp_header_error_index(header)) != 0 ||
+        ber_writer_begin_len(w, SNMP_DATA_T_SEQUENCE, len) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+snmp_write_msg(struct ber_writer *w, struct snmp_msg_header *header,
+               uint32_t varbind_num, struct snmp_varbind *varbinds)
+{
+    uint32_t len = snmp_sizeof_varbinds(varbind_num, varbinds);
+    uint32_t i;
+
+    if (len == 0 && varbind_num > 0) {
+        return -1;
+    }
+
+    if (snmp_write_msg_begin_len(w, header, len) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i < varbind_num; ++i) {
+        if (snmp_write_varbind(w, &varbinds[i]) != 0) {
+            return -1;
+        }
+    }
+
+    return snmp_write_msg_end(w);
+}
+
+/** Encode length in 2-byte long form, so that it can be patched in place */
+static uint8_t *
+snmp_tmpl_encode_length(uint8_t *out, uint32_t length)
+{
+    *out-- = (uint8_t)(length & 0xFF);
+    *out-- = (uint8_t)(length >> 8);
+    *out-- = 0x82;
+
+    return out;
+}
+
+/** Add *delta* (which can be negative in two's complement) to 2-byte length */
+static void
+snmp_tmpl_add_length(uint8_t *buf, uint32_t delta)
+{
+    uint32_t length = ((uint32_t)buf[1] << 8 | buf[2]) + delta;
+
+    buf[1] = (uint8_t)(length >> 8);
+    buf[2] = (uint8_t)(length & 0xFF);
+}
+
+static void
+snmp_tmpl_shift(uint32_t *off, uint32_t changed_off, uint32_t delta)
+{
+    if (*off > changed_off) {
+        *off += delta;
+    }
+}
+
+/**
+ * Replace TLV at *off* with *hdr* followed by *data*. If its size changes,
+ * move the rest of the message and fix up all enclosing lengths. *slot* is
+ * the varbind containing the TLV or NULL for PDU header fields.
+ */
+static int
+snmp_tmpl_replace(struct snmp_msg_tmpl *tmpl, uint32_t off, const uint8_t *hdr, uint32_t hdr_len,
+                  const char *data, uint32_t data_len, struct snmp_tmpl_slot *slot)
+{
+    uint8_t *tlv = tmpl->buf + off;
+    uint8_t *content;
+    uint32_t content_len, old_len, new_len, delta, i;
+
+    content = ber_decode_length(tlv + 1, &content_len);
+    old_len = (uint32_t)(content - tlv) + content_len;
+    new_len = hdr_len + data_len;
+    delta = new_len - old_len;
+
+    if (delta != 0) {
+        if (new_len > old_len &&
+            (new_len - old_len > tmpl->size - tmpl->len ||
+             tmpl->len + (new_len - old_len) - 4 > 0xFFFF)) {
+            return -1;
+        }
+
+        memmove(tlv + new_len, tlv + old_len, tmpl->len - off - old_len);
+        tmpl->len += delta;
+
+        snmp_tmpl_add_length(tmpl->buf + tmpl->msg_len_off, delta);
+        snmp_tmpl_add_length(tmpl->buf + tmpl->pdu_len_off, delta);
+        if (slot != NULL) {
+            snmp_tmpl_add_length(tmpl->buf + tmpl->list_len_off, delta);
+            snmp_tmpl_add_length(tmpl->buf + slot->seq_len_off, delta);
+        }
+
+        snmp_tmpl_shift(&tmpl->list_len_off, off, delta);
+        snmp_tmpl_shift(&tmpl->request_id_off, off, delta);
+        snmp_tmpl_shift(&tmpl->error_status_off, off, delta);
+        snmp_tmpl_shift(&tmpl->error_index_off, off, delta);
+        for (i = 0; i < tmpl->varbind_num; ++i) {
+            snmp_tmpl_shift(&tmpl->slots[i].seq_len_off, off, delta);
+            snmp_tmpl_shift(&tmpl->slots[i].value_off, off, delta);
+        }
+    }
+
+    memcpy(tlv, hdr, hdr_len);
+    if (data_len > 0) {
+        memcpy(tlv + hdr_len, data, data_len);
+    }
+
+    return 0;
+}
+
+int
+snmp_tmpl_compile(struct snmp_msg_tmpl *tmpl, uint8_t *buf, uint32_t size,
+                  struct snmp_msg_header *header, uint32_t varbind_num,
+                  struct snmp_varbind *varbinds, struct snmp_tmpl_slot *slots)
+{
+    struct snmp_varbind *varbind;
+    uint8_t *out_end = buf + size - 1;
+    uint8_t *out = out_end;
+    uint8_t *out_prev;
+    uint32_t oid_len, value_len, need, len, i;
+
+    /* until the whole message is encoded, all offsets are
+     * kept as distances from out_end */
+    for (i = varbind_num; i > 0; --i) {
+        varbind = &varbinds[i - 1];
+        out_prev = out;
+
+        oid_len = 0;
+        while (varbind->oid[oid_len] != SNMP_MSG_OID_END) {
+            ++oid_len;
+        }
+
+        value_len = 0;
+        if (varbind->value_type == SNMP_DATA_T_OCTET_STRING) {
+            value_len = (uint32_t)strlen(varbind->value.s);
+        }
+
+        need = value_len + 6 + 4 + oid_len * 5 + 6;
+        if (need > (uint32_t)(out - buf + 1)) {
+            return -1;
+        }
+
+        out = snmp_encode_value(out, varbind->value_type, &varbind->value, value_len);
+        if (out == NULL) {
+            return -1;
+        }
+        slots[i - 1].value_off = (uint32_t)(out_end - out - 1);
+
+        out = snmp_encode_oid_len(out, varbind->oid, oid_len);
+
+        out = snmp_tmpl_encode_length(out, (uint32_t)(out_prev - out));
+        slots[i - 1].seq_len_off = (uint32_t)(out_end - out - 1);
+        *out-- = SNMP_DATA_T_SEQUENCE;
+
+        if (out_end - out > 0xFFFF) {
+            return -1;
+        }
+    }
+
+    need = 4 + 3 * 6 + 4 + (uint32_t)strlen(header->community) + 6 + 6 + 4;
+    if (need > (uint32_t)(out - buf + 1)) {
+        return -1;
+    }
+
+    out = snmp_tmpl_encode_length(out, (uint32_t)(out_end - out));
+    tmpl->list_len_off = (uint32_t)(out_end - out - 1);
+    *out-- = SNMP_DATA_T_SEQUENCE;
+
+    /* writing pdu header */
+    out = ber_encode_int(out, snmp_header_error_index(header));
+    tmpl->error_index_off = (uint32_t)(out_end - out - 1);
+    out = ber_encode_int(out, snmp_header_error_status(header));
+    tmpl->error_status_off = (uint32_t)(out_end - out - 1);
+    out = ber_encode_int(out, header->request_id);
+    tmpl->request_id_off = (uint32_t)(out_end - out - 1);
+
+    out = snmp_tmpl_encode_length(out, (uint32_t)(out_end - out));
+    tmpl->pdu_len_off = (uint32_t)(out_end - out - 1);
+    *out-- = header->pdu_type;
+
+    /* writing the rest of snmp msg data */
+    out = ber_encode_string(out, header->community);
+    out = ber_encode_int(out, header->snmp_ver);
+
+    if (out_end - out > 0xFFFF) {
+        return -1;
+    }
+
+    out = snmp_tmpl_encode_length(out, (uint32_t)(out_end - out));
+    tmpl->msg_len_off = (uint32_t)(out_end - out - 1);
+    *out-- = SNMP_DATA_T_SEQUENCE;
+
+    /* turn distances into offsets from the beginning of the message */
+    len = (uint32_t)(out_end - out);
+    tmpl->msg_len_off = len - 1 - tmpl->msg_len_off;
+    tmpl->pdu_len_off = len - 1 - tmpl->pdu_len_off;
+    tmpl->list_len_off = len - 1 - tmpl->list_len_off;
+    tmpl->request_id_off = len - 1 - tmpl->request_id_off;
+    tmpl->error_status_off = len - 1 - tmpl->error_status_off;
+    tmpl->error_index_off = len - 1 - tmpl->error_index_off;
+    for (i = 0; i < varbind_num; ++i) {
+        slots[i].seq_len_off = len - 1 - slots[i].seq_len_off;
+        slots[i].value_off = len - 1 - slots[i].value_off;
+    }
+
+    memmove(buf, out + 1, len);
+
+    tmpl->buf = buf;
+    tmpl->size = size;
+    tmpl->len = len;
+    tmpl->varbind_num = varbind_num;
+    tmpl->slots = slots;
+
+    return 0;
+}
+
+/** Get the size of the whole TLV at given offset */
+static uint32_t
+snmp_tmpl_tlv_len(struct snmp_msg_tmpl *tmpl, uint32_t off)
+{
+    uint8_t *tlv = tmpl->buf + off;
+    uint8_t *content;
+    uint32_t content_len;
+
+    content = ber_decode_length(tlv + 1, &content_len);
+    return (uint32_t)(content - tlv) + content_len;
+}
+
+int
+snmp_tmpl_set_header(struct snmp_msg_tmpl *tmpl, uint32_t request_id,
+                     uint32_t error_status, uint32_t error_index)
+{
+    uint32_t *offs[3] = { &tmpl->request_id_off, &tmpl->error_status_off, &tmpl->error_index_off };
+    uint32_t nums[3] = { request_id, error_status, error_index };
+    uint8_t hdrs[3][6];
+    uint8_t *hdr_end, *out[3];
+    uint32_t hdr_len[3], old_len[3], len = tmpl->len, grow, i;
+
+    /* check that all fields fit before patching any of them */
+    for (i = 0; i < 3; ++i) {
+        hdr_end = hdrs[i] + sizeof(hdrs[i]) - 1;
+        out[i] = ber_encode_int(hdr_end, nums[i]) + 1;
+        hdr_len[i] = (uint32_t)(hdr_end - out[i]) + 1;
+        old_len[i] = snmp_tmpl_tlv_len(tmpl, *offs[i]);
+        len += hdr_len[i] - old_len[i];
+    }
+
+    if (len > tmpl->size || len - 4 > 0xFFFF) {
+        return -1;
+    }
+
+    /* shrink first, so the message never gets bigger than the final one */
+    for (grow = 0; grow < 2; ++grow) {
+        for (i = 0; i < 3; ++i) {
+            if ((hdr_len[i] > old_len[i]) == grow &&
+                snmp_tmpl_replace(tmpl, *offs[i], out[i], hdr_len[i], NULL, 0, NULL) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int
+snmp_tmpl_set_value(struct snmp_msg_tmpl *tmpl, uint32_t idx, enum snmp_data_type value_type,
+                    const union snmp_varbind_val *value, uint32_t value_len)
+{
+    uint8_t hdr[11]; /* the longest is a 9-byte Counter64 */
+    uint8_t *hdr_end = hdr + sizeof(hdr) - 1;
+    uint8_t *out;
+    const char *data = NULL;
+    uint32_t data_len = 0;
+
+    if (idx >= tmpl->varbind_num) {
+        return -1;
+    }
+
+    switch (value_type) {
+        case SNMP_DATA_T_INTEGER:
+            out = ber_encode_int(hdr_end, value->i);
+            break;
+        case SNMP_DATA_T_OCTET_STRING:
+            /* only the header is encoded, payload is copied in place */
+            out = ber_encode_length(hdr_end, value_len);
+            *out-- = SNMP_DATA_T_OCTET_STRING;
+            data = value->s;
+            data_len = value_len;
+            break;
+        case SNMP_DATA_T_COUNTER32:
+        case SNMP_DATA_T_GAUGE32:
+        case SNMP_DATA_T_TIMETICKS:
+        case SNMP_DATA_T_COUNTER64:
+        case SNMP_DATA_T_NULL:
+        case SNMP_DATA_T_NO_SUCH_OBJECT:
+        case SNMP_DATA_T_NO_SUCH_INSTANCE:
+        case SNMP_DATA_T_END_OF_MIB_VIEW:
+            out = snmp_encode_value(hdr_end, value_type, value, 0);
+            break;
+        default:
+            return -1;
+    }
+
+    return snmp_tmpl_replace(tmpl, tmpl->slots[idx].value_off, out + 1, (uint32_t)(hdr_end - out),
+                             data, data_len, &tmpl->slots[idx]);
+}
+
+/**
+ * Decode SNMP message header, up to the beginning of the first varbind.
+ * If *terminate* is non-zero, the community will be NUL-terminated in place.
+ * Otherwise *buf* is never written. The length of the varbind list is
+ * returned via *remaining_len*.
+ */
+static uint8_t *
+snmp_decode_header(uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                   uint32_t *remaining_len, int terminate)
+{
+    uint8_t *out_start = buf;
+    uint32_t new_remaining_len;
+
+    ++buf; /* ignore ber type, assume it's a sequence */
+    buf = ber_decode_length(buf, remaining_len);
+    if (buf == NULL || *remaining_len + 5 > buf_len - (buf - out_start)) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    /* since remaining len starts counting from that point,
+     * reset out_start here */
+    out_start = buf;
+
+    buf = ber_decode_int(buf, &header->snmp_ver);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(INT);
+    }
+
+    *remaining_len -= buf - out_start;
+    *remaining_len &= -!(*remaining_len & 0x80000000); /* dont underflow */
+    out_start = buf;
+    buf = ber_decode_string_len_buffer(buf, &header->community, &header->community_len);
+    if (buf == NULL || header->community_len > *remaining_len) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    header->pdu_type = (enum snmp_data_type)*buf;
+    if (!snmp_pdu_type_valid(*buf)) {
+        return SNMP_DECODE_FAIL(PDU);
+    }
+
+    if (terminate) {
+        *buf = 0;
+    }
+
+    ++buf;
+    buf = ber_decode_length(buf, &new_remaining_len);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    *remaining_len -= buf - out_start;
+    *remaining_len &= -!(*remaining_len & 0x80000000);
+    out_start = buf;
+
+    if (new_remaining_len != *remaining_len) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    buf = ber_decode_int(buf, &header->request_id);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(INT);
+    }
+
+    buf = ber_decode_int(buf, &header->error_status);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(INT);
+    }
+
+    buf = ber_decode_int(buf, &header->error_index);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(INT);
+    }
+    snmp_header_decode_bulk(header);
+
+    ++buf; /* ignore ber type, assume it's a sequence */
+    buf = ber_decode_length(buf, &new_remaining_len);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    *remaining_len -= buf - out_start;
+    *remaining_len &= -!(*remaining_len & 0x80000000);
+
+    if (new_remaining_len != *remaining_len) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    return buf;
+}
+
+/** Put decoded value of unsigned application type into *value* */
+static int
+snmp_set_uint_value(enum snmp_data_type value_type, uint64_t num, union snmp_varbind_val *value)
+{
+    if (value_type == SNMP_DATA_T_COUNTER64) {
+        value->i64 = num;
+        return 0;
+    }
+
+    if (num > UINT32_MAX) {
+        return -1;
+    }
+
+    value->i = (uint32_t)num;
+    return 0;
+}
+
+/**
+ * Decode a single varbind. *remaining_len* is the number of bytes left in
+ * the varbind list and will be decreased by the size of decoded varbind.
+ * OID is decoded into *oid* array of *oid_len* size, see snmp_decode_oid.
+ * If *terminate* is non-zero, string value will be NUL-terminated in place.
+ * Otherwise *buf* is never written.
+ */
+static uint8_t *
+snmp_decode_varbind(uint8_t *buf, uint32_t *remaining_len, uint32_t *oid, uint32_t *oid_len,
+                    enum snmp_data_type *value_type, union snmp_varbind_val *value,
+                    uint32_t *value_len, int terminate)
+{
+    uint8_t *out_start = buf;
+    uint32_t new_remaining_len;
+    uint64_t num;
+
+    buf++; /* ignore ber type, assume it's a sequence */
+    buf = ber_decode_length(buf, &new_remaining_len);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    *remaining_len -= buf - out_start;
+    *remaining_len &= -!(*remaining_len & 0x80000000);
+    out_start = buf;
+
+    if (new_remaining_len > *remaining_len) {
+        return SNMP_DECODE_FAIL(LENGTH);
+    }
+
+    buf = snmp_decode_oid(buf, new_remaining_len + 5, oid, oid_len);
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(OID);
+    }
+
+    *value_type = (enum snmp_data_type) * buf;
+    *value_len = 0;
+    switch (*value_type) {
+        case SNMP_DATA_T_INTEGER:
+            buf = ber_decode_int(buf, &value->i);
+            if (buf == NULL) {
+                return SNMP_DECODE_FAIL(INT);
+            }
+            break;
+        case SNMP_DATA_T_COUNTER32:
+        case SNMP_DATA_T_GAUGE32:
+        case SNMP_DATA_T_TIMETICKS:
+        case SNMP_DATA_T_COUNTER64:
+            /* this may read past the 5 bytes of slack, so check the length */
+            new_remaining_len -= buf - out_start;
+            new_remaining_len &= -!(new_remaining_len & 0x80000000);
+            if (2u + buf[1] > new_remaining_len) {
+                return SNMP_DECODE_FAIL(LENGTH);
+            }
+
+            buf = ber_decode_uint64(buf, &num);
+            if (buf == NULL) {
+                return SNMP_DECODE_FAIL(INT);
+            }
+
+            if (snmp_set_uint_value(*value_type, num, value) != 0) {
+                return SNMP_DECODE_FAIL(VALUE);
+            }
+            break;
+        case SNMP_DATA_T_OCTET_STRING:
+            new_remaining_len -= buf - out_start;
+            new_remaining_len &= -!(new_remaining_len & 0x80000000);
+            buf = ber_decode_string_len_buffer(buf, &value->s, value_len);
+            if (buf == NULL || *value_len > new_remaining_len) {
+                return SNMP_DECODE_FAIL(LENGTH);
+            }
+
+            if (terminate) {
+                *buf = 0;
+            }
+            break;
+        case SNMP_DATA_T_NULL:
+        case SNMP_DATA_T_NO_SUCH_OBJECT:
+        case SNMP_DATA_T_NO_SUCH_INSTANCE:
+        case SNMP_DATA_T_END_OF_MIB_VIEW:
+            buf = ber_decode_null(buf);
+            break;
+        default:
+            return SNMP_DECODE_FAIL(VALUE);
+    }
+
+    if (buf == NULL) {
+        return SNMP_DECODE_FAIL(VALUE);
+    }
+
+    *remaining_len -= buf - out_start;
+    *remaining_len &= -!(*remaining_len & 0x80000000);
+
+    return buf;
+}
+
+/**
+ * Decode SNMP message. If *terminate* is non-zero, community and string
+ * values will be NUL-terminated in place. Otherwise *buf* is never written.
+ */
+static uint8_t *
+snmp_decode_msg_common(uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                       uint32_t *varbind_num, struct snmp_varbind *varbinds, int terminate)
+{
+#ifdef BER_STATS
+    uint8_t *buf_start = buf;
+#endif
+    uint32_t remaining_len, oid_len, i;
+
+    BER_STATS_CALL(SNMP_DECODE_MSG);
+    buf = snmp_decode_header(buf, buf_len, header, &remaining_len, terminate);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; remaining_len > 0 && i < *varbind_num; ++i) {
+        oid_len = SNMP_MSG_OID_LEN;
+        buf = snmp_decode_varbind(buf, &remaining_len, varbinds[i].oid, &oid_len,
+                                  &varbinds[i].value_type, &varbinds[i].value,
+                                  &varbinds[i].value_len, terminate);
+        if (buf == NULL) {
+            return NULL;
+        }
     }
 
-    out = ber_encode_vlint(out + 1, *(out + 1) + 40 * *oid);
-    out = ber_encode_length(out, (uint32_t)(out_start - out));
-    *out-- = SNMP_DATA_T_OBJECT;
+    *varbind_num = i;
+    BER_STATS_ADD(bytes_decoded, buf - buf_start);
 
-    return out;
+    return buf;
 }
 
 uint8_t *
-snmp_decode_oid(uint8_t *buf, uint32_t buf_len, uint32_t *oid, uint32_t *oid_len)
+snmp_decode_msg(uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                uint32_t *varbind_num, struct snmp_varbind *varbinds)
 {
-    uint32_t *oid_start = oid;
-    uint8_t *buf_end;
-    uint32_t len;
-    div_t first;
+    return snmp_decode_msg_common(buf, buf_len, header, varbind_num, varbinds, 1);
+}
 
-    buf++; /* ignore ber type, assume it's an object */
-    buf = ber_decode_length(buf, &len);
-    if (buf == NULL || len + 2 + 5 /* 5 bytes of vlint */ > buf_len) {
-        return NULL;
-    }
+const uint8_t *
+snmp_decode_msg_slice(const uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                      uint32_t *varbind_num, struct snmp_varbind *varbinds)
+{
+    /* BER primitives take non-const buffers, but none of the ones used
+     * by snmp_decode_msg_common write to it unless *terminate* is set */
+    return snmp_decode_msg_common((uint8_t *)(uintptr_t)buf, buf_len, header,
+                                  varbind_num, varbinds, 0);
+}
 
-    buf_end = buf + len;
+/**
+ * Same as ber_decode_header, but inlined into the validator. *end* is the
+ * end of the enclosing object.
+ */
+static inline const uint8_t *
+snmp_validate_header(const uint8_t *buf, const uint8_t *end, uint8_t type, uint32_t *len)
+{
+    uint32_t i, len_bytes;
 
-    first = div(*buf++, 40);
-    *oid++ = (uint32_t)first.quot;
-    *oid++ = (uint32_t)first.rem;
-    *oid_len -= 2;
+    if (end - buf < 2 || *buf != type) {
+        return NULL;
+    }
 
-    while (buf < buf_end) {
-        --(*oid_len);
-        if (*oid_len == 0) {
+    *len = buf[1];
+    buf += 2;
+    if (*len & 0x80) {
+        len_bytes = *len & 0x7F;
+        if (len_bytes == 0 || len_bytes > 4 || (uint32_t)(end - buf) < len_bytes) {
             return NULL;
         }
 
-        buf = ber_decode_vlint(buf, oid);
-        if (buf == NULL) {
-            return NULL;
+        *len = 0;
+        for (i = 0; i < len_bytes; ++i) {
+            *len = *len << 8 | *buf++;
         }
-
-        ++oid;
     }
 
-    *oid++ = SNMP_MSG_OID_END;
-    *oid_len = (uint32_t)(oid - oid_start);
+    if ((uint32_t)(end - buf) < *len) {
+        return NULL;
+    }
 
     return buf;
 }
 
-uint8_t *
-snmp_encode_msg(uint8_t *out, struct snmp_msg_header *header,
-                uint32_t varbind_num, struct snmp_varbind *varbinds)
+/** Check INTEGER that ber_decode_int can decode, return its end */
+static inline const uint8_t *
+snmp_validate_int(const uint8_t *buf, const uint8_t *end)
 {
-    struct snmp_varbind *varbind;
-    uint8_t *out_end = out;
-    uint8_t *out_prev;
-    int i;
-
-    /* writing varbinds */
-    for (i = varbind_num - 1; i >= 0; --i) {
-        varbind = &varbinds[i];
-        out_prev = out;
-
-        switch (varbind->value_type) {
-            case SNMP_DATA_T_INTEGER:
-                out = ber_encode_int(out, varbind->value.i);
-                break;
-            case SNMP_DATA_T_OCTET_STRING:
-                out = ber_encode_string(out, varbind->value.s);
-                break;
-            case SNMP_DATA_T_NULL:
-                out = ber_encode_null(out);
-                break;
-            default:
-                return NULL;
-        }
+    uint32_t len;
 
-        out = snmp_encode_oid(out, varbind->oid);
-        out = ber_encode_length(out, (uint32_t)(out_prev - out));
-        *out-- = SNMP_DATA_T_SEQUENCE;
+    buf = snmp_validate_header(buf, end, SNMP_DATA_T_INTEGER, &len);
+    if (buf == NULL || len - 1 > 3) {
+        return NULL;
     }
 
-    out = ber_encode_length(out, (uint32_t)(out_end - out));
-    *out-- = SNMP_DATA_T_SEQUENCE;
-
-    /* writing pdu header */
-    out = ber_encode_int(out, header->error_index);
-    out = ber_encode_int(out, header->error_status);
-    out = ber_encode_int(out, header->request_id);
+    return buf + len;
+}
 
-    out = ber_encode_length(out, (uint32_t)(out_end - out));
-    *out-- = header->pdu_type;
+/** Gather continuation bits of 8 bytes in *word* into bits of the result */
+static inline uint32_t
+snmp_validate_cont_mask(uint64_t word)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return (uint32_t)(((word & 0x8080808080808080ULL) * 0x0002040810204081ULL) >> 56);
+}
 
-    /* writing the rest of snmp msg data */
-    out = ber_encode_string(out, header->community);
-    out = ber_encode_int(out, header->snmp_ver);
+/** Check that 5-byte arcs between *buf* and *end* don't overflow 32 bits */
+static const uint8_t *
+snmp_validate_oid_long_arcs(const uint8_t *buf, const uint8_t *end)
+{
+    const uint8_t *arc;
 
-    out = ber_encode_length(out, (uint32_t)(out_end - out));
-    *out = SNMP_DATA_T_SEQUENCE;
+    while (buf < end) {
+        arc = buf;
+        while (*buf++ & 0x80) {
+        }
+        if (buf - arc == 5 && *arc & 0x70) {
+            return NULL;
+        }
+    }
 
-    return out;
+    return end;
 }
 
-uint8_t *
-snmp_decode_msg(uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
-                uint32_t *varbind_num, struct snmp_varbind *varbinds)
+/** Check OID that fits in SNMP_MSG_OID_LEN arcs, return its end */
+static inline const uint8_t *
+snmp_validate_oid(const uint8_t *buf, const uint8_t *end)
 {
-    uint8_t *out_start = buf;
-    uint32_t remaining_len, new_remaining_len, oid_len = SNMP_MSG_OID_LEN, i;
-    uint8_t next;
+    const uint8_t *oid_start, *oid_end;
+    uint64_t word;
+    uint32_t len, arcs = 2, mask, prev = 0, runs, run4, long_arcs = 0, too_long = 0, n, i;
 
-    ++buf; /* ignore ber type, assume it's a sequence */
-    buf = ber_decode_length(buf, &remaining_len);
-    if (buf == NULL || remaining_len + 5 > buf_len - (buf - out_start)) {
+    buf = snmp_validate_header(buf, end, SNMP_DATA_T_OBJECT, &len);
+    if (buf == NULL || len == 0) {
         return NULL;
     }
 
-    /* since remaining len starts counting from that point,
-     * reset out_start here */
-    out_start = buf;
+    /* the first byte holds first two arcs, check the rest 8 bytes at a
+     * time: there can't be 5 continuation bits in a row (vlint longer
+     * than 5 bytes) and each byte without continuation bit ends an arc.
+     * 5-byte arcs are rare, so they're checked for overflow separately */
+    oid_start = buf + 1;
+    oid_end = buf + len;
+    for (++buf; buf < oid_end; buf += 8) {
+        n = oid_end - buf < 8 ? (uint32_t)(oid_end - buf) : 8;
+        if (end - buf >= 8) {
+            /* bytes past the OID are still within the varbind */
+            memcpy(&word, buf, sizeof(word));
+            mask = snmp_validate_cont_mask(word) & ((1U << n) - 1);
+        } else if (len > 8) {
+            /* re-read some already checked bytes instead */
+            memcpy(&word, oid_end - 8, sizeof(word));
+            mask = snmp_validate_cont_mask(word) >> (8 - n);
+        } else {
+            mask = 0;
+            for (i = 0; i < n; ++i) {
+                mask |= (uint32_t)(buf[i] >> 7) << i;
+            }
+        }
 
-    buf = ber_decode_int(buf, &header->snmp_ver);
-    if (buf == NULL) {
-        return NULL;
+        runs = prev | mask << 8;
+        run4 = runs & runs >> 1 & runs >> 2 & runs >> 3;
+        too_long |= run4 & runs >> 4;
+        long_arcs |= run4;
+        prev = mask;
+        /* arcs can't overflow SNMP_MSG_OID_LEN in short OIDs, don't count them */
+        if (len > SNMP_MSG_OID_LEN - 2) {
+            arcs += n - (uint32_t)__builtin_popcount(mask);
+        }
     }
 
-    remaining_len -= buf - out_start;
-    remaining_len &= -!(remaining_len & 0x80000000); /* dont underflow */
-    out_start = buf;
-    buf = ber_decode_string_buffer(buf, &header->community, remaining_len, &next);
-    if (buf == NULL) {
+    /* leave space for SNMP_MSG_OID_END */
+    if (too_long || (oid_end[-1] & 0x80 && len > 1) || arcs > SNMP_MSG_OID_LEN - 1) {
         return NULL;
     }
 
-    header->pdu_type = (enum snmp_data_type)next;
-    if (header->pdu_type != SNMP_DATA_T_PDU_GET_REQUEST &&
-        header->pdu_type != SNMP_DATA_T_PDU_GET_NEXT_REQUEST &&
-        header->pdu_type != SNMP_DATA_T_PDU_GET_RESPONSE &&
-        header->pdu_type != SNMP_DATA_T_PDU_SET_REQUEST) {
+    if (long_arcs) {
+        return snmp_validate_oid_long_arcs(oid_start, oid_end);
+    }
+
+    return oid_end;
+}
+
+/** Check varbind value, return its end */
+static inline const uint8_t *
+snmp_validate_value(const uint8_t *buf, const uint8_t *end)
+{
+    const uint8_t *value;
+    uint32_t len, i;
+
+    if (buf == end) {
         return NULL;
     }
 
-    ++buf;
-    buf = ber_decode_length(buf, &new_remaining_len);
-    if (buf == NULL) {
+    value = snmp_validate_header(buf, end, *buf, &len);
+    if (value == NULL) {
         return NULL;
     }
 
-    remaining_len -= buf - out_start;
-    remaining_len &= -!(remaining_len & 0x80000000);
-    out_start = buf;
+    switch (*buf) {
+        case SNMP_DATA_T_INTEGER:
+            if (len - 1 > 3) {
+                return NULL;
+            }
+            break;
+        case SNMP_DATA_T_COUNTER32:
+        case SNMP_DATA_T_GAUGE32:
+        case SNMP_DATA_T_TIMETICKS:
+            /* has to fit in 32 bits, but may have leading zeros */
+            for (i = 0; i + 4 < len; ++i) {
+                if (value[i] != 0) {
+                    return NULL;
+                }
+            }
+            /* fall through */
+        case SNMP_DATA_T_COUNTER64:
+            if (len - 1 > 8 || (len == 9 && value[0] != 0)) {
+                return NULL;
+            }
+            break;
+        case SNMP_DATA_T_OCTET_STRING:
+            break;
+        case SNMP_DATA_T_NULL:
+        case SNMP_DATA_T_NO_SUCH_OBJECT:
+        case SNMP_DATA_T_NO_SUCH_INSTANCE:
+        case SNMP_DATA_T_END_OF_MIB_VIEW:
+            if (len != 0) {
+                return NULL;
+            }
+            break;
+        default:
+            return NULL;
+    }
+
+    return value + len;
+}
+
+const uint8_t *
+snmp_validate_msg(const uint8_t *buf, uint32_t buf_len, uint32_t *varbind_num)
+{
+    const uint8_t *msg_end, *varbind_end;
+    uint32_t len, num = 0;
 
-    if (new_remaining_len != remaining_len) {
+    BER_STATS_CALL(SNMP_VALIDATE_MSG);
+    buf = snmp_validate_header(buf, buf + buf_len, SNMP_DATA_T_SEQUENCE, &len);
+    if (buf == NULL) {
         return NULL;
     }
+    msg_end = buf + len;
 
-    buf = ber_decode_int(buf, &header->request_id);
+    buf = snmp_validate_int(buf, msg_end);
     if (buf == NULL) {
         return NULL;
     }
 
-    buf = ber_decode_int(buf, &header->error_status);
+    buf = snmp_validate_header(buf, msg_end, SNMP_DATA_T_OCTET_STRING, &len);
     if (buf == NULL) {
         return NULL;
     }
+    buf += len;
 
-    buf = ber_decode_int(buf, &header->error_index);
-    if (buf == NULL) {
+    /* PDU spans the rest of the message */
+    if (buf == msg_end || !snmp_pdu_type_valid(*buf)) {
+        return NULL;
+    }
+    buf = snmp_validate_header(buf, msg_end, *buf, &len);
+    if (buf == NULL || buf + len != msg_end) {
         return NULL;
     }
 
-    ++buf; /* ignore ber type, assume it's a sequence */
-    buf = ber_decode_length(buf, &new_remaining_len);
+    buf = snmp_validate_int(buf, msg_end);
+    if (buf != NULL) {
+        buf = snmp_validate_int(buf, msg_end);
+    }
+    if (buf != NULL) {
+        buf = snmp_validate_int(buf, msg_end);
+    }
     if (buf == NULL) {
         return NULL;
     }
 
-    remaining_len -= buf - out_start;
-    remaining_len &= -!(remaining_len & 0x80000000);
-    out_start = buf;
-
-    if (new_remaining_len != remaining_len) {
+    /* and so does the varbind list */
+    buf = snmp_validate_header(buf, msg_end, SNMP_DATA_T_SEQUENCE, &len);
+    if (buf == NULL || buf + len != msg_end) {
         return NULL;
     }
 
-    for (i = 0; remaining_len > 0 && i < *varbind_num; ++i) {
-        buf++; /* ignore ber type, assume it's a sequence */
-        buf = ber_decode_length(buf, &new_remaining_len);
+    while (buf < msg_end) {
+        buf = snmp_validate_header(buf, msg_end, SNMP_DATA_T_SEQUENCE, &len);
         if (buf == NULL) {
             return NULL;
         }
+        varbind_end = buf + len;
 
-        remaining_len -= buf - out_start;
-        remaining_len &= -!(remaining_len & 0x80000000);
-        out_start = buf;
-
-        if (new_remaining_len > remaining_len) {
+        buf = snmp_validate_oid(buf, varbind_end);
+        if (buf == NULL) {
             return NULL;
         }
 
-        buf = snmp_decode_oid(buf, new_remaining_len + 5, varbinds[i].oid, &oid_len);
-        if (buf == NULL) {
+        buf = snmp_validate_value(buf, varbind_end);
+        if (buf != varbind_end) {
             return NULL;
         }
 
-        varbinds[i].value_type = (enum snmp_data_type) * buf;
-        switch (varbinds[i].value_type) {
+        ++num;
+    }
+
+    *varbind_num = num;
+    return msg_end;
+}
+
+/** Skip type and decode length of validated object, return its value */
+static inline const uint8_t *
+snmp_unchecked_header(const uint8_t *buf, uint32_t *len)
+{
+    uint32_t len_bytes;
+
+    *len = buf[1];
+    buf += 2;
+    if (*len & 0x80) {
+        len_bytes = *len & 0x7F;
+        *len = 0;
+        while (len_bytes--) {
+            *len = *len << 8 | *buf++;
+        }
+    }
+
+    return buf;
+}
+
+/** Decode validated unsigned integer of any application type */
+static inline const uint8_t *
+snmp_unchecked_uint(const uint8_t *buf, uint64_t *num)
+{
+    uint32_t len;
+
+    buf = snmp_unchecked_header(buf, &len);
+    *num = 0;
+    while (len--) {
+        *num = *num << 8 | *buf++;
+    }
+
+    return buf;
+}
+
+static inline const uint8_t *
+snmp_unchecked_int(const uint8_t *buf, uint32_t *num)
+{
+    uint64_t num64;
+
+    buf = snmp_unchecked_uint(buf, &num64);
+    *num = (uint32_t)num64;
+
+    return buf;
+}
+
+const uint8_t *
+snmp_decode_msg_unchecked(const uint8_t *buf, struct snmp_msg_header *header,
+                          uint32_t *varbind_num, struct snmp_varbind *varbinds)
+{
+    struct snmp_varbind *varbind;
+    const uint8_t *list_end, *oid_end;
+#ifdef BER_STATS
+    const uint8_t *buf_start = buf;
+#endif
+    uint32_t len, arc, arcs, i;
+    uint64_t num;
+
+    BER_STATS_CALL(SNMP_DECODE_MSG_UNCHECKED);
+    buf = snmp_unchecked_header(buf, &len);
+    buf = snmp_unchecked_int(buf, &header->snmp_ver);
+    buf = snmp_unchecked_header(buf, &header->community_len);
+    header->community = (const char *)buf;
+    buf += header->community_len;
+    header->pdu_type = (enum snmp_data_type)*buf;
+    buf = snmp_unchecked_header(buf, &len);
+    buf = snmp_unchecked_int(buf, &header->request_id);
+    buf = snmp_unchecked_int(buf, &header->error_status);
+    buf = snmp_unchecked_int(buf, &header->error_index);
+    snmp_header_decode_bulk(header);
+
+    buf = snmp_unchecked_header(buf, &len);
+    list_end = buf + len;
+
+    for (i = 0; buf < list_end && i < *varbind_num; ++i) {
+        varbind = &varbinds[i];
+        buf = snmp_unchecked_header(buf, &len);
+        buf = snmp_unchecked_header(buf, &len);
+        oid_end = buf + len;
+
+        varbind->oid[0] = *buf / 40;
+        varbind->oid[1] = *buf % 40;
+        for (++buf, arcs = 2; buf < oid_end; ++arcs) {
+            arc = *buf++;
+            if (arc & 0x80) {
+                arc &= 0x7F;
+                do {
+                    arc = arc << 7 | (*buf & 0x7F);
+                } while (*buf++ & 0x80);
+            }
+            varbind->oid[arcs] = arc;
+        }
+        varbind->oid[arcs] = SNMP_MSG_OID_END;
+
+        varbind->value_type = (enum snmp_data_type)*buf;
+        varbind->value_len = 0;
+        switch (varbind->value_type) {
             case SNMP_DATA_T_INTEGER:
-                buf = ber_decode_int(buf, &varbinds[i].value.i);
+                buf = snmp_unchecked_int(buf, &varbind->value.i);
                 break;
-            case SNMP_DATA_T_OCTET_STRING:
-                new_remaining_len -= buf - out_start;
-                new_remaining_len &= -!(new_remaining_len & 0x80000000);
-                buf = ber_decode_string_buffer(buf, &varbinds[i].value.s, new_remaining_len, &next);
+            case SNMP_DATA_T_COUNTER32:
+            case SNMP_DATA_T_GAUGE32:
+            case SNMP_DATA_T_TIMETICKS:
+            case SNMP_DATA_T_COUNTER64:
+                buf = snmp_unchecked_uint(buf, &num);
+                (void)snmp_set_uint_value(varbind->value_type, num, &varbind->value);
                 break;
-            case SNMP_DATA_T_NULL:
-                buf = ber_decode_null(buf);
+            case SNMP_DATA_T_OCTET_STRING:
+                buf = snmp_unchecked_header(buf, &varbind->value_len);
+                varbind->value.s = (const char *)buf;
+                buf += varbind->value_len;
                 break;
             default:
-                return NULL;
+                /* empty, but the length may still be in the long form */
+                buf = snmp_unchecked_header(buf, &len);
+                buf += len;
+                break;
         }
+    }
 
-        if (buf == NULL) {
+    *varbind_num = i;
+    BER_STATS_ADD(bytes_decoded, buf - buf_start);
+    return buf;
+}
+
+const uint8_t *
+snmp_decode_msg_compact(const uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                        struct ber_arena *arena, uint32_t *varbind_num,
+                        struct snmp_varbind_compact *varbinds)
+{
+    uint8_t *out = (uint8_t *)(uintptr_t)buf;
+    uint32_t remaining_len, oid_len, i;
+    uint32_t *oid;
+
+    BER_STATS_CALL(SNMP_DECODE_MSG);
+    out = snmp_decode_header(out, buf_len, header, &remaining_len, 0);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; remaining_len > 0 && i < *varbind_num; ++i) {
+        /* decode straight into the free part of the arena */
+        oid = ber_arena_alloc(arena, 0);
+        if (oid == NULL) {
+            return NULL;
+        }
+
+        oid_len = (arena->size - arena->used) / sizeof(uint32_t);
+        out = snmp_decode_varbind(out, &remaining_len, oid, &oid_len,
+                                  &varbinds[i].value_type, &varbinds[i].value,
+                                  &varbinds[i].value_len, 0);
+        if (out == NULL) {
             return NULL;
         }
 
-        remaining_len -= buf - out_start;
-        remaining_len &= -!(remaining_len & 0x80000000);
-        out_start = buf;
+        varbinds[i].oid_enc = NULL;
+
+        /* commit all arcs but SNMP_MSG_OID_END */
+        varbinds[i].oid_len = oid_len - 1;
+        varbinds[i].oid_off = (uint32_t)((uint8_t *)oid - arena->buf);
+        (void)ber_arena_alloc(arena, varbinds[i].oid_len * sizeof(uint32_t));
     }
 
     *varbind_num = i;
+    BER_STATS_ADD(bytes_decoded, out - buf);
 
-    return buf;
+    return out;
+}
+
+int
+snmp_varbind_compact_set_oid(struct ber_arena *arena, struct snmp_varbind_compact *varbind,
+                             const uint32_t *oid, uint32_t oid_len)
+{
+    uint32_t *arcs;
+
+    arcs = ber_arena_alloc(arena, oid_len * sizeof(uint32_t));
+    if (arcs == NULL) {
+        return -1;
+    }
+
+    memcpy(arcs, oid, oid_len * sizeof(uint32_t));
+    varbind->oid_off = (uint32_t)((uint8_t *)arcs - arena->buf);
+    varbind->oid_len = oid_len;
+
+    return 0;
+}
+
+uint32_t *
+snmp_varbind_compact_oid(const struct ber_arena *arena, const struct snmp_varbind_compact *varbind)
+{
+    return (uint32_t *)(void *)(arena->buf + varbind->oid_off);
+}
+
+const uint8_t *
+snmp_decode_msg_header(const uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                       struct snmp_varbind_iter *iter)
+{
+    uint8_t *out;
+
+    out = snmp_decode_header((uint8_t *)(uintptr_t)buf, buf_len, header, &iter->remaining_len, 0);
+    iter->buf = out;
+
+    return out;
+}
+
+int
+snmp_varbind_iter_next(struct snmp_varbind_iter *iter, struct snmp_varbind *varbind)
+{
+    uint32_t oid_len = SNMP_MSG_OID_LEN;
+    uint8_t *out;
+
+    if (iter->remaining_len == 0) {
+        return 0;
+    }
+
+    out = snmp_decode_varbind((uint8_t *)(uintptr_t)iter->buf, &iter->remaining_len,
+                              varbind->oid, &oid_len, &varbind->value_type, &varbind->value,
+                              &varbind->value_len, 0);
+    if (out == NULL) {
+        return -1;
+    }
+
+    iter->buf = out;
+
+    return 1;
+}
+
+int
+snmp_varbind_iter_skip(struct snmp_varbind_iter *iter)
+{
+    const uint8_t *out_start = iter->buf;
+    const uint8_t *buf;
+    uint32_t len;
+
+    if (iter->remaining_len == 0) {
+        return 0;
+    }
+
+    buf = ber_decode_length((uint8_t *)(uintptr_t)iter->buf + 1, &len);
+    if (buf == NULL || (uint32_t)(buf - out_start) > iter->remaining_len ||
+        len > iter->remaining_len - (uint32_t)(buf - out_start)) {
+        return -1;
+    }
+
+    iter->buf = buf + len;
+    iter->remaining_len -= (uint32_t)(iter->buf - out_start);
+
+    return 1;
+}
+
+/** Number of messages decoded in lockstep by snmp_decode_msg_batch */
+#define SNMP_MSG_BATCH_GROUP 8
+
+#ifdef __GNUC__
+#define SNMP_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define SNMP_PREFETCH(addr) (void)(addr)
+#endif
+
+uint32_t
+snmp_decode_msg_batch(struct snmp_msg_batch *msgs, uint32_t msg_num)
+{
+    struct snmp_varbind_iter iters[SNMP_MSG_BATCH_GROUP];
+    uint32_t varbind_max[SNMP_MSG_BATCH_GROUP];
+    struct snmp_msg_batch *msg;
+    uint32_t base, group, i, active, decoded = 0;
+    int rc;
+
+    for (base = 0; base < msg_num; base += group) {
+        group = msg_num - base < SNMP_MSG_BATCH_GROUP ? msg_num - base : SNMP_MSG_BATCH_GROUP;
+
+        for (i = 0; i < group; ++i) {
+            msg = &msgs[base + i];
+            if (base + group + i < msg_num) {
+                SNMP_PREFETCH(msgs[base + group + i].buf);
+            }
+
+            varbind_max[i] = msg->varbind_num;
+            msg->varbind_num = 0;
+            msg->status = snmp_decode_msg_header(msg->buf, msg->buf_len, &msg->header, &iters[i]) ? 0 : -1;
+        }
+
+        do {
+            active = 0;
+            for (i = 0; i < group; ++i) {
+                msg = &msgs[base + i];
+                if (msg->status != 0 || msg->varbind_num == varbind_max[i]) {
+                    continue;
+                }
+
+                rc = snmp_varbind_iter_next(&iters[i], &msg->varbinds[msg->varbind_num]);
+                if (rc == 1) {
+                    ++msg->varbind_num;
+                    ++active;
+                } else if (rc == 0) {
+                    varbind_max[i] = msg->varbind_num;
+                } else {
+                    msg->status = -1;
+                }
+            }
+        } while (active > 0);
+
+        for (i = 0; i < group; ++i) {
+            decoded += msgs[base + i].status == 0;
+        }
+    }
+
+    return decoded;
+}
+
+enum snmp_stream_field {
+    SNMP_STREAM_F_MSG = 0,
+    SNMP_STREAM_F_VERSION,
+    SNMP_STREAM_F_COMMUNITY,
+    SNMP_STREAM_F_PDU,
+    SNMP_STREAM_F_REQUEST_ID,
+    SNMP_STREAM_F_ERROR_STATUS,
+    SNMP_STREAM_F_ERROR_INDEX,
+    SNMP_STREAM_F_VARBIND_LIST,
+    SNMP_STREAM_F_VARBIND,
+    SNMP_STREAM_F_OID,
+    SNMP_STREAM_F_VALUE,
+    SNMP_STREAM_F_END,
+    SNMP_STREAM_F_ERROR,
+};
+
+/** Nesting depth of every field, indexed by enum snmp_stream_field */
+static const uint8_t snmp_stream_field_depth[] = { 0, 1, 1, 1, 2, 2, 2, 2, 3, 4, 4 };
+
+void
+snmp_stream_init(struct snmp_stream *s)
+{
+    ber_stream_init(&s->ber);
+    s->field = SNMP_STREAM_F_MSG;
+}
+
+int
+snmp_stream_feed(struct snmp_stream *s, const uint8_t *data, uint32_t len, uint32_t *consumed,
+                 struct snmp_msg_header *header, struct snmp_varbind *varbind)
+{
+    struct ber_stream_token tok;
+    uint32_t used, oid_len, total = 0;
+    uint64_t num;
+    int rc;
+
+    *consumed = 0;
+    if (s->field == SNMP_STREAM_F_ERROR) {
+        return SNMP_STREAM_ERROR;
+    }
+
+    if (s->field == SNMP_STREAM_F_END) {
+        /* the message was completed by the previous token */
+        s->field = SNMP_STREAM_F_MSG;
+        return SNMP_STREAM_END;
+    }
+
+    for (;;) {
+        rc = ber_stream_feed(&s->ber, data + total, len - total, &used, &tok);
+        total += used;
+        *consumed = total;
+        if (rc == BER_STREAM_NEED_MORE) {
+            return SNMP_STREAM_NEED_MORE;
+        } else if (rc != BER_STREAM_TOKEN || tok.depth != snmp_stream_field_depth[s->field]) {
+            goto error;
+        }
+
+        switch (s->field) {
+            case SNMP_STREAM_F_MSG:
+            case SNMP_STREAM_F_VARBIND:
+                if (tok.type != SNMP_DATA_T_SEQUENCE) {
+                    goto error;
+                }
+                break;
+            case SNMP_STREAM_F_VERSION:
+                if (tok.type != SNMP_DATA_T_INTEGER ||
+                    ber_stream_token_int(&tok, &header->snmp_ver) != 0) {
+                    goto error;
+                }
+                break;
+            case SNMP_STREAM_F_COMMUNITY:
+                if (tok.type != SNMP_DATA_T_OCTET_STRING || tok.len > BER_STREAM_VALUE_MAX) {
+                    goto error;
+                }
+                memcpy(s->community, tok.value, tok.len);
+                s->community[tok.len] = 0;
+                header->community = s->community;
+                header->community_len = tok.len;
+                break;
+            case SNMP_STREAM_F_PDU:
+                if (!snmp_pdu_type_valid(tok.type)) {
+                    goto error;
+                }
+                header->pdu_type = (enum snmp_data_type)tok.type;
+                break;
+            case SNMP_STREAM_F_REQUEST_ID:
+            case SNMP_STREAM_F_ERROR_STATUS:
+            case SNMP_STREAM_F_ERROR_INDEX:
+                if (tok.type != SNMP_DATA_T_INTEGER ||
+                    ber_stream_token_int(&tok, s->field == SNMP_STREAM_F_REQUEST_ID ? &header->request_id :
+                                               s->field == SNMP_STREAM_F_ERROR_STATUS ? &header->error_status :
+                                               &header->error_index) != 0) {
+                    goto error;
+                }
+                if (s->field == SNMP_STREAM_F_ERROR_INDEX) {
+                    snmp_header_decode_bulk(header);
+                }
+                break;
+            case SNMP_STREAM_F_VARBIND_LIST:
+                if (tok.type != SNMP_DATA_T_SEQUENCE) {
+                    goto error;
+                }
+                s->field = s->ber.depth == 0 ? SNMP_STREAM_F_END : SNMP_STREAM_F_VARBIND;
+                return SNMP_STREAM_HEADER;
+            case SNMP_STREAM_F_OID:
+                oid_len = SNMP_MSG_OID_LEN;
+                if (tok.type != SNMP_DATA_T_OBJECT || tok.len == 0 || tok.value_len != tok.len ||
+                    snmp_decode_oid_value((uint8_t *)(uintptr_t)tok.value, tok.len,
+                                          varbind->oid, &oid_len) == NULL) {
+                    goto error;
+                }
+                break;
+            case SNMP_STREAM_F_VALUE:
+                varbind->value_type = (enum snmp_data_type)tok.type;
+                varbind->value_len = 0;
+                switch (tok.type) {
+                    case SNMP_DATA_T_INTEGER:
+                        if (ber_stream_token_int(&tok, &varbind->value.i) != 0) {
+                            goto error;
+                        }
+                        break;
+                    case SNMP_DATA_T_COUNTER32:
+                    case SNMP_DATA_T_GAUGE32:
+                    case SNMP_DATA_T_TIMETICKS:
+                    case SNMP_DATA_T_COUNTER64:
+                        if (ber_stream_token_uint64(&tok, &num) != 0 ||
+                            snmp_set_uint_value(varbind->value_type, num, &varbind->value) != 0) {
+                            goto error;
+                        }
+                        break;
+                    case SNMP_DATA_T_OCTET_STRING:
+                        varbind->value.s = (const char *)tok.value;
+                        varbind->value_len = tok.value_len;
+                        if (tok.value_off + tok.value_len < tok.len) {
+                            return SNMP_STREAM_VALUE_PART;
+                        }
+                        break;
+                    case SNMP_DATA_T_NULL:
+                    case SNMP_DATA_T_NO_SUCH_OBJECT:
+                    case SNMP_DATA_T_NO_SUCH_INSTANCE:
+                    case SNMP_DATA_T_END_OF_MIB_VIEW:
+                        if (tok.len != 0) {
+                            goto error;
+                        }
+                        break;
+                    default:
+                        goto error;
+                }
+
+                /* the varbind has to end here */
+                if (s->ber.depth > 3) {
+                    goto error;
+                }
+                s->field = s->ber.depth == 0 ? SNMP_STREAM_F_END : SNMP_STREAM_F_VARBIND;
+                return SNMP_STREAM_VARBIND;
+            default:
+                goto error;
+        }
+
+        ++s->field;
+    }
+
+error:
+    s->field = SNMP_STREAM_F_ERROR;
+    return SNMP_STREAM_ERROR;
 }
@@ -8,9 +8,14 @@
 #define BER_SNMP_H
 
 #include <stdint.h>
+#include "ber.h"
 
 #define SNMP_MSG_OID_END ((uint32_t)-1)
 #define SNMP_MSG_OID_LEN 32
+/** Strings shorter than that are copied by snmp_encode_msg_iov anyway */
+#define SNMP_MSG_IOV_MIN_LEN 64
+
+struct iovec;
 
 /** BER data types used by this SNMP library */
 enum snmp_data_type {
@@ -21,21 +26,49 @@ enum snmp_data_type {
     SNMP_DATA_T_OBJECT = 0x06,
     SNMP_DATA_T_SEQUENCE = 0x30,
 
+    /** SNMP application types. All are unsigned, Counter64 uses value.i64 */
+    SNMP_DATA_T_COUNTER32 = 0x41,
+    SNMP_DATA_T_GAUGE32 = 0x42,
+    SNMP_DATA_T_TIMETICKS = 0x43,
+    SNMP_DATA_T_COUNTER64 = 0x46,
+
     SNMP_DATA_T_PDU_GET_REQUEST = 0xA0,
     SNMP_DATA_T_PDU_GET_NEXT_REQUEST = 0xA1,
     SNMP_DATA_T_PDU_GET_RESPONSE = 0xA2,
     SNMP_DATA_T_PDU_SET_REQUEST = 0xA3,
     SNMP_DATA_T_PDU_TRAP = 0xA4,
+    SNMP_DATA_T_PDU_GET_BULK_REQUEST = 0xA5,
+
+    /** SNMPv2 exceptions, encoded with no value just like NULL */
+    SNMP_DATA_T_NO_SUCH_OBJECT = 0x80,
+    SNMP_DATA_T_NO_SUCH_INSTANCE = 0x81,
+    SNMP_DATA_T_END_OF_MIB_VIEW = 0x82,
+};
+
+/**
+ * OID pre-encoded as BER object, see snmp_oid_preencode.
+ * Its content should be treated as opaque.
+ */
+struct snmp_oid_enc {
+    uint32_t len;
+    uint8_t data[SNMP_MSG_OID_LEN * 5 + 6];
 };
 
 /** Header data for SNMP message */
 struct snmp_msg_header {
     uint32_t snmp_ver;
     const char *community;
+    uint32_t community_len; /**< set by decoders only */
     enum snmp_data_type pdu_type;
     uint32_t request_id;
     uint32_t error_status;
     uint32_t error_index;
+    /**
+     * GetBulk fields, encoded in place of error_status and error_index
+     * when pdu_type is SNMP_DATA_T_PDU_GET_BULK_REQUEST
+     */
+    uint32_t non_repeaters;
+    uint32_t max_repetitions;
 };
 
 /** Actual data in SNMP message */
@@ -44,10 +77,85 @@ struct snmp_varbind {
     enum snmp_data_type value_type;
     union snmp_varbind_val {
         uint32_t i;
+        uint64_t i64;
         const char *s;
     } value;
+    uint32_t value_len; /**< length of value.s, set by decoders only */
+};
+
+/**
+ * Compact varbind. OID arcs are not stored inline, but in a struct ber_arena
+ * shared by all varbinds of a message, so the OID length is not limited
+ * by SNMP_MSG_OID_LEN.
+ */
+struct snmp_varbind_compact {
+    uint32_t oid_off; /**< byte offset of the first arc in the arena */
+    uint32_t oid_len; /**< number of arcs, without SNMP_MSG_OID_END */
+    enum snmp_data_type value_type;
+    uint32_t value_len; /**< length of value.s, used by encoders as well */
+    union snmp_varbind_val value;
+    /** if not NULL, encoders will copy it instead of encoding the arena OID */
+    const struct snmp_oid_enc *oid_enc;
+};
+
+/** Location of a single varbind in struct snmp_msg_tmpl */
+struct snmp_tmpl_slot {
+    uint32_t seq_len_off;
+    uint32_t value_off;
+};
+
+/**
+ * SNMP message compiled into a patchable template, see snmp_tmpl_compile.
+ * The encoded message is always at buf[0 .. len).
+ */
+struct snmp_msg_tmpl {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t len;
+    uint32_t msg_len_off;
+    uint32_t pdu_len_off;
+    uint32_t list_len_off;
+    uint32_t request_id_off;
+    uint32_t error_status_off;
+    uint32_t error_index_off;
+    uint32_t varbind_num;
+    struct snmp_tmpl_slot *slots;
+};
+
+/** Lazy varbind decoder, see snmp_decode_msg_header */
+struct snmp_varbind_iter {
+    const uint8_t *buf;
+    uint32_t remaining_len;
 };
 
+/** Single datagram decoded by snmp_decode_msg_batch */
+struct snmp_msg_batch {
+    const uint8_t *buf;
+    uint32_t buf_len; /**< size of *buf*, see snmp_decode_msg */
+    struct snmp_msg_header header;
+    uint32_t varbind_num; /**< max size of *varbinds*, replaced with decoded num */
+    struct snmp_varbind *varbinds;
+    int status; /**< 0 if the message was decoded or -1 if it's invalid */
+};
+
+/** Return codes of snmp_stream_feed */
+enum snmp_stream_status {
+    SNMP_STREAM_ERROR = -1,
+    SNMP_STREAM_NEED_MORE = 0,
+    SNMP_STREAM_HEADER = 1,
+    SNMP_STREAM_VARBIND = 2,
+    SNMP_STREAM_END = 3,
+    SNMP_STREAM_VALUE_PART = 4,
+};
+
+/** Resumable SNMP message decoder, see snmp_stream_init */
+struct snmp_stream {
+    struct ber_stream ber;
+    uint32_t field; /**< next expected message field */
+    char community[BER_STREAM_VALUE_MAX + 1];
+};
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -63,10 +171,59 @@ extern "C" {
  */
 uint8_t *snmp_encode_oid(uint8_t *out, uint32_t *oid);
 
+/**
+ * Encode SNMP Object IDentifier of given length as BER object.
+ * @see snmp_encode_oid
+ * @param out pointer to the **end** of the output buffer.
+ * The first encoded byte will be put in buf, next one in (buf - 1), etc.
+ * @param oid array of integers forming OID
+ * @param oid_len number of arcs in *oid*. Has to be at least 2.
+ * @return pointer to the next empty byte in the given buffer.
+ * Will always be smaller than given buf pointer.
+ */
+uint8_t *snmp_encode_oid_len(uint8_t *out, const uint32_t *oid, uint32_t oid_len);
+
+/**
+ * Get the exact number of bytes snmp_encode_oid would write.
+ * @param oid array of integers forming OID terminated with SNMP_MSG_OID_END
+ * @return size of encoded OID
+ */
+uint32_t snmp_sizeof_oid(uint32_t *oid);
+
+/**
+ * Get the exact number of bytes snmp_encode_oid_len would write.
+ * @param oid array of integers forming OID
+ * @param oid_len number of arcs in *oid*. Has to be at least 2.
+ * @return size of encoded OID
+ */
+uint32_t snmp_sizeof_oid_len(const uint32_t *oid, uint32_t oid_len);
+
+/**
+ * Pre-encode SNMP Object IDentifier for repeated use by message encoders.
+ * @param enc handle to be filled with the encoded object
+ * @param oid array of integers forming OID
+ * @param oid_len number of arcs in *oid*. Has to be at least 2 and at most
+ * SNMP_MSG_OID_LEN.
+ * @return 0 on success or -1 if *oid_len* is out of range
+ */
+int snmp_oid_preencode(struct snmp_oid_enc *enc, const uint32_t *oid, uint32_t oid_len);
+
+/**
+ * Encode pre-encoded SNMP Object IDentifier. This is a plain memcpy.
+ * @param out pointer to the **end** of the output buffer.
+ * The first encoded byte will be put in buf, next one in (buf - 1), etc.
+ * @param enc handle filled by snmp_oid_preencode
+ * @return pointer to the next empty byte in the given buffer.
+ * Will always be smaller than given buf pointer.
+ */
+uint8_t *snmp_encode_oid_enc(uint8_t *out, const struct snmp_oid_enc *enc);
+
 /**
  * Decode SNMP Object IDentifier from BER object.
  * Note that this function does not check against input buffer overflow.
  * It will read at most *oid_len * 5 + 6.
+ * Arcs are decoded with ber_decode_vlint_batch, which never reads past
+ * the encoded object.
  * @param buf pointer to the **beginning** of the input buffer.
  * The first byte should be SNMP_DATA_T_OBJECT. However, this function
  * does not check against it.
@@ -97,6 +254,76 @@ uint8_t *snmp_decode_oid(uint8_t *buf, uint32_t buf_len, uint32_t *oid, uint32_t
 uint8_t *snmp_encode_msg(uint8_t *out, struct snmp_msg_header *header,
                          uint32_t varbind_num, struct snmp_varbind *varbinds);
 
+/**
+ * Encode given SNMP message with some of the OIDs pre-encoded.
+ * @see snmp_encode_msg
+ * @param out pointer to the **end** of the output buffer.
+ * The first encoded byte will be put in buf, next one in (buf - 1), etc.
+ * @param header header to be encoded
+ * @param varbind_num number of following snmp_varbind* items
+ * @param varbinds pointer to array of varbinds to be encoded
+ * @param oid_encs array of *varbind_num* OIDs filled by snmp_oid_preencode.
+ * If oid_encs[i] is not NULL, it's copied instead of encoding varbinds[i].oid,
+ * which is ignored then.
+ * @return pointer to the first byte of encoded sequence in given buffer or NULL
+ * if varbinds parsing error occured.
+ */
+uint8_t *snmp_encode_msg_oid_enc(uint8_t *out, struct snmp_msg_header *header,
+                                 uint32_t varbind_num, struct snmp_varbind *varbinds,
+                                 const struct snmp_oid_enc *const *oid_encs);
+
+/**
+ * Encode as many leading varbinds of SNMP message as fit in the buffer.
+ * This is meant for GetBulk responses, which should be truncated rather
+ * than rejected when all requested repetitions don't fit. The varbinds
+ * are usually non-repeaters followed by the repeated rows.
+ * @see snmp_encode_msg
+ * @param out pointer to the **end** of the output buffer.
+ * @param out_size number of bytes available at and before *out*
+ * @param header header to be encoded
+ * @param varbind_num number of following snmp_varbind* items
+ * @param varbinds pointer to array of varbinds to be encoded
+ * @param encoded_num pointer to put the number of encoded varbinds into
+ * @return pointer to the first byte of encoded message or NULL if
+ * varbinds parsing error occured or even the message with no varbinds
+ * doesn't fit.
+ */
+uint8_t *snmp_encode_msg_fit(uint8_t *out, uint32_t out_size, struct snmp_msg_header *header,
+                             uint32_t varbind_num, struct snmp_varbind *varbinds,
+                             uint32_t *encoded_num);
+
+/**
+ * Encode given SNMP message as a scatter-gather list, without copying
+ * string values of at least SNMP_MSG_IOV_MIN_LEN bytes. Only BER headers
+ * and small values are written to *out*, while long strings are referenced
+ * in place. The resulting *iov* array can be passed straight to writev() or
+ * sendmsg(). Strings must not be modified or freed until it's sent.
+ * @see snmp_encode_msg
+ * @param out pointer to the **end** of the output buffer. It never needs
+ * more than snmp_sizeof_msg() bytes.
+ * @param header header to be encoded
+ * @param varbind_num number of following snmp_varbind* items
+ * @param varbinds pointer to array of varbinds to be encoded
+ * @param iov array to put the message parts into, in order
+ * @param iov_num pointer to the size of *iov* array. Underlying value
+ * will be replaced with the number of used items. Each long string
+ * takes up to 2 of them, plus one for the message header.
+ * @return pointer to the first byte of encoded message in given buffer,
+ * which is also the base of iov[0], or NULL if varbinds parsing error
+ * occured or *iov* array is too small.
+ */
+uint8_t *snmp_encode_msg_iov(uint8_t *out, struct snmp_msg_header *header, uint32_t varbind_num,
+                             struct snmp_varbind *varbinds, struct iovec *iov, uint32_t *iov_num);
+
+/**
+ * Get the exact number of bytes snmp_encode_msg would write.
+ * This can be used to allocate the output buffer before encoding.
+ * @see snmp_encode_msg for the description of params
+ * @return size of encoded message or 0 if varbinds parsing error occured.
+ */
+uint32_t snmp_sizeof_msg(struct snmp_msg_header *header, uint32_t varbind_num,
+                         struct snmp_varbind *varbinds);
+
 /**
  * Decode given SNMP message (GetRequest, GetNextRequest, GetResponse, SetRequest).
  * Trap PDU is not supported. This function will modify input buffer, further
@@ -114,11 +341,311 @@ uint8_t *snmp_encode_msg(uint8_t *out, struct snmp_msg_header *header,
  * returns NULL, the content of this param is undefined.
  * @param varbinds pointer to array of varbinds to be decoded. All strings will
  * be taken directly from input buffer, without any additional allocation.
- * @return
+ * @return pointer to the next not processed byte in the given buffer or NULL
+ * if the message is invalid.
  */
 uint8_t *snmp_decode_msg(uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
                          uint32_t *varbind_num, struct snmp_varbind *varbinds);
 
+/**
+ * Decode given SNMP message without modifying the input buffer.
+ * This works the same way as snmp_decode_msg, but community and OCTET STRING
+ * values are not NUL-terminated. They are (pointer, length) slices into *buf*,
+ * see header->community_len and varbind->value_len. The same buffer can be
+ * decoded any number of times, also from multiple threads at once.
+ * @see snmp_decode_msg for the description of params. *buf* has the same size
+ * requirements.
+ * @return pointer to the next not processed byte in the given buffer or NULL
+ * if the message is invalid.
+ */
+const uint8_t *snmp_decode_msg_slice(const uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                                     uint32_t *varbind_num, struct snmp_varbind *varbinds);
+
+/**
+ * Check the structure of SNMP message without decoding it.
+ * All types, all lengths and their nesting are checked against each other
+ * and against *buf_len*, as well as sizes of integers and OIDs. A message
+ * accepted by this function can be decoded with snmp_decode_msg_unchecked.
+ * This never reads past *buf* + *buf_len* and never writes to *buf*.
+ * @param buf pointer to the **beginning** of the input buffer.
+ * @param buf_len size of the input buffer
+ * @param varbind_num pointer to put the number of varbinds in the message
+ * @return pointer to the first byte after the message or NULL if the
+ * message is invalid.
+ */
+const uint8_t *snmp_validate_msg(const uint8_t *buf, uint32_t buf_len, uint32_t *varbind_num);
+
+/**
+ * Decode SNMP message already accepted by snmp_validate_msg.
+ * This works the same way as snmp_decode_msg_slice, but without any
+ * bounds or type checks. It never reads past the message, so *buf* doesn't
+ * need any extra bytes at its end. Calling it on a message which was not
+ * validated is undefined behavior.
+ * @param buf pointer to the **beginning** of the validated message.
+ * @param header header structure to be filled with decoded data
+ * @param varbind_num pointer to max size of *varbinds* array. Underlying value
+ * will be replaced with the actual, decoded varbinds num.
+ * @param varbinds pointer to array of varbinds to be decoded
+ * @return pointer to the next not processed byte in the given buffer.
+ */
+const uint8_t *snmp_decode_msg_unchecked(const uint8_t *buf, struct snmp_msg_header *header,
+                                         uint32_t *varbind_num, struct snmp_varbind *varbinds);
+
+/**
+ * Encode given SNMP message with compact varbinds.
+ * @see snmp_encode_msg
+ * @param out pointer to the **end** of the output buffer.
+ * The first encoded byte will be put in buf, next one in (buf - 1), etc.
+ * @param header header to be encoded
+ * @param arena arena holding OID arcs of all *varbinds*. May be NULL if all
+ * of them have oid_enc set.
+ * @param varbind_num number of following snmp_varbind_compact* items
+ * @param varbinds pointer to array of varbinds to be encoded. String values
+ * are encoded with their value_len, they don't need to be NUL-terminated.
+ * @return pointer to the first byte of encoded sequence in given buffer or NULL
+ * if varbinds parsing error occured.
+ */
+uint8_t *snmp_encode_msg_compact(uint8_t *out, struct snmp_msg_header *header, const struct ber_arena *arena,
+                                 uint32_t varbind_num, const struct snmp_varbind_compact *varbinds);
+
+/**
+ * Get the exact number of bytes snmp_encode_msg_compact would write.
+ * @see snmp_encode_msg_compact for the description of params
+ * @return size of encoded message or 0 if varbinds parsing error occured.
+ */
+uint32_t snmp_sizeof_msg_compact(struct snmp_msg_header *header, const struct ber_arena *arena,
+                                 uint32_t varbind_num, const struct snmp_varbind_compact *varbinds);
+
+/**
+ * Write SNMP Object IDentifier with front-to-back encoder.
+ * @see snmp_encode_oid_len
+ * @param w writer initialized with ber_writer_init
+ * @param oid array of integers forming OID
+ * @param oid_len number of arcs in *oid*. Has to be at least 2.
+ * @return 0 on success or -1 if the writer failed
+ */
+int snmp_write_oid(struct ber_writer *w, const uint32_t *oid, uint32_t oid_len);
+
+/**
+ * Write SNMP message header with front-to-back encoder and open
+ * its varbind list. Varbinds can be then written one at a time with
+ * snmp_write_varbind, and the message has to be closed with
+ * snmp_write_msg_end. Everything written before the message can be
+ * flushed in the meantime.
+ * @param w writer initialized with ber_writer_init
+ * @param header header to be encoded
+ * @return 0 on success or -1 if the writer failed
+ */
+int snmp_write_msg_begin(struct ber_writer *w, struct snmp_msg_header *header);
+
+/**
+ * Write a single varbind with front-to-back encoder.
+ * @param w writer with a message opened by snmp_write_msg_begin
+ * @param varbind varbind to be encoded
+ * @return 0 on success or -1 if varbind parsing error occured or
+ * the writer failed
+ */
+int snmp_write_varbind(struct ber_writer *w, struct snmp_varbind *varbind);
+
+/**
+ * Close the message opened by snmp_write_msg_begin and patch its lengths.
+ * Since the whole message stays in the writer's buffer until then, use
+ * snmp_write_msg for messages that may not fit in it.
+ * @param w writer with a message opened by snmp_write_msg_begin
+ * @return 0 on success or -1 if the writer failed
+ */
+int snmp_write_msg_end(struct ber_writer *w);
+
+/**
+ * Write given SNMP message with front-to-back encoder. The output is the same
+ * as produced by snmp_encode_msg. All lengths are computed and written
+ * up front, so the message can be flushed while it's written and doesn't
+ * have to fit in the writer's buffer.
+ * @param w writer initialized with ber_writer_init
+ * @param header header to be encoded
+ * @param varbind_num number of following snmp_varbind* items
+ * @param varbinds pointer to array of varbinds to be encoded
+ * @return 0 on success or -1 if varbinds parsing error occured or
+ * the writer failed
+ */
+int snmp_write_msg(struct ber_writer *w, struct snmp_msg_header *header,
+                   uint32_t varbind_num, struct snmp_varbind *varbinds);
+
+/**
+ * Initialize resumable SNMP message decoder.
+ * @see ber_stream_init
+ * The stream accepts messages in chunks of arbitrary size, e.g. from
+ * a TCP socket, and reports the header and every varbind as soon as they
+ * are decoded, without reassembling the whole message first. Multiple
+ * messages may follow each other.
+ * @param s stream to be initialized
+ */
+void snmp_stream_init(struct snmp_stream *s);
+
+/**
+ * Feed the SNMP decoder with the next chunk of input.
+ * The function stops after every decoded header, varbind and message end,
+ * so it should be called repeatedly with the rest of the chunk until it
+ * returns SNMP_STREAM_NEED_MORE.
+ * @param s stream initialized with snmp_stream_init
+ * @param data input chunk
+ * @param len length of *data*
+ * @param consumed pointer to put the number of processed bytes into.
+ * On SNMP_STREAM_NEED_MORE it's always equal to *len*.
+ * @param header header to be filled. It's complete once
+ * SNMP_STREAM_HEADER is returned. Community is copied into the stream.
+ * @param varbind varbind to be filled on SNMP_STREAM_VARBIND. OCTET_STRING
+ * value is not copied and it's valid only until the next call. A string
+ * longer than BER_STREAM_VALUE_MAX that is split between chunks is
+ * reported in pieces: every piece but the last one is returned with
+ * SNMP_STREAM_VALUE_PART, and the last one with SNMP_STREAM_VARBIND.
+ * *value.s* and *value_len* always describe the current piece.
+ * @return SNMP_STREAM_HEADER, SNMP_STREAM_VARBIND or SNMP_STREAM_END when
+ * the corresponding part of the message was decoded, SNMP_STREAM_VALUE_PART
+ * when a piece of a long string value was decoded,
+ * SNMP_STREAM_NEED_MORE if all data was consumed, or SNMP_STREAM_ERROR if
+ * the message is malformed or its community is longer than
+ * BER_STREAM_VALUE_MAX. Once an error occurs, the stream has to be
+ * initialized again.
+ */
+int snmp_stream_feed(struct snmp_stream *s, const uint8_t *data, uint32_t len, uint32_t *consumed,
+                     struct snmp_msg_header *header, struct snmp_varbind *varbind);
+
+/**
+ * Decode a vector of SNMP messages, e.g. datagrams received with recvmmsg().
+ * Every message is decoded just like with snmp_decode_msg_slice, but
+ * the work is interleaved: headers of a group of messages are decoded first,
+ * while the next group is being prefetched, then varbinds are decoded
+ * round-robin, one per message at a time. This hides the memory latency
+ * of one message behind the decoding of the others.
+ * @param msgs array of messages. *buf*, *buf_len*, *varbind_num* and
+ * *varbinds* have to be set by the caller, the rest is filled by
+ * this function. A failure of one message doesn't affect the others.
+ * @param msg_num number of items in *msgs*
+ * @return number of successfully decoded messages
+ */
+uint32_t snmp_decode_msg_batch(struct snmp_msg_batch *msgs, uint32_t msg_num);
+
+/**
+ * Decode given SNMP message into compact varbinds.
+ * OID arcs of all varbinds are allocated from *arena*, back to back.
+ * Just like snmp_decode_msg_slice, this function never modifies the input
+ * buffer and strings are (pointer, length) slices into it.
+ * @see snmp_decode_msg for the description of other params. *buf* has
+ * the same size requirements.
+ * @param arena arena to allocate OID arcs from. Decoding fails if it's full.
+ * @return pointer to the next not processed byte in the given buffer or NULL
+ * if the message is invalid.
+ */
+const uint8_t *snmp_decode_msg_compact(const uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                                       struct ber_arena *arena, uint32_t *varbind_num,
+                                       struct snmp_varbind_compact *varbinds);
+
+/**
+ * Copy given OID into the arena and point compact varbind to it.
+ * @param arena arena to allocate OID arcs from
+ * @param varbind varbind to be updated
+ * @param oid array of integers forming OID
+ * @param oid_len number of arcs in *oid*
+ * @return 0 on success or -1 if the arena is full
+ */
+int snmp_varbind_compact_set_oid(struct ber_arena *arena, struct snmp_varbind_compact *varbind,
+                                 const uint32_t *oid, uint32_t oid_len);
+
+/**
+ * Get OID arcs of the compact varbind.
+ * @param arena arena holding the OID
+ * @param varbind compact varbind
+ * @return pointer to varbind->oid_len arcs, not terminated with SNMP_MSG_OID_END
+ */
+uint32_t *snmp_varbind_compact_oid(const struct ber_arena *arena, const struct snmp_varbind_compact *varbind);
+
+/**
+ * Compile SNMP message into a template, so that subsequent messages of the
+ * same shape can be produced by patching request_id, error fields and
+ * values only. All constructed types are encoded with 2-byte long form
+ * lengths (0x82 0xXX 0xXX), so that the length headers never change size
+ * and can be fixed up in place. This limits the message to 65535 bytes.
+ * Unlike snmp_encode_msg, this function checks against buffer overflow.
+ * @param tmpl template to be initialized
+ * @param buf output buffer. It has to be big enough to hold the largest
+ * message produced by patching the template.
+ * @param size size of *buf*
+ * @param header header to be encoded
+ * @param varbind_num number of following snmp_varbind* items
+ * @param varbinds pointer to array of varbinds to be encoded
+ * @param slots array of *varbind_num* slots to be used by the template.
+ * It has to outlive the template.
+ * @return 0 on success or -1 if varbinds parsing error occured or the message
+ * doesn't fit in *buf*.
+ */
+int snmp_tmpl_compile(struct snmp_msg_tmpl *tmpl, uint8_t *buf, uint32_t size,
+                      struct snmp_msg_header *header, uint32_t varbind_num,
+                      struct snmp_varbind *varbinds, struct snmp_tmpl_slot *slots);
+
+/**
+ * Patch request_id and error fields of the compiled message.
+ * @param tmpl compiled template
+ * @param request_id new request_id
+ * @param error_status new error_status
+ * @param error_index new error_index
+ * @return 0 on success or -1 if the patched message doesn't fit in the buffer
+ */
+int snmp_tmpl_set_header(struct snmp_msg_tmpl *tmpl, uint32_t request_id,
+                         uint32_t error_status, uint32_t error_index);
+
+/**
+ * Patch the value of a single varbind of the compiled message.
+ * If the encoded value changes its size, the rest of the message is moved
+ * and all enclosing lengths are fixed up.
+ * @param tmpl compiled template
+ * @param idx index of the varbind
+ * @param value_type type of the new value, can be different than the
+ * compiled one
+ * @param value new value
+ * @param value_len length of value->s, ignored for other types
+ * @return 0 on success or -1 if *idx* or *value_type* is invalid or
+ * the patched message doesn't fit in the buffer
+ */
+int snmp_tmpl_set_value(struct snmp_msg_tmpl *tmpl, uint32_t idx, enum snmp_data_type value_type,
+                        const union snmp_varbind_val *value, uint32_t value_len);
+
+/**
+ * Decode SNMP message header and prepare an iterator over its varbinds.
+ * No varbind is decoded by this function, see snmp_varbind_iter_next.
+ * Just like snmp_decode_msg_slice, this function never modifies the input
+ * buffer and the community is not NUL-terminated.
+ * @see snmp_decode_msg for the description of *buf* and *buf_len*.
+ * The buffer has the same size requirements.
+ * @param header header structure to be filled with decoded data
+ * @param iter iterator to be initialized. It points into *buf*, so the buffer
+ * has to outlive it.
+ * @return pointer to the first varbind in the given buffer or NULL
+ * if the message header is invalid.
+ */
+const uint8_t *snmp_decode_msg_header(const uint8_t *buf, uint32_t buf_len, struct snmp_msg_header *header,
+                                      struct snmp_varbind_iter *iter);
+
+/**
+ * Decode the next varbind of the message.
+ * String values are (pointer, length) slices into the input buffer.
+ * @param iter iterator initialized with snmp_decode_msg_header
+ * @param varbind varbind to be filled with decoded data. In case this
+ * function doesn't return 1, the content of this param is undefined.
+ * @return 1 if a varbind was decoded, 0 if there are no more varbinds or
+ * -1 if the varbind is invalid. The iterator shouldn't be used after -1.
+ */
+int snmp_varbind_iter_next(struct snmp_varbind_iter *iter, struct snmp_varbind *varbind);
+
+/**
+ * Skip the next varbind of the message without decoding it.
+ * @param iter iterator initialized with snmp_decode_msg_header
+ * @return 1 if a varbind was skipped, 0 if there are no more varbinds or
+ * -1 if the varbind length is invalid. The iterator shouldn't be used
+ * after -1.
+ */
+int snmp_varbind_iter_skip(struct snmp_varbind_iter *iter);
+
 #ifdef __cplusplus
 }
 #endif